@@ -0,0 +1,964 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared transport, I2C trace, register protocol, register table firmware
+ * and PMIC helpers for the ams Mira and Poncha sensor drivers.
+ * Copyright (C) 2023, ams-OSRAM
+ */
+
+#include <linux/crc32.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/firmware.h>
+#include <linux/fs.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/overflow.h>
+#include <linux/vmalloc.h>
+#include <media/v4l2-ctrls.h>
+#include <asm/unaligned.h>
+
+#include "ams_sensor_core.h"
+
+/* Largest sensor transfer: 16-bit reg addr and 32-bit value */
+#define AMS_SENSOR_MAX_XFER	6
+
+/*
+ * Register table firmware, little-endian: this header, then num_regs
+ * entries of 16-bit reg addr and 8-bit value. crc32 is the zlib crc32()
+ * of the entries. Must match tools/regfw.
+ */
+#define AMS_SENSOR_FW_MAGIC	0x52534d41 /* "AMSR" */
+#define AMS_SENSOR_FW_VERSION	1
+#define AMS_SENSOR_FW_ENTRY	3
+
+struct ams_sensor_fw_header {
+	__le32 magic;
+	__le16 version;
+	__le16 reserved;
+	__le32 num_regs;
+	__le32 crc32;
+} __packed;
+
+/*
+ * I2C transaction trace, see tools/i2c_trace. The trace is this header
+ * followed by fixed size records, little-endian. Must match the tool.
+ */
+#define AMS_SENSOR_TRACE_MAGIC		"AMSI2CTR"
+#define AMS_SENSOR_TRACE_VERSION	1
+#define AMS_SENSOR_TRACE_MAX_RECORDS	32768
+#define AMS_SENSOR_TRACE_MAX_DATA	8
+#define AMS_SENSOR_TRACE_WRITE		0
+#define AMS_SENSOR_TRACE_READ		1
+
+struct ams_sensor_trace_record {
+	/* Time since trace start */
+	__le64 timestamp_ns;
+	/* Duration of the transfer */
+	__le32 duration_ns;
+	/* Return value of the transfer */
+	__le32 status;
+	__le16 i2c_addr;
+	/* AMS_SENSOR_TRACE_WRITE or AMS_SENSOR_TRACE_READ */
+	u8 dir;
+	/* Number of bytes on the bus. Only the first 8 are kept. */
+	u8 len;
+	u8 data[AMS_SENSOR_TRACE_MAX_DATA];
+	u8 reserved[4];
+} __packed;
+
+struct ams_sensor_trace {
+	char magic[8];
+	__le32 version;
+	__le32 record_size;
+	__le32 num_records;
+	/* Records dropped because the buffer was full */
+	__le32 num_dropped;
+	struct ams_sensor_trace_record records[];
+} __packed;
+
+static void ams_sensor_trace_record(struct ams_sensor *ams, u8 dir,
+				    const u8 *buf, int len, int status,
+				    u64 start_ns)
+{
+	struct ams_sensor_trace *trace;
+	struct ams_sensor_trace_record *rec;
+	u64 end_ns = ktime_get_ns();
+	u32 n;
+
+	mutex_lock(&ams->trace_lock);
+	trace = ams->trace;
+	if (!trace || !ams->trace_enabled)
+		goto out;
+
+	n = le32_to_cpu(trace->num_records);
+	if (n >= AMS_SENSOR_TRACE_MAX_RECORDS) {
+		trace->num_dropped = cpu_to_le32(le32_to_cpu(trace->num_dropped) + 1);
+		goto out;
+	}
+
+	rec = &trace->records[n];
+	memset(rec, 0, sizeof(*rec));
+	rec->timestamp_ns = cpu_to_le64(start_ns - ams->trace_start_ns);
+	rec->duration_ns = cpu_to_le32((u32)(end_ns - start_ns));
+	rec->status = cpu_to_le32((u32)status);
+	rec->i2c_addr = cpu_to_le16(ams->client->addr);
+	rec->dir = dir;
+	rec->len = len;
+	memcpy(rec->data, buf, min_t(int, len, AMS_SENSOR_TRACE_MAX_DATA));
+	trace->num_records = cpu_to_le32(n + 1);
+out:
+	mutex_unlock(&ams->trace_lock);
+}
+
+static int ams_sensor_i2c_send(struct ams_sensor *ams, const u8 *buf, int len)
+{
+	bool trace = READ_ONCE(ams->trace_enabled);
+	u64 start_ns = 0;
+	int ret;
+
+	if (trace)
+		start_ns = ktime_get_ns();
+	ret = i2c_master_send(ams->client, buf, len);
+	if (trace)
+		ams_sensor_trace_record(ams, AMS_SENSOR_TRACE_WRITE, buf, len,
+					ret, start_ns);
+
+	return ret;
+}
+
+static int ams_sensor_i2c_recv(struct ams_sensor *ams, u8 *buf, int len)
+{
+	bool trace = READ_ONCE(ams->trace_enabled);
+	u64 start_ns = 0;
+	int ret;
+
+	if (trace)
+		start_ns = ktime_get_ns();
+	ret = i2c_master_recv(ams->client, buf, len);
+	if (trace)
+		ams_sensor_trace_record(ams, AMS_SENSOR_TRACE_READ, buf, len,
+					ret, start_ns);
+
+	return ret;
+}
+
+/*
+ * A negative return code, or transferring the wrong number of bytes, both
+ * count as an error. Success needs to produce a 0 return code.
+ */
+static int ams_sensor_xfer_ret(struct ams_sensor *ams, int ret, int len,
+			       const char *dir, u16 reg)
+{
+	if (ret == len)
+		return 0;
+
+	dev_dbg(&ams->client->dev, "i2c %s error, reg: %x\n", dir, reg);
+
+	return ret < 0 ? ret : -EINVAL;
+}
+
+/* Send the 16-bit reg addr, then read len bytes */
+static int ams_sensor_read_buf(struct ams_sensor *ams, u16 reg, u8 *buf, int len)
+{
+	u8 addr[2];
+	int ret;
+
+	put_unaligned_be16(reg, addr);
+	ret = ams_sensor_i2c_send(ams, addr, sizeof(addr));
+	ret = ams_sensor_xfer_ret(ams, ret, sizeof(addr), "write", reg);
+	if (ret)
+		return ret;
+
+	ret = ams_sensor_i2c_recv(ams, buf, len);
+
+	return ams_sensor_xfer_ret(ams, ret, len, "read", reg);
+}
+
+/* buf holds the 16-bit reg addr followed by the value, len bytes in all */
+static int ams_sensor_write_buf(struct ams_sensor *ams, u8 *buf, int len)
+{
+	u16 reg = get_unaligned_be16(buf);
+	int ret;
+
+	ret = ams_sensor_i2c_send(ams, buf, len);
+
+	return ams_sensor_xfer_ret(ams, ret, len, "write", reg);
+}
+
+int ams_sensor_read(struct ams_sensor *ams, u16 reg, u8 *val)
+{
+	return ams_sensor_read_buf(ams, reg, val, 1);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_read);
+
+/* 32-bit val on I2C is big-endian, msb at the lower reg addr */
+int ams_sensor_read_be32(struct ams_sensor *ams, u16 reg, u32 *val)
+{
+	u8 buf[4];
+	int ret;
+
+	ret = ams_sensor_read_buf(ams, reg, buf, sizeof(buf));
+	*val = get_unaligned_be32(buf);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_read_be32);
+
+int ams_sensor_write(struct ams_sensor *ams, u16 reg, u8 val)
+{
+	u8 buf[3];
+
+	put_unaligned_be16(reg, buf);
+	buf[2] = val;
+
+	return ams_sensor_write_buf(ams, buf, sizeof(buf));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write);
+
+/* Big-endian: msb of val goes to lower reg addr */
+int ams_sensor_write_be16(struct ams_sensor *ams, u16 reg, u16 val)
+{
+	u8 buf[4];
+
+	put_unaligned_be16(reg, buf);
+	put_unaligned_be16(val, buf + 2);
+
+	return ams_sensor_write_buf(ams, buf, sizeof(buf));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_be16);
+
+int ams_sensor_write_be24(struct ams_sensor *ams, u16 reg, u32 val)
+{
+	u8 buf[5];
+
+	put_unaligned_be16(reg, buf);
+	put_unaligned_be24(val, buf + 2);
+
+	return ams_sensor_write_buf(ams, buf, sizeof(buf));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_be24);
+
+int ams_sensor_write_be32(struct ams_sensor *ams, u16 reg, u32 val)
+{
+	u8 buf[AMS_SENSOR_MAX_XFER];
+
+	put_unaligned_be16(reg, buf);
+	put_unaligned_be32(val, buf + 2);
+
+	return ams_sensor_write_buf(ams, buf, sizeof(buf));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_be32);
+
+/* Little-endian: lsb of val goes to lower reg addr */
+int ams_sensor_write_le16(struct ams_sensor *ams, u16 reg, u16 val)
+{
+	u8 buf[4];
+
+	put_unaligned_be16(reg, buf);
+	put_unaligned_le16(val, buf + 2);
+
+	return ams_sensor_write_buf(ams, buf, sizeof(buf));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_le16);
+
+/* Write a list of registers, stop at the first error */
+int ams_sensor_write_regs(struct ams_sensor *ams,
+			  const struct ams_sensor_reg *regs, u32 len)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < len; i++) {
+		ret = ams_sensor_write(ams, regs[i].address, regs[i].val);
+		if (ret) {
+			dev_err_ratelimited(&ams->client->dev,
+					    "Failed to write reg 0x%4.4x. error = %d\n",
+					    regs[i].address, ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_regs);
+
+static int ams_sensor_fw_check(const struct firmware *fw)
+{
+	const struct ams_sensor_fw_header *hdr = (const void *)fw->data;
+	const u8 *entries = fw->data + sizeof(*hdr);
+	u32 num_regs;
+
+	if (fw->size < sizeof(*hdr) ||
+	    le32_to_cpu(hdr->magic) != AMS_SENSOR_FW_MAGIC)
+		return -EINVAL;
+	if (le16_to_cpu(hdr->version) != AMS_SENSOR_FW_VERSION)
+		return -EPROTO;
+
+	num_regs = le32_to_cpu(hdr->num_regs);
+	if (num_regs > (fw->size - sizeof(*hdr)) / AMS_SENSOR_FW_ENTRY ||
+	    fw->size != sizeof(*hdr) + num_regs * AMS_SENSOR_FW_ENTRY)
+		return -EINVAL;
+
+	if ((crc32_le(~0, entries, num_regs * AMS_SENSOR_FW_ENTRY) ^ ~0) !=
+	    le32_to_cpu(hdr->crc32))
+		return -EBADMSG;
+
+	return 0;
+}
+
+/* NULL if there is no valid table, the built-in one is used then */
+static const struct firmware *ams_sensor_fw_get(struct ams_sensor *ams,
+						const char *name)
+{
+	struct device *dev = &ams->client->dev;
+	const struct firmware *fw;
+	int ret;
+
+	ret = firmware_request_nowarn(&fw, name, dev);
+	if (ret) {
+		dev_dbg(dev, "No register table %s, using the built-in one\n", name);
+		return NULL;
+	}
+
+	ret = ams_sensor_fw_check(fw);
+	if (ret) {
+		dev_warn(dev, "Invalid register table %s: %d, using the built-in one\n",
+			 name, ret);
+		release_firmware(fw);
+		return NULL;
+	}
+
+	dev_info(dev, "Register table %s, %u regs\n", name,
+		 le32_to_cpu(((const struct ams_sensor_fw_header *)fw->data)->num_regs));
+
+	return fw;
+}
+
+static int ams_sensor_write_fw(struct ams_sensor *ams, const struct firmware *fw)
+{
+	const struct ams_sensor_fw_header *hdr = (const void *)fw->data;
+	const u8 *entry = fw->data + sizeof(*hdr);
+	u32 num_regs = le32_to_cpu(hdr->num_regs);
+	unsigned int i;
+	u16 reg;
+	int ret;
+
+	for (i = 0; i < num_regs; i++, entry += AMS_SENSOR_FW_ENTRY) {
+		reg = get_unaligned_le16(entry);
+		ret = ams_sensor_write(ams, reg, entry[2]);
+		if (ret) {
+			dev_err_ratelimited(&ams->client->dev,
+					    "Failed to write reg 0x%4.4x. error = %d\n",
+					    reg, ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The slot of table fw_name of mode, loaded on first use. Switching to
+ * another mode drops the tables of the previous one. NULL if the slots
+ * are taken by other tables of mode.
+ */
+static struct ams_sensor_fw_table *ams_sensor_fw_table(struct ams_sensor *ams,
+						       const void *mode,
+						       const char *fw_name)
+{
+	unsigned int i;
+
+	if (mode != ams->fw_mode) {
+		ams_sensor_fw_release(ams);
+		ams->fw_mode = mode;
+	}
+
+	for (i = 0; i < AMS_SENSOR_FW_TABLES; i++) {
+		if (!ams->fw[i].name) {
+			ams->fw[i].name = fw_name;
+			ams->fw[i].fw = ams_sensor_fw_get(ams, fw_name);
+			return &ams->fw[i];
+		}
+		if (!strcmp(ams->fw[i].name, fw_name))
+			return &ams->fw[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Write a register table of mode. The firmware fw_name replaces the
+ * built-in table regs if it is present and valid. Only the tables of
+ * the last mode written stay loaded, they are dropped when another mode
+ * is written. Without fw_name this is ams_sensor_write_regs(). Callers
+ * serialize, as for the sensor register writes.
+ */
+int ams_sensor_write_table(struct ams_sensor *ams, const void *mode,
+			   const char *fw_name,
+			   const struct ams_sensor_reg *regs, u32 len)
+{
+	struct ams_sensor_fw_table *table;
+	const struct firmware *fw;
+	int ret;
+
+	if (!fw_name)
+		return ams_sensor_write_regs(ams, regs, len);
+
+	table = ams_sensor_fw_table(ams, mode, fw_name);
+
+	/* More tables per mode than slots, load this one without keeping it */
+	if (!table) {
+		fw = ams_sensor_fw_get(ams, fw_name);
+		if (!fw)
+			return ams_sensor_write_regs(ams, regs, len);
+		ret = ams_sensor_write_fw(ams, fw);
+		release_firmware(fw);
+		return ret;
+	}
+
+	if (!table->fw)
+		return ams_sensor_write_regs(ams, regs, len);
+
+	return ams_sensor_write_fw(ams, table->fw);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_write_table);
+
+/*
+ * Whether ams_sensor_write_table() of the same arguments writes the
+ * firmware table instead of the built-in one. The table is loaded and
+ * kept as for a write. Callers serialize, as for ams_sensor_write_table().
+ */
+bool ams_sensor_table_from_fw(struct ams_sensor *ams, const void *mode,
+			      const char *fw_name)
+{
+	struct ams_sensor_fw_table *table;
+	const struct firmware *fw;
+
+	if (!fw_name)
+		return false;
+
+	table = ams_sensor_fw_table(ams, mode, fw_name);
+	if (table)
+		return table->fw != NULL;
+
+	fw = ams_sensor_fw_get(ams, fw_name);
+	release_firmware(fw);
+
+	return fw != NULL;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_table_from_fw);
+
+/* Drop the loaded tables, the next ams_sensor_write_table() loads again */
+void ams_sensor_fw_release(struct ams_sensor *ams)
+{
+	unsigned int i;
+
+	for (i = 0; i < AMS_SENSOR_FW_TABLES; i++) {
+		release_firmware(ams->fw[i].fw);
+		ams->fw[i].fw = NULL;
+		ams->fw[i].name = NULL;
+	}
+	ams->fw_mode = NULL;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_fw_release);
+
+/*
+ * debugfs interface of the I2C transaction trace:
+ * write 1 to i2c_trace_enable to clear the trace and start capturing,
+ * write 0 to stop. Read i2c_trace to get the binary trace.
+ */
+static ssize_t ams_sensor_trace_enable_write(struct file *file,
+					     const char __user *ubuf,
+					     size_t count, loff_t *ppos)
+{
+	struct ams_sensor *ams = file->private_data;
+	struct ams_sensor_trace *trace;
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(ubuf, count, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&ams->trace_lock);
+	if (enable) {
+		if (!ams->trace) {
+			ams->trace = vzalloc(struct_size(trace, records,
+							 AMS_SENSOR_TRACE_MAX_RECORDS));
+			if (!ams->trace) {
+				mutex_unlock(&ams->trace_lock);
+				return -ENOMEM;
+			}
+		}
+		trace = ams->trace;
+		memcpy(trace->magic, AMS_SENSOR_TRACE_MAGIC, sizeof(trace->magic));
+		trace->version = cpu_to_le32(AMS_SENSOR_TRACE_VERSION);
+		trace->record_size = cpu_to_le32(sizeof(struct ams_sensor_trace_record));
+		trace->num_records = 0;
+		trace->num_dropped = 0;
+		ams->trace_start_ns = ktime_get_ns();
+	}
+	WRITE_ONCE(ams->trace_enabled, enable);
+	mutex_unlock(&ams->trace_lock);
+
+	return count;
+}
+
+static ssize_t ams_sensor_trace_enable_read(struct file *file,
+					    char __user *ubuf,
+					    size_t count, loff_t *ppos)
+{
+	struct ams_sensor *ams = file->private_data;
+	char buf[2];
+
+	buf[0] = READ_ONCE(ams->trace_enabled) ? '1' : '0';
+	buf[1] = '\n';
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, sizeof(buf));
+}
+
+static const struct file_operations ams_sensor_trace_enable_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ams_sensor_trace_enable_read,
+	.write = ams_sensor_trace_enable_write,
+	.llseek = default_llseek,
+};
+
+static ssize_t ams_sensor_trace_read(struct file *file, char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	struct ams_sensor *ams = file->private_data;
+	struct ams_sensor_trace *trace;
+	ssize_t ret = 0;
+
+	mutex_lock(&ams->trace_lock);
+	trace = ams->trace;
+	if (trace)
+		ret = simple_read_from_buffer(ubuf, count, ppos, trace,
+			struct_size(trace, records, le32_to_cpu(trace->num_records)));
+	mutex_unlock(&ams->trace_lock);
+
+	return ret;
+}
+
+static const struct file_operations ams_sensor_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ams_sensor_trace_read,
+	.llseek = default_llseek,
+};
+
+/* Add i2c_trace_enable and i2c_trace to the debugfs directory of the driver */
+void ams_sensor_trace_init(struct ams_sensor *ams, struct dentry *dir)
+{
+	mutex_init(&ams->trace_lock);
+	debugfs_create_file("i2c_trace_enable", 0600, dir, ams,
+			    &ams_sensor_trace_enable_fops);
+	debugfs_create_file("i2c_trace", 0400, dir, ams, &ams_sensor_trace_fops);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_trace_init);
+
+/* Free the trace, after the debugfs files are removed */
+void ams_sensor_trace_cleanup(struct ams_sensor *ams)
+{
+	vfree(ams->trace);
+	ams->trace = NULL;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_trace_cleanup);
+
+/* Write PMIC registers, and can be reused to write microcontroller reg. */
+int ams_pmic_write(struct i2c_client *client, u8 reg, u8 val)
+{
+	u8 data[2] = { reg, val };
+	int ret;
+
+	ret = i2c_master_send(client, data, sizeof(data));
+	if (ret == sizeof(data))
+		return 0;
+
+	dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n", __func__, reg);
+
+	return ret < 0 ? ret : -EINVAL;
+}
+EXPORT_SYMBOL_GPL(ams_pmic_write);
+
+int ams_pmic_read(struct i2c_client *client, u8 reg, u8 *val)
+{
+	struct i2c_msg msgs[2];
+	u8 addr_buf[1] = { reg };
+	u8 data_buf[1] = { 0 };
+	int ret;
+
+	/* Write register address */
+	msgs[0].addr = client->addr;
+	msgs[0].flags = 0;
+	msgs[0].len = ARRAY_SIZE(addr_buf);
+	msgs[0].buf = addr_buf;
+
+	/* Read data from register */
+	msgs[1].addr = client->addr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = ARRAY_SIZE(data_buf);
+	msgs[1].buf = data_buf;
+
+	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	if (ret != ARRAY_SIZE(msgs))
+		return -EIO;
+
+	*val = data_buf[0];
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ams_pmic_read);
+
+/* Select the bank and context a REG_W/REG_R flag asks for */
+static int ams_sensor_reg_select(struct ams_sensor *ams, u8 reg_flag)
+{
+	struct device *dev = &ams->client->dev;
+	int ret;
+
+	if (!(reg_flag & AMS_SENSOR_REG_FLAG_USE_BANK))
+		return 0;
+
+	if (ams->bank_sel_reg & AMS_SENSOR_SEL_REG_VALID) {
+		ret = ams_sensor_write(ams, (u16)ams->bank_sel_reg,
+				       !!(reg_flag & AMS_SENSOR_REG_FLAG_BANK));
+		if (ret) {
+			dev_err(dev, "Error setting BANK_SEL_REG.");
+			return ret;
+		}
+	}
+
+	if (ams->context_sel_reg & AMS_SENSOR_SEL_REG_VALID) {
+		ret = ams_sensor_write(ams, (u16)ams->context_sel_reg,
+				       !!(reg_flag & AMS_SENSOR_REG_FLAG_CONTEXT));
+		if (ret) {
+			dev_err(dev, "Error setting RW_CONTEXT.");
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The device at tbd_client_i2c_addr. The pre-allocated board clients are
+ * used if the address is theirs, any other address gets a temporary
+ * client that the caller unregisters when *tmp is set.
+ */
+static struct i2c_client *ams_sensor_tbd_client(struct ams_sensor *ams,
+						bool *tmp)
+{
+	struct i2c_client *client = NULL;
+
+	switch (ams->tbd_client_i2c_addr) {
+	case AMS_SENSOR_PMIC_I2C_ADDR:
+		client = ams->pmic_client;
+		break;
+	case AMS_SENSOR_UC_I2C_ADDR:
+		client = ams->uc_client;
+		break;
+	case AMS_SENSOR_LED_I2C_ADDR:
+		client = ams->led_client;
+		break;
+	}
+
+	*tmp = !client;
+	if (client)
+		return client;
+
+	return i2c_new_dummy_device(ams->client->adapter,
+				    ams->tbd_client_i2c_addr);
+}
+
+/* AMS_CAMERA_CID_MIRA_REG_W */
+int ams_sensor_reg_w(struct ams_sensor *ams, u32 value)
+{
+	const struct ams_sensor_ops *ops = ams->ops;
+	struct device *dev = &ams->client->dev;
+	struct i2c_client *client;
+	u16 reg_addr = (value >> 8) & 0xFFFF;
+	u8 reg_val = value & 0xFF;
+	u8 reg_flag = (value >> 24) & 0xFF;
+	bool tmp;
+	int ret;
+
+	if (reg_flag & AMS_SENSOR_REG_FLAG_CMD_SEL) {
+		if (reg_flag == AMS_SENSOR_REG_FLAG_SLEEP_US) {
+			/* All 24 bits of reg_addr and reg_val are the sleep in us */
+			u32 sleep_us = value & 0x00FFFFFF;
+
+			/* Sleep range needs an interval, 1/8 of the sleep value */
+			dev_dbg(dev, "%s sleep_us: %u.\n", __func__, sleep_us);
+			usleep_range(sleep_us, sleep_us + (sleep_us >> 3));
+		} else if (ops && ops->reg_cmd) {
+			ops->reg_cmd(ams, reg_flag, value);
+		} else {
+			dev_info(dev, "%s unknown command from flag %u, ignored.\n",
+				 __func__, reg_flag);
+		}
+		return 0;
+	}
+
+	if (reg_flag & AMS_SENSOR_REG_FLAG_FOR_READ) {
+		/* Skip the write, cache addr and flag for REG_R */
+		ams->reg_w_cached_addr = reg_addr;
+		ams->reg_w_cached_flag = reg_flag;
+		return 0;
+	}
+
+	switch (reg_flag & AMS_SENSOR_REG_FLAG_I2C_SEL) {
+	case AMS_SENSOR_REG_FLAG_I2C_MIRA:
+		if (ops && ops->reg_w_sensor)
+			ops->reg_w_sensor(ams, reg_addr, reg_val);
+		ret = ams_sensor_reg_select(ams, reg_flag);
+		if (ret)
+			return ret;
+		ret = ams_sensor_write(ams, reg_addr, reg_val);
+		if (ret) {
+			dev_err_ratelimited(dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n",
+					    reg_addr);
+			return -EINVAL;
+		}
+		break;
+	case AMS_SENSOR_REG_FLAG_I2C_SET_TBD:
+		/* Store the TBD I2C address for the following accesses */
+		dev_dbg(dev, "tbd_client_i2c_addr = 0x%X.\n", reg_val);
+		ams->tbd_client_i2c_addr = reg_val;
+		break;
+	case AMS_SENSOR_REG_FLAG_I2C_TBD:
+		client = ams_sensor_tbd_client(ams, &tmp);
+		if (IS_ERR(client))
+			return PTR_ERR(client);
+		ret = ams_pmic_write(client, reg_addr & 0xFF, reg_val);
+		dev_dbg(dev, "write i2c_addr 0x%X, reg_addr 0x%X, reg_val 0x%X, ret %d.\n",
+			client->addr, reg_addr & 0xFF, reg_val, ret);
+		if (tmp)
+			i2c_unregister_device(client);
+		break;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_reg_w);
+
+/* AMS_CAMERA_CID_MIRA_REG_R, from the addr and flag cached by REG_W */
+int ams_sensor_reg_r(struct ams_sensor *ams, u32 *value)
+{
+	struct device *dev = &ams->client->dev;
+	struct i2c_client *client;
+	u16 reg_addr = ams->reg_w_cached_addr;
+	u8 reg_flag = ams->reg_w_cached_flag;
+	u8 reg_val = 0;
+	bool tmp;
+	int ret;
+
+	*value = 0;
+
+	switch (reg_flag & AMS_SENSOR_REG_FLAG_I2C_SEL) {
+	case AMS_SENSOR_REG_FLAG_I2C_MIRA:
+		ret = ams_sensor_reg_select(ams, reg_flag);
+		if (ret)
+			return ret;
+		ret = ams_sensor_read(ams, reg_addr, &reg_val);
+		if (ret) {
+			dev_err_ratelimited(dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n",
+					    reg_addr);
+			return -EINVAL;
+		}
+		break;
+	case AMS_SENSOR_REG_FLAG_I2C_TBD:
+		client = ams_sensor_tbd_client(ams, &tmp);
+		if (IS_ERR(client))
+			return PTR_ERR(client);
+		ret = ams_pmic_read(client, reg_addr & 0xFF, &reg_val);
+		dev_dbg(dev, "read i2c_addr 0x%X, reg_addr 0x%X, reg_val 0x%X, ret %d.\n",
+			client->addr, reg_addr & 0xFF, reg_val, ret);
+		if (tmp)
+			i2c_unregister_device(client);
+		break;
+	}
+
+	/* Return 32-bit value that includes flags, addr, and register value */
+	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ams_sensor_reg_r);
+
+/*
+ * Lowest and highest gain of the V4L2_CID_ANALOGUE_GAIN range. The gains
+ * need not increase with the index, the Mira016 8 bit LUT does not.
+ */
+static void ams_sensor_gain_linear_range(struct ams_sensor *ams,
+					 u32 *min, u32 *max)
+{
+	u32 index, gain;
+
+	*min = U32_MAX;
+	*max = 0;
+	for (index = ams->gain->minimum; index <= ams->gain->maximum; index++) {
+		gain = ams->ops->gain_to_linear(ams, index);
+		*min = min(*min, gain);
+		*max = max(*max, gain);
+	}
+}
+
+/* Index of the range with the gain closest to linear, the lowest on a tie */
+static u32 ams_sensor_gain_linear_to_index(struct ams_sensor *ams, u32 linear)
+{
+	u32 best = ams->gain->minimum;
+	u32 best_diff = U32_MAX;
+	u32 index, gain, diff;
+
+	for (index = ams->gain->minimum; index <= ams->gain->maximum; index++) {
+		gain = ams->ops->gain_to_linear(ams, index);
+		diff = gain > linear ? gain - linear : linear - gain;
+		if (diff < best_diff) {
+			best = index;
+			best_diff = diff;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Create AMS_CAMERA_CID_ANALOG_GAIN_LINEAR for gain, with the driver's
+ * control ops. Nothing is created without gain, a failure is left in
+ * hdl->error like for the other controls.
+ */
+void ams_sensor_gain_linear_init(struct ams_sensor *ams,
+				 struct v4l2_ctrl_handler *hdl,
+				 const struct v4l2_ctrl_ops *ops,
+				 struct v4l2_ctrl *gain)
+{
+	struct v4l2_ctrl_config cfg = {
+		.ops = ops,
+		.id = AMS_CAMERA_CID_ANALOG_GAIN_LINEAR,
+		.name = "analog_gain_linear",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.step = 1,
+	};
+	u32 min, max;
+
+	ams->gain = gain;
+	if (!gain)
+		return;
+
+	ams_sensor_gain_linear_range(ams, &min, &max);
+	cfg.min = min;
+	cfg.max = max;
+	cfg.def = ams->ops->gain_to_linear(ams, gain->default_value);
+	ams->gain_linear = v4l2_ctrl_new_custom(hdl, &cfg, NULL);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_gain_linear_init);
+
+/*
+ * s_ctrl of AMS_CAMERA_CID_ANALOG_GAIN_LINEAR. Sets the closest
+ * V4L2_CID_ANALOGUE_GAIN index, whose s_ctrl writes the sensor, and
+ * reports the gain that is applied.
+ */
+int ams_sensor_gain_linear_s_ctrl(struct ams_sensor *ams,
+				  struct v4l2_ctrl *ctrl)
+{
+	u32 index = ams_sensor_gain_linear_to_index(ams, ctrl->val);
+
+	ctrl->val = ams->ops->gain_to_linear(ams, index);
+	if (index == ams->gain->val)
+		return 0;
+	return __v4l2_ctrl_s_ctrl(ams->gain, index);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_gain_linear_s_ctrl);
+
+/* Follow a new V4L2_CID_ANALOGUE_GAIN value, from its s_ctrl */
+int ams_sensor_gain_linear_sync(struct ams_sensor *ams)
+{
+	u32 linear;
+
+	if (!ams->gain_linear)
+		return 0;
+
+	linear = ams->ops->gain_to_linear(ams, ams->gain->val);
+	if (ams->gain_linear->val == linear)
+		return 0;
+	return __v4l2_ctrl_s_ctrl(ams->gain_linear, linear);
+}
+EXPORT_SYMBOL_GPL(ams_sensor_gain_linear_sync);
+
+/*
+ * Follow a new V4L2_CID_ANALOGUE_GAIN range, or new gains after a mode
+ * change, and set the index closest to linear, the gain used before. The
+ * caller reads linear before changing the gain range.
+ */
+int ams_sensor_gain_linear_update(struct ams_sensor *ams, u32 linear)
+{
+	u32 min, max, index;
+	int ret;
+
+	if (!ams->gain_linear)
+		return 0;
+
+	ams_sensor_gain_linear_range(ams, &min, &max);
+	ret = __v4l2_ctrl_modify_range(ams->gain_linear, min, max, 1,
+				       ams->ops->gain_to_linear(ams, ams->gain->default_value));
+	if (ret)
+		return ret;
+
+	index = ams_sensor_gain_linear_to_index(ams, linear);
+	ret = __v4l2_ctrl_s_ctrl(ams->gain, index);
+	if (ret)
+		return ret;
+
+	return __v4l2_ctrl_s_ctrl(ams->gain_linear,
+				  ams->ops->gain_to_linear(ams, index));
+}
+EXPORT_SYMBOL_GPL(ams_sensor_gain_linear_update);
+
+/*
+ * Run a board bring-up sequence. A failed write does not stop the
+ * sequence, the first error is returned at the end.
+ */
+int ams_pmic_run_seq(struct ams_sensor *ams,
+		     const struct ams_pmic_step *seq, u32 len)
+{
+	struct i2c_client *client;
+	unsigned int i;
+	int err = 0;
+	int ret;
+
+	for (i = 0; i < len; i++) {
+		switch (seq[i].op) {
+		case AMS_PMIC_SEQ_SLEEP:
+			usleep_range(seq[i].min_us, seq[i].max_us);
+			continue;
+		case AMS_PMIC_SEQ_PMIC:
+			client = ams->pmic_client;
+			break;
+		case AMS_PMIC_SEQ_UC:
+			client = ams->uc_client;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		ret = client ? ams_pmic_write(client, seq[i].reg, seq[i].val) : -ENODEV;
+		if (ret && !err) {
+			dev_warn(&ams->client->dev,
+				 "Board bring-up step %u, reg 0x%02x failed: %d\n",
+				 i, seq[i].reg, ret);
+			err = ret;
+		}
+	}
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ams_pmic_run_seq);
+
+MODULE_AUTHOR("Zhenyu Ye <zhenyu.ye@ams-osram.com>");
+MODULE_DESCRIPTION("ams sensor driver core");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Shared transport, register protocol and PMIC helpers for the ams
+ * Mira and Poncha sensor drivers.
+ * Copyright (C) 2023, ams-OSRAM
+ */
+
+#ifndef __AMS_SENSOR_CORE_H__
+#define __AMS_SENSOR_CORE_H__
+
+#include <linux/types.h>
+#include <linux/v4l2-controls.h>
+#include <linux/videodev2.h>
+
+/*
+ * Private controls and events of the ams drivers, also included by the
+ * userspace tools. Every driver takes its IDs from this one allocation,
+ * so an ID means the same thing on every sensor. Add new ones at the end,
+ * never reuse one.
+ */
+#define AMS_CAMERA_CID_BASE		(V4L2_CTRL_CLASS_CAMERA | 0x2000)
+#define AMS_CAMERA_CID_MIRA_REG_W	(AMS_CAMERA_CID_BASE+0)
+#define AMS_CAMERA_CID_MIRA_REG_R	(AMS_CAMERA_CID_BASE+1)
+#define AMS_CAMERA_CID_EXPOSURE_DELAY	(AMS_CAMERA_CID_BASE+2)
+#define AMS_CAMERA_CID_GAIN_DELAY	(AMS_CAMERA_CID_BASE+3)
+#define AMS_CAMERA_CID_VBLANK_DELAY	(AMS_CAMERA_CID_BASE+4)
+#define AMS_CAMERA_CID_STARTUP_FRAMES	(AMS_CAMERA_CID_BASE+5)
+/* Mira130 HDR modes */
+#define AMS_CAMERA_CID_EXPOSURE_SHORT	(AMS_CAMERA_CID_BASE+6)
+#define AMS_CAMERA_CID_GAIN_SHORT	(AMS_CAMERA_CID_BASE+7)
+/* Mira220 */
+#define AMS_CAMERA_CID_BURST_COUNT	(AMS_CAMERA_CID_BASE+8)
+#define AMS_CAMERA_CID_BURST_TRIGGER	(AMS_CAMERA_CID_BASE+9)
+/* +10 and +11 were EXPOSURE_B and ILLUMINATION_B, retired */
+#define AMS_CAMERA_CID_ANALOG_GAIN_LINEAR	(AMS_CAMERA_CID_BASE+12)
+
+/* AMS_CAMERA_CID_ANALOG_GAIN_LINEAR is in 1/256 */
+#define AMS_CAMERA_GAIN_LINEAR_UNITY	256
+
+/*
+ * Sent when deferred control values have been written to the sensor.
+ * The payload is struct ams_camera_event_ctrl_applied.
+ */
+#define AMS_CAMERA_EVENT_BASE		(V4L2_EVENT_PRIVATE_START + 0x2000)
+#define AMS_CAMERA_EVENT_CTRL_APPLIED	(AMS_CAMERA_EVENT_BASE+0)
+
+/* Fits the 64-byte v4l2_event payload */
+#define AMS_CAMERA_CTRL_APPLIED_MAX	3
+
+struct ams_camera_event_ctrl_applied {
+	/* Incremented for every event */
+	__u32 seq;
+	/* Number of valid entries in ctrls */
+	__u32 count;
+	struct {
+		__u32 id;
+		__s32 value;
+		/* 0 or the negative error code of the register write */
+		__s32 status;
+	} ctrls[AMS_CAMERA_CTRL_APPLIED_MAX];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/bits.h>
+#include <linux/firmware.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+
+/*
+ * AMS_CAMERA_CID_MIRA_REG_W/REG_R flags, common to all drivers.
+ * The 32-bit control value is [31:24] flag, [23:8] reg addr, [7:0] reg val.
+ * REG_W with FOR_READ set caches addr and flag for the next REG_R.
+ */
+#define AMS_SENSOR_REG_FLAG_FOR_READ	0b00000001
+/* Sensor register access: select bank and context before the access */
+#define AMS_SENSOR_REG_FLAG_USE_BANK	0b00000010
+#define AMS_SENSOR_REG_FLAG_BANK	0b00000100
+#define AMS_SENSOR_REG_FLAG_CONTEXT	0b00001000
+/* The flag itself is a command, the low 24 bits are its argument */
+#define AMS_SENSOR_REG_FLAG_CMD_SEL	0b00010000
+#define AMS_SENSOR_REG_FLAG_SLEEP_US	0b00010000
+/* Which I2C device the access goes to */
+#define AMS_SENSOR_REG_FLAG_I2C_SEL	0b01100000
+#define AMS_SENSOR_REG_FLAG_I2C_MIRA	0b00000000
+#define AMS_SENSOR_REG_FLAG_I2C_TBD	0b00100000
+#define AMS_SENSOR_REG_FLAG_I2C_SET_TBD	0b01000000
+
+/* Bank/context select register, reg addr 0x0000 is a valid one */
+#define AMS_SENSOR_SEL_REG_VALID	BIT(31)
+#define AMS_SENSOR_SEL_REG(reg)		(AMS_SENSOR_SEL_REG_VALID | (reg))
+
+/* I2C addresses of the board devices next to the sensor */
+#define AMS_SENSOR_PMIC_I2C_ADDR	0x2D
+#define AMS_SENSOR_UC_I2C_ADDR		0x0A
+#define AMS_SENSOR_LED_I2C_ADDR		0x53
+
+/* Firmware tables kept per device, a mode writes at most 3 */
+#define AMS_SENSOR_FW_TABLES		4
+
+struct ams_sensor;
+struct ams_sensor_trace;
+struct dentry;
+struct v4l2_ctrl;
+struct v4l2_ctrl_handler;
+struct v4l2_ctrl_ops;
+
+struct ams_sensor_reg {
+	u16 address;
+	u8 val;
+};
+
+/* A loaded table, fw is NULL if the built-in table is used instead */
+struct ams_sensor_fw_table {
+	const char *name;
+	const struct firmware *fw;
+};
+
+struct ams_sensor_ops {
+	/* REG_W command other than SLEEP_US, value is the control value */
+	void (*reg_cmd)(struct ams_sensor *ams, u8 cmd, u32 value);
+	/* Called before REG_W writes a sensor register, may be NULL */
+	void (*reg_w_sensor)(struct ams_sensor *ams, u16 reg, u8 val);
+	/*
+	 * Gain of a V4L2_CID_ANALOGUE_GAIN index of the current mode, in
+	 * AMS_CAMERA_GAIN_LINEAR_UNITY. Needed by ams_sensor_gain_linear_init().
+	 */
+	u32 (*gain_to_linear)(struct ams_sensor *ams, u32 index);
+};
+
+/*
+ * Per-device state, embedded in the driver's device struct. The driver
+ * fills client, ops and the board clients at probe.
+ */
+struct ams_sensor {
+	struct i2c_client *client;
+	const struct ams_sensor_ops *ops;
+
+	/* Board devices, NULL if absent */
+	struct i2c_client *pmic_client;
+	struct i2c_client *uc_client;
+	struct i2c_client *led_client;
+
+	/*
+	 * Registers selected by REG_FLAG_USE_BANK, set with
+	 * AMS_SENSOR_SEL_REG(). 0 if the sensor has no such register, the
+	 * flag bit is then ignored.
+	 */
+	u32 bank_sel_reg;
+	u32 context_sel_reg;
+
+	/* REG_W/REG_R protocol state */
+	u32 tbd_client_i2c_addr;
+	u16 reg_w_cached_addr;
+	u8 reg_w_cached_flag;
+
+	/*
+	 * V4L2_CID_ANALOGUE_GAIN and the AMS_CAMERA_CID_ANALOG_GAIN_LINEAR
+	 * control following it, set by ams_sensor_gain_linear_init()
+	 */
+	struct v4l2_ctrl *gain;
+	struct v4l2_ctrl *gain_linear;
+
+	/* Tables of the mode fw_mode, see ams_sensor_write_table() */
+	const void *fw_mode;
+	struct ams_sensor_fw_table fw[AMS_SENSOR_FW_TABLES];
+
+	/*
+	 * I2C transaction trace of the sensor transfers, set up by
+	 * ams_sensor_trace_init(). Transfers check trace_enabled before
+	 * taking trace_lock, a stopped trace costs no lock.
+	 */
+	struct mutex trace_lock;
+	struct ams_sensor_trace *trace;
+	bool trace_enabled;
+	u64 trace_start_ns;
+};
+
+int ams_sensor_read(struct ams_sensor *ams, u16 reg, u8 *val);
+int ams_sensor_read_be32(struct ams_sensor *ams, u16 reg, u32 *val);
+int ams_sensor_write(struct ams_sensor *ams, u16 reg, u8 val);
+int ams_sensor_write_be16(struct ams_sensor *ams, u16 reg, u16 val);
+int ams_sensor_write_be24(struct ams_sensor *ams, u16 reg, u32 val);
+int ams_sensor_write_be32(struct ams_sensor *ams, u16 reg, u32 val);
+int ams_sensor_write_le16(struct ams_sensor *ams, u16 reg, u16 val);
+int ams_sensor_write_regs(struct ams_sensor *ams,
+			  const struct ams_sensor_reg *regs, u32 len);
+int ams_sensor_write_table(struct ams_sensor *ams, const void *mode,
+			   const char *fw_name,
+			   const struct ams_sensor_reg *regs, u32 len);
+bool ams_sensor_table_from_fw(struct ams_sensor *ams, const void *mode,
+			      const char *fw_name);
+void ams_sensor_fw_release(struct ams_sensor *ams);
+
+void ams_sensor_trace_init(struct ams_sensor *ams, struct dentry *dir);
+void ams_sensor_trace_cleanup(struct ams_sensor *ams);
+
+int ams_sensor_reg_w(struct ams_sensor *ams, u32 value);
+int ams_sensor_reg_r(struct ams_sensor *ams, u32 *value);
+
+void ams_sensor_gain_linear_init(struct ams_sensor *ams,
+				 struct v4l2_ctrl_handler *hdl,
+				 const struct v4l2_ctrl_ops *ops,
+				 struct v4l2_ctrl *gain);
+int ams_sensor_gain_linear_s_ctrl(struct ams_sensor *ams,
+				  struct v4l2_ctrl *ctrl);
+int ams_sensor_gain_linear_sync(struct ams_sensor *ams);
+int ams_sensor_gain_linear_update(struct ams_sensor *ams, u32 linear);
+
+/* PMIC, micro-controller and LED driver: 8-bit addr and 8-bit value */
+int ams_pmic_write(struct i2c_client *client, u8 reg, u8 val);
+int ams_pmic_read(struct i2c_client *client, u8 reg, u8 *val);
+
+/*
+ * Board bring-up sequence, a table of PMIC and micro-controller writes
+ * and sleeps run in order by ams_pmic_run_seq().
+ */
+#define AMS_PMIC_SEQ_PMIC	0
+#define AMS_PMIC_SEQ_UC		1
+#define AMS_PMIC_SEQ_SLEEP	2
+
+struct ams_pmic_step {
+	u8 op;
+	u8 reg;
+	u8 val;
+	u32 min_us;
+	u32 max_us;
+};
+
+#define AMS_PMIC_W(_reg, _val) \
+	{ .op = AMS_PMIC_SEQ_PMIC, .reg = (_reg), .val = (_val) }
+#define AMS_UC_W(_reg, _val) \
+	{ .op = AMS_PMIC_SEQ_UC, .reg = (_reg), .val = (_val) }
+#define AMS_PMIC_SLEEP(_min, _max) \
+	{ .op = AMS_PMIC_SEQ_SLEEP, .min_us = (_min), .max_us = (_max) }
+
+int ams_pmic_run_seq(struct ams_sensor *ams,
+		     const struct ams_pmic_step *seq, u32 len);
+
+#endif /* __KERNEL__ */
+
+#endif /* __AMS_SENSOR_CORE_H__ */
@@ -0,0 +1,4 @@
+LINUX_PATH=../../linux
+PATCH_PATH=.
+cp $PATCH_PATH/ams_sensor_core.h $LINUX_PATH/drivers/media/i2c/
+cp $PATCH_PATH/ams_sensor_core.c $LINUX_PATH/drivers/media/i2c/
@@ -23,6 +23,10 @@ ln -sf $PWD/linux-${TAG} linux
 
 # apply patches and sources
 echo "Applying patches to Linux source"
+(cd $PWD/ams_sensor_core/patch && ./apply_patch.sh)
+echo "Copying source files to Linux source"
+(cd $PWD/ams_sensor_core/src && ./apply_src.sh)
+echo "Applying patches to Linux source"
 (cd $PWD/mira220/patch && ./apply_patch.sh)
 echo "Copying source files to Linux source"
 (cd $PWD/mira220/src && ./apply_src.sh)
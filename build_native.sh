@@ -45,7 +45,7 @@ Version: $PKGVER
 Architecture: $PKGARCH
 Maintainer: Zhenyu Ye <zhenyu.ye@ams-osram.com>
 Description: Mira device tree and driver for RPI.
- It contains mira220, mira220color, mira050, mira050color, mira016, mira130, poncha110." > $PKGDIR/DEBIAN/control
+ It contains ams_sensor_core, mira220, mira050, mira016, mira130, poncha110 and the mono and color overlays." > $PKGDIR/DEBIAN/control
 
 MODULEDIR=$PKGDIR/usr/lib/modules/$KERNELRELEASE/kernel/drivers/media/i2c
 mkdir -p $MODULEDIR
@@ -55,6 +55,11 @@ echo "#############################"
 echo "# Add driver and dtbo to deb"
 echo "#############################"
 
+# Build the shared core first, the drivers link against its Module.symvers
+(cd ams_sensor_core/src && make)
+# Install core to deb package folder
+(cd ams_sensor_core/src && make INSTALL_MOD_PATH=$PKGDIR install)
+
 # Build dtbo and driver
 (cd poncha110/src && make)
 # Install driver to deb package folder
@@ -101,6 +106,9 @@ echo "#############################"
 # Cleanup artifacts from source folder
 (cd mira130/src && make clean)
 
+# Cleanup core artifacts once all drivers are built
+(cd ams_sensor_core/src && make clean)
+
 
 
 echo "#############################"
@@ -11,6 +11,7 @@
 #define __MIRA016_INL__
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
@@ -24,16 +25,29 @@
 #include <media/v4l2-mediabus.h>
 #include <asm/unaligned.h>
 
-/*
- * Introduce new v4l2 control
- */
-#include <linux/v4l2-controls.h>
+#include "ams_sensor_core.h"
 
 #include "mira016_registers.inl"
 
-#define AMS_CAMERA_CID_BASE (V4L2_CTRL_CLASS_CAMERA | 0x2000)
-#define AMS_CAMERA_CID_MIRA_REG_W (AMS_CAMERA_CID_BASE + 0)
-#define AMS_CAMERA_CID_MIRA_REG_R (AMS_CAMERA_CID_BASE + 1)
+/*
+ * Firmware replacing a built-in mode table, loaded from
+ * /lib/firmware/ams/mira016_<table>.bin. Pack it with tools/regfw.
+ */
+#define MIRA016_FW_NAME(table) "ams/mira016_" #table ".bin"
+
+/*
+ * Frames until a control written during frame N is used, and frames to
+ * drop after stream-on. EXP_TIME and TARGET_FRAME_TIME are context
+ * registers, taken at the next frame start, and the global shutter
+ * exposure does not overlap the previous readout: frame N + 1 uses them.
+ * The gain is written with the sensor stopped, in every bit depth, so
+ * the first frame after the restart is N + 1 as well. No mode changes
+ * this. Check with tools/ctrl_latency -c.
+ */
+#define MIRA016_EXPOSURE_DELAY 1
+#define MIRA016_GAIN_DELAY 1
+#define MIRA016_VBLANK_DELAY 1
+#define MIRA016_STARTUP_FRAMES 1
 
 /* Most significant Byte is flag, and most significant bit is unused. */
 #define AMS_CAMERA_CID_MIRA016_REG_FLAG_FOR_READ 0b00000001
@@ -79,7 +93,7 @@
  * The TBD I2C address is default to MIRA016LED_I2C_ADDR.
  * To change the TBD I2C address, set bit 6&7 to 0b10,
  * then the reg_val will become TBD I2C address.
- * The TBD I2C address is stored in mira016->tbd_client_i2c_addr.
+ * The TBD I2C address is stored in mira016->ams.tbd_client_i2c_addr.
  */
 #define AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL 0b01100000
 #define AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_MIRA 0b00000000
@@ -177,6 +191,7 @@
 #define MIRA016_DEFAULT_VBLANK_60 8000 // 200 fps
 #define MIRA016_HBLANK 0
 
+/* Link freq of the PLL and CSI settings in the mode tables */
 #define MIRA016_DEFAULT_LINK_FREQ 750000000
 #define MIRA016_PIXEL_RATE (200000000) /*reduce factor 2 because max isp pixel rate is 380Mpix/s*/
 
@@ -278,6 +293,16 @@ static const char *const mira016_supply_name[] = {
 
 #define MIRA016_NUM_SUPPLIES ARRAY_SIZE(mira016_supply_name)
 
+/*
+ * MIPI link frequencies, in V4L2_CID_LINK_FREQ menu order. The mode tables
+ * program MIRA016_DEFAULT_LINK_FREQ. Other rates need their CSI PLL
+ * and D-PHY timing registers, which are not known yet, so the control is
+ * read-only until then.
+ */
+static const s64 link_freq_menu[] = {
+	MIRA016_DEFAULT_LINK_FREQ,
+};
+
 /*
  * The supported formats. All flip/mirror combinations have the same byte order because the sensor
  * is monochrome
@@ -309,10 +334,12 @@ static const struct mira016_mode supported_modes[] = {
 		.reg_list_pre_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_400_400_100fps_10b_1lane_reg_pre_soft_reset),
 			.regs = full_400_400_100fps_10b_1lane_reg_pre_soft_reset,
+			.fw_name = MIRA016_FW_NAME(full_400_400_100fps_10b_1lane_reg_pre_soft_reset),
 		},
 		.reg_list_post_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_400_400_100fps_10b_1lane_reg_post_soft_reset),
 			.regs = full_400_400_100fps_10b_1lane_reg_post_soft_reset,
+			.fw_name = MIRA016_FW_NAME(full_400_400_100fps_10b_1lane_reg_post_soft_reset),
 		},
 		.min_vblank = MIRA016_MIN_VBLANK_60,
 		.max_vblank = MIRA016_MAX_VBLANK,
@@ -332,10 +359,12 @@ static const struct mira016_mode supported_modes[] = {
 		.reg_list_pre_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_400_400_100fps_8b_1lane_reg_pre_soft_reset),
 			.regs = full_400_400_100fps_8b_1lane_reg_pre_soft_reset,
+			.fw_name = MIRA016_FW_NAME(full_400_400_100fps_8b_1lane_reg_pre_soft_reset),
 		},
 		.reg_list_post_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_400_400_100fps_8b_1lane_reg_post_soft_reset),
 			.regs = full_400_400_100fps_8b_1lane_reg_post_soft_reset,
+			.fw_name = MIRA016_FW_NAME(full_400_400_100fps_8b_1lane_reg_post_soft_reset),
 		},
 		.min_vblank = MIRA016_MIN_VBLANK_60,
 		.max_vblank = MIRA016_MAX_VBLANK,
@@ -390,6 +419,9 @@ struct mira016
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *link_freq;
+	/* Entries of link_freq_menu listed in device tree */
+	unsigned long link_freq_mask;
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
@@ -399,8 +431,6 @@ struct mira016
 	// custom v4l2 control
 	struct v4l2_ctrl *mira016_reg_w;
 	struct v4l2_ctrl *mira016_reg_r;
-	u16 mira016_reg_w_cached_addr;
-	u8 mira016_reg_w_cached_flag;
 
 	/* Current mode */
 	const struct mira016_mode *mode;
@@ -433,282 +463,36 @@ struct mira016
 	u32 row_length;
 	/*
 	 * Mutex for serialized access:
-	 * Protect sensor module set pad format and start/stop streaming safely.
+	 * Control handler lock, protects driver state and control ranges.
+	 * Not held across power-on and register table upload.
 	 */
 	struct mutex mutex;
-
-	/* Streaming on/off */
-	bool streaming;
-
-	/* pmic, uC, LED */
-	struct i2c_client *pmic_client;
-	struct i2c_client *uc_client;
-	struct i2c_client *led_client;
-	/* User specified I2C device address */
-	u32 tbd_client_i2c_addr;
-};
-
-static inline struct mira016 *to_mira016(struct v4l2_subdev *_sd)
-{
-	return container_of(_sd, struct mira016, sd);
-}
-
-static int mira016_read(struct mira016 *mira016, u16 reg, u8 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, val, 1);
-	/*
-	 * The only return value indicating success is 1. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 1)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira016_write(struct mira016 *mira016, u16 reg, u8 val)
-{
-	int ret;
-	unsigned char data[3] = {reg >> 8, reg & 0xff, val};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data, 3);
-
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 3)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
 	/*
-	 * The code below is for debug purpose.
-	 * It reads back the written values.
-	 * Some registers have different read and write addresses.
-	 * These registers typically have WR addr 0xE... but RD addr 0x4...
+	 * Serializes hardware sequences (stream on/off, suspend/resume) and
+	 * ACTIVE format changes. Lock order: hw_lock, then mutex.
 	 */
+	struct mutex hw_lock;
+	/* Set while a hardware sequence runs without mutex */
+	bool hw_busy;
 	/*
-	{
-		usleep_range(50, 300);
-		u8 ret_val;
-		u16 ret_reg;
-		if (((reg >>12) & 0x000F) == 0x000E) {
-			ret_reg = ((reg & 0x0FFF) | 0x4000);
-		} else {
-			ret_reg = reg;
-		}
-		ret = mira016_read(mira016, ret_reg, &ret_val);
-		printk(KERN_INFO "[MIRA016]: Write reg 0x%4.4x, Read ret_reg 0x%4.4x, val = 0x%x.\n",
-				reg, ret_reg, ret_val);
-		if (val != ret_val) {
-			printk(KERN_INFO "[MIRA016]: WARNING Write reg 0x%4.4x, val = 0x%x, read ret_reg = 0x%4.4x, ret_val = 0x%x.\n",
-				reg, val, ret_reg, ret_val);
-		}
-	}
-	*/
-
-	return ret;
-}
-
-/*
- * mira016 is big-endian: msb of val goes to lower reg addr
- */
-static int mira016_write_be16(struct mira016 *mira016, u16 reg, u16 val)
-{
-	int ret;
-	unsigned char data[4] = {reg >> 8, reg & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data, 4);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 4)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * mira016 is big-endian: msb of val goes to lower reg addr
- */
-static int mira016_write_be24(struct mira016 *mira016, u16 reg, u32 val)
-{
-	int ret;
-	unsigned char data[5] = {reg >> 8, reg & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data, 5);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
+	 * Publishes mode, fmt and bit_depth so format and selection
+	 * queries can read them without taking mutex.
 	 */
-	if (ret == 5)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
+	seqlock_t fmt_seqlock;
 
-	return ret;
-}
-
-/*
- * mira016 is big-endian: msb of val goes to lower reg addr
- */
-static int mira016_write_be32(struct mira016 *mira016, u16 reg, u32 val)
-{
-	int ret;
-	unsigned char data[6] = {reg >> 8, reg & 0xff, (val >> 24) & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data, 6);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 6)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * mira016 OTP 32-bit val on I2C is big-endian. However, val content can be little-endian.
- */
-static int mira016_read_be32(struct mira016 *mira016, u16 reg, u32 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	/* Big-endian 32-bit buffer. */
-	unsigned char data_r[4];
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
+	/* Streaming on/off */
+	bool streaming;
 
-	ret = i2c_master_recv(client, data_r, 4);
-	*val = (u32)((data_r[0] << 24) | (data_r[1] << 16) | (data_r[2] << 8) | data_r[3]);
-	/*
-	 * The only return value indicating success is 4. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 4)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
+	/* I2C transport, pmic, uC, LED and the REG_W/REG_R state */
+	struct ams_sensor ams;
 
-	return ret;
-}
+	/* debugfs directory, holds the I2C transaction trace */
+	struct dentry *debugfs;
+};
 
-/* Write a list of registers */
-static int mira016_write_regs(struct mira016 *mira016,
-							  const struct mira016_reg *regs, u32 len)
+static inline struct mira016 *to_mira016(struct v4l2_subdev *_sd)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++)
-	{
-		ret = mira016_write(mira016, regs[i].address, regs[i].val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev,
-								"Failed to write reg 0x%4.4x. error = %d\n",
-								regs[i].address, ret);
-
-			return ret;
-		}
-		else
-		{
-			// Debug code below
-			// u8 val;
-			// ret = mira016_read(mira016, regs[i].address, &val);
-			// printk(KERN_INFO "[MIRA016]: Read reg 0x%4.4x, val = 0x%x.\n",
-			// 		regs[i].address, val);
-		}
-	}
-
-	return 0;
+	return container_of(_sd, struct mira016, sd);
 }
 
 /*
@@ -721,15 +505,15 @@ static int mira016_otp_read(struct mira016 *mira016, u8 addr, u32 *val)
 	int poll_cnt = 0;
 	int poll_cnt_max = 10;
 	int ret;
-	mira016_write(mira016, MIRA016_BANK_SEL_REG, 0);
-	mira016_write(mira016, MIRA016_OTP_COMMAND, 0);
-	mira016_write(mira016, MIRA016_OTP_ADDR, addr);
-	mira016_write(mira016, MIRA016_OTP_START, 1);
+	ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0);
+	ams_sensor_write(&mira016->ams, MIRA016_OTP_COMMAND, 0);
+	ams_sensor_write(&mira016->ams, MIRA016_OTP_ADDR, addr);
+	ams_sensor_write(&mira016->ams, MIRA016_OTP_START, 1);
 	usleep_range(15, 50);
-	mira016_write(mira016, MIRA016_OTP_START, 0);
+	ams_sensor_write(&mira016->ams, MIRA016_OTP_START, 0);
 	for (poll_cnt = 0; poll_cnt < poll_cnt_max; poll_cnt++)
 	{
-		mira016_read(mira016, MIRA016_OTP_BUSY, &busy_status);
+		ams_sensor_read(&mira016->ams, MIRA016_OTP_BUSY, &busy_status);
 		if (busy_status == 0)
 		{
 			break;
@@ -742,7 +526,7 @@ static int mira016_otp_read(struct mira016 *mira016, u8 addr, u32 *val)
 	if (poll_cnt < poll_cnt_max && busy_status == 0)
 	{
 		usleep_range(15, 50);
-		ret = mira016_read_be32(mira016, MIRA016_OTP_DOUT, val);
+		ret = ams_sensor_read_be32(&mira016->ams, MIRA016_OTP_DOUT, val);
 		printk(KERN_INFO "[MIRA016]: Read OTP 0x%x, val = 0x%x.\n",
 		 		addr,*val);
 	}
@@ -756,60 +540,6 @@ static int mira016_otp_read(struct mira016 *mira016, u8 addr, u32 *val)
 	return ret;
 }
 
-/* Write PMIC registers, and can be reused to write microcontroller reg. */
-static int mira016pmic_write(struct i2c_client *client, u8 reg, u8 val)
-{
-	int ret;
-	unsigned char data[2] = {reg & 0xff, val};
-
-	ret = i2c_master_send(client, data, 2);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 2)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira016pmic_read(struct i2c_client *client, u8 reg, u8 *val)
-{
-	struct i2c_msg msgs[2];
-	u8 addr_buf[1] = {reg & 0xff};
-	u8 data_buf[1] = {0};
-	int ret;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = 1;
-	msgs[1].buf = &data_buf[0];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = (u8)(data_buf[0]);
-
-	return 0;
-}
-
 /* Power/clock management functions */
 static int mira016_power_on(struct device *dev)
 {
@@ -891,7 +621,7 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 	u32 width_adjust = 0;
 
 	// Set context bank 1A or bank 1B
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting RW_CONTEXT.");
@@ -899,7 +629,7 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 	}
 
 	// Set conetxt bank 0 or 1
-	ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 1);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 1);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -908,7 +638,7 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 
 	// Enable or disable illumination trigger
 	printk(KERN_INFO "[MIRA016]: Writing EN_TRIG_ILLUM to %d.\n", mira016->illum_enable);
-	ret = mira016_write(mira016, MIRA016_EN_TRIG_ILLUM, mira016->illum_enable);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_EN_TRIG_ILLUM, mira016->illum_enable);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting EN_TRIG_ILLUM to %d.", mira016->illum_enable);
@@ -919,7 +649,7 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 	{
 		// Set illumination width. Write 24 bits. All 24 bits are valid.
 		printk(KERN_INFO "[MIRA016]: LPS DISABLED. Writing ILLUM_WIDTH to %u.\n", mira016->illum_width);
-		ret = mira016_write_be24(mira016, MIRA016_ILLUM_WIDTH_REG, mira016->illum_width);
+		ret = ams_sensor_write_be24(&mira016->ams, MIRA016_ILLUM_WIDTH_REG, mira016->illum_width);
 		if (ret)
 		{
 			dev_err(&client->dev, "LPS DISABLED. Error setting ILLUM_WIDTH to %u.", mira016->illum_width);
@@ -980,7 +710,7 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 		width_adjust = (lps_time > 0 ? lps_time * 1500 / 8 - 30 : 0);
 		printk(KERN_INFO "[MIRA016]: LPS ENABLE -s width adjust is  %u.\n", width_adjust);
 
-		ret = mira016_write_be24(mira016, MIRA016_ILLUM_WIDTH_REG, mira016->illum_width - width_adjust);
+		ret = ams_sensor_write_be24(&mira016->ams, MIRA016_ILLUM_WIDTH_REG, mira016->illum_width - width_adjust);
 
 		if (ret)
 		{
@@ -992,333 +722,126 @@ static int mira016_write_illum_trig_regs(struct mira016 *mira016)
 }
 
 
-static int mira016_v4l2_reg_w(struct mira016 *mira016, u32 value)
+/* AMS_CAMERA_CID_MIRA_REG_W commands, the protocol is in ams_sensor_reg_w() */
+static void mira016_reg_cmd(struct ams_sensor *ams, u8 reg_flag, u32 value)
 {
-	struct i2c_client *const client = v4l2_get_subdevdata(&mira016->sd);
-	u32 ret = 0;
+	struct mira016 *mira016 = container_of(ams, struct mira016, ams);
+	struct i2c_client *const client = ams->client;
 	u32 tmp_flag;
 
-	u16 reg_addr = (value >> 8) & 0xFFFF;
-	u8 reg_val = value & 0xFF;
-	u8 reg_flag = (value >> 24) & 0xFF;
-
-	// printk(KERN_INFO "[MIRA016]: %s reg_flag: 0x%02X; reg_addr: 0x%04X; reg_val: 0x%02X.\n",
-	// 		__func__, reg_flag, reg_addr, reg_val);
-
-	if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_CMD_SEL)
+	if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_RESET_ON)
 	{
-		if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_SLEEP_US)
-		{
-			// If it is for sleep, combine all 24 bits of reg_addr and reg_val as sleep us.
-			u32 sleep_us_val = value & 0x00FFFFFF;
-			// Sleep range needs an interval, default to 1/8 of the sleep value.
-			u32 sleep_us_interval = sleep_us_val >> 3;
-			printk(KERN_INFO "[MIRA016]: %s sleep_us: %u.\n", __func__, sleep_us_val);
-			usleep_range(sleep_us_val, sleep_us_val + sleep_us_interval);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_RESET_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Enable reset at stream on/off.\n", __func__);
-			mira016->skip_reset = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_RESET_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Disable reset at stream on/off.\n", __func__);
-			mira016->skip_reset = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_REG_UP_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Enable base register sequence upload.\n", __func__);
-			mira016->skip_reg_upload = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_REG_UP_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Disable base register sequence upload.\n", __func__);
-			mira016->skip_reg_upload = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_POWER_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Call power on function mira016_power_on().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira016->skip_reset;
-			mira016->skip_reset = 0;
-			mira016_power_on(&client->dev);
-			mira016->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_POWER_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Call power off function mira016_power_off().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira016->skip_reset;
-			mira016->skip_reset = 0;
-			mira016_power_off(&client->dev);
-			mira016->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_TRIG_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Enable illumination trigger.\n", __func__);
-			mira016->illum_enable = 1;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_TRIG_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Disable illumination trigger.\n", __func__);
-			mira016->illum_enable = 0;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_WIDTH)
-		{
-			// Combine all 24 bits of reg_addr and reg_val as ILLUM_WIDTH.
-			u32 illum_width = value & 0x00FFFFFF;
-			printk(KERN_INFO "[MIRA016]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
-			mira016->illum_width = illum_width;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_DELAY)
-		{
-			// Combine reg_addr and reg_val, then select 20 bits from [19:0] as ILLUM_DELAY.
-			u32 illum_delay = value & 0x000FFFFF;
-			printk(KERN_INFO "[MIRA016]: %s Set ILLUM_DELAY to 0x%X.\n", __func__, illum_delay);
-			mira016->illum_delay = illum_delay;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_EXP_T_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s enable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
-			mira016->illum_width_auto = 1;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_EXP_T_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s disable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
-			mira016->illum_width_auto = 0;
-			mira016_write_illum_trig_regs(mira016);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_STREAM_CTRL_ON)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
-			mira016->force_stream_ctrl = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_STREAM_CTRL_OFF)
-		{
-			printk(KERN_INFO "[MIRA016]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
-			mira016->force_stream_ctrl = 0;
-		}
-		else
-		{
-			printk(KERN_INFO "[MIRA016]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
-		}
+		printk(KERN_INFO "[MIRA016]: %s Enable reset at stream on/off.\n", __func__);
+		mira016->skip_reset = 0;
 	}
-	else if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_FOR_READ)
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_RESET_OFF)
 	{
-		// If it is for read, skip reagister write, cache addr and flag for read.
-		mira016->mira016_reg_w_cached_addr = reg_addr;
-		mira016->mira016_reg_w_cached_flag = reg_flag;
+		printk(KERN_INFO "[MIRA016]: %s Disable reset at stream on/off.\n", __func__);
+		mira016->skip_reset = 1;
 	}
-	else
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_REG_UP_ON)
 	{
-		// If it is for write, select which I2C device by the flag "I2C_SEL".
-		if ((reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_MIRA)
-		{
-			// Before writing MIRA016 register, first optionally select BANK and CONTEXT
-			if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_USE_BANK)
-			{
-				u8 bank;
-				u8 context;
-				// Set conetxt bank 0 or 1
-				if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_BANK)
-				{
-					bank = 1;
-				}
-				else
-				{
-					bank = 0;
-				}
-				// printk(KERN_INFO "[MIRA016]: %s select bank: %u.\n", __func__, bank);
-				ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, bank);
-				if (ret)
-				{
-					dev_err(&client->dev, "Error setting BANK_SEL_REG.");
-					return ret;
-				}
-				// Set context bank 1A or bank 1B
-				if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_CONTEXT)
-				{
-					context = 1;
-				}
-				else
-				{
-					context = 0;
-				}
-				// printk(KERN_INFO "[MIRA016]: %s select context: %u.\n", __func__, context);
-				ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, context);
-				if (ret)
-				{
-					dev_err(&client->dev, "Error setting RW_CONTEXT.");
-					return ret;
-				}
-			}
-			// Writing the actual MIRA016 register
-			// printk(KERN_INFO "[MIRA016]: %s write reg_addr: 0x%04X; reg_val: 0x%02X.\n", __func__, reg_addr, reg_val);
-			ret = mira016_write(mira016, reg_addr, reg_val);
-			if (ret)
-			{
-				dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n", reg_addr);
-				return -EINVAL;
-			}
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SET_TBD)
-		{
-			/* User tries to set TBD I2C address, store reg_val to mira016->tbd_client_i2c_addr. Skip write. */
-			printk(KERN_INFO "[MIRA016]: mira016->tbd_client_i2c_addr = 0x%X.\n", reg_val);
-			mira016->tbd_client_i2c_addr = reg_val;
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_TBD)
-		{
-			if (mira016->tbd_client_i2c_addr == MIRA016PMIC_I2C_ADDR)
-			{
-				// Write PMIC. Use pre-allocated mira016->pmic_client.
-				printk(KERN_INFO "[MIRA016]: write pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira016pmic_write(mira016->pmic_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (mira016->tbd_client_i2c_addr == MIRA016UC_I2C_ADDR)
-			{
-				// Write micro-controller. Use pre-allocated mira016->uc_client.
-				printk(KERN_INFO "[MIRA016]: write uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira016pmic_write(mira016->uc_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (mira016->tbd_client_i2c_addr == MIRA016LED_I2C_ADDR)
-			{
-				// Write LED driver. Use pre-allocated mira016->led_client.
-				printk(KERN_INFO "[MIRA016]: write led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira016pmic_write(mira016->led_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else
-			{
-				/* Write other TBD I2C address.
-				 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SET_TBD.
-				 * The TBD I2C address is stored in mira016->tbd_client_i2c_addr.
-				 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-				 */
-				struct i2c_client *tmp_client;
-				tmp_client = i2c_new_dummy_device(client->adapter, mira016->tbd_client_i2c_addr);
-				if (IS_ERR(tmp_client))
-					return PTR_ERR(tmp_client);
-				printk(KERN_INFO "[MIRA016]: write tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-					   mira016->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira016pmic_write(tmp_client, (u8)(reg_addr & 0xFF), reg_val);
-				i2c_unregister_device(tmp_client);
-			}
-		}
+		printk(KERN_INFO "[MIRA016]: %s Enable base register sequence upload.\n", __func__);
+		mira016->skip_reg_upload = 0;
 	}
-
-	return 0;
-}
-
-static int mira016_v4l2_reg_r(struct mira016 *mira016, u32 *value)
-{
-	struct i2c_client *const client = v4l2_get_subdevdata(&mira016->sd);
-	u32 ret = 0;
-
-	u16 reg_addr = mira016->mira016_reg_w_cached_addr;
-	u8 reg_flag = mira016->mira016_reg_w_cached_flag;
-	u8 reg_val = 0;
-
-	*value = 0;
-
-	if ((reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_MIRA)
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_REG_UP_OFF)
 	{
-		if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_USE_BANK)
-		{
-			u8 bank;
-			u8 context;
-			// Set conetxt bank 0 or 1
-			if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_BANK)
-			{
-				bank = 1;
-			}
-			else
-			{
-				bank = 0;
-			}
-			// printk(KERN_INFO "[MIRA016]: %s select bank: %u.\n", __func__, bank);
-			ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, bank);
-			if (ret)
-			{
-				dev_err(&client->dev, "Error setting BANK_SEL_REG.");
-				return ret;
-			}
-			// Set context bank 1A or bank 1B
-			if (reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_CONTEXT)
-			{
-				context = 1;
-			}
-			else
-			{
-				context = 0;
-			}
-			// printk(KERN_INFO "[MIRA016]: %s select context: %u.\n", __func__, context);
-			ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, context);
-			if (ret)
-			{
-				dev_err(&client->dev, "Error setting RW_CONTEXT.");
-				return ret;
-			}
-		}
-		ret = mira016_read(mira016, reg_addr, &reg_val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n", reg_addr);
-			return -EINVAL;
-		}
+		printk(KERN_INFO "[MIRA016]: %s Disable base register sequence upload.\n", __func__);
+		mira016->skip_reg_upload = 1;
 	}
-	else if ((reg_flag & AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_TBD)
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_POWER_ON)
 	{
-		if (mira016->tbd_client_i2c_addr == MIRA016PMIC_I2C_ADDR)
-		{
-			// Read PMIC. Use pre-allocated mira016->pmic_client.
-			ret = mira016pmic_read(mira016->pmic_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA016]: read pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (mira016->tbd_client_i2c_addr == MIRA016UC_I2C_ADDR)
-		{
-			// Read micro-controller. Use pre-allocated mira016->uc_client.
-			ret = mira016pmic_read(mira016->uc_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA016]: read uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (mira016->tbd_client_i2c_addr == MIRA016LED_I2C_ADDR)
-		{
-			// Read LED driver. Use pre-allocated mira016->led_client.
-			ret = mira016pmic_read(mira016->led_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA016]: read led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else
-		{
-			/* Read other TBD I2C address.
-			 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA016_REG_FLAG_I2C_SET_TBD.
-			 * The TBD I2C address is stored in mira016->tbd_client_i2c_addr.
-			 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-			 */
-			struct i2c_client *tmp_client;
-			tmp_client = i2c_new_dummy_device(client->adapter, mira016->tbd_client_i2c_addr);
-			if (IS_ERR(tmp_client))
-				return PTR_ERR(tmp_client);
-			ret = mira016pmic_read(tmp_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA016]: read tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-				   mira016->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-			i2c_unregister_device(tmp_client);
-		}
+		printk(KERN_INFO "[MIRA016]: %s Call power on function mira016_power_on().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira016->skip_reset;
+		mira016->skip_reset = 0;
+		mira016_power_on(&client->dev);
+		mira016->skip_reset = tmp_flag;
 	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_POWER_OFF)
+	{
+		printk(KERN_INFO "[MIRA016]: %s Call power off function mira016_power_off().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira016->skip_reset;
+		mira016->skip_reset = 0;
+		mira016_power_off(&client->dev);
+		mira016->skip_reset = tmp_flag;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_TRIG_ON)
+	{
+		printk(KERN_INFO "[MIRA016]: %s Enable illumination trigger.\n", __func__);
+		mira016->illum_enable = 1;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_TRIG_OFF)
+	{
+		printk(KERN_INFO "[MIRA016]: %s Disable illumination trigger.\n", __func__);
+		mira016->illum_enable = 0;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_WIDTH)
+	{
+		// Combine all 24 bits of reg_addr and reg_val as ILLUM_WIDTH.
+		u32 illum_width = value & 0x00FFFFFF;
+		printk(KERN_INFO "[MIRA016]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
+		mira016->illum_width = illum_width;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_DELAY)
+	{
+		// Combine reg_addr and reg_val, then select 20 bits from [19:0] as ILLUM_DELAY.
+		u32 illum_delay = value & 0x000FFFFF;
+		printk(KERN_INFO "[MIRA016]: %s Set ILLUM_DELAY to 0x%X.\n", __func__, illum_delay);
+		mira016->illum_delay = illum_delay;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_EXP_T_ON)
+	{
+		printk(KERN_INFO "[MIRA016]: %s enable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
+		mira016->illum_width_auto = 1;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_ILLUM_EXP_T_OFF)
+	{
+		printk(KERN_INFO "[MIRA016]: %s disable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
+		mira016->illum_width_auto = 0;
+		mira016_write_illum_trig_regs(mira016);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_STREAM_CTRL_ON)
+	{
+		printk(KERN_INFO "[MIRA016]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
+		mira016->force_stream_ctrl = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA016_REG_FLAG_STREAM_CTRL_OFF)
+	{
+		printk(KERN_INFO "[MIRA016]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
+		mira016->force_stream_ctrl = 0;
+	}
+	else
+	{
+		printk(KERN_INFO "[MIRA016]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
+	}
+}
 
-	// Return 32-bit value that includes flags, addr, and register value
-	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
-
-	// printk(KERN_INFO "[MIRA016]: mira016_v4l2_reg_r() reg_flag: 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
-	// 		reg_flag, reg_addr, reg_val);
+/*
+ * Gain of an analog gain index in 1/256 like the LUTs. Same LUT choice as
+ * mira016_write_analog_gain_reg(), bit_depth is not set yet when the
+ * controls are created for the default 10 bit mode.
+ */
+static u32 mira016_gain_to_linear(struct ams_sensor *ams, u32 index)
+{
+	struct mira016 *mira016 = container_of(ams, struct mira016, ams);
 
-	return 0;
+	if (mira016->bit_depth == 8)
+		return fine_gain_lut_8bit_16x[index].analog_gain;
+	return fine_gain_lut_10bit_hs_4x[index].analog_gain;
 }
 
+static const struct ams_sensor_ops mira016_ams_ops = {
+	.reg_cmd = mira016_reg_cmd,
+	.gain_to_linear = mira016_gain_to_linear,
+};
+
 // Returns the maximum exposure time in microseconds (reg value)
 static u32 mira016_calculate_max_exposure_time(u32 row_length, u32 vsize,
 											   u32 vblank)
@@ -1350,12 +873,12 @@ static int mira016_write_exposure_reg(struct mira016 *mira016, u32 exposure_line
 	}
 
 	/* Write Bank 1 context 0 */
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
-	ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 1);
-	ret = mira016_write_be32(mira016, MIRA016_EXP_TIME_L_REG, exposure);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 1);
+	ret = ams_sensor_write_be32(&mira016->ams, MIRA016_EXP_TIME_L_REG, exposure);
 	/* Write Bank 1 context 1 */
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 1);
-	ret = mira016_write_be32(mira016, MIRA016_EXP_TIME_L_REG, exposure);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 1);
+	ret = ams_sensor_write_be32(&mira016->ams, MIRA016_EXP_TIME_L_REG, exposure);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting exposure time to %d", exposure);
@@ -1377,12 +900,12 @@ static int mira016_write_target_frame_time_reg(struct mira016 *mira016, u32 targ
 	u32 ret = 0;
 
 	/* Write Bank 1 context 0 */
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
-	ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 1);
-	ret = mira016_write_be32(mira016, MIRA016_TARGET_FRAME_TIME_REG, target_frame_time_us);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 1);
+	ret = ams_sensor_write_be32(&mira016->ams, MIRA016_TARGET_FRAME_TIME_REG, target_frame_time_us);
 	/* Write Bank 1 context 1 */
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 1);
-	ret = mira016_write_be32(mira016, MIRA016_TARGET_FRAME_TIME_REG, target_frame_time_us);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 1);
+	ret = ams_sensor_write_be32(&mira016->ams, MIRA016_TARGET_FRAME_TIME_REG, target_frame_time_us);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting target frame time to %d", target_frame_time_us);
@@ -1398,7 +921,7 @@ static int mira016_write_start_streaming_regs(struct mira016 *mira016)
 	int ret = 0;
 
 	// Set conetxt bank 0 or 1
-	ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -1406,7 +929,7 @@ static int mira016_write_start_streaming_regs(struct mira016 *mira016)
 	}
 
 	// Set context bank 1A or bank 1B
-	ret = mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting RW_CONTEXT.");
@@ -1414,7 +937,7 @@ static int mira016_write_start_streaming_regs(struct mira016 *mira016)
 	}
 
 	// Raising CMD_REQ_1 to 1 for REQ_EXP
-	ret = mira016_write(mira016, MIRA016_CMD_REQ_1_REG,
+	ret = ams_sensor_write(&mira016->ams, MIRA016_CMD_REQ_1_REG,
 						1);
 	if (ret)
 	{
@@ -1425,7 +948,7 @@ static int mira016_write_start_streaming_regs(struct mira016 *mira016)
 	usleep_range(10, 20);
 
 	// Setting CMD_REQ_1 tp 0 for REQ_EXP
-	ret = mira016_write(mira016, MIRA016_CMD_REQ_1_REG,
+	ret = ams_sensor_write(&mira016->ams, MIRA016_CMD_REQ_1_REG,
 						0);
 	if (ret)
 	{
@@ -1444,7 +967,7 @@ static int mira016_write_stop_streaming_regs(struct mira016 *mira016)
 	printk(KERN_INFO "[MIRA016]: mira016_write_stop_streaming_regs  function.\n");
 
 	// Set conetxt bank 0 or 1
-	ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 0);
+	ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -1452,7 +975,7 @@ static int mira016_write_stop_streaming_regs(struct mira016 *mira016)
 	}
 
 	// Raising CMD_HALT_BLOCK to 1 to stop streaming
-	ret = mira016_write(mira016, MIRA016_CMD_HALT_BLOCK_REG,
+	ret = ams_sensor_write(&mira016->ams, MIRA016_CMD_HALT_BLOCK_REG,
 						1);
 	if (ret)
 	{
@@ -1463,7 +986,7 @@ static int mira016_write_stop_streaming_regs(struct mira016 *mira016)
 	usleep_range(10, 20);
 
 	// Setting CMD_HALT_BLOCK to 0 to stop streaming
-	ret = mira016_write(mira016, MIRA016_CMD_HALT_BLOCK_REG,
+	ret = ams_sensor_write(&mira016->ams, MIRA016_CMD_HALT_BLOCK_REG,
 						0);
 	if (ret)
 	{
@@ -1504,7 +1027,7 @@ static int mira016_write_analog_gain_reg(struct mira016 *mira016, u8 gain)
 			usleep_range(wait_us, wait_us + 100);
 			printk(KERN_INFO "[mira016]: Write reg sequence for analog gain x1 in 12 bit mode");
 			num_of_regs = ARRAY_SIZE(partial_analog_gain_x1_12bit);
-			ret = mira016_write_regs(mira016, partial_analog_gain_x1_12bit, num_of_regs);
+			ret = ams_sensor_write_regs(&mira016->ams, partial_analog_gain_x1_12bit, num_of_regs);
 			mira016_write_start_streaming_regs(mira016);
 			mira016->row_length = 1504;
 		}
@@ -1514,7 +1037,7 @@ static int mira016_write_analog_gain_reg(struct mira016 *mira016, u8 gain)
 			usleep_range(wait_us, wait_us + 100);
 			printk(KERN_INFO "[mira016]: Write reg sequence for analog gain x2 in 12 bit mode");
 			num_of_regs = ARRAY_SIZE(partial_analog_gain_x2_12bit);
-			ret = mira016_write_regs(mira016, partial_analog_gain_x2_12bit, num_of_regs);
+			ret = ams_sensor_write_regs(&mira016->ams, partial_analog_gain_x2_12bit, num_of_regs);
 			mira016_write_start_streaming_regs(mira016);
 			mira016->row_length = 2056;
 		}
@@ -1544,12 +1067,12 @@ static int mira016_write_analog_gain_reg(struct mira016 *mira016, u8 gain)
 			printk(KERN_INFO "[MIRA016]: Write reg sequence for analog gain %u in 10 bit mode", gain);
 			printk(KERN_INFO "[MIRA016]: analoggain: %u,gdig_preamp: %u rg_adcgain: %u, rg_mult: %u\n",
 				   analog_gain, gdig_preamp, rg_adcgain, rg_mult );
-			mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
-			mira016_write(mira016, MIRA016_BANK_SEL_REG, 1);
-			mira016_write(mira016, MIRA016_GDIG_PREAMP, gdig_preamp);
-			mira016_write(mira016, MIRA016_BANK_SEL_REG, 0);
-			mira016_write(mira016, MIRA016_BIAS_RG_ADCGAIN, rg_adcgain);
-			mira016_write(mira016, MIRA016_BIAS_RG_MULT, rg_mult);
+			ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
+			ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 1);
+			ams_sensor_write(&mira016->ams, MIRA016_GDIG_PREAMP, gdig_preamp);
+			ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0);
+			ams_sensor_write(&mira016->ams, MIRA016_BIAS_RG_ADCGAIN, rg_adcgain);
+			ams_sensor_write(&mira016->ams, MIRA016_BIAS_RG_MULT, rg_mult);
 			/* Resume streaming */
 			mira016_write_start_streaming_regs(mira016);
 		}
@@ -1587,12 +1110,12 @@ static int mira016_write_analog_gain_reg(struct mira016 *mira016, u8 gain)
 			printk(KERN_INFO "[MIRA016]: Write reg sequence for analog gain %u in 8 bit mode", gain);
 			printk(KERN_INFO "[MIRA016]: analoggain: %u,gdig_preamp: %u rg_adcgain: %u, rg_mult: %u\n",
 				   analog_gain, gdig_preamp, rg_adcgain, rg_mult );
-			mira016_write(mira016, MIRA016_RW_CONTEXT_REG, 0);
-			mira016_write(mira016, MIRA016_BANK_SEL_REG, 1);
-			mira016_write(mira016, MIRA016_GDIG_PREAMP, gdig_preamp);
-			mira016_write(mira016, MIRA016_BANK_SEL_REG, 0);
-			mira016_write(mira016, MIRA016_BIAS_RG_ADCGAIN, rg_adcgain);
-			mira016_write(mira016, MIRA016_BIAS_RG_MULT, rg_mult);
+			ams_sensor_write(&mira016->ams, MIRA016_RW_CONTEXT_REG, 0);
+			ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 1);
+			ams_sensor_write(&mira016->ams, MIRA016_GDIG_PREAMP, gdig_preamp);
+			ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0);
+			ams_sensor_write(&mira016->ams, MIRA016_BIAS_RG_ADCGAIN, rg_adcgain);
+			ams_sensor_write(&mira016->ams, MIRA016_BIAS_RG_MULT, rg_mult);
 			/* Resume streaming */
 			mira016_write_start_streaming_regs(mira016);
 		}
@@ -1618,14 +1141,41 @@ static int mira016_write_analog_gain_reg(struct mira016 *mira016, u8 gain)
 }
 
 
+/* Publish a new active mode and format. Caller holds hw_lock. */
+static void mira016_publish_format(struct mira016 *mira016,
+								   const struct mira016_mode *mode,
+								   const struct v4l2_mbus_framefmt *fmt,
+								   u8 bit_depth)
+{
+	write_seqlock(&mira016->fmt_seqlock);
+	mira016->mode = mode;
+	if (fmt)
+		mira016->fmt = *fmt;
+	mira016->bit_depth = bit_depth;
+	write_sequnlock(&mira016->fmt_seqlock);
+}
+
+/* Read a consistent copy of the active mode and format without mutex */
+static void mira016_read_format(struct mira016 *mira016,
+								const struct mira016_mode **mode,
+								struct v4l2_mbus_framefmt *fmt)
+{
+	unsigned int seq;
+
+	do
+	{
+		seq = read_seqbegin(&mira016->fmt_seqlock);
+		*mode = mira016->mode;
+		*fmt = mira016->fmt;
+	} while (read_seqretry(&mira016->fmt_seqlock, seq));
+}
+
 // Gets the format code if supported. Otherwise returns the default format code `codes[0]`
 static u32 mira016_validate_format_code_or_default(struct mira016 *mira016, u32 code)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
 	unsigned int i;
 
-	lockdep_assert_held(&mira016->mutex);
-
 	for (i = 0; i < ARRAY_SIZE(codes); i++)
 		if (codes[i] == code)
 			break;
@@ -1667,7 +1217,7 @@ static int mira016_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
 	struct v4l2_rect *try_crop;
 
-	mutex_lock(&mira016->mutex);
+	/* Only the file handle's own try state is touched, mutex is not needed */
 
 	/* Initialize try_fmt for the image pad */
 	try_fmt_img->width = supported_modes[0].width;
@@ -1689,8 +1239,6 @@ static int mira016_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	try_crop->width = MIRA016_PIXEL_ARRAY_WIDTH;
 	try_crop->height = MIRA016_PIXEL_ARRAY_HEIGHT;
 
-	mutex_unlock(&mira016->mutex);
-
 	return 0;
 }
 
@@ -1705,6 +1253,16 @@ static int mira016_set_ctrl(struct v4l2_ctrl *ctrl)
 	// Debug print
 	// printk(KERN_INFO "[MIRA016]: mira016_set_ctrl() id: 0x%X value: 0x%X.\n", ctrl->id, ctrl->val);
 
+	if (ctrl->id == AMS_CAMERA_CID_ANALOG_GAIN_LINEAR)
+		return ams_sensor_gain_linear_s_ctrl(&mira016->ams, ctrl);
+
+	if (ctrl->id == V4L2_CID_ANALOGUE_GAIN)
+	{
+		ret = ams_sensor_gain_linear_sync(&mira016->ams);
+		if (ret)
+			return ret;
+	}
+
 	if (ctrl->id == V4L2_CID_VBLANK)
 	{
 		int exposure_max, exposure_def;
@@ -1721,6 +1279,13 @@ static int mira016_set_ctrl(struct v4l2_ctrl *ctrl)
 								 (int)( exposure_def ));
 	}
 
+	/*
+	 * The running hardware sequence writes all control values
+	 * with __v4l2_ctrl_handler_setup() once the tables are uploaded.
+	 */
+	if (mira016->hw_busy)
+		return 0;
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -1752,22 +1317,22 @@ static int mira016_set_ctrl(struct v4l2_ctrl *ctrl)
 			break;
 		case V4L2_CID_HFLIP:
 			// TODO: HFLIP requires multiple register writes
-			// ret = mira016_write(mira016, MIRA016_HFLIP_REG,
+			// ret = ams_sensor_write(&mira016->ams, MIRA016_HFLIP_REG,
 			//		        ctrl->val);
 			printk(KERN_ERR "[MIRA016]: HFLIP: set %d.\n", ctrl->val);
 
 			if (ctrl->val == 0)
 			{
 				printk(KERN_ERR "[MIRA016]: HFLIP: disable %d.\n", ctrl->val);
-				ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 0x01);
-				ret = mira016_write(mira016, MIRA016_XMIRROR_REG, 0);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0x01);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_XMIRROR_REG, 0);
 
 			}
 			else
 			{
 				printk(KERN_ERR "[MIRA016]: HFLIP: enable %d.\n", ctrl->val);
-				ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 0x01);
-				ret = mira016_write(mira016, MIRA016_XMIRROR_REG, 1);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0x01);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_XMIRROR_REG, 1);
 			}
 			break;
 		case V4L2_CID_VFLIP:
@@ -1777,20 +1342,20 @@ static int mira016_set_ctrl(struct v4l2_ctrl *ctrl)
 			// {0x002C, 0xE},	// None
 			// TODO: VFLIP seems not supported in MIRA016
 			printk(KERN_ERR "[MIRA016]: VFLIP: set %d.\n", ctrl->val);
-			ret = mira016_write(mira016, MIRA016_BANK_SEL_REG, 0x00);
+			ret = ams_sensor_write(&mira016->ams, MIRA016_BANK_SEL_REG, 0x00);
 
 			if (ctrl->val == 0)
 			{
 				printk(KERN_ERR "[MIRA016]: VFLIP: disable %d.\n", ctrl->val);
-				ret = mira016_write(mira016, MIRA016_YWIN_DIR_REG, 0x0);
-				ret = mira016_write_be16(mira016, MIRA016_YWIN_START_REG, 14);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_YWIN_DIR_REG, 0x0);
+				ret = ams_sensor_write_be16(&mira016->ams, MIRA016_YWIN_START_REG, 14);
 
 			}
 			else
 			{
 				printk(KERN_ERR "[MIRA016]: VFLIP: enable %d.\n", ctrl->val);
-				ret = mira016_write(mira016, MIRA016_YWIN_DIR_REG, 0x1);
-				ret = mira016_write_be16(mira016, MIRA016_YWIN_START_REG, 413);
+				ret = ams_sensor_write(&mira016->ams, MIRA016_YWIN_DIR_REG, 0x1);
+				ret = ams_sensor_write_be16(&mira016->ams, MIRA016_YWIN_START_REG, 413);
 			}
 
 			break;
@@ -1842,10 +1407,14 @@ static int mira016_s_ctrl(struct v4l2_ctrl *ctrl)
 	 * Users need to make sure first power on then write register.
 	 */
 
+	/* Raw accesses would interleave with the table upload */
+	if (mira016->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_W:
-		ret = mira016_v4l2_reg_w(mira016, ctrl->val);
+		ret = ams_sensor_reg_w(&mira016->ams, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -1875,10 +1444,13 @@ static int mira016_g_ctrl(struct v4l2_ctrl *ctrl)
 	 * Therefore, the check of "powered" flag is disabled for now.
 	 */
 
+	if (mira016->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_R:
-		ret = mira016_v4l2_reg_r(mira016, (u32 *)&ctrl->cur.val);
+		ret = ams_sensor_reg_r(&mira016->ams, (u32 *)&ctrl->cur.val);
 		ctrl->val = ctrl->cur.val;
 		break;
 	default:
@@ -1927,6 +1499,46 @@ static struct v4l2_ctrl_config custom_ctrl_config_list[] = {
 		.def = 0,
 		.step = 1,
 	},
+	{
+		.id = AMS_CAMERA_CID_EXPOSURE_DELAY,
+		.name = "exposure_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA016_EXPOSURE_DELAY,
+		.max = MIRA016_EXPOSURE_DELAY,
+		.def = MIRA016_EXPOSURE_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_GAIN_DELAY,
+		.name = "gain_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA016_GAIN_DELAY,
+		.max = MIRA016_GAIN_DELAY,
+		.def = MIRA016_GAIN_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_VBLANK_DELAY,
+		.name = "vblank_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA016_VBLANK_DELAY,
+		.max = MIRA016_VBLANK_DELAY,
+		.def = MIRA016_VBLANK_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_STARTUP_FRAMES,
+		.name = "startup_frames",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA016_STARTUP_FRAMES,
+		.max = MIRA016_STARTUP_FRAMES,
+		.def = MIRA016_STARTUP_FRAMES,
+		.step = 1,
+	},
 
 };
 
@@ -2035,13 +1647,11 @@ static int __mira016_get_pad_format(struct mira016 *mira016,
 {
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
-	printk(KERN_ERR "[MIRA016] [PB]: __mira016_get_pad_format");
 
 	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY)
 	{
 		struct v4l2_mbus_framefmt *try_fmt =
 			v4l2_subdev_get_try_format(&mira016->sd, sd_state, fmt->pad);
-		printk(KERN_ERR "[MIRA016] [PB]: __mira016_get_pad_format V4L2_SUBDEV_FORMAT_TRY");
 
 		try_fmt->code = fmt->pad == IMAGE_PAD ? mira016_validate_format_code_or_default(mira016, try_fmt->code) : MEDIA_BUS_FMT_SENSOR_DATA;
 		fmt->format = *try_fmt;
@@ -2050,12 +1660,13 @@ static int __mira016_get_pad_format(struct mira016 *mira016,
 	{
 		if (fmt->pad == IMAGE_PAD)
 		{
-			printk(KERN_ERR "[MIRA016] [PB]: __mira016_get_pad_format IMAGE_PAD");
+			const struct mira016_mode *mode;
+			struct v4l2_mbus_framefmt active;
 
-			mira016_update_image_pad_format(mira016, mira016->mode,
-											fmt);
+			mira016_read_format(mira016, &mode, &active);
+			mira016_update_image_pad_format(mira016, mode, fmt);
 			fmt->format.code = mira016_validate_format_code_or_default(mira016,
-																	   mira016->fmt.code);
+																	   active.code);
 		}
 		else
 		{
@@ -2071,14 +1682,9 @@ static int mira016_get_pad_format(struct v4l2_subdev *sd,
 								  struct v4l2_subdev_format *fmt)
 {
 	struct mira016 *mira016 = to_mira016(sd);
-	int ret;
-	printk(KERN_ERR "[MIRA016] [PB]: mira016_get_pad_format IMAGE_PAD");
 
-	mutex_lock(&mira016->mutex);
-	ret = __mira016_get_pad_format(mira016, sd_state, fmt);
-	mutex_unlock(&mira016->mutex);
-
-	return ret;
+	/* Lockless: ACTIVE reads the published snapshot, TRY is per file handle */
+	return __mira016_get_pad_format(mira016, sd_state, fmt);
 }
 
 static int mira016_set_pad_format(struct v4l2_subdev *sd,
@@ -2088,15 +1694,23 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	struct mira016 *mira016 = to_mira016(sd);
 	const struct mira016_mode *mode;
+	u8 new_bit_depth = mira016->bit_depth;
+	const struct mira016_mode *new_mode = mira016->mode;
 	struct v4l2_mbus_framefmt *framefmt;
 	u32 max_exposure = 0, default_exp = 0;
+	u32 gain_linear;
 	int rc = 0;
 	printk(KERN_INFO "[MIRA016] [PB]: set pad format \n");
 
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
 
-	mutex_lock(&mira016->mutex);
+	/* TRY formats live in the file handle state and need no locking */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		mutex_lock(&mira016->hw_lock);
+		mutex_lock(&mira016->mutex);
+	}
 
 	if (fmt->pad == IMAGE_PAD)
 	{
@@ -2108,8 +1722,8 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 		{
 		case MEDIA_BUS_FMT_SGRBG10_1X10:
 			printk(KERN_INFO "[MIRA016] [PB]: fmt->format.code() selects 10 bit mode.\n");
-			mira016->mode = &supported_modes[0];
-			mira016->bit_depth = 10;
+			new_mode = &supported_modes[0];
+			new_bit_depth = 10;
 			// return 0;
 			break;
 
@@ -2122,8 +1736,8 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 
 		case MEDIA_BUS_FMT_SGRBG8_1X8:
 			printk(KERN_INFO "[MIRA016] [PB]: fmt->format.code() selects 8 bit mode.\n");
-			mira016->mode = &supported_modes[1];
-			mira016->bit_depth = 8;
+			new_mode = &supported_modes[1];
+			new_bit_depth = 8;
 			// return 0;
 			break;
 		default:
@@ -2146,12 +1760,14 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 			*framefmt = fmt->format;
 
 		}
-		else if (mira016->mode != mode ||
+		else if (new_mode != mode ||
 				 mira016->fmt.code != fmt->format.code)
 		{
+			/* The LUT differs per bit depth, keep the gain */
+			gain_linear = mira016->ams.gain_linear->val;
 
-			mira016->fmt = fmt->format;
-			mira016->mode = mode;
+			mira016_publish_format(mira016, mode, &fmt->format,
+								   new_bit_depth);
 
 			// Update controls based on new mode (range and current value).
 			max_exposure = mira016_calculate_max_exposure_time(MIRA016_MIN_ROW_LENGTH,
@@ -2176,6 +1792,8 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 			rc = 		__v4l2_ctrl_modify_range(mira016->gain,
 								 mira016->mode->gain_min, mira016->mode->gain_max,
 								 mira016->mode->gain_step, mira016->mode->gain_min);
+			if (!rc)
+				rc = ams_sensor_gain_linear_update(&mira016->ams, gain_linear);
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting gain range");
@@ -2222,7 +1840,11 @@ static int mira016_set_pad_format(struct v4l2_subdev *sd,
 		}
 	}
 
-	mutex_unlock(&mira016->mutex);
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		mutex_unlock(&mira016->mutex);
+		mutex_unlock(&mira016->hw_lock);
+	}
 
 	return 0;
 }
@@ -2234,15 +1856,13 @@ static int mira016_set_framefmt(struct mira016 *mira016)
 	{
 	case MEDIA_BUS_FMT_SGRBG8_1X8:
 		printk(KERN_INFO "[MIRA016]: mira016_set_framefmt() selects 8 bit mode.\n");
-		mira016->mode = &supported_modes[1];
-		mira016->bit_depth = 8;
+		mira016_publish_format(mira016, &supported_modes[1], NULL, 8);
 		__v4l2_ctrl_modify_range(mira016->gain,
 								 0, ARRAY_SIZE(fine_gain_lut_8bit_16x) - 1, 1, 0);
 		return 0;
 	case MEDIA_BUS_FMT_SGRBG10_1X10:
 		printk(KERN_INFO "[MIRA016]: mira016_set_framefmt() selects 10 bit mode.\n");
-		mira016->mode = &supported_modes[0];
-		mira016->bit_depth = 10;
+		mira016_publish_format(mira016, &supported_modes[0], NULL, 10);
 		__v4l2_ctrl_modify_range(mira016->gain,
 								 0, ARRAY_SIZE(fine_gain_lut_10bit_hs_4x) - 1, 1, 0);
 		return 0;
@@ -2270,7 +1890,14 @@ __mira016_get_pad_crop(struct mira016 *mira016, struct v4l2_subdev_state *sd_sta
 	case V4L2_SUBDEV_FORMAT_TRY:
 		return v4l2_subdev_get_try_crop(&mira016->sd, sd_state, pad);
 	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &mira016->mode->crop;
+	{
+		const struct mira016_mode *mode;
+		struct v4l2_mbus_framefmt fmt;
+
+		/* Modes are static, only the pointer needs a consistent read */
+		mira016_read_format(mira016, &mode, &fmt);
+		return &mode->crop;
+	}
 	}
 
 	return NULL;
@@ -2286,10 +1913,8 @@ static int mira016_get_selection(struct v4l2_subdev *sd,
 	{
 		struct mira016 *mira016 = to_mira016(sd);
 
-		mutex_lock(&mira016->mutex);
 		sel->r = *__mira016_get_pad_crop(mira016, sd_state, sel->pad,
 										 sel->which);
-		mutex_unlock(&mira016->mutex);
 
 		return 0;
 	}
@@ -2321,7 +1946,6 @@ static int mira016_start_streaming(struct mira016 *mira016)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
 	const struct mira016_reg_list *reg_list;
-
 	int ret;
 
 	printk(KERN_INFO "[MIRA016]: Entering start streaming function.\n");
@@ -2337,7 +1961,11 @@ static int mira016_start_streaming(struct mira016 *mira016)
 	}
 
 	/* Set current mode according to frame format bit depth */
+	mutex_lock(&mira016->mutex);
 	ret = mira016_set_framefmt(mira016);
+	if (!ret)
+		mira016->hw_busy = true;
+	mutex_unlock(&mira016->mutex);
 	if (ret)
 	{
 		dev_err(&client->dev, "%s failed to set frame format: %d\n",
@@ -2352,11 +1980,12 @@ static int mira016_start_streaming(struct mira016 *mira016)
 		/* Apply pre soft reset default values of current mode */
 		reg_list = &mira016->mode->reg_list_pre_soft_reset;
 		printk(KERN_INFO "[MIRA016]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = mira016_write_regs(mira016, reg_list->regs, reg_list->num_of_regs);
+		ret = ams_sensor_write_table(&mira016->ams, mira016->mode, reg_list->fw_name,
+						     reg_list->regs, reg_list->num_of_regs);
 		if (ret)
 		{
 			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			goto err_busy;
 		}
 	}
 	else
@@ -2366,11 +1995,16 @@ static int mira016_start_streaming(struct mira016 *mira016)
 
 	printk(KERN_INFO "[MIRA016]: Entering v4l2 ctrl handler setup function.\n");
 
-	/* Apply customized values from user */
+	/*
+	 * Apply customized values from user. Control writes that came in
+	 * during the upload were cached and are written here.
+	 */
+	mutex_lock(&mira016->mutex);
+	mira016->hw_busy = false;
 	ret = __v4l2_ctrl_handler_setup(mira016->sd.ctrl_handler);
 	printk(KERN_INFO "[MIRA016]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
 	if (ret)
-		goto err_rpm_put;
+		goto err_unlock;
 
 	usleep_range(8000, 10000);
 
@@ -2383,7 +2017,7 @@ static int mira016_start_streaming(struct mira016 *mira016)
 		if (ret)
 		{
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_unlock;
 		}
 	}
 	else
@@ -2401,9 +2035,15 @@ static int mira016_start_streaming(struct mira016 *mira016)
 	// printk(KERN_INFO "[MIRA016]: %s Enable illumination trigger.\n", __func__);
 	mira016->illum_enable = 1;
 	mira016_write_illum_trig_regs(mira016);
+	mutex_unlock(&mira016->mutex);
 
 	return 0;
 
+err_busy:
+	mutex_lock(&mira016->mutex);
+	mira016->hw_busy = false;
+err_unlock:
+	mutex_unlock(&mira016->mutex);
 err_rpm_put:
 	pm_runtime_put(&client->dev);
 	return ret;
@@ -2415,8 +2055,11 @@ static void mira016_stop_streaming(struct mira016 *mira016)
 	printk(KERN_INFO "[MIRA016]: Entering mira016_stop_streaming function.\n");
 
 	/* Unlock controls for vflip and hflip */
+	mutex_lock(&mira016->mutex);
 	__v4l2_ctrl_grab(mira016->vflip, false);
 	__v4l2_ctrl_grab(mira016->hflip, false);
+	mira016->hw_busy = true;
+	mutex_unlock(&mira016->mutex);
 
 	if (mira016->skip_reset == 0)
 	{
@@ -2442,47 +2085,64 @@ static void mira016_stop_streaming(struct mira016 *mira016)
 	}
 
 	pm_runtime_put(&client->dev);
+
+	mutex_lock(&mira016->mutex);
+	mira016->hw_busy = false;
+	mutex_unlock(&mira016->mutex);
 }
 static int mira016_set_stream(struct v4l2_subdev *sd, int enable)
 {
 	struct mira016 *mira016 = to_mira016(sd);
 	int ret = 0;
 
+	/*
+	 * The sequence runs under hw_lock. mutex is only taken for the
+	 * short state updates, so queries and control reads do not wait
+	 * for the power-on and the register table upload.
+	 */
+	mutex_lock(&mira016->hw_lock);
 	mutex_lock(&mira016->mutex);
 	if (mira016->streaming == enable)
 	{
 		mutex_unlock(&mira016->mutex);
+		mutex_unlock(&mira016->hw_lock);
 		return 0;
 	}
 
 	printk(KERN_INFO "[MIRA016]: Entering mira016_set_stream enable: %d.\n", enable);
 
+	if (!enable)
+		mira016->streaming = false;
+	mutex_unlock(&mira016->mutex);
+
 	if (enable)
 	{
 		/*
 		 * Apply default & customized values
 		 * and then start streaming.
+		 * On failure the runtime PM reference is already dropped.
 		 */
 		ret = mira016_start_streaming(mira016);
 		if (ret)
 			goto err_unlock;
+
+		mutex_lock(&mira016->mutex);
+		mira016->streaming = true;
+		mutex_unlock(&mira016->mutex);
 	}
 	else
 	{
 		mira016_stop_streaming(mira016);
 	}
 
-	mira016->streaming = enable;
-
-	mutex_unlock(&mira016->mutex);
+	mutex_unlock(&mira016->hw_lock);
 
 	printk(KERN_INFO "[MIRA016]: Returning mira016_set_stream with ret: %d.\n", ret);
 
 	return ret;
 
 err_unlock:
-	mira016_stop_streaming(mira016);
-	mutex_unlock(&mira016->mutex);
+	mutex_unlock(&mira016->hw_lock);
 
 	return ret;
 }
@@ -2495,8 +2155,10 @@ static int __maybe_unused mira016_suspend(struct device *dev)
 
 	printk(KERN_INFO "[MIRA016]: Entering suspend function.\n");
 
+	mutex_lock(&mira016->hw_lock);
 	if (mira016->streaming)
 		mira016_stop_streaming(mira016);
+	mutex_unlock(&mira016->hw_lock);
 
 	return 0;
 }
@@ -2510,18 +2172,22 @@ static int __maybe_unused mira016_resume(struct device *dev)
 
 	printk(KERN_INFO "[MIRA016]: Entering resume function.\n");
 
+	mutex_lock(&mira016->hw_lock);
 	if (mira016->streaming)
 	{
 		ret = mira016_start_streaming(mira016);
 		if (ret)
 			goto error;
 	}
+	mutex_unlock(&mira016->hw_lock);
 
 	return 0;
 
 error:
-	mira016_stop_streaming(mira016);
+	mutex_lock(&mira016->mutex);
 	mira016->streaming = false;
+	mutex_unlock(&mira016->mutex);
+	mutex_unlock(&mira016->hw_lock);
 
 	return ret;
 }
@@ -2545,13 +2211,13 @@ static int mira016_identify_module(struct mira016 *mira016)
 	int ret;
 	u8 val;
 
-	ret = mira016_read(mira016, 0x25, &val);
+	ret = ams_sensor_read(&mira016->ams, 0x25, &val);
 	printk(KERN_INFO "[MIRA016]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x25, val);
-	ret = mira016_read(mira016, 0x3, &val);
+	ret = ams_sensor_read(&mira016->ams, 0x3, &val);
 	printk(KERN_INFO "[MIRA016]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x3, val);
-	ret = mira016_read(mira016, 0x4, &val);
+	ret = ams_sensor_read(&mira016->ams, 0x4, &val);
 	printk(KERN_INFO "[MIRA016]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x4, val);
 
@@ -2594,10 +2260,11 @@ static int mira016_init_controls(struct mira016 *mira016)
 	int ret;
 	struct v4l2_ctrl_config *mira016_reg_w;
 	struct v4l2_ctrl_config *mira016_reg_r;
+	unsigned int i;
 
 	ctrl_hdlr = &mira016->ctrl_handler;
 	/* v4l2_ctrl_handler_init gives a hint/guess of the number of v4l2_ctrl_new */
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 21);
 	if (ret)
 		return ret;
 
@@ -2614,6 +2281,18 @@ static int mira016_init_controls(struct mira016 *mira016)
 											MIRA016_PIXEL_RATE, 1,
 											MIRA016_PIXEL_RATE);
 
+	/* Limited to the rates listed in DT */
+	mira016->link_freq = v4l2_ctrl_new_int_menu(ctrl_hdlr, &mira016_ctrl_ops,
+											V4L2_CID_LINK_FREQ,
+											ARRAY_SIZE(link_freq_menu) - 1,
+											__ffs(mira016->link_freq_mask),
+											link_freq_menu);
+	if (mira016->link_freq)
+	{
+		mira016->link_freq->menu_skip_mask = ~mira016->link_freq_mask;
+		mira016->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	}
+
 	printk(KERN_INFO "[MIRA016]: %s V4L2_CID_VBLANK %X.\n", __func__, V4L2_CID_VBLANK);
 
 	mira016->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &mira016_ctrl_ops,
@@ -2645,6 +2324,8 @@ static int mira016_init_controls(struct mira016 *mira016)
 	mira016->gain = v4l2_ctrl_new_std(ctrl_hdlr, &mira016_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
 									  mira016->mode->gain_min, mira016->mode->gain_max,
 									  mira016->mode->gain_step,mira016->mode->gain_min);
+	ams_sensor_gain_linear_init(&mira016->ams, ctrl_hdlr, &mira016_ctrl_ops,
+								mira016->gain);
 
 	printk(KERN_INFO "[MIRA016]: %s V4L2_CID_HFLIP new %X.\n", __func__, V4L2_CID_HFLIP);
 
@@ -2675,6 +2356,10 @@ static int mira016_init_controls(struct mira016 *mira016)
 	if (mira016->mira016_reg_r)
 		mira016->mira016_reg_r->flags |= (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_READ_ONLY);
 
+	/* Control delays and startup frames, read-only */
+	for (i = 2; i < ARRAY_SIZE(custom_ctrl_config_list); i++)
+		v4l2_ctrl_new_custom(ctrl_hdlr, &custom_ctrl_config_list[i], NULL);
+
 	if (ctrl_hdlr->error)
 	{
 		ret = ctrl_hdlr->error;
@@ -2709,11 +2394,12 @@ static void mira016_free_controls(struct mira016 *mira016)
 	mutex_destroy(&mira016->mutex);
 }
 
-static int mira016_check_hwcfg(struct device *dev)
+static int mira016_check_hwcfg(struct device *dev, struct mira016 *mira016)
 {
 	struct fwnode_handle *endpoint;
 	struct v4l2_fwnode_endpoint ep_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY};
+	unsigned int i, j;
 	int ret = -EINVAL;
 
 	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -2743,11 +2429,25 @@ static int mira016_check_hwcfg(struct device *dev)
 		goto error_out;
 	}
 
-	if (ep_cfg.nr_of_link_frequencies != 1 ||
-		ep_cfg.link_frequencies[0] != MIRA016_DEFAULT_LINK_FREQ)
+	mira016->link_freq_mask = 0;
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++)
+	{
+		for (j = 0; j < ARRAY_SIZE(link_freq_menu); j++)
+		{
+			if (ep_cfg.link_frequencies[i] == link_freq_menu[j])
+			{
+				mira016->link_freq_mask |= BIT(j);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(link_freq_menu))
+			dev_warn(dev, "Link frequency not supported: %lld\n",
+					 ep_cfg.link_frequencies[i]);
+	}
+
+	if (!mira016->link_freq_mask)
 	{
-		dev_err(dev, "Link frequency not supported: %lld\n",
-				ep_cfg.link_frequencies[0]);
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto error_out;
 	}
 
@@ -2761,7 +2461,22 @@ error_out:
 	return ret;
 }
 
+static void mira016_debugfs_init(struct mira016 *mira016)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira016->sd);
+	char name[32];
 
+	snprintf(name, sizeof(name), "mira016-%s", dev_name(&client->dev));
+	mira016->debugfs = debugfs_create_dir(name, NULL);
+	ams_sensor_trace_init(&mira016->ams, mira016->debugfs);
+}
+
+static void mira016_debugfs_cleanup(struct mira016 *mira016)
+{
+	debugfs_remove_recursive(mira016->debugfs);
+	mira016->debugfs = NULL;
+	ams_sensor_trace_cleanup(&mira016->ams);
+}
 
 static int mira016_probe(struct i2c_client *client)
 {
@@ -2779,17 +2494,23 @@ static int mira016_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	v4l2_i2c_subdev_init(&mira016->sd, client, &mira016_subdev_ops);
+	mira016->ams.client = client;
+	mira016->ams.ops = &mira016_ams_ops;
+	mira016->ams.bank_sel_reg = AMS_SENSOR_SEL_REG(MIRA016_BANK_SEL_REG);
+	mira016->ams.context_sel_reg = AMS_SENSOR_SEL_REG(MIRA016_RW_CONTEXT_REG);
+	mutex_init(&mira016->hw_lock);
+	seqlock_init(&mira016->fmt_seqlock);
 
 	/* Check the hardware configuration in device tree */
-	if (mira016_check_hwcfg(dev))
+	if (mira016_check_hwcfg(dev, mira016))
 		return -EINVAL;
 
 	/* Parse device tree to check if dtoverlay has param skip-reg-upload=1 */
 	device_property_read_u32(dev, "skip-reg-upload", &mira016->skip_reg_upload);
 	printk(KERN_INFO "[MIRA016]: skip-reg-upload %d.\n", mira016->skip_reg_upload);
 	/* Set default TBD I2C device address to LED I2C Address*/
-	mira016->tbd_client_i2c_addr = MIRA016LED_I2C_ADDR;
-	printk(KERN_INFO "[MIRA016]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira016->tbd_client_i2c_addr);
+	mira016->ams.tbd_client_i2c_addr = MIRA016LED_I2C_ADDR;
+	printk(KERN_INFO "[MIRA016]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira016->ams.tbd_client_i2c_addr);
 
 	/* Get system clock (xclk) */
 	mira016->xclk = devm_clk_get(dev, NULL);
@@ -2816,18 +2537,18 @@ static int mira016_probe(struct i2c_client *client)
 
 	// {
 	// 	printk(KERN_INFO "[MIRA016]: Init PMIC and uC and led driver.\n");
-	// 	mira016->pmic_client = i2c_new_dummy_device(client->adapter,
+	// 	mira016->ams.pmic_client = i2c_new_dummy_device(client->adapter,
 	// 												MIRA016PMIC_I2C_ADDR);
-	// 	if (IS_ERR(mira016->pmic_client))
-	// 		return PTR_ERR(mira016->pmic_client);
-	// 	mira016->uc_client = i2c_new_dummy_device(client->adapter,
+	// 	if (IS_ERR(mira016->ams.pmic_client))
+	// 		return PTR_ERR(mira016->ams.pmic_client);
+	// 	mira016->ams.uc_client = i2c_new_dummy_device(client->adapter,
 	// 											  MIRA016UC_I2C_ADDR);
-	// 	if (IS_ERR(mira016->uc_client))
-	// 		return PTR_ERR(mira016->uc_client);
-	// 	mira016->led_client = i2c_new_dummy_device(client->adapter,
+	// 	if (IS_ERR(mira016->ams.uc_client))
+	// 		return PTR_ERR(mira016->ams.uc_client);
+	// 	mira016->ams.led_client = i2c_new_dummy_device(client->adapter,
 	// 											   MIRA016LED_I2C_ADDR);
-	// 	if (IS_ERR(mira016->led_client))
-	// 		return PTR_ERR(mira016->led_client);
+	// 	if (IS_ERR(mira016->ams.led_client))
+	// 		return PTR_ERR(mira016->ams.led_client);
 	// }
 
 	dev_err(dev, "[MIRA016] Sleep for 1 second to let PMIC driver complete init.\n");
@@ -2904,6 +2625,8 @@ static int mira016_probe(struct i2c_client *client)
 	/* For debug purpose */
 	// mira016_start_streaming(mira016);
 
+	mira016_debugfs_init(mira016);
+
 	/* Enable runtime PM and turn off the device */
 	pm_runtime_set_active(dev);
 	pm_runtime_enable(dev);
@@ -2920,9 +2643,9 @@ error_handler_free:
 error_power_off:
 	mira016_power_off(dev);
 
-	i2c_unregister_device(mira016->pmic_client);
-	i2c_unregister_device(mira016->uc_client);
-	i2c_unregister_device(mira016->led_client);
+	i2c_unregister_device(mira016->ams.pmic_client);
+	i2c_unregister_device(mira016->ams.uc_client);
+	i2c_unregister_device(mira016->ams.led_client);
 
 	return ret;
 }
@@ -2932,13 +2655,16 @@ static void mira016_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct mira016 *mira016 = to_mira016(sd);
 
-	i2c_unregister_device(mira016->pmic_client);
-	i2c_unregister_device(mira016->uc_client);
-	i2c_unregister_device(mira016->led_client);
+	i2c_unregister_device(mira016->ams.pmic_client);
+	i2c_unregister_device(mira016->ams.uc_client);
+	i2c_unregister_device(mira016->ams.led_client);
+
+	mira016_debugfs_cleanup(mira016);
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
 	mira016_free_controls(mira016);
+	ams_sensor_fw_release(&mira016->ams);
 
 	pm_runtime_disable(&client->dev);
 	if (!pm_runtime_status_suspended(&client->dev))
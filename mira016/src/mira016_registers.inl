@@ -1,11 +1,5 @@
 
 
-struct mira016_reg
-{
-	u16 address;
-	u8 val;
-};
-
 struct mira016_fine_gain_lut_new
 {
 	u32 analog_gain;
@@ -17,7 +11,9 @@ struct mira016_fine_gain_lut_new
 struct mira016_reg_list
 {
 	unsigned int num_of_regs;
-	const struct mira016_reg *regs;
+	const struct ams_sensor_reg *regs;
+	/* Firmware replacing regs, NULL for a built-in only table */
+	const char *fw_name;
 };
 
 struct mira016_v4l2_reg
@@ -26,7 +22,7 @@ struct mira016_v4l2_reg
 };
 
 // converted_Draco_i2c_configuration_sequence_hex_10bit_1x_360fps_Version3
-static const struct mira016_reg full_400_400_100fps_10b_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_10b_1lane_reg_pre_soft_reset[] = {
 
 	//"Mira016_register_sequence_10b_1-4x_60fps_1000M.txt"
 	{0xE000, 0x0},	// None
@@ -730,7 +726,7 @@ static const struct mira016_reg full_400_400_100fps_10b_1lane_reg_pre_soft_reset
 
 };
 
-static const struct mira016_reg full_400_400_100fps_10b_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_10b_1lane_reg_post_soft_reset[] = {
 	{0xE000, 0},
 	{0xE004, 0},
 	// Below are manually added after reg seq txt
@@ -747,7 +743,7 @@ static const struct mira016_reg full_400_400_100fps_10b_1lane_reg_post_soft_rese
 	{0x0ee, 4}, // #cp trim,
 };
 
-static const struct mira016_reg full_400_400_100fps_12b_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_12b_1lane_reg_pre_soft_reset[] = {
 	// Mira016_register_sequence_12b_1x_60fps_1000M.txt
 	{0xE000, 0x0},	// None
 	{0x01E4, 0x0},	// None
@@ -1439,7 +1435,7 @@ static const struct mira016_reg full_400_400_100fps_12b_1lane_reg_pre_soft_reset
 	{0x33D, 1},
 };
 
-static const struct mira016_reg full_400_400_100fps_12b_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_12b_1lane_reg_post_soft_reset[] = {
 	{0xE000, 0},
 	{0xE004, 0},
 	// Below are manually added after reg seq txt
@@ -1456,7 +1452,7 @@ static const struct mira016_reg full_400_400_100fps_12b_1lane_reg_post_soft_rese
 	{0x0ee, 4}, // #cp trim,
 };
 
-static const struct mira016_reg partial_analog_gain_x1_12bit[] = {
+static const struct ams_sensor_reg partial_analog_gain_x1_12bit[] = {
 	{57344, 0},
 	{443, 180},
 	{444, 172},
@@ -1685,7 +1681,7 @@ static const struct mira016_reg partial_analog_gain_x1_12bit[] = {
 
 };
 
-static const struct mira016_reg partial_analog_gain_x2_12bit[] = {
+static const struct ams_sensor_reg partial_analog_gain_x2_12bit[] = {
 	{57344, 0},
 	{443, 156},
 	{444, 148},
@@ -1913,7 +1909,7 @@ static const struct mira016_reg partial_analog_gain_x2_12bit[] = {
 };
 
 // converted_Draco_i2c_configuration_sequence_hex_8bit_1x_360fps_Version3
-static const struct mira016_reg full_400_400_100fps_8b_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_8b_1lane_reg_pre_soft_reset[] = {
 	// Sensor Operating Mode
 	//"Mira016_register_sequence_8b_1-16x_60fps_1000M.txt"
 	{0xE000, 0x0},	// None
@@ -2604,7 +2600,7 @@ static const struct mira016_reg full_400_400_100fps_8b_1lane_reg_pre_soft_reset[
 
 };
 
-static const struct mira016_reg full_400_400_100fps_8b_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_400_400_100fps_8b_1lane_reg_post_soft_reset[] = {
 	{0xE000, 0},
 	{0xE004, 0},
 	{0x0335, 1},  // iref sel
@@ -10,17 +10,34 @@
 #include "mira050.inl"
 
 static const struct of_device_id mira050_dt_ids[] = {
-	{ .compatible = "ams,mira050" },
+	{ .compatible = "ams,mira050", .data = &mira050_mono },
+	{ .compatible = "ams,mira050color", .data = &mira050_color },
 	{ /* sentinel */ }
 };
 MODULE_DEVICE_TABLE(of, mira050_dt_ids);
 
 static const struct i2c_device_id mira050_ids[] = {
-	{ "mira050", 0 },
+	{ "mira050", (kernel_ulong_t)&mira050_mono },
+	{ "mira050color", (kernel_ulong_t)&mira050_color },
 	{ }
 };
 MODULE_DEVICE_TABLE(i2c, mira050_ids);
 
+/* The DT compatible, or the i2c device id without DT */
+static const struct mira050_variant *mira050_get_variant(struct i2c_client *client)
+{
+	const struct mira050_variant *variant;
+	const struct i2c_device_id *id;
+
+	variant = device_get_match_data(&client->dev);
+	if (variant)
+		return variant;
+
+	id = i2c_match_id(mira050_ids, client);
+
+	return id ? (const struct mira050_variant *)id->driver_data : NULL;
+}
+
 static struct i2c_driver mira050_i2c_driver = {
 	.driver = {
 		.name = "mira050",
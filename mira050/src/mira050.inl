@@ -11,26 +11,40 @@
 #define __MIRA050_INL__
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/gcd.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
+#include <media/v4l2-rect.h>
 #include <asm/unaligned.h>
 
+#include "ams_sensor_core.h"
+
 /*
- * Introduce new v4l2 control
+ * Frames until a control written during frame N is used, and frames to
+ * drop after stream-on. EXP_TIME and TARGET_FRAME_TIME are context
+ * registers, taken at the next frame start, and the global shutter
+ * exposure does not overlap the previous readout: frame N + 1 uses them.
+ * The gain is written with the sensor stopped, in every bit depth, so
+ * the first frame after the restart is N + 1 as well. No mode changes
+ * this. Controls deferred to the worker are written within the frame
+ * they were set in. Check with tools/ctrl_latency -c.
  */
-#include <linux/v4l2-controls.h>
-#define AMS_CAMERA_CID_BASE (V4L2_CTRL_CLASS_CAMERA | 0x2000)
-#define AMS_CAMERA_CID_MIRA_REG_W (AMS_CAMERA_CID_BASE + 0)
-#define AMS_CAMERA_CID_MIRA_REG_R (AMS_CAMERA_CID_BASE + 1)
+#define MIRA050_EXPOSURE_DELAY 1
+#define MIRA050_GAIN_DELAY 1
+#define MIRA050_VBLANK_DELAY 1
+#define MIRA050_STARTUP_FRAMES 1
 
 /* Most significant Byte is flag, and most significant bit is unused. */
 #define AMS_CAMERA_CID_MIRA050_REG_FLAG_FOR_READ 0b00000001
@@ -76,7 +90,7 @@
  * The TBD I2C address is default to MIRA050LED_I2C_ADDR.
  * To change the TBD I2C address, set bit 6&7 to 0b10,
  * then the reg_val will become TBD I2C address.
- * The TBD I2C address is stored in mira050->tbd_client_i2c_addr.
+ * The TBD I2C address is stored in mira050->ams.tbd_client_i2c_addr.
  */
 #define AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL 0b01100000
 #define AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_MIRA 0b00000000
@@ -106,6 +120,12 @@
 #define MIRA050_CMD_REQ_1_REG 0x000A
 #define MIRA050_CMD_HALT_BLOCK_REG 0x000C
 
+/*
+ * The mode tables only give the continuous REQ_EXP value of CTRL_MODE
+ * (0x0011) and context A for NEXT_ACTIVE_CONTEXT (0xE003), so there is no
+ * snapshot or alternating context mode until the other values are known.
+ */
+
 // Exposure time is indicated in us
 #define MIRA050_EXP_TIME_L_REG 0x000E
 #define MIRA050_EXP_TIME_S_REG 0x0012
@@ -123,71 +143,51 @@
 #define MIRA050_GRAN_TG MIRA050_DATA_RATE * 50 / 1500  // 33
 #define MIRA050_LPS_CYCLE_TIME 12600 // 12500 + 100
 #define MIRA050_GLOB_TIME (int)((190 + MIRA050_LUT_DEL_008) * MIRA050_GRAN_TG * MIRA050_SEQ_TIME_BASE)
-#define MIRA050_ROW_LENGTH 1842 // 12b
 #define MIRA050_LPS_DISABLED 0
-#define MIRA050_TROW_US MIRA050_ROW_LENGTH * 8 / MIRA050_DATA_RATE
 
+/*
+ * ROW_LENGTH (0x0032) in sequencer clock cycles, as written by the
+ * register table of each bit depth.
+ */
+#define MIRA050_ROW_LENGTH_12B 3069
+#define MIRA050_ROW_LENGTH_10B 1912
+#define MIRA050_ROW_LENGTH_8B 1762
 
-// set pixel rate equal to width. such that 1 row time is 1 us.
-// pixel_rate = link_freq * 2 * nr_of_lanes / bits_per_sample
-// 1.0Gb/s * 2 * 1 / 12 = 178956970
-#define MIRA050_PIXEL_RATE (57600000) //reduce by factor 10, otherwise driver complains...
-/* Should match device tree link freq */
+/*
+ * PIXEL_RATE is the sequencer clock (DATA_RATE / 8), so that
+ * WIDTH + HBLANK equals ROW_LENGTH and one line is one true row time:
+ * ROW_TIME = ROW_LENGTH / PIXEL_RATE
+ * 12b: 16.37 us, 10b: 10.20 us, 8b: 9.40 us
+ */
+#define MIRA050_PIXEL_RATE (MIRA050_DATA_RATE * 125000)
+/* Link freq of the PLL and CSI settings in the mode tables */
 #define MIRA050_DEFAULT_LINK_FREQ 456000000
-#define MIRA050_DEFAULT_LINE_LENGTH 10 //((HSIZE+HBLANK)  / pixel rate) 
-// Default exposure is adjusted to 1 ms
 
-#define MIRA050_MIN_ROW_LENGTH MIRA050_ROW_LENGTH // 1042 for 8 bit
-#define MIRA050_MIN_ROW_LENGTH_US (MIRA050_MIN_ROW_LENGTH * 8 / MIRA050_DATA_RATE)
 #define MIRA050_EXPOSURE_MIN_US (int)(1 + (151 + MIRA050_LUT_DEL_008) * MIRA050_GRAN_TG * 8 / MIRA050_DATA_RATE)
 #define MIRA050_EXPOSURE_MAX_US (1000000)
-#define MIRA050_EXPOSURE_MIN_LINES (MIRA050_EXPOSURE_MIN_US/MIRA050_DEFAULT_LINE_LENGTH)
-#define MIRA050_EXPOSURE_MAX_LINES (MIRA050_EXPOSURE_MAX_US/MIRA050_DEFAULT_LINE_LENGTH)
+// Default exposure is adjusted to 10 ms
+#define MIRA050_DEFAULT_EXPOSURE_US 10000
+// Exposure for V4L2 is in row time of the active mode
 
-#define MIRA050_DEFAULT_EXPOSURE_LINES 1000
-#define MIRA050_DEFAULT_EXPOSURE_US MIRA050_DEFAULT_EXPOSURE_LINES*MIRA050_DEFAULT_LINE_LENGTH
-// Default exposure for V4L2 is in row time
-
-// #define MIRA050_MIN_VBLANK 11 // for 10b or 8b, 360fps
-// 50 fps
-#define MIRA050_MIN_VBLANK_60 900
-
-// 50 fps
-#define MIRA050_MIN_VBLANK_120 65
-
-// 120 fps
+/*
+ * Frame time is programmed in us via TARGET_FRAME_TIME:
+ * TARGET_FRAME_TIME = (HEIGHT + VBLANK) * ROW_LENGTH / PIXEL_RATE
+ * The minimum VBLANK of a mode is derived from its fastest frame time.
+ */
+#define MIRA050_FRAME_TIME_US_60 16680
+#define MIRA050_FRAME_TIME_US_120 8330
+#define MIRA050_DEFAULT_FRAME_TIME_US MIRA050_FRAME_TIME_US_60
+#define MIRA050_FRAME_TIME_TO_VBLANK(us, row_length, height) \
+	((u32)DIV_ROUND_UP((u64)(us) * MIRA050_PIXEL_RATE, (u64)(row_length) * 1000000) - (height))
 
 #define MIRA050_MAX_VBLANK 50000
 
-// Default exposure is adjusted to 1 ms
-// #define MIRA050_LUT_DEL_008			66
-// #define MIRA050_GRAN_TG				34
-// #define MIRA050_DATA_RATE			1000 // Mbit/s
-// #define MIRA050_MIN_ROW_LENGTH			1842
-// #define MIRA050_MIN_ROW_LENGTH_US		(MIRA050_MIN_ROW_LENGTH * 8 / MIRA050_DATA_RATE)
-// #define MIRA050_EXPOSURE_MIN_US			(int)(1 + (151 + MIRA050_LUT_DEL_008) * MIRA050_GRAN_TG * 8 / MIRA050_DATA_RATE)
-// #define MIRA050_EXPOSURE_MIN_RT			(int)(1 + (151 + MIRA050_LUT_DEL_008) * MIRA050_GRAN_TG / MIRA050_MIN_ROW_LENGTH)
-// #define MIRA050_EXPOSURE_MAX_US			(16601)
-// #define MIRA050_EXPOSURE_MAX_RT			(int)(1 + MIRA050_EXPOSURE_MAX_US / MIRA050_MIN_ROW_LENGTH_US)
-// #define MIRA050_DEFAULT_EXPOSURE_US		1000
-// #define MIRA050_DEFAULT_EXPOSURE_RT		(int)(1 + MIRA050_DEFAULT_EXPOSURE_US / MIRA050_MIN_ROW_LENGTH_US)
-
 // Power on function timing
 #define MIRA050_XCLR_MIN_DELAY_US 150000
 #define MIRA050_XCLR_DELAY_RANGE_US 3000
 
-/* Trick the libcamera with achievable fps via hblank */
-
-/* Formular in libcamera to derive TARGET_FPS:
- * TARGET_FPS=1/((1/MIRA050_PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+MIRA050_MIN_VBLANK))
- * Example with HBLANK=0 and MIRA050_MIN_VBLANK=12
- * TARGET_FPS=1/((1/178956970)*576*(768+12))=398
- *
- * Inverse the above formula to derive HBLANK from TARGET_FPS:
- * HBLANK=1/((1/MIRA050_PIXEL_RATE)*TARGET_FPS*(HEIGHT+MIRA050_MIN_VBLANK))-WIDTH
- * Example with TARGET_FPS of 50 fps
- * HBLANK=1/((1/178956970)*50*(768+12))-576=4013
- */
+// With preload, how long an unused upload stays powered
+#define MIRA050_PRELOAD_AUTOSUSPEND_MS 2000
 
 // For test pattern with fixed data
 #define MIRA050_TRAINING_WORD_REG 0x0060
@@ -199,6 +199,9 @@
 #define MIRA050_TEST_PATTERN_FIXED_DATA 0x01
 #define MIRA050_TEST_PATTERN_2D_GRADIENT 0x02
 
+/* Max number of queued AMS_CAMERA_EVENT_CTRL_APPLIED events per file handle */
+#define MIRA050_CTRL_APPLIED_EVENTS 8
+
 /* Embedded metadata stream structure */
 #define MIRA050_EMBEDDED_LINE_WIDTH 16384
 #define MIRA050_NUM_EMBEDDED_LINES 1
@@ -225,6 +228,21 @@
 #define MIRA050_DMUX0_SEL 0x00F3		  // bank 0
 #define MIRA050_TRIG_SYNC_ON_REQ_1 0x001D // bank 0
 
+/*
+ * Vertical ROI, bank 0. The tables enable window 0 only (YWIN_ENA) and
+ * read the pixel array from row MIRA050_YWIN_ROW_OFFSET. YWIN0_SIZE
+ * counts the rows read, YWIN0_SUBS holds the row subsampling factor
+ * minus one (0 in the tables).
+ */
+#define MIRA050_YWIN0_SIZE_REG 0x0024
+#define MIRA050_YWIN0_START_REG 0x0026
+#define MIRA050_YWIN0_SUBS_REG 0x0028
+#define MIRA050_YWIN_ROW_OFFSET 24
+// Rows go in pairs to keep the Bayer order
+#define MIRA050_YWIN_ALIGN 2
+#define MIRA050_YWIN_MIN_HEIGHT 8
+#define MIRA050_YWIN_MAX_SUBS 4
+
 #define MIRA050_EN_TRIG_ILLUM 0x001C
 #define MIRA050_ILLUM_WIDTH_REG 0x0019
 #define MIRA050_ILLUM_DELAY_REG 0x0016
@@ -232,6 +250,7 @@
 #define MIRA050_ILLUM_DELAY_DEFAULT (1 << 19)
 #define MIRA050_ILLUM_WIDTH_AUTO_DEFAULT 1;
 #define MIRA050_ILLUM_ENABLE_DEFAULT 1;
+
 enum pad_types
 {
 	IMAGE_PAD,
@@ -239,12 +258,6 @@ enum pad_types
 	NUM_PADS
 };
 
-struct mira050_reg
-{
-	u16 address;
-	u8 val;
-};
-
 // struct mira050_fine_gain_lut
 // {
 // 	u8 gdig_preamp;
@@ -261,14 +274,36 @@ struct mira050_fine_gain_lut_new
 struct mira050_reg_list
 {
 	unsigned int num_of_regs;
-	const struct mira050_reg *regs;
+	const struct ams_sensor_reg *regs;
+	/* Firmware replacing regs, NULL for a built-in only table */
+	const char *fw_name;
 };
 
+/*
+ * Firmware replacing a built-in mode table, loaded from
+ * /lib/firmware/ams/mira050_<table>.bin. Pack it with tools/regfw.
+ */
+#define MIRA050_FW_NAME(table) "ams/mira050_" #table ".bin"
+
 struct mira050_v4l2_reg
 {
 	u32 val;
 };
 
+/* Controls written by the control worker while streaming, in write order */
+enum mira050_deferred_ctrl
+{
+	MIRA050_DEFERRED_VBLANK,
+	MIRA050_DEFERRED_EXPOSURE,
+	MIRA050_DEFERRED_GAIN,
+	MIRA050_NUM_DEFERRED_CTRLS
+};
+
+/* ctrl_pending bit of a window written by the control worker */
+#define MIRA050_PENDING_WINDOW MIRA050_NUM_DEFERRED_CTRLS
+
+static_assert(MIRA050_NUM_DEFERRED_CTRLS <= AMS_CAMERA_CTRL_APPLIED_MAX);
+
 /* Mode : resolution and related config&values */
 struct mira050_mode
 {
@@ -283,6 +318,10 @@ struct mira050_mode
 	/* Default register values */
 	struct mira050_reg_list reg_list_pre_soft_reset;
 	struct mira050_reg_list reg_list_post_soft_reset;
+	/* Written instead of the full tables over another mode of the same size */
+	struct mira050_reg_list reg_list_bit_depth;
+	/* Writes registers the other modes leave at their reset value */
+	bool exclusive_regs;
 	u32 gain_min;
 	u32 gain_max;
 	u32 min_vblank;
@@ -299,7 +338,7 @@ struct mira050_mode
 
 // 576_768_50fps_12b_1lane
 // Taken from generated_api\CSP_orig_12-bit mode_anagain1_60fps_exp2000us_datarate_1500.0_mclk_24.0.txt
-static const struct mira050_reg full_576_768_50fps_12b_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_12b_1lane_reg_pre_soft_reset[] = {
 
 {0xE000,0x0},
 {0x01E4,0x0},
@@ -932,11 +971,11 @@ static const struct mira050_reg full_576_768_50fps_12b_1lane_reg_pre_soft_reset[
 
 };
 
-static const struct mira050_reg full_576_768_50fps_12b_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_12b_1lane_reg_post_soft_reset[] = {
 
 };
 // from API 1.5.1
-static const struct mira050_reg full_576_768_50fps_10b_hs_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_10b_hs_1lane_reg_pre_soft_reset[] = {
 {0xE000,0x0},//,Base Configuration.BANK_SEL
 {0x01E4,0x0},//,Base Configuration
 {0x01E5,0x13},//,Base Configuration
@@ -1567,12 +1606,12 @@ static const struct mira050_reg full_576_768_50fps_10b_hs_1lane_reg_pre_soft_res
 
 };
 
-static const struct mira050_reg full_576_768_50fps_10b_hs_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_10b_hs_1lane_reg_post_soft_reset[] = {
 
 };
 
 // api 1.5.1, 1500Mbit/s 60 fps
-static const struct mira050_reg full_576_768_50fps_8b_1lane_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_8b_1lane_reg_pre_soft_reset[] = {
 	{0xE000,0x0},//,Base Configuration.BANK_SEL
 {0x01E4,0x0},//,Base Configuration
 {0x01E5,0x13},//,Base Configuration
@@ -2204,11 +2243,231 @@ static const struct mira050_reg full_576_768_50fps_8b_1lane_reg_pre_soft_reset[]
 
 };
 
-static const struct mira050_reg full_576_768_50fps_8b_1lane_reg_post_soft_reset[] = {
+static const struct ams_sensor_reg full_576_768_50fps_8b_1lane_reg_post_soft_reset[] = {
+
+};
+
+/*
+ * Registers of the full tables above that differ between the bit depths:
+ * bit mode, CSI-2 data type, PLL, time bases, ADC timing, gain LUT,
+ * offset clipping and row length. Written over a powered sensor that
+ * holds another 576x768 mode, the result equals the full table of the
+ * new mode. 0xE195 is only written by the 8 bit table, so leaving 8 bit
+ * mode power cycles the sensor and writes the full tables. Runtime PM
+ * alone does not: a put followed by a get keeps the sensor powered.
+ */
+static const struct ams_sensor_reg full_576_768_50fps_12b_1lane_reg_bit_depth[] = {
+{0xE000,0x0},//,Base Configuration.BANK_SEL
+{0xE004,0x0},
+{0xE0C1,0x20},
+{0xE0C3,0x20},
+{0x016A,0x2},
+{0x0168,0x2C},
+{0x2076,0x93},
+{0x0070,0x6},
+{0x016D,0x22},
+{0x0176,0x42},
+{0x015B,0x46},
+{0x015D,0x46},
+{0x015F,0x46},
+{0x01BB,0x99},
+{0x01BC,0x91},
+{0x01F0,0x8},
+{0x01F3,0x0},
+{0x016E,0xFF},
+{0x0172,0xFF},
+{0x0173,0x2E},
+{0x016F,0xFF},
+{0x0170,0xFF},
+{0x0171,0xFF},
+{0x0174,0xFF},
+{0x0175,0xAB},
+{0x018B,0x8},
+{0x018C,0xCA},
+{0x018F,0x12},
+{0x0190,0xBE},
+{0x01EE,0x14},
+{0x01EF,0xA2},
+{0x01A2,0x6},
+{0x01A3,0xA5},
+{0x031F,0x6},
+{0x0320,0xAE},
+{0x01A6,0x7},
+{0x01A7,0x3C},
+{0x01A4,0xF},
+{0x01A5,0x27},
+{0x0321,0xF},
+{0x0322,0x30},
+{0x01A8,0xF},
+{0x01A9,0xBE},
+{0x01A0,0x1},
+{0x01A1,0x25},
+{0x01B2,0x1},
+{0x01B3,0x3D},
+{0x01B0,0x1},
+{0x01B1,0x38},
+{0x01AC,0x1},
+{0x01AD,0x43},
+{0x0193,0x38},
+{0x0194,0xA6},
+{0xE000,0x1},//,Base Configuration.BANK_SEL
+{0x0032,0xB},
+{0x0033,0xFD},
+{0xE004,0x1},
+{0x0032,0xB},
+{0x0033,0xFD},
+{0xE004,0x0},
+{0x000A,0x82},
+{0x000B,0x35},
+{0xE004,0x1},
+{0x000A,0x82},
+{0x000B,0x35},
+{0xE004,0x0},
+{0xE000,0x0},//,Base Configuration.BANK_SEL
+};
+
+static const struct ams_sensor_reg full_576_768_50fps_10b_hs_1lane_reg_bit_depth[] = {
+{0xE000,0x0},//,Base Configuration.BANK_SEL
+{0xE004,0x0},
+{0xE0C1,0x10},//,Base Configuration
+{0xE0C3,0x10},//,Base Configuration
+{0x016A,0x1},//,Base Configuration.DPATH_BITMODE
+{0x0168,0x2B},//,Base Configuration.CSI2_DATA_TYPE
+{0x2076,0xBD},//,PLL.PLL_DIV_M
+{0x0070,0x9},//,PLL.OTP_GRANULARITY
+{0x016D,0x32},//,PLL.GRAN_TG
+{0x0176,0x0},//,PLL.LUT_DEL_008
+{0x015B,0x33},//,Time Bases.GLOB_TIME
+{0x015D,0x33},//,Time Bases.GLOB_TIME_A
+{0x015F,0x33},//,Time Bases.GLOB_TIME_B
+{0x01BB,0xC8},//,Analog Gain
+{0x01BC,0xC0},//,Analog Gain
+{0x016E,0xBA},//,Analog Gain.LUT_DEL_000
+{0x0172,0x0},//,Analog Gain.LUT_DEL_004
+{0x0173,0x0},//,Analog Gain.LUT_DEL_005
+{0x016F,0x7E},//,Analog Gain.LUT_DEL_001
+{0x0170,0x0},//,Analog Gain.LUT_DEL_002
+{0x0171,0xBA},//,Analog Gain.LUT_DEL_003
+{0x0174,0x0},//,Analog Gain.LUT_DEL_006
+{0x0175,0x20},//,Analog Gain.LUT_DEL_007
+{0x018B,0x3},//,Analog Gain
+{0x018C,0x2},//,Analog Gain
+{0x018F,0x5},//,Analog Gain
+{0x0190,0x7F},//,Analog Gain
+{0x01EE,0x15},//,Analog Gain.SHUTTER_LAG
+{0x01EF,0xD8},//,Analog Gain.SHUTTER_LAG
+{0x01A2,0x5},//,Analog Gain.POS_ANACOL_TRIGGER
+{0x01A3,0x6F},//,Analog Gain.POS_ANACOL_TRIGGER
+{0x031F,0x5},//,Analog Gain.POS_YADDR_TRIGGER
+{0x0320,0x78},//,Analog Gain.POS_YADDR_TRIGGER
+{0x01A6,0x6},//,Analog Gain.POS_ADC_TRIGGER
+{0x01A7,0x6},//,Analog Gain.POS_ADC_TRIGGER
+{0x01A4,0x9},//,Analog Gain.POS_ANACOL_YBIN_TRIGGER
+{0x01A5,0x30},//,Analog Gain.POS_ANACOL_YBIN_TRIGGER
+{0x0321,0x9},//,Analog Gain.POS_YADDR_YBIN_TRIGGER
+{0x0322,0x39},//,Analog Gain.POS_YADDR_YBIN_TRIGGER
+{0x01A8,0x9},//,Analog Gain.POS_ADC_YBIN_TRIGGER
+{0x01A9,0xC7},//,Analog Gain.POS_ADC_YBIN_TRIGGER
+{0x01A0,0x0},//,Analog Gain.POS_VIS_TRIGGER
+{0x01A1,0xCC},//,Analog Gain.POS_VIS_TRIGGER
+{0x01B2,0x0},//,Analog Gain.POS_HSYNC_RISE
+{0x01B3,0xE4},//,Analog Gain.POS_HSYNC_RISE
+{0x01B0,0x0},//,Analog Gain.POS_STAT_TRIGGER
+{0x01B1,0xDF},//,Analog Gain.POS_STAT_TRIGGER
+{0x01AC,0x0},//,Analog Gain.POS_SVAL_TRIGGER
+{0x01AD,0xEA},//,Analog Gain.POS_SVAL_TRIGGER
+{0x01F0,0x24},//,Analog Gain
+{0x01F3,0x1},//,Analog Gain
+{0x0193,0xF},//,Black Level.OFFSET_CLIPPING
+{0x0194,0xA8},//,Black Level.OFFSET_CLIPPING
+{0xE000,0x1},//,Base Configuration.BANK_SEL
+{0x0032,0x7},//,Frame && Exposure Control.ROW_LENGTH
+{0x0033,0x78},//,Frame && Exposure Control.ROW_LENGTH
+{0xE004,0x1},
+{0x0032,0x7},//,Frame && Exposure Control.ROW_LENGTH
+{0x0033,0x78},//,Frame && Exposure Control.ROW_LENGTH
+{0xE004,0x0},
+{0x000A,0x41},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0x000B,0x1B},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0xE004,0x1},
+{0x000A,0x41},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0x000B,0x1B},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0xE004,0x0},
+{0xE000,0x0},//,Base Configuration.BANK_SEL
+};
 
+static const struct ams_sensor_reg full_576_768_50fps_8b_1lane_reg_bit_depth[] = {
+{0xE000,0x0},//,Base Configuration.BANK_SEL
+{0xE004,0x0},
+{0xE0C1,0x8},//,Base Configuration
+{0xE0C3,0x8},//,Base Configuration
+{0xE195,0xF},//,Analog Gain
+{0x016A,0x0},//,Base Configuration.DPATH_BITMODE
+{0x0168,0x2A},//,Base Configuration.CSI2_DATA_TYPE
+{0x2076,0xBD},//,PLL.PLL_DIV_M
+{0x0070,0x9},//,PLL.OTP_GRANULARITY
+{0x016D,0x32},//,PLL.GRAN_TG
+{0x0176,0x0},//,PLL.LUT_DEL_008
+{0x015B,0x33},//,Time Bases.GLOB_TIME
+{0x015D,0x33},//,Time Bases.GLOB_TIME_A
+{0x015F,0x33},//,Time Bases.GLOB_TIME_B
+{0x01BB,0xC8},//,Analog Gain
+{0x01BC,0xC0},//,Analog Gain
+{0x016E,0xBA},//,Analog Gain.LUT_DEL_000
+{0x0172,0x0},//,Analog Gain.LUT_DEL_004
+{0x0173,0x0},//,Analog Gain.LUT_DEL_005
+{0x016F,0x7E},//,Analog Gain.LUT_DEL_001
+{0x0170,0x0},//,Analog Gain.LUT_DEL_002
+{0x0171,0xBA},//,Analog Gain.LUT_DEL_003
+{0x0174,0x0},//,Analog Gain.LUT_DEL_006
+{0x0175,0x20},//,Analog Gain.LUT_DEL_007
+{0x018B,0x3},//,Analog Gain
+{0x018C,0x2},//,Analog Gain
+{0x018F,0x5},//,Analog Gain
+{0x0190,0x7F},//,Analog Gain
+{0x01EE,0x16},//,Analog Gain.SHUTTER_LAG
+{0x01EF,0x6E},//,Analog Gain.SHUTTER_LAG
+{0x01A2,0x4},//,Analog Gain.POS_ANACOL_TRIGGER
+{0x01A3,0xD9},//,Analog Gain.POS_ANACOL_TRIGGER
+{0x031F,0x4},//,Analog Gain.POS_YADDR_TRIGGER
+{0x0320,0xE2},//,Analog Gain.POS_YADDR_TRIGGER
+{0x01A6,0x5},//,Analog Gain.POS_ADC_TRIGGER
+{0x01A7,0x70},//,Analog Gain.POS_ADC_TRIGGER
+{0x01A4,0x8},//,Analog Gain.POS_ANACOL_YBIN_TRIGGER
+{0x01A5,0x9A},//,Analog Gain.POS_ANACOL_YBIN_TRIGGER
+{0x0321,0x8},//,Analog Gain.POS_YADDR_YBIN_TRIGGER
+{0x0322,0xA3},//,Analog Gain.POS_YADDR_YBIN_TRIGGER
+{0x01A8,0x9},//,Analog Gain.POS_ADC_YBIN_TRIGGER
+{0x01A9,0x31},//,Analog Gain.POS_ADC_YBIN_TRIGGER
+{0x01A0,0x0},//,Analog Gain.POS_VIS_TRIGGER
+{0x01A1,0xFF},//,Analog Gain.POS_VIS_TRIGGER
+{0x01B2,0x1},//,Analog Gain.POS_HSYNC_RISE
+{0x01B3,0x17},//,Analog Gain.POS_HSYNC_RISE
+{0x01B0,0x1},//,Analog Gain.POS_STAT_TRIGGER
+{0x01B1,0x12},//,Analog Gain.POS_STAT_TRIGGER
+{0x01AC,0x1},//,Analog Gain.POS_SVAL_TRIGGER
+{0x01AD,0x1D},//,Analog Gain.POS_SVAL_TRIGGER
+{0x01F0,0x24},//,Analog Gain
+{0x01F3,0x1},//,Analog Gain
+{0x0193,0xF},//,Black Level.OFFSET_CLIPPING
+{0x0194,0xA8},//,Black Level.OFFSET_CLIPPING
+{0xE000,0x1},//,Base Configuration.BANK_SEL
+{0x0032,0x6},//,Frame && Exposure Control.ROW_LENGTH
+{0x0033,0xE2},//,Frame && Exposure Control.ROW_LENGTH
+{0xE004,0x1},
+{0x0032,0x6},//,Frame && Exposure Control.ROW_LENGTH
+{0x0033,0xE2},//,Frame && Exposure Control.ROW_LENGTH
+{0xE004,0x0},
+{0x000A,0x41},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0x000B,0x1B},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0xE004,0x1},
+{0x000A,0x41},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0x000B,0x1B},//,Frame && Exposure Control.TARGET_FRAME_TIME
+{0xE004,0x0},
+{0xE000,0x0},//,Base Configuration.BANK_SEL
 };
 
-static const struct mira050_reg partial_analog_gain_x1_12bit[] = {
+static const struct ams_sensor_reg partial_analog_gain_x1_12bit[] = {
 	{0xE000,0x0}, //,Analog Gain.BANK_SEL
 	{0x01BB,0xC8}, //,Analog Gain
 	{0x01BC,0xC0}, //,Analog Gain
@@ -2254,7 +2513,7 @@ static const struct mira050_reg partial_analog_gain_x1_12bit[] = {
 
 };
 
-static const struct mira050_reg partial_analog_gain_x2_12bit[] = {
+static const struct ams_sensor_reg partial_analog_gain_x2_12bit[] = {
 	{0xE000,0x0},//,Analog Gain.BANK_SEL
 	{0x01BB,0xAF},//,Analog Gain
 	{0x01BC,0xA7},//,Analog Gain
@@ -2300,7 +2559,7 @@ static const struct mira050_reg partial_analog_gain_x2_12bit[] = {
 
 };
 
-static const struct mira050_reg partial_analog_gain_x4_12bit[] = {
+static const struct ams_sensor_reg partial_analog_gain_x4_12bit[] = {
 	// # Analog Gain
 	{0xE000, 0x00},
 	{0x01BB, 0x99},
@@ -2529,6 +2788,16 @@ static const char *const mira050_supply_name[] = {
  * The supported formats. All flip/mirror combinations have the same byte order because the sensor
  * is monochrome
  */
+/*
+ * MIPI link frequencies, in V4L2_CID_LINK_FREQ menu order. The mode tables
+ * program MIRA050_DEFAULT_LINK_FREQ. Other rates need their CSI PLL
+ * and D-PHY timing registers, which are not known yet, so the control is
+ * read-only until then.
+ */
+static const s64 link_freq_menu[] = {
+	MIRA050_DEFAULT_LINK_FREQ,
+};
+
 static const u32 codes[] = {
 	// MEDIA_BUS_FMT_Y8_1X8,
 	// MEDIA_BUS_FMT_Y10_1X10,
@@ -2538,6 +2807,30 @@ static const u32 codes[] = {
 	MEDIA_BUS_FMT_SGRBG12_1X12,
 };
 
+/*
+ * Mono and color variant, the match data of both device tables. Both
+ * report the Bayer codes above, as the separate mira050 and
+ * mira050color modules did, so existing userspace tuning keeps working.
+ */
+struct mira050_variant
+{
+	const char *name;
+	const u32 *codes;
+	unsigned int num_codes;
+};
+
+static const struct mira050_variant mira050_mono = {
+	.name = "mira050",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
+static const struct mira050_variant mira050_color = {
+	.name = "mira050color",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
 /* Mode configs */
 /*
  * Only one mode is exposed to the public (576x768 at 12 bit).
@@ -2559,15 +2852,23 @@ static const struct mira050_mode supported_modes[] = {
 		.reg_list_pre_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_12b_1lane_reg_pre_soft_reset),
 			.regs = full_576_768_50fps_12b_1lane_reg_pre_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_12b_1lane_reg_pre_soft_reset),
 		},
 		.reg_list_post_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_12b_1lane_reg_post_soft_reset),
 			.regs = full_576_768_50fps_12b_1lane_reg_post_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_12b_1lane_reg_post_soft_reset),
 		},
-		.min_vblank = MIRA050_MIN_VBLANK_60,
+		.reg_list_bit_depth = {
+			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_12b_1lane_reg_bit_depth),
+			.regs = full_576_768_50fps_12b_1lane_reg_bit_depth,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_12b_1lane_reg_bit_depth),
+		},
+		.min_vblank = MIRA050_FRAME_TIME_TO_VBLANK(MIRA050_FRAME_TIME_US_60,
+													MIRA050_ROW_LENGTH_12B, 768),
 		.max_vblank = MIRA050_MAX_VBLANK,
-
-		.hblank = 0,
+		.hblank = MIRA050_ROW_LENGTH_12B - 576,
+		.row_length = MIRA050_ROW_LENGTH_12B,
 		.bit_depth = 12,
 		.code = MEDIA_BUS_FMT_SGRBG12_1X12,
 		.gain_min = 0,
@@ -2581,14 +2882,23 @@ static const struct mira050_mode supported_modes[] = {
 		.reg_list_pre_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_10b_hs_1lane_reg_pre_soft_reset),
 			.regs = full_576_768_50fps_10b_hs_1lane_reg_pre_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_10b_hs_1lane_reg_pre_soft_reset),
 		},
 		.reg_list_post_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_10b_hs_1lane_reg_post_soft_reset),
 			.regs = full_576_768_50fps_10b_hs_1lane_reg_post_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_10b_hs_1lane_reg_post_soft_reset),
 		},
-		.min_vblank = MIRA050_MIN_VBLANK_120,
+		.reg_list_bit_depth = {
+			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_10b_hs_1lane_reg_bit_depth),
+			.regs = full_576_768_50fps_10b_hs_1lane_reg_bit_depth,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_10b_hs_1lane_reg_bit_depth),
+		},
+		.min_vblank = MIRA050_FRAME_TIME_TO_VBLANK(MIRA050_FRAME_TIME_US_120,
+													MIRA050_ROW_LENGTH_10B, 768),
 		.max_vblank = MIRA050_MAX_VBLANK,
-		.hblank = 0,
+		.hblank = MIRA050_ROW_LENGTH_10B - 576,
+		.row_length = MIRA050_ROW_LENGTH_10B,
 		.bit_depth = 10,
 		.code = MEDIA_BUS_FMT_SGRBG10_1X10,
 		.gain_min = 0,
@@ -2602,14 +2912,24 @@ static const struct mira050_mode supported_modes[] = {
 		.reg_list_pre_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_8b_1lane_reg_pre_soft_reset),
 			.regs = full_576_768_50fps_8b_1lane_reg_pre_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_8b_1lane_reg_pre_soft_reset),
 		},
 		.reg_list_post_soft_reset = {
 			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_8b_1lane_reg_post_soft_reset),
 			.regs = full_576_768_50fps_8b_1lane_reg_post_soft_reset,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_8b_1lane_reg_post_soft_reset),
+		},
+		.reg_list_bit_depth = {
+			.num_of_regs = ARRAY_SIZE(full_576_768_50fps_8b_1lane_reg_bit_depth),
+			.regs = full_576_768_50fps_8b_1lane_reg_bit_depth,
+			.fw_name = MIRA050_FW_NAME(full_576_768_50fps_8b_1lane_reg_bit_depth),
 		},
-		.min_vblank = MIRA050_MIN_VBLANK_120,
+		.exclusive_regs = true,
+		.min_vblank = MIRA050_FRAME_TIME_TO_VBLANK(MIRA050_FRAME_TIME_US_120,
+													MIRA050_ROW_LENGTH_8B, 768),
 		.max_vblank = MIRA050_MAX_VBLANK,
-		.hblank = 0,
+		.hblank = MIRA050_ROW_LENGTH_8B - 576,
+		.row_length = MIRA050_ROW_LENGTH_8B,
 		.bit_depth = 8,
 		.code = MEDIA_BUS_FMT_SGRBG8_1X8,
 		.gain_min = 0,
@@ -2621,9 +2941,15 @@ static const struct mira050_mode supported_modes[] = {
 struct mira050
 {
 	struct v4l2_subdev sd;
+	/* Mono or color, from the device match data */
+	const struct mira050_variant *variant;
 	struct media_pad pad[NUM_PADS];
 
 	struct v4l2_mbus_framefmt fmt;
+	/* Vertical window, mode->crop unless changed with set_selection */
+	struct v4l2_rect crop;
+	/* Row subsampling of the window, fmt.height is crop.height / ysubs */
+	u32 ysubs;
 
 	struct clk *xclk; /* system clock to MIRA050 */
 	u32 xclk_freq;
@@ -2633,6 +2959,9 @@ struct mira050
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *link_freq;
+	/* Entries of link_freq_menu listed in device tree */
+	unsigned long link_freq_mask;
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
@@ -2642,8 +2971,6 @@ struct mira050
 	// custom v4l2 control
 	struct v4l2_ctrl *mira050_reg_w;
 	struct v4l2_ctrl *mira050_reg_r;
-	u16 mira050_reg_w_cached_addr;
-	u8 mira050_reg_w_cached_flag;
 
 	/* Current mode */
 	const struct mira050_mode *mode;
@@ -2655,9 +2982,31 @@ struct mira050
 	u16 otp_dark_cal_10bit_hs;
 	u16 otp_dark_cal_10bit;
 	u16 otp_dark_cal_12bit;
+	/* OFFSET_CLIPPING per gain index, computed from the OTP values above */
+	bool offset_clipping_valid;
+	u16 offset_clipping_12bit[MIRA050_ANALOG_GAIN_MAX + 1];
+	u16 offset_clipping_10bit_hs[ARRAY_SIZE(fine_gain_lut_10bit_hs_4x)];
+	u16 offset_clipping_8bit[ARRAY_SIZE(fine_gain_lut_8bit_16x)];
 
 	/* Whether to skip base register sequence upload */
 	u32 skip_reg_upload;
+	/*
+	 * The powered sensor may hold registers of an exclusive_regs mode,
+	 * which only a power cycle restores. Cleared at power off.
+	 */
+	bool needs_reset;
+	/* Upload the mode in the background after an ACTIVE set_fmt */
+	u32 preload;
+	/* The mode of preload_code is uploaded, cleared when the sensor powers off */
+	bool preloaded;
+	u32 preload_code;
+	struct v4l2_rect preload_crop;
+	u32 preload_ysubs;
+	struct work_struct preload_work;
+	/* Mode whose tables the powered sensor holds, NULL if unknown */
+	const struct mira050_mode *uploaded_mode;
+	/* A full table of uploaded_mode came from firmware */
+	bool uploaded_fw;
 	/* Whether to reset sensor when stream on/off */
 	u32 skip_reset;
 	/* Whether regulator and clk are powered on */
@@ -2676,282 +3025,49 @@ struct mira050
 	u32 row_length;
 	/*
 	 * Mutex for serialized access:
-	 * Protect sensor module set pad format and start/stop streaming safely.
+	 * Control handler lock, protects driver state and control ranges.
+	 * Not held across power-on and register table upload.
 	 */
 	struct mutex mutex;
-
-	/* Streaming on/off */
-	bool streaming;
-
-	/* pmic, uC, LED */
-	struct i2c_client *pmic_client;
-	struct i2c_client *uc_client;
-	struct i2c_client *led_client;
-	/* User specified I2C device address */
-	u32 tbd_client_i2c_addr;
-};
-
-static inline struct mira050 *to_mira050(struct v4l2_subdev *_sd)
-{
-	return container_of(_sd, struct mira050, sd);
-}
-
-static int mira050_read(struct mira050 *mira050, u16 reg, u8 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, val, 1);
-	/*
-	 * The only return value indicating success is 1. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 1)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira050_write(struct mira050 *mira050, u16 reg, u8 val)
-{
-	int ret;
-	unsigned char data[3] = {reg >> 8, reg & 0xff, val};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-
-	ret = i2c_master_send(client, data, 3);
-
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 3)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	/*
-	 * The code below is for debug purpose.
-	 * It reads back the written values.
-	 * Some registers have different read and write addresses.
-	 * These registers typically have WR addr 0xE... but RD addr 0x4...
-	 */
-	/*
-	{
-		usleep_range(50, 300);
-		u8 ret_val;
-		u16 ret_reg;
-		if (((reg >>12) & 0x000F) == 0x000E) {
-			ret_reg = ((reg & 0x0FFF) | 0x4000);
-		} else {
-			ret_reg = reg;
-		}
-		ret = mira050_read(mira050, ret_reg, &ret_val);
-		printk(KERN_INFO "[MIRA050]: Write reg 0x%4.4x, Read ret_reg 0x%4.4x, val = 0x%x.\n",
-				reg, ret_reg, ret_val);
-		if (val != ret_val) {
-			printk(KERN_INFO "[MIRA050]: WARNING Write reg 0x%4.4x, val = 0x%x, read ret_reg = 0x%4.4x, ret_val = 0x%x.\n",
-				reg, val, ret_reg, ret_val);
-		}
-	}
-	*/
-
-	return ret;
-}
-
-/*
- * mira050 is big-endian: msb of val goes to lower reg addr
- */
-static int mira050_write_be16(struct mira050 *mira050, u16 reg, u16 val)
-{
-	int ret;
-	unsigned char data[4] = {reg >> 8, reg & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-
-	ret = i2c_master_send(client, data, 4);
 	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
+	 * Serializes hardware sequences (stream on/off, suspend/resume) and
+	 * ACTIVE format changes. Lock order: hw_lock, then mutex.
 	 */
-	if (ret == 4)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * mira050 is big-endian: msb of val goes to lower reg addr
- */
-static int mira050_write_be24(struct mira050 *mira050, u16 reg, u32 val)
-{
-	int ret;
-	unsigned char data[5] = {reg >> 8, reg & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-
-	ret = i2c_master_send(client, data, 5);
+	struct mutex hw_lock;
+	/* Set while a hardware sequence runs without mutex */
+	bool hw_busy;
 	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
+	 * Publishes mode, fmt, bit_depth and the window so format and
+	 * selection queries can read them without taking mutex.
 	 */
-	if (ret == 5)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
+	seqlock_t fmt_seqlock;
 
-/*
- * mira050 is big-endian: msb of val goes to lower reg addr
- */
-static int mira050_write_be32(struct mira050 *mira050, u16 reg, u32 val)
-{
-	int ret;
-	unsigned char data[6] = {reg >> 8, reg & 0xff, (val >> 24) & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-
-	ret = i2c_master_send(client, data, 6);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 6)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * mira050 OTP 32-bit val on I2C is big-endian. However, val content can be little-endian.
- */
-static int mira050_read_be32(struct mira050 *mira050, u16 reg, u32 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	/* Big-endian 32-bit buffer. */
-	unsigned char data_r[4];
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+	/* Streaming on/off */
+	bool streaming;
 
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
+	/* I2C transport, pmic, uC, LED and the REG_W/REG_R state */
+	struct ams_sensor ams;
 
-	ret = i2c_master_recv(client, data_r, 4);
-	*val = (u32)((data_r[0] << 24) | (data_r[1] << 16) | (data_r[2] << 8) | data_r[3]);
 	/*
-	 * The only return value indicating success is 4. Anything else, even
-	 * a non-negative value, indicates something went wrong.
+	 * Slow control writes are deferred to an ordered worker while streaming.
+	 * Only the latest value of each pending control is written.
 	 */
-	if (ret == 4)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
+	struct workqueue_struct *ctrl_wq;
+	struct work_struct ctrl_work;
+	spinlock_t ctrl_pending_lock;
+	unsigned long ctrl_pending;
+	s32 ctrl_pending_val[MIRA050_NUM_DEFERRED_CTRLS];
+	u32 ctrl_applied_seq;
+	/* Result of the last MIRA050_PENDING_WINDOW write */
+	int window_ret;
+
+	/* debugfs directory, holds the I2C transaction trace */
+	struct dentry *debugfs;
+};
 
-/* Write a list of registers */
-static int mira050_write_regs(struct mira050 *mira050,
-							  const struct mira050_reg *regs, u32 len)
+static inline struct mira050 *to_mira050(struct v4l2_subdev *_sd)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++)
-	{
-		ret = mira050_write(mira050, regs[i].address, regs[i].val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev,
-								"Failed to write reg 0x%4.4x. error = %d\n",
-								regs[i].address, ret);
-
-			return ret;
-		}
-		else
-		{
-			// Debug code below
-			// u8 val;
-			// ret = mira050_read(mira050, regs[i].address, &val);
-			// printk(KERN_INFO "[MIRA050]: Read reg 0x%4.4x, val = 0x%x.\n",
-			// 		regs[i].address, val);
-		}
-	}
-
-	return 0;
+	return container_of(_sd, struct mira050, sd);
 }
 
 /*
@@ -2964,15 +3080,15 @@ static int mira050_otp_read(struct mira050 *mira050, u8 addr, u32 *val)
 	int poll_cnt = 0;
 	int poll_cnt_max = 10;
 	int ret;
-	mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
-	mira050_write(mira050, MIRA050_OTP_COMMAND, 0);
-	mira050_write(mira050, MIRA050_OTP_ADDR, addr);
-	mira050_write(mira050, MIRA050_OTP_START, 1);
+	ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
+	ams_sensor_write(&mira050->ams, MIRA050_OTP_COMMAND, 0);
+	ams_sensor_write(&mira050->ams, MIRA050_OTP_ADDR, addr);
+	ams_sensor_write(&mira050->ams, MIRA050_OTP_START, 1);
 	usleep_range(15, 50);
-	mira050_write(mira050, MIRA050_OTP_START, 0);
+	ams_sensor_write(&mira050->ams, MIRA050_OTP_START, 0);
 	for (poll_cnt = 0; poll_cnt < poll_cnt_max; poll_cnt++)
 	{
-		mira050_read(mira050, MIRA050_OTP_BUSY, &busy_status);
+		ams_sensor_read(&mira050->ams, MIRA050_OTP_BUSY, &busy_status);
 		if (busy_status == 0)
 		{
 			break;
@@ -2985,7 +3101,7 @@ static int mira050_otp_read(struct mira050 *mira050, u8 addr, u32 *val)
 	if (poll_cnt < poll_cnt_max && busy_status == 0)
 	{
 		usleep_range(15, 50);
-		ret = mira050_read_be32(mira050, MIRA050_OTP_DOUT, val);
+		ret = ams_sensor_read_be32(&mira050->ams, MIRA050_OTP_DOUT, val);
 		printk(KERN_INFO "[MIRA050]: Read OTP 0x%x, val = 0x%x.\n",
 		 		addr,*val);
 	}
@@ -2999,60 +3115,6 @@ static int mira050_otp_read(struct mira050 *mira050, u8 addr, u32 *val)
 	return ret;
 }
 
-/* Write PMIC registers, and can be reused to write microcontroller reg. */
-static int mira050pmic_write(struct i2c_client *client, u8 reg, u8 val)
-{
-	int ret;
-	unsigned char data[2] = {reg & 0xff, val};
-
-	ret = i2c_master_send(client, data, 2);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 2)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira050pmic_read(struct i2c_client *client, u8 reg, u8 *val)
-{
-	struct i2c_msg msgs[2];
-	u8 addr_buf[1] = {reg & 0xff};
-	u8 data_buf[1] = {0};
-	int ret;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = 1;
-	msgs[1].buf = &data_buf[0];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = (u8)(data_buf[0]);
-
-	return 0;
-}
-
 /* Power/clock management functions */
 static int mira050_power_on(struct device *dev)
 {
@@ -3111,6 +3173,9 @@ static int mira050_power_off(struct device *dev)
 			regulator_bulk_disable(MIRA050_NUM_SUPPLIES, mira050->supplies);
 			clk_disable_unprepare(mira050->xclk);
 			mira050->powered = 0;
+			mira050->uploaded_mode = NULL;
+			mira050->preloaded = false;
+			mira050->needs_reset = false;
 		}
 		else
 		{
@@ -3125,6 +3190,37 @@ static int mira050_power_off(struct device *dev)
 	return 0;
 }
 
+/*
+ * Release a runtime PM reference. With preload the sensor then stays
+ * powered for MIRA050_PRELOAD_AUTOSUSPEND_MS, keeping the uploaded mode.
+ */
+static void mira050_pm_put(struct mira050 *mira050)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+
+	pm_runtime_mark_last_busy(&client->dev);
+	pm_runtime_put_autosuspend(&client->dev);
+}
+
+/*
+ * Power cycle a powered sensor, the caller holds a runtime PM reference.
+ * With skip_reset the sensor stays powered and keeps its registers.
+ */
+static int mira050_power_cycle(struct mira050 *mira050)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+
+	printk(KERN_INFO "[MIRA050]: Power cycle to reset the registers.\n");
+	mira050_power_off(&client->dev);
+	if (mira050->powered)
+	{
+		dev_warn(&client->dev, "skip_reset set, registers of the previous mode are kept\n");
+		return 0;
+	}
+
+	return mira050_power_on(&client->dev);
+}
+
 static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 {
 	struct i2c_client *const client = v4l2_get_subdevdata(&mira050->sd);
@@ -3133,14 +3229,14 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 	int en_trig_sync = 1;
 	int dmux0_sel = 40;
 	// Set context bank 1A or bank 1B
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting RW_CONTEXT.");
 		return ret;
 	}
 	// Set reg bank 0 or 1
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 1);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 1);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -3180,7 +3276,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 
 	// Enable or disable illumination trigger
 	printk(KERN_INFO "[MIRA050]: Writing EN_TRIG_ILLUM to %d.\n", en_trig_illum);
-	ret = mira050_write(mira050, MIRA050_EN_TRIG_ILLUM, en_trig_illum);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_EN_TRIG_ILLUM, en_trig_illum);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting EN_TRIG_ILLUM to %d.", en_trig_illum);
@@ -3188,7 +3284,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 	}
 	// Enable or disable illumination trigger
 	printk(KERN_INFO "[MIRA050]: Writing MIRA050_TRIG_SYNC_ON_REQ_1 to %d.\n", en_trig_sync);
-	ret = mira050_write(mira050, MIRA050_TRIG_SYNC_ON_REQ_1, en_trig_sync);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_TRIG_SYNC_ON_REQ_1, en_trig_sync);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting MIRA050_TRIG_SYNC_ON_REQ_1 to %d.", en_trig_sync);
@@ -3197,7 +3293,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 
 	// Enable or disable sync trigger
 	printk(KERN_INFO "[MIRA050]: Writing EN_TRIG_SYNC to %d.\n", en_trig_sync);
-	ret = mira050_write(mira050, MIRA050_EN_TRIG_SYNC, en_trig_sync);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_EN_TRIG_SYNC, en_trig_sync);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting MIRA050_EN_TRIG_SYNC to %d.", en_trig_sync);
@@ -3205,7 +3301,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 	}
 	// Set illumination width. Write 24 bits. All 24 bits are valid.
 	printk(KERN_INFO "[MIRA050]: Writing ILLUM_WIDTH to %u.\n", mira050->illum_width);
-	ret = mira050_write_be24(mira050, MIRA050_ILLUM_WIDTH_REG, mira050->illum_width);
+	ret = ams_sensor_write_be24(&mira050->ams, MIRA050_ILLUM_WIDTH_REG, mira050->illum_width);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting ILLUM_WIDTH to %u.", mira050->illum_width);
@@ -3214,7 +3310,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 
 	// Set illumination delay. Write 24 bits. Only 20 bits, [19:0], are valid.
 	printk(KERN_INFO "[MIRA050]: Writing ILLUM_DELAY to %u.\n", mira050->illum_delay);
-	ret = mira050_write_be24(mira050, MIRA050_ILLUM_DELAY_REG, mira050->illum_delay);
+	ret = ams_sensor_write_be24(&mira050->ams, MIRA050_ILLUM_DELAY_REG, mira050->illum_delay);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting ILLUM_DELAY to %u.", mira050->illum_delay);
@@ -3224,7 +3320,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 	return ret;
 
 	// Set reg bank 0 or 1
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -3233,7 +3329,7 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 
 	// DMUX SEL (set bank)
 	printk(KERN_INFO "[MIRA050]: Writing DMUX0SEL to %d.\n", dmux0_sel);
-	ret = mira050_write(mira050, MIRA050_DMUX0_SEL, dmux0_sel);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_DMUX0_SEL, dmux0_sel);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting MIRA050_DMUX0_SEL to %d.", dmux0_sel);
@@ -3241,353 +3337,207 @@ static int mira050_write_illum_trig_regs(struct mira050 *mira050)
 	}
 }
 
-static int mira050_v4l2_reg_w(struct mira050 *mira050, u32 value)
+/* AMS_CAMERA_CID_MIRA_REG_W commands, the protocol is in ams_sensor_reg_w() */
+static void mira050_reg_cmd(struct ams_sensor *ams, u8 reg_flag, u32 value)
 {
-	struct i2c_client *const client = v4l2_get_subdevdata(&mira050->sd);
-	u32 ret = 0;
+	struct mira050 *mira050 = container_of(ams, struct mira050, ams);
+	struct i2c_client *const client = ams->client;
 	u32 tmp_flag;
 
-	u16 reg_addr = (value >> 8) & 0xFFFF;
-	u8 reg_val = value & 0xFF;
-	u8 reg_flag = (value >> 24) & 0xFF;
-
-	// printk(KERN_INFO "[MIRA050]: %s reg_flag: 0x%02X; reg_addr: 0x%04X; reg_val: 0x%02X.\n",
-	// 		__func__, reg_flag, reg_addr, reg_val);
-
-	if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_CMD_SEL)
+	if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_RESET_ON)
 	{
-		if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_SLEEP_US)
-		{
-			// If it is for sleep, combine all 24 bits of reg_addr and reg_val as sleep us.
-			u32 sleep_us_val = value & 0x00FFFFFF;
-			// Sleep range needs an interval, default to 1/8 of the sleep value.
-			u32 sleep_us_interval = sleep_us_val >> 3;
-			printk(KERN_INFO "[MIRA050]: %s sleep_us: %u.\n", __func__, sleep_us_val);
-			usleep_range(sleep_us_val, sleep_us_val + sleep_us_interval);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_RESET_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Enable reset at stream on/off.\n", __func__);
-			mira050->skip_reset = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_RESET_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Disable reset at stream on/off.\n", __func__);
-			mira050->skip_reset = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_REG_UP_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Enable base register sequence upload.\n", __func__);
-			mira050->skip_reg_upload = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_REG_UP_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Disable base register sequence upload.\n", __func__);
-			mira050->skip_reg_upload = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_POWER_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Call power on function mira050_power_on().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira050->skip_reset;
-			mira050->skip_reset = 0;
-			mira050_power_on(&client->dev);
-			mira050->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_POWER_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Call power off function mira050_power_off().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira050->skip_reset;
-			mira050->skip_reset = 0;
-			mira050_power_off(&client->dev);
-			mira050->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_TRIG_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Enable illumination trigger.\n", __func__);
-			mira050->illum_enable = 1;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_TRIG_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Disable illumination trigger.\n", __func__);
-			mira050->illum_enable = 0;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_WIDTH)
-		{
-			// Combine all 24 bits of reg_addr and reg_val as ILLUM_WIDTH.
-			u32 illum_width = value & 0x00FFFFFF;
-			printk(KERN_INFO "[MIRA050]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
-			mira050->illum_width = illum_width;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_DELAY)
-		{
-			// Combine reg_addr and reg_val, then select 20 bits from [19:0] as ILLUM_DELAY.
-			u32 illum_delay = value & 0x000FFFFF;
-			printk(KERN_INFO "[MIRA050]: %s Set ILLUM_DELAY to 0x%X.\n", __func__, illum_delay);
-			mira050->illum_delay = illum_delay;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_EXP_T_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s enable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
-			mira050->illum_width_auto = 1;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_EXP_T_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s disable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
-			mira050->illum_width_auto = 0;
-			mira050_write_illum_trig_regs(mira050);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_STREAM_CTRL_ON)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
-			mira050->force_stream_ctrl = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_STREAM_CTRL_OFF)
-		{
-			printk(KERN_INFO "[MIRA050]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
-			mira050->force_stream_ctrl = 0;
-		}
-		else
-		{
-			printk(KERN_INFO "[MIRA050]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
-		}
+		printk(KERN_INFO "[MIRA050]: %s Enable reset at stream on/off.\n", __func__);
+		mira050->skip_reset = 0;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_RESET_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Disable reset at stream on/off.\n", __func__);
+		mira050->skip_reset = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_REG_UP_ON)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Enable base register sequence upload.\n", __func__);
+		mira050->skip_reg_upload = 0;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_REG_UP_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Disable base register sequence upload.\n", __func__);
+		mira050->skip_reg_upload = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_POWER_ON)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Call power on function mira050_power_on().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira050->skip_reset;
+		mira050->skip_reset = 0;
+		mira050_power_on(&client->dev);
+		mira050->skip_reset = tmp_flag;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_POWER_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Call power off function mira050_power_off().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira050->skip_reset;
+		mira050->skip_reset = 0;
+		mira050_power_off(&client->dev);
+		mira050->skip_reset = tmp_flag;
 	}
-	else if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_FOR_READ)
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_TRIG_ON)
 	{
-		// If it is for read, skip reagister write, cache addr and flag for read.
-		mira050->mira050_reg_w_cached_addr = reg_addr;
-		mira050->mira050_reg_w_cached_flag = reg_flag;
+		printk(KERN_INFO "[MIRA050]: %s Enable illumination trigger.\n", __func__);
+		mira050->illum_enable = 1;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_TRIG_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Disable illumination trigger.\n", __func__);
+		mira050->illum_enable = 0;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_WIDTH)
+	{
+		// Combine all 24 bits of reg_addr and reg_val as ILLUM_WIDTH.
+		u32 illum_width = value & 0x00FFFFFF;
+		printk(KERN_INFO "[MIRA050]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
+		mira050->illum_width = illum_width;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_DELAY)
+	{
+		// Combine reg_addr and reg_val, then select 20 bits from [19:0] as ILLUM_DELAY.
+		u32 illum_delay = value & 0x000FFFFF;
+		printk(KERN_INFO "[MIRA050]: %s Set ILLUM_DELAY to 0x%X.\n", __func__, illum_delay);
+		mira050->illum_delay = illum_delay;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_EXP_T_ON)
+	{
+		printk(KERN_INFO "[MIRA050]: %s enable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
+		mira050->illum_width_auto = 1;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_ILLUM_EXP_T_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s disable ILLUM_WIDTH to automatically track exposure time.\n", __func__);
+		mira050->illum_width_auto = 0;
+		mira050_write_illum_trig_regs(mira050);
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_STREAM_CTRL_ON)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
+		mira050->force_stream_ctrl = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_MIRA050_REG_FLAG_STREAM_CTRL_OFF)
+	{
+		printk(KERN_INFO "[MIRA050]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
+		mira050->force_stream_ctrl = 0;
 	}
 	else
 	{
-		// If it is for write, select which I2C device by the flag "I2C_SEL".
-		if ((reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_MIRA)
-		{
-			// Before writing Mira050 register, first optionally select BANK and CONTEXT
-			if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_USE_BANK)
-			{
-				u8 bank;
-				u8 context;
-				// Set conetxt bank 0 or 1
-				if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_BANK)
-				{
-					bank = 1;
-				}
-				else
-				{
-					bank = 0;
-				}
-				// printk(KERN_INFO "[MIRA050]: %s select bank: %u.\n", __func__, bank);
-				ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, bank);
-				if (ret)
-				{
-					dev_err(&client->dev, "Error setting BANK_SEL_REG.");
-					return ret;
-				}
-				// Set context bank 1A or bank 1B
-				if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_CONTEXT)
-				{
-					context = 1;
-				}
-				else
-				{
-					context = 0;
-				}
-				// printk(KERN_INFO "[MIRA050]: %s select context: %u.\n", __func__, context);
-				ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, context);
-				if (ret)
-				{
-					dev_err(&client->dev, "Error setting RW_CONTEXT.");
-					return ret;
-				}
-			}
-			// Writing the actual Mira050 register
-			// printk(KERN_INFO "[MIRA050]: %s write reg_addr: 0x%04X; reg_val: 0x%02X.\n", __func__, reg_addr, reg_val);
-			ret = mira050_write(mira050, reg_addr, reg_val);
-			if (ret)
-			{
-				dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n", reg_addr);
-				return -EINVAL;
-			}
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SET_TBD)
-		{
-			/* User tries to set TBD I2C address, store reg_val to mira050->tbd_client_i2c_addr. Skip write. */
-			printk(KERN_INFO "[MIRA050]: mira050->tbd_client_i2c_addr = 0x%X.\n", reg_val);
-			mira050->tbd_client_i2c_addr = reg_val;
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_TBD)
-		{
-			if (mira050->tbd_client_i2c_addr == MIRA050PMIC_I2C_ADDR)
-			{
-				// Write PMIC. Use pre-allocated mira050->pmic_client.
-				printk(KERN_INFO "[MIRA050]: write pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira050pmic_write(mira050->pmic_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (mira050->tbd_client_i2c_addr == MIRA050UC_I2C_ADDR)
-			{
-				// Write micro-controller. Use pre-allocated mira050->uc_client.
-				printk(KERN_INFO "[MIRA050]: write uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira050pmic_write(mira050->uc_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (mira050->tbd_client_i2c_addr == MIRA050LED_I2C_ADDR)
-			{
-				// Write LED driver. Use pre-allocated mira050->led_client.
-				printk(KERN_INFO "[MIRA050]: write led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira050pmic_write(mira050->led_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else
-			{
-				/* Write other TBD I2C address.
-				 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SET_TBD.
-				 * The TBD I2C address is stored in mira050->tbd_client_i2c_addr.
-				 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-				 */
-				struct i2c_client *tmp_client;
-				tmp_client = i2c_new_dummy_device(client->adapter, mira050->tbd_client_i2c_addr);
-				if (IS_ERR(tmp_client))
-					return PTR_ERR(tmp_client);
-				printk(KERN_INFO "[MIRA050]: write tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-					   mira050->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira050pmic_write(tmp_client, (u8)(reg_addr & 0xFF), reg_val);
-				i2c_unregister_device(tmp_client);
-			}
-		}
+		printk(KERN_INFO "[MIRA050]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
 	}
-
-	return 0;
 }
 
-static int mira050_v4l2_reg_r(struct mira050 *mira050, u32 *value)
+/* A raw REG_W write leaves the sensor out of sync with the mode tables */
+static void mira050_reg_w_sensor(struct ams_sensor *ams, u16 reg, u8 val)
 {
-	struct i2c_client *const client = v4l2_get_subdevdata(&mira050->sd);
-	u32 ret = 0;
+	struct mira050 *mira050 = container_of(ams, struct mira050, ams);
 
-	u16 reg_addr = mira050->mira050_reg_w_cached_addr;
-	u8 reg_flag = mira050->mira050_reg_w_cached_flag;
-	u8 reg_val = 0;
-
-	*value = 0;
+	mira050->uploaded_mode = NULL;
+}
 
-	if ((reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_MIRA)
-	{
-		if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_USE_BANK)
-		{
-			u8 bank;
-			u8 context;
-			// Set conetxt bank 0 or 1
-			if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_BANK)
-			{
-				bank = 1;
-			}
-			else
-			{
-				bank = 0;
-			}
-			// printk(KERN_INFO "[MIRA050]: %s select bank: %u.\n", __func__, bank);
-			ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, bank);
-			if (ret)
-			{
-				dev_err(&client->dev, "Error setting BANK_SEL_REG.");
-				return ret;
-			}
-			// Set context bank 1A or bank 1B
-			if (reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_CONTEXT)
-			{
-				context = 1;
-			}
-			else
-			{
-				context = 0;
-			}
-			// printk(KERN_INFO "[MIRA050]: %s select context: %u.\n", __func__, context);
-			ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, context);
-			if (ret)
-			{
-				dev_err(&client->dev, "Error setting RW_CONTEXT.");
-				return ret;
-			}
-		}
-		ret = mira050_read(mira050, reg_addr, &reg_val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n", reg_addr);
-			return -EINVAL;
-		}
-	}
-	else if ((reg_flag & AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_TBD)
-	{
-		if (mira050->tbd_client_i2c_addr == MIRA050PMIC_I2C_ADDR)
-		{
-			// Read PMIC. Use pre-allocated mira050->pmic_client.
-			ret = mira050pmic_read(mira050->pmic_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA050]: read pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (mira050->tbd_client_i2c_addr == MIRA050UC_I2C_ADDR)
-		{
-			// Read micro-controller. Use pre-allocated mira050->uc_client.
-			ret = mira050pmic_read(mira050->uc_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA050]: read uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (mira050->tbd_client_i2c_addr == MIRA050LED_I2C_ADDR)
-		{
-			// Read LED driver. Use pre-allocated mira050->led_client.
-			ret = mira050pmic_read(mira050->led_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA050]: read led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else
-		{
-			/* Read other TBD I2C address.
-			 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA050_REG_FLAG_I2C_SET_TBD.
-			 * The TBD I2C address is stored in mira050->tbd_client_i2c_addr.
-			 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-			 */
-			struct i2c_client *tmp_client;
-			tmp_client = i2c_new_dummy_device(client->adapter, mira050->tbd_client_i2c_addr);
-			if (IS_ERR(tmp_client))
-				return PTR_ERR(tmp_client);
-			ret = mira050pmic_read(tmp_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA050]: read tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-				   mira050->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-			i2c_unregister_device(tmp_client);
-		}
-	}
+/*
+ * Gain of an analog gain index in the bit depth of the mode, in 1/256
+ * like the gain LUTs
+ */
+static u32 mira050_gain_to_linear(struct ams_sensor *ams, u32 index)
+{
+	struct mira050 *mira050 = container_of(ams, struct mira050, ams);
+
+	if (mira050->mode->bit_depth == 10)
+		return fine_gain_lut_10bit_hs_4x[index].analog_gain;
+	if (mira050->mode->bit_depth == 8)
+		return fine_gain_lut_8bit_16x[index].analog_gain;
+	/* 12 bit only has the x1, x2 and x4 sequences */
+	return AMS_CAMERA_GAIN_LINEAR_UNITY << index;
+}
 
-	// Return 32-bit value that includes flags, addr, and register value
-	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
+static const struct ams_sensor_ops mira050_ams_ops = {
+	.reg_cmd = mira050_reg_cmd,
+	.reg_w_sensor = mira050_reg_w_sensor,
+	.gain_to_linear = mira050_gain_to_linear,
+};
 
-	// printk(KERN_INFO "[MIRA050]: mira050_v4l2_reg_r() reg_flag: 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
-	// 		reg_flag, reg_addr, reg_val);
+// Converts an exposure in rows of the given mode to microseconds (reg value)
+static u32 mira050_exposure_lines_to_us(const struct mira050_mode *mode, u32 lines)
+{
+	return (u32)div_u64((u64)lines * mode->row_length * 1000, MIRA050_PIXEL_RATE / 1000);
+}
 
-	return 0;
+// Converts microseconds to an exposure in rows of the given mode
+static u32 mira050_exposure_us_to_lines(const struct mira050_mode *mode, u32 us)
+{
+	return (u32)div_u64((u64)us * (MIRA050_PIXEL_RATE / 1000), mode->row_length * 1000);
 }
 
-// Returns the maximum exposure time in microseconds (reg value)
-static u32 mira050_calculate_max_exposure_time(u32 row_length, u32 vsize,
+// Returns the maximum exposure time in rows of the given mode
+static u32 mira050_calculate_max_exposure_time(const struct mira050_mode *mode,
 											   u32 vblank)
 {
-	(void)(row_length);
-	(void)(vsize);
 	(void)(vblank);
 	/* Mira050 does not have a max exposure limit besides register bits */
-	// return row_length * (vsize + vblank) - MIRA050_GLOB_NUM_CLK_CYCLES;
-	return MIRA050_EXPOSURE_MAX_LINES;
+	return mira050_exposure_us_to_lines(mode, MIRA050_EXPOSURE_MAX_US);
+}
+
+// Returns the minimum exposure time in rows of the given mode
+static u32 mira050_calculate_min_exposure_time(const struct mira050_mode *mode)
+{
+	u32 lines = mira050_exposure_us_to_lines(mode, MIRA050_EXPOSURE_MIN_US);
+
+	if (mira050_exposure_lines_to_us(mode, lines) < MIRA050_EXPOSURE_MIN_US)
+		lines++;
+
+	return lines;
+}
+
+// Returns the vblank of the given mode and window height closest to a frame
+// time in microseconds
+static u32 mira050_frame_time_to_vblank(const struct mira050_mode *mode,
+										u32 height, u32 us)
+{
+	u32 frame_length = (u32)div_u64((u64)us * (MIRA050_PIXEL_RATE / 1000) +
+										mode->row_length * 500,
+									mode->row_length * 1000);
+	u32 vblank = frame_length > height ? frame_length - height : 0;
+
+	return clamp(vblank, mode->min_vblank, mode->max_vblank);
+}
+
+static u32 mira050_default_vblank(const struct mira050_mode *mode)
+{
+	return mira050_frame_time_to_vblank(mode, mode->height,
+										MIRA050_DEFAULT_FRAME_TIME_US);
+}
+
+// Frame interval of the given mode, window height and vblank, in seconds
+static void mira050_frame_interval(const struct mira050_mode *mode, u32 height,
+								   u32 vblank, struct v4l2_fract *interval)
+{
+	u32 num = (mode->width + mode->hblank) * (height + vblank);
+	u32 den = MIRA050_PIXEL_RATE;
+	u32 div = gcd(num, den);
+
+	interval->numerator = num / div;
+	interval->denominator = den / div;
 }
 
 static int mira050_write_exposure_reg(struct mira050 *mira050, u32 exposure_lines)
 {
 	struct i2c_client *const client = v4l2_get_subdevdata(&mira050->sd);
 	const u32 min_exposure = MIRA050_EXPOSURE_MIN_US;
-	u32 max_exposure = mira050->exposure->maximum * MIRA050_MIN_ROW_LENGTH_US;
+	const u32 max_exposure = MIRA050_EXPOSURE_MAX_US;
 	u32 ret = 0;
-	u32 exposure = exposure_lines * MIRA050_DEFAULT_LINE_LENGTH;
-
+	u32 exposure = mira050_exposure_lines_to_us(mira050->mode, exposure_lines);
 
 	if (exposure < min_exposure)
 	{
@@ -3601,12 +3551,12 @@ static int mira050_write_exposure_reg(struct mira050 *mira050, u32 exposure_line
 	// printk(KERN_INFO "[MIRA050]: mira050_write_exposure_reg: exp us = %u.\n", exposure);
 
 	/* Write Bank 1 context 0 */
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 1);
-	ret = mira050_write_be32(mira050, MIRA050_EXP_TIME_L_REG, exposure);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 1);
+	ret = ams_sensor_write_be32(&mira050->ams, MIRA050_EXP_TIME_L_REG, exposure);
 	/* Write Bank 1 context 1 */
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 1);
-	ret = mira050_write_be32(mira050, MIRA050_EXP_TIME_L_REG, exposure);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 1);
+	ret = ams_sensor_write_be32(&mira050->ams, MIRA050_EXP_TIME_L_REG, exposure);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting exposure time to %d", exposure);
@@ -3628,12 +3578,12 @@ static int mira050_write_target_frame_time_reg(struct mira050 *mira050, u32 targ
 	u32 ret = 0;
 
 	/* Write Bank 1 context 0 */
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 1);
-	ret = mira050_write_be32(mira050, MIRA050_TARGET_FRAME_TIME_REG, target_frame_time_us);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 1);
+	ret = ams_sensor_write_be32(&mira050->ams, MIRA050_TARGET_FRAME_TIME_REG, target_frame_time_us);
 	/* Write Bank 1 context 1 */
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 1);
-	ret = mira050_write_be32(mira050, MIRA050_TARGET_FRAME_TIME_REG, target_frame_time_us);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 1);
+	ret = ams_sensor_write_be32(&mira050->ams, MIRA050_TARGET_FRAME_TIME_REG, target_frame_time_us);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting target frame time to %d", target_frame_time_us);
@@ -3649,7 +3599,7 @@ static int mira050_write_start_streaming_regs(struct mira050 *mira050)
 	int ret = 0;
 
 	// Set conetxt bank 0 or 1
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -3657,7 +3607,7 @@ static int mira050_write_start_streaming_regs(struct mira050 *mira050)
 	}
 
 	// Set context bank 1A or bank 1B
-	ret = mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting RW_CONTEXT.");
@@ -3665,7 +3615,7 @@ static int mira050_write_start_streaming_regs(struct mira050 *mira050)
 	}
 
 	// Raising CMD_REQ_1 to 1 for REQ_EXP
-	ret = mira050_write(mira050, MIRA050_CMD_REQ_1_REG,
+	ret = ams_sensor_write(&mira050->ams, MIRA050_CMD_REQ_1_REG,
 						1);
 	if (ret)
 	{
@@ -3676,7 +3626,7 @@ static int mira050_write_start_streaming_regs(struct mira050 *mira050)
 	usleep_range(10, 20);
 
 	// Setting CMD_REQ_1 tp 0 for REQ_EXP
-	ret = mira050_write(mira050, MIRA050_CMD_REQ_1_REG,
+	ret = ams_sensor_write(&mira050->ams, MIRA050_CMD_REQ_1_REG,
 						0);
 	if (ret)
 	{
@@ -3694,7 +3644,7 @@ static int mira050_write_stop_streaming_regs(struct mira050 *mira050)
 	int ret = 0;
 
 	// Set conetxt bank 0 or 1
-	ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
 	if (ret)
 	{
 		dev_err(&client->dev, "Error setting BANK_SEL_REG.");
@@ -3702,7 +3652,7 @@ static int mira050_write_stop_streaming_regs(struct mira050 *mira050)
 	}
 
 	// Raising CMD_HALT_BLOCK to 1 to stop streaming
-	ret = mira050_write(mira050, MIRA050_CMD_HALT_BLOCK_REG,
+	ret = ams_sensor_write(&mira050->ams, MIRA050_CMD_HALT_BLOCK_REG,
 						1);
 	if (ret)
 	{
@@ -3713,7 +3663,7 @@ static int mira050_write_stop_streaming_regs(struct mira050 *mira050)
 	usleep_range(10, 20);
 
 	// Setting CMD_HALT_BLOCK to 0 to stop streaming
-	ret = mira050_write(mira050, MIRA050_CMD_HALT_BLOCK_REG,
+	ret = ams_sensor_write(&mira050->ams, MIRA050_CMD_HALT_BLOCK_REG,
 						0);
 	if (ret)
 	{
@@ -3740,246 +3690,154 @@ static int mira050_write_stop_streaming_regs(struct mira050 *mira050)
 	return ret;
 }
 
+/*
+ * OFFSET_CLIPPING model of a bit depth, with the noncontinuous clock.
+ * The 12 bit coarse gains each have their own CDS offset.
+ */
+struct mira050_offset_model
+{
+	u16 dark_offset_100;
+	u16 scale_factor;
+	u16 cds_offset;
+	u16 target_black_level;
+};
+
+static const struct mira050_offset_model mira050_offset_model_12bit = {1794, 1, 1700, 128};
+static const struct mira050_offset_model mira050_offset_model_10bit_hs = {291, 4, 1540, 32};
+static const struct mira050_offset_model mira050_offset_model_8bit = {72, 16, 1540, 16};
+static const u16 mira050_cds_offset_12bit[MIRA050_ANALOG_GAIN_MAX + 1] = {1700, 2708, 4500};
+
+/* OFFSET_CLIPPING of one gain, analog_gain in 1/256 */
+static u16 mira050_calc_offset_clipping(const struct mira050_offset_model *model,
+										u16 otp_dark_cal, u32 analog_gain,
+										u16 preamp_gain_inv, u16 cds_offset)
+{
+	u16 scaled_offset;
+	int offset_clipping;
+
+	scaled_offset = (u16)(((otp_dark_cal + model->dark_offset_100) * analog_gain *
+						   preamp_gain_inv / model->scale_factor / 256) -
+						  model->dark_offset_100) / 100;
+	offset_clipping = cds_offset - model->target_black_level * preamp_gain_inv + scaled_offset;
+
+	/* Avoid negative offset_clipping value. */
+	return offset_clipping < 0 ? 0 : offset_clipping;
+}
+
+/*
+ * Fill the OFFSET_CLIPPING tables of all bit depths and gain indices
+ * from the OTP dark calibration, once the OTP is read. The gain path
+ * only looks the value up.
+ */
+static void mira050_update_offset_clipping(struct mira050 *mira050)
+{
+	const struct mira050_fine_gain_lut_new *lut;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_12bit); i++)
+		mira050->offset_clipping_12bit[i] =
+			mira050_calc_offset_clipping(&mira050_offset_model_12bit,
+										 mira050->otp_dark_cal_12bit,
+										 AMS_CAMERA_GAIN_LINEAR_UNITY << i, 1,
+										 mira050_cds_offset_12bit[i]);
+
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_10bit_hs); i++)
+	{
+		lut = &fine_gain_lut_10bit_hs_4x[i];
+		/* invert because fixed point arithmetic */
+		mira050->offset_clipping_10bit_hs[i] =
+			mira050_calc_offset_clipping(&mira050_offset_model_10bit_hs,
+										 mira050->otp_dark_cal_10bit_hs,
+										 lut->analog_gain, 16 / (lut->gdig_preamp + 1),
+										 mira050_offset_model_10bit_hs.cds_offset);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_8bit); i++)
+	{
+		lut = &fine_gain_lut_8bit_16x[i];
+		mira050->offset_clipping_8bit[i] =
+			mira050_calc_offset_clipping(&mira050_offset_model_8bit,
+										 mira050->otp_dark_cal_8bit,
+										 lut->analog_gain, 16 / (lut->gdig_preamp + 1),
+										 mira050_offset_model_8bit.cds_offset);
+	}
+
+	mira050->offset_clipping_valid = true;
+}
+
+/* Fine gain registers of both contexts and the precomputed OFFSET_CLIPPING */
+static int mira050_write_fine_gain_regs(struct mira050 *mira050,
+										const struct mira050_fine_gain_lut_new *lut,
+										u16 offset_clipping)
+{
+	int ret;
+
+	ret = ams_sensor_write(&mira050->ams, MIRA050_RW_CONTEXT_REG, 0);
+	ret |= ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 1);
+	ret |= ams_sensor_write(&mira050->ams, MIRA050_GDIG_PREAMP, lut->gdig_preamp);
+	ret |= ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
+	ret |= ams_sensor_write(&mira050->ams, MIRA050_BIAS_RG_ADCGAIN, lut->rg_adcgain);
+	ret |= ams_sensor_write(&mira050->ams, MIRA050_BIAS_RG_MULT, lut->rg_mult);
+	ret |= ams_sensor_write_be16(&mira050->ams, MIRA050_OFFSET_CLIPPING, offset_clipping);
+
+	return ret;
+}
+
 static int mira050_write_analog_gain_reg(struct mira050 *mira050, u8 gain)
 {
 	struct i2c_client *const client = v4l2_get_subdevdata(&mira050->sd);
-	u32 num_of_regs;
-	u32 ret = 0;
 	u32 wait_us = 20000;
-	u16 target_black_level = 128;
-	u16 cds_offset = 1700;
-	u16 dark_offset_100 = 1794; // noncont clock
-	u16 scale_factor = 1;
-	u16 preamp_gain_inv = 1;
-	u16 preamp_gain = 1;
-
-	u16 analog_gain = 1;
-	u16 offset_clipping = 0;
-	u16 scaled_offset = 0;
-	printk(KERN_INFO "[MIRA050]: Write analog gain %u",gain);
+	int ret = 0;
 
 	// Select partial register sequence according to bit depth
 	if (mira050->bit_depth == 12)
 	{
+		// Other gains are not supported
+		if (gain >= ARRAY_SIZE(mira050->offset_clipping_12bit))
+			return 0;
+
 		mira050_write_stop_streaming_regs(mira050);
 		usleep_range(wait_us, wait_us + 100);
-		scale_factor = 1;
 
 		// Select register sequence according to gain value
 		if (gain == 0)
-		{
-			analog_gain = 1;
-			// printk(KERN_INFO "[MIRA050]: Write reg sequence for analog gain x1 in 12 bit mode");
-			num_of_regs = ARRAY_SIZE(partial_analog_gain_x1_12bit);
-			ret = mira050_write_regs(mira050, partial_analog_gain_x1_12bit, num_of_regs);
-			cds_offset = 1700;
-		}
+			ret = ams_sensor_write_regs(&mira050->ams, partial_analog_gain_x1_12bit,
+									 ARRAY_SIZE(partial_analog_gain_x1_12bit));
 		else if (gain == 1)
-		{
-			analog_gain = 2;
-			// printk(KERN_INFO "[MIRA050]: Write reg sequence for analog gain x2 in 12 bit mode");
-			num_of_regs = ARRAY_SIZE(partial_analog_gain_x2_12bit);
-			ret = mira050_write_regs(mira050, partial_analog_gain_x2_12bit, num_of_regs);
-			cds_offset = 2708;
-		}
-		else if (gain == 2)
-		{
-			analog_gain = 4;
-
-			// printk(KERN_INFO "[MIRA050]: Write reg sequence for analog gain x4 in 12 bit mode");
-			num_of_regs = ARRAY_SIZE(partial_analog_gain_x4_12bit);
-			ret = mira050_write_regs(mira050, partial_analog_gain_x4_12bit, num_of_regs);
-			cds_offset = 4500;
-		}
+			ret = ams_sensor_write_regs(&mira050->ams, partial_analog_gain_x2_12bit,
+									 ARRAY_SIZE(partial_analog_gain_x2_12bit));
 		else
-		{
-			// Other gains are not supported
-			// printk(KERN_INFO "[MIRA050]: Ignore analog gain %u in 12 bit mode", gain);
-		}
-		u16 part1 = (mira050->otp_dark_cal_12bit + dark_offset_100) / 100;
-		u16 part3 = (dark_offset_100 / 100);
-		u16 part2 = analog_gain / (scale_factor * preamp_gain);
-		scaled_offset = (u16)((mira050->otp_dark_cal_12bit + dark_offset_100) / 100 * analog_gain / (scale_factor * preamp_gain)) - (u16)(dark_offset_100 / 100);
-		// printk(KERN_INFO "[MIRA050]: scaled offset  12 bit mode is %u dark cal is %u", scaled_offset, mira050->otp_dark_cal_12bit);
-		// printk(KERN_INFO "[MIRA050]: scaled offset  12 bit mode part1 %u part2 %u part3 %u ", part1, part2, part3);
-
-
-
-		scaled_offset = (u16)(((mira050->otp_dark_cal_12bit + dark_offset_100) * analog_gain * preamp_gain_inv / (scale_factor)) - dark_offset_100) / 100;
-		// newly added.
-		// printk(KERN_INFO "[MIRA050]: scaled offset  new 12 bit mode is %u dark cal is %u", scaled_offset, mira050->otp_dark_cal_12bit);
-
-		/* Avoid negative offset_clipping value. */
-		offset_clipping = ((int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset) < 0 ? 0 : (int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset));
-		/* Stop streaming and wait for frame data transmission done */
-		// mira050_write_stop_streaming_regs(mira050);
-
-
-		/* Avoid negative offset_clipping value. */
-		// offset_clipping = ((int)(cds_offset - target_black_level / preamp_gain + scaled_offset) < 0 ? 0 : (int)(cds_offset - target_black_level / preamp_gain + scaled_offset));
-		/* Stop streaming and wait for frame data transmission done */
-		// mira050_write_stop_streaming_regs(mira050);
-		printk(KERN_INFO "[MIRA050]: offset clip  12 bit mode is  %u", offset_clipping);
+			ret = ams_sensor_write_regs(&mira050->ams, partial_analog_gain_x4_12bit,
+									 ARRAY_SIZE(partial_analog_gain_x4_12bit));
 
 		usleep_range(wait_us, wait_us + 100);
-		/* Write fine gain registers */
-		
-		mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
-		mira050_write_be16(mira050, MIRA050_OFFSET_CLIPPING, offset_clipping);
-		printk(KERN_INFO "[MIRA050]: Write offset clipping, val = 0x%x.\n",
-			   offset_clipping);
+		ret |= ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
+		ret |= ams_sensor_write_be16(&mira050->ams, MIRA050_OFFSET_CLIPPING,
+								  mira050->offset_clipping_12bit[gain]);
 		mira050_write_start_streaming_regs(mira050);
-
-		// mira050_write_start_streaming_regs(mira050);
 	}
 	else if (mira050->bit_depth == 10) // 10bit high speed mode gain 1-4
 	{
-		dark_offset_100 = 291; // noncont clock
-		scale_factor = 4;
-		cds_offset = 1540;
-		target_black_level = 32;
-
 		if (gain < ARRAY_SIZE(fine_gain_lut_10bit_hs_4x))
 		{
-			u32 analog_gain = fine_gain_lut_10bit_hs_4x[gain].analog_gain;
-			u8 gdig_preamp = fine_gain_lut_10bit_hs_4x[gain].gdig_preamp;
-			u8 rg_adcgain = fine_gain_lut_10bit_hs_4x[gain].rg_adcgain;
-			u8 rg_mult = fine_gain_lut_10bit_hs_4x[gain].rg_mult;
-			/* otp_cal_val should come from OTP, but OTP may have incorrect value. */
-			u16 preamp_gain_inv = 16 / (gdig_preamp + 1); // invert because fixed point arithmetic
-
-			u16 scaled_offset = (u16)(((mira050->otp_dark_cal_10bit_hs + dark_offset_100) * analog_gain * preamp_gain_inv / (scale_factor)/256) - dark_offset_100) / 100; //div by 256 for analog gain
-			// newly added.
-			printk(KERN_INFO "[MIRA050]: scaled offset  10 bit mode is %u dark cal is %u", scaled_offset, mira050->otp_dark_cal_10bit_hs);
-
-			/* Avoid negative offset_clipping value. */
-			u16 offset_clipping = ((int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset) < 0 ? 0 : (int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset));
-			/* Stop streaming and wait for frame data transmission done */
-			// mira050_write_stop_streaming_regs(mira050);
-			printk(KERN_INFO "[MIRA050]: offset clip  10 bit mode is  %u", offset_clipping);
-
-			// int part1 = (int)(otp_cal_val + 2.5) ;
-			// int part2 = (int)(part1*analog_gain / (int)(gdig_preamp + 1)) ;
-			// int offset_clipping = (part2>>8) - 2;
-			// int scaled_offset = ((otp_cal_val - 1540) / 4 - target_black_level) * 16 / (gdig_preamp + 1);
-			/* Avoid negative offset_clipping value. */
-			// int offset_clipping = (int)((otp_cal_fine_val + 4) * analog_gain / (int)(gdig_preamp + 1) / 256 - 4);
-
-			// int offset_clipping_calc = (int)(cds_offset - (target_black_level  - offset_clipping));
-			/*preamp_gain, _, _ = gain_settings._gain_lut[gain]
-scaled_offset = (calibration_value + 2.5) * gain/(16*preamp_gain) - 2.5
-mira_xs_api.write_register(
-'OFFSET_CLIPPING',
-2*act1 - round(target_black_level/preamp_gain - scaled_offset)
-	offset_clipping = (calibration_value + 2.5) * (analog_gain/4) - 2.5
-cds_offset = 1540
-offset_clip = int(cds_offset - round(target/digital_gain - offset_clipping))
-*/
-			// if (offset_clipping_calc < 0)
-			// {
-			// 	offset_clipping = 0;
-			// }
-			// else
-			// {
-			// 	offset_clipping = (uint16_t)(offset_clipping_calc);
-			// }
-			//  = (int)(cds_offset - (target_black_level*digital_gain - offset_clipping)) < 0 ? 0 : (int)(cds_offset - (target_black_level*digital_gain - offset_clipping));
-
-			// u16 offset_clipping = (offset_clipping_calc < 0) ? 0 : (int)(offset_clipping_calc);
 			/* Stop streaming and wait for frame data transmission done */
 			mira050_write_stop_streaming_regs(mira050);
 			usleep_range(wait_us, wait_us + 100);
-			/* Write fine gain registers */
-			printk(KERN_INFO "[MIRA050]: Write reg sequence for analog gain %u in 10 bit mode", gain);
-			printk(KERN_INFO "[MIRA050]: analoggain: %u,gdig_preamp: %u rg_adcgain: %u, rg_mult: %u, offset_clipping: %u,   offset_clipping: %u\n",
-				   analog_gain, gdig_preamp, rg_adcgain, rg_mult, offset_clipping, offset_clipping);
-			mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
-			mira050_write(mira050, MIRA050_BANK_SEL_REG, 1);
-			mira050_write(mira050, MIRA050_GDIG_PREAMP, gdig_preamp);
-			mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
-			mira050_write(mira050, MIRA050_BIAS_RG_ADCGAIN, rg_adcgain);
-			mira050_write(mira050, MIRA050_BIAS_RG_MULT, rg_mult);
-			mira050_write_be16(mira050, MIRA050_OFFSET_CLIPPING, offset_clipping);
+			ret = mira050_write_fine_gain_regs(mira050, &fine_gain_lut_10bit_hs_4x[gain],
+											   mira050->offset_clipping_10bit_hs[gain]);
 			/* Resume streaming */
 			mira050_write_start_streaming_regs(mira050);
 		}
 	}
 	else if (mira050->bit_depth == 8)
 	{
-		dark_offset_100 = 72; // noncont clock
-		scale_factor = 16;
-		cds_offset = 1540;
-		target_black_level = 16;
-
 		if (gain < ARRAY_SIZE(fine_gain_lut_8bit_16x))
 		{
-			u32 analog_gain = fine_gain_lut_8bit_16x[gain].analog_gain;
-			u8 gdig_preamp = fine_gain_lut_8bit_16x[gain].gdig_preamp;
-			u8 rg_adcgain = fine_gain_lut_8bit_16x[gain].rg_adcgain;
-			u8 rg_mult = fine_gain_lut_8bit_16x[gain].rg_mult;
-			/* otp_cal_val should come from OTP, but OTP may have incorrect value. */
-			u16 preamp_gain_inv = 16 / (gdig_preamp + 1);
-
-			// int part1 = (int)(otp_cal_val + 2.5) ;
-			// int part2 = (int)(part1*analog_gain / (int)(gdig_preamp + 1)) ;
-			// int offset_clipping = (part2>>8) - 2;
-			// int scaled_offset = ((otp_cal_val - 1540) / 4 - target_black_level) * 16 / (gdig_preamp + 1);
-			/* Avoid negative offset_clipping value. */
-
-			// newly added.
-			u16 scaled_offset = (u16)(((mira050->otp_dark_cal_8bit + dark_offset_100) * analog_gain * preamp_gain_inv / (scale_factor)/256) - dark_offset_100) / 100;
-			printk(KERN_INFO "[MIRA050]: scaled offset 8 bit mode is %u dark cal is %u", scaled_offset, mira050->otp_dark_cal_8bit);
-
-			/* Avoid negative offset_clipping value. */
-			u16 offset_clipping = ((int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset) < 0 ? 0 : (int)(cds_offset - target_black_level * preamp_gain_inv + scaled_offset));
-			/* Stop streaming and wait for frame data transmission done */
-			// mira050_write_stop_streaming_regs(mira050);
-			printk(KERN_INFO "[MIRA050]: offset clip  8 bit mode is  %u", offset_clipping);
-
-			// int part1 = (int)(otp_cal_val + 2.5) ;
-			// int part2 = (int)(part1*analog_gain / (int)(gdig_preamp + 1)) ;
-			// int offset_clipping = (part2>>8) - 2;
-			// int scaled_offset = ((otp_cal_val - 1540) / 4 - target_black_level) * 16 / (gdig_preamp + 1);
-			/* Avoid negative offset_clipping value. */
-			// int offset_clipping = (int)((otp_cal_fine_val + 4) * analog_gain / (int)(gdig_preamp + 1) / 256 - 4);
-
-			// int offset_clipping_calc = (int)(cds_offset - (target_black_level  - offset_clipping));
-			/*preamp_gain, _, _ = gain_settings._gain_lut[gain]
-scaled_offset = (calibration_value + 2.5) * gain/(16*preamp_gain) - 2.5
-mira_xs_api.write_register(
-'OFFSET_CLIPPING',
-2*act1 - round(target_black_level/preamp_gain - scaled_offset)
-	offset_clipping = (calibration_value + 2.5) * (analog_gain/4) - 2.5
-cds_offset = 1540
-offset_clip = int(cds_offset - round(target/digital_gain - offset_clipping))
-*/
-			// if (offset_clipping_calc < 0)
-			// {
-			// 	offset_clipping = 0;
-			// }
-			// else
-			// {
-			// 	offset_clipping = (uint16_t)(offset_clipping_calc);
-			// }
-			printk(KERN_INFO "[MIRA050]: est offset: %u,offset_clipping_calc: %u rg_adcgain: %u, rg_mult: %u, offset_clipping: %u\n",
-				   analog_gain / 256, gdig_preamp, rg_adcgain, rg_mult, offset_clipping);
-			//  = (int)(cds_offset - (target_black_level*digital_gain - offset_clipping)) < 0 ? 0 : (int)(cds_offset - (target_black_level*digital_gain - offset_clipping));
-
-			// u16 offset_clipping = (offset_clipping_calc < 0) ? 0 : (int)(offset_clipping_calc);
 			/* Stop streaming and wait for frame data transmission done */
 			mira050_write_stop_streaming_regs(mira050);
 			usleep_range(wait_us, wait_us + 100);
-			/* Write fine gain registers */
-			printk(KERN_INFO "[MIRA050]: Write reg sequence for analog gain %u in 8 bit mode", gain);
-			printk(KERN_INFO "[MIRA050]: analoggain: %u,gdig_preamp: %u rg_adcgain: %u, rg_mult: %u, offset_clipping: %u,   offset_clipping: %u\n",
-				   analog_gain, gdig_preamp, rg_adcgain, rg_mult, offset_clipping, offset_clipping);
-			mira050_write(mira050, MIRA050_RW_CONTEXT_REG, 0);
-			mira050_write(mira050, MIRA050_BANK_SEL_REG, 1);
-			mira050_write(mira050, MIRA050_GDIG_PREAMP, gdig_preamp);
-			mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
-			mira050_write(mira050, MIRA050_BIAS_RG_ADCGAIN, rg_adcgain);
-			mira050_write(mira050, MIRA050_BIAS_RG_MULT, rg_mult);
-			mira050_write_be16(mira050, MIRA050_OFFSET_CLIPPING, offset_clipping);
+			ret = mira050_write_fine_gain_regs(mira050, &fine_gain_lut_8bit_16x[gain],
+											   mira050->offset_clipping_8bit[gain]);
 			/* Resume streaming */
 			mira050_write_start_streaming_regs(mira050);
 		}
@@ -3995,84 +3853,298 @@ offset_clip = int(cds_offset - round(target/digital_gain - offset_clipping))
 		dev_err(&client->dev, "%s failed to set mode\n", __func__);
 	}
 
-	// Always return 0 even if it fails
-	return 0;
+	return ret;
 }
 
-// Gets the format code if supported. Otherwise returns the default format code `codes[0]`
+/* Publish a new active mode and format. Caller holds hw_lock. */
+static void mira050_publish_format(struct mira050 *mira050,
+								   const struct mira050_mode *mode,
+								   const struct v4l2_mbus_framefmt *fmt,
+								   u8 bit_depth)
+{
+	write_seqlock(&mira050->fmt_seqlock);
+	mira050->mode = mode;
+	if (fmt)
+		mira050->fmt = *fmt;
+	mira050->bit_depth = bit_depth;
+	write_sequnlock(&mira050->fmt_seqlock);
+}
+
+/* Publish a new vertical window and the format height it gives. Caller holds hw_lock. */
+static void mira050_publish_window(struct mira050 *mira050,
+								   const struct v4l2_rect *crop, u32 ysubs)
+{
+	write_seqlock(&mira050->fmt_seqlock);
+	mira050->crop = *crop;
+	mira050->ysubs = ysubs;
+	mira050->fmt.height = crop->height / ysubs;
+	write_sequnlock(&mira050->fmt_seqlock);
+}
+
+/* Read a consistent copy of the active mode, format and window without mutex */
+static void mira050_read_format(struct mira050 *mira050,
+								const struct mira050_mode **mode,
+								struct v4l2_mbus_framefmt *fmt,
+								struct v4l2_rect *crop)
+{
+	unsigned int seq;
+
+	do
+	{
+		seq = read_seqbegin(&mira050->fmt_seqlock);
+		*mode = mira050->mode;
+		*fmt = mira050->fmt;
+		*crop = mira050->crop;
+	} while (read_seqretry(&mira050->fmt_seqlock, seq));
+}
+
+// Gets the format code if supported. Otherwise returns the variant's first code
 static u32 mira050_validate_format_code_or_default(struct mira050 *mira050, u32 code)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
 	unsigned int i;
 
-	lockdep_assert_held(&mira050->mutex);
-
-	for (i = 0; i < ARRAY_SIZE(codes); i++)
-		if (codes[i] == code)
+	for (i = 0; i < mira050->variant->num_codes; i++)
+		if (mira050->variant->codes[i] == code)
 			break;
 
-	if (i >= ARRAY_SIZE(codes))
+	if (i >= mira050->variant->num_codes)
 	{
 		dev_err_ratelimited(&client->dev, "Could not set requested format code %u", code);
-		dev_err_ratelimited(&client->dev, "Using default format %u", codes[0]);
+		dev_err_ratelimited(&client->dev, "Using default format %u", mira050->variant->codes[0]);
 		i = 0;
 	}
 
-	return codes[i];
-}
+	return mira050->variant->codes[i];
+}
+
+static void mira050_set_default_format(struct mira050 *mira050)
+{
+	struct v4l2_mbus_framefmt *fmt;
+
+	fmt = &mira050->fmt;
+	fmt->code = MEDIA_BUS_FMT_SGRBG12_1X12; // MEDIA_BUS_FMT_Y12_1X12;
+	mira050->bit_depth = 12;
+	fmt->colorspace = V4L2_COLORSPACE_RAW;
+	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
+	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true,
+													  fmt->colorspace,
+													  fmt->ycbcr_enc);
+	fmt->xfer_func = V4L2_MAP_XFER_FUNC_DEFAULT(fmt->colorspace);
+	fmt->width = supported_modes[0].width;
+	fmt->height = supported_modes[0].height;
+	fmt->field = V4L2_FIELD_NONE;
+	mira050->crop = supported_modes[0].crop;
+	mira050->ysubs = 1;
+}
+
+static int mira050_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
+{
+	struct mira050 *mira050 = to_mira050(sd);
+	struct v4l2_mbus_framefmt *try_fmt_img =
+		v4l2_subdev_get_try_format(sd, fh->state, IMAGE_PAD);
+	struct v4l2_mbus_framefmt *try_fmt_meta =
+		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
+	struct v4l2_rect *try_crop;
+
+	/* Only the file handle's own try state is touched, mutex is not needed */
+
+	/* Initialize try_fmt for the image pad */
+	try_fmt_img->width = supported_modes[0].width;
+	try_fmt_img->height = supported_modes[0].height;
+	try_fmt_img->code = mira050_validate_format_code_or_default(mira050,
+																MEDIA_BUS_FMT_SGRBG12_1X12);
+	try_fmt_img->field = V4L2_FIELD_NONE;
+
+	/* TODO(jalv): Initialize try_fmt for the embedded metadata pad */
+	try_fmt_meta->width = MIRA050_EMBEDDED_LINE_WIDTH;
+	try_fmt_meta->height = MIRA050_NUM_EMBEDDED_LINES;
+	try_fmt_meta->code = MEDIA_BUS_FMT_SENSOR_DATA;
+	try_fmt_meta->field = V4L2_FIELD_NONE;
+
+	/* Initialize try_crop rectangle. */
+	try_crop = v4l2_subdev_get_try_crop(sd, fh->state, 0);
+	try_crop->top = MIRA050_PIXEL_ARRAY_TOP;
+	try_crop->left = MIRA050_PIXEL_ARRAY_LEFT;
+	try_crop->width = MIRA050_PIXEL_ARRAY_WIDTH;
+	try_crop->height = MIRA050_PIXEL_ARRAY_HEIGHT;
+
+	return 0;
+}
+
+/* Write the value of a standard control to the sensor */
+static int mira050_apply_ctrl(struct mira050 *mira050, u32 id, s32 val)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+	int ret = 0;
+
+	switch (id)
+	{
+	case V4L2_CID_ANALOGUE_GAIN:
+		printk(KERN_INFO "[MIRA050]: V4L2_CID_ANALOGUE_GAIN: = %u !!!!!!!!!!!!!\n",
+				val);
+		ret = mira050_write_analog_gain_reg(mira050, val);
+		break;
+	case V4L2_CID_EXPOSURE:
+		printk(KERN_INFO "[MIRA050]: V4L2_CID_EXPOSURE: exp line = %u \n",
+				val);
+		ret = mira050_write_exposure_reg(mira050, val);
+		break;
+	case V4L2_CID_TEST_PATTERN:
+		ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
+		// Fixed data is hard coded to 0xAB.
+		ret = ams_sensor_write(&mira050->ams, MIRA050_TRAINING_WORD_REG, 0xAB);
+		// Gradient is hard coded to 45 degree.
+		ret = ams_sensor_write(&mira050->ams, MIRA050_DELTA_TEST_IMG_REG, 0x01);
+		ret = ams_sensor_write(&mira050->ams, MIRA050_TEST_PATTERN_REG,
+							mira050_test_pattern_val[val]);
+		break;
+	case V4L2_CID_HFLIP:
+		// TODO: HFLIP requires multiple register writes
+		// ret = ams_sensor_write(&mira050->ams, MIRA050_HFLIP_REG,
+		//		        val);
+		break;
+	case V4L2_CID_VFLIP:
+		// TODO: VFLIP seems not supported in Mira050
+		// ret = ams_sensor_write(&mira050->ams, MIRA050_VFLIP_REG,
+		//		        val);
+		break;
+	case V4L2_CID_VBLANK:
+		/*
+		 * In libcamera, frame time (== 1/framerate) is controlled by VBLANK:
+		 * TARGET_FRAME_TIME (us) = 1000000 * ((1/PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+VBLANK))
+		 */
+		mira050->target_frame_time_us = (u32)((u64)(1000000 * (u64)(mira050->mode->width + mira050->mode->hblank) * (u64)(mira050->fmt.height + val)) / MIRA050_PIXEL_RATE);
+		// Debug print
+		printk(KERN_INFO "[MIRA050]: mira050_write_target_frame_time_reg target_frame_time_us = %u.\n",
+			   mira050->target_frame_time_us);
+		printk(KERN_INFO "[MIRA050]: width %d, hblank %d, vblank %d, height %d, val %d.\n",
+			   mira050->mode->width, mira050->mode->hblank, mira050->mode->min_vblank, mira050->mode->height, val);
+		ret = mira050_write_target_frame_time_reg(mira050, mira050->target_frame_time_us);
+		break;
+	case V4L2_CID_HBLANK:
+		break;
+	default:
+		dev_info(&client->dev,
+				 "ctrl(id:0x%x,val:0x%x) is not handled\n",
+				 id, val);
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+/*
+ * Queue a slow control write to the control worker.
+ * A value that is still pending for the same control is replaced.
+ * Returns false if the control is written synchronously.
+ */
+static bool mira050_defer_ctrl(struct mira050 *mira050, struct v4l2_ctrl *ctrl)
+{
+	int idx;
+
+	switch (ctrl->id)
+	{
+	case V4L2_CID_VBLANK:
+		idx = MIRA050_DEFERRED_VBLANK;
+		break;
+	case V4L2_CID_EXPOSURE:
+		idx = MIRA050_DEFERRED_EXPOSURE;
+		break;
+	case V4L2_CID_ANALOGUE_GAIN:
+		idx = MIRA050_DEFERRED_GAIN;
+		break;
+	default:
+		return false;
+	}
+
+	spin_lock(&mira050->ctrl_pending_lock);
+	mira050->ctrl_pending_val[idx] = ctrl->val;
+	set_bit(idx, &mira050->ctrl_pending);
+	spin_unlock(&mira050->ctrl_pending_lock);
 
-static void mira050_set_default_format(struct mira050 *mira050)
-{
-	struct v4l2_mbus_framefmt *fmt;
+	queue_work(mira050->ctrl_wq, &mira050->ctrl_work);
 
-	fmt = &mira050->fmt;
-	fmt->code = MEDIA_BUS_FMT_SGRBG12_1X12; // MEDIA_BUS_FMT_Y12_1X12;
-	mira050->bit_depth = 12;
-	fmt->colorspace = V4L2_COLORSPACE_RAW;
-	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
-	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true,
-													  fmt->colorspace,
-													  fmt->ycbcr_enc);
-	fmt->xfer_func = V4L2_MAP_XFER_FUNC_DEFAULT(fmt->colorspace);
-	fmt->width = supported_modes[0].width;
-	fmt->height = supported_modes[0].height;
-	fmt->field = V4L2_FIELD_NONE;
+	return true;
 }
 
-static int mira050_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
+/* Program the vertical window. The sensor is powered with the tables uploaded. */
+static int mira050_write_ywin(struct mira050 *mira050,
+							  const struct v4l2_rect *crop, u32 ysubs)
 {
-	struct mira050 *mira050 = to_mira050(sd);
-	struct v4l2_mbus_framefmt *try_fmt_img =
-		v4l2_subdev_get_try_format(sd, fh->state, IMAGE_PAD);
-	struct v4l2_mbus_framefmt *try_fmt_meta =
-		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
-	struct v4l2_rect *try_crop;
-
-	mutex_lock(&mira050->mutex);
+	int ret;
 
-	/* Initialize try_fmt for the image pad */
-	try_fmt_img->width = supported_modes[0].width;
-	try_fmt_img->height = supported_modes[0].height;
-	try_fmt_img->code = mira050_validate_format_code_or_default(mira050,
-																MEDIA_BUS_FMT_SGRBG12_1X12);
-	try_fmt_img->field = V4L2_FIELD_NONE;
+	ret = ams_sensor_write(&mira050->ams, MIRA050_BANK_SEL_REG, 0);
+	if (!ret)
+		ret = ams_sensor_write_be16(&mira050->ams, MIRA050_YWIN0_SIZE_REG, crop->height);
+	if (!ret)
+		ret = ams_sensor_write_be16(&mira050->ams, MIRA050_YWIN0_START_REG,
+								 MIRA050_YWIN_ROW_OFFSET + crop->top);
+	if (!ret)
+		ret = ams_sensor_write(&mira050->ams, MIRA050_YWIN0_SUBS_REG, ysubs - 1);
 
-	/* TODO(jalv): Initialize try_fmt for the embedded metadata pad */
-	try_fmt_meta->width = MIRA050_EMBEDDED_LINE_WIDTH;
-	try_fmt_meta->height = MIRA050_NUM_EMBEDDED_LINES;
-	try_fmt_meta->code = MEDIA_BUS_FMT_SENSOR_DATA;
-	try_fmt_meta->field = V4L2_FIELD_NONE;
+	return ret;
+}
 
-	/* Initialize try_crop rectangle. */
-	try_crop = v4l2_subdev_get_try_crop(sd, fh->state, 0);
-	try_crop->top = MIRA050_PIXEL_ARRAY_TOP;
-	try_crop->left = MIRA050_PIXEL_ARRAY_LEFT;
-	try_crop->width = MIRA050_PIXEL_ARRAY_WIDTH;
-	try_crop->height = MIRA050_PIXEL_ARRAY_HEIGHT;
+/*
+ * Runs without mutex and hw_lock. hw_lock holders flush it without
+ * mutex, set_ctrl flushes it with mutex before a synchronous write.
+ * Controls are only deferred while streaming, when the mode, format and
+ * bit depth cannot change: set_pad_format refuses ACTIVE formats then,
+ * and every other writer of the mode or the bank selects flushes this
+ * work first. A window from set_selection is written here, in order with
+ * the pending controls, and set_selection holds hw_lock until it is done.
+ */
+static void mira050_ctrl_work(struct work_struct *work)
+{
+	static const u32 ids[MIRA050_NUM_DEFERRED_CTRLS] = {
+		[MIRA050_DEFERRED_VBLANK] = V4L2_CID_VBLANK,
+		[MIRA050_DEFERRED_EXPOSURE] = V4L2_CID_EXPOSURE,
+		[MIRA050_DEFERRED_GAIN] = V4L2_CID_ANALOGUE_GAIN,
+	};
+	struct mira050 *mira050 = container_of(work, struct mira050, ctrl_work);
+	struct ams_camera_event_ctrl_applied *applied;
+	struct v4l2_event ev = {
+		.type = AMS_CAMERA_EVENT_CTRL_APPLIED,
+	};
+	s32 vals[MIRA050_NUM_DEFERRED_CTRLS];
+	unsigned long pending;
+	int i;
+
+	spin_lock(&mira050->ctrl_pending_lock);
+	pending = mira050->ctrl_pending;
+	mira050->ctrl_pending = 0;
+	memcpy(vals, mira050->ctrl_pending_val, sizeof(vals));
+	spin_unlock(&mira050->ctrl_pending_lock);
+
+	if (!pending)
+		return;
+
+	/* Before VBLANK, TARGET_FRAME_TIME counts the rows of the window */
+	if (pending & BIT(MIRA050_PENDING_WINDOW))
+		mira050->window_ret = mira050_write_ywin(mira050, &mira050->crop,
+												 mira050->ysubs);
+
+	applied = (struct ams_camera_event_ctrl_applied *)ev.u.data;
+	for (i = 0; i < MIRA050_NUM_DEFERRED_CTRLS; i++)
+	{
+		if (!(pending & BIT(i)))
+			continue;
+		applied->ctrls[applied->count].id = ids[i];
+		applied->ctrls[applied->count].value = vals[i];
+		applied->ctrls[applied->count].status = mira050_apply_ctrl(mira050, ids[i], vals[i]);
+		applied->count++;
+	}
+	applied->seq = ++mira050->ctrl_applied_seq;
 
-	mutex_unlock(&mira050->mutex);
+	v4l2_subdev_notify_event(&mira050->sd, &ev);
+}
 
-	return 0;
+/* Wait until the control worker has written all pending values */
+static void mira050_flush_ctrl_work(struct mira050 *mira050)
+{
+	flush_work(&mira050->ctrl_work);
 }
 
 static int mira050_set_ctrl(struct v4l2_ctrl *ctrl)
@@ -4086,21 +4158,39 @@ static int mira050_set_ctrl(struct v4l2_ctrl *ctrl)
 	// Debug print
 	// printk(KERN_INFO "[MIRA050]: mira050_set_ctrl() id: 0x%X value: 0x%X.\n", ctrl->id, ctrl->val);
 
+	if (ctrl->id == AMS_CAMERA_CID_ANALOG_GAIN_LINEAR)
+		return ams_sensor_gain_linear_s_ctrl(&mira050->ams, ctrl);
+
+	if (ctrl->id == V4L2_CID_ANALOGUE_GAIN)
+	{
+		ret = ams_sensor_gain_linear_sync(&mira050->ams);
+		if (ret)
+			return ret;
+	}
+
 	if (ctrl->id == V4L2_CID_VBLANK)
 	{
 		int exposure_max, exposure_def;
 
 		/* Update max exposure while meeting expected vblanking */
-		exposure_max = mira050_calculate_max_exposure_time(MIRA050_MIN_ROW_LENGTH,
-														   mira050->mode->height,
+		exposure_max = mira050_calculate_max_exposure_time(mira050->mode,
 														   ctrl->val);
-		exposure_def = (exposure_max < MIRA050_DEFAULT_EXPOSURE_LINES) ? exposure_max : MIRA050_DEFAULT_EXPOSURE_LINES;
+		exposure_def = mira050_exposure_us_to_lines(mira050->mode,
+													MIRA050_DEFAULT_EXPOSURE_US);
+		exposure_def = (exposure_max < exposure_def) ? exposure_max : exposure_def;
 		__v4l2_ctrl_modify_range(mira050->exposure,
 								 mira050->exposure->minimum,
 								 (int)( exposure_max ), mira050->exposure->step,
 								 (int)( exposure_def ));
 	}
 
+	/*
+	 * The running hardware sequence writes all control values
+	 * with __v4l2_ctrl_handler_setup() once the tables are uploaded.
+	 */
+	if (mira050->hw_busy)
+		return 0;
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -4115,58 +4205,15 @@ static int mira050_set_ctrl(struct v4l2_ctrl *ctrl)
 
 	if (mira050->skip_reg_upload == 0)
 	{
-		switch (ctrl->id)
+		/*
+		 * While streaming, slow writes are done by the control worker
+		 * and AMS_CAMERA_EVENT_CTRL_APPLIED reports when they are applied.
+		 */
+		if (!mira050->streaming || !mira050_defer_ctrl(mira050, ctrl))
 		{
-		case V4L2_CID_ANALOGUE_GAIN:
-			printk(KERN_INFO "[MIRA050]: V4L2_CID_ANALOGUE_GAIN: = %u !!!!!!!!!!!!!\n",
-					ctrl->val);
-			ret = mira050_write_analog_gain_reg(mira050, ctrl->val);
-			break;
-		case V4L2_CID_EXPOSURE:
-			printk(KERN_INFO "[MIRA050]: V4L2_CID_EXPOSURE: exp line = %u \n",
-					ctrl->val);
-			ret = mira050_write_exposure_reg(mira050, ctrl->val);
-			break;
-		case V4L2_CID_TEST_PATTERN:
-			ret = mira050_write(mira050, MIRA050_BANK_SEL_REG, 0);
-			// Fixed data is hard coded to 0xAB.
-			ret = mira050_write(mira050, MIRA050_TRAINING_WORD_REG, 0xAB);
-			// Gradient is hard coded to 45 degree.
-			ret = mira050_write(mira050, MIRA050_DELTA_TEST_IMG_REG, 0x01);
-			ret = mira050_write(mira050, MIRA050_TEST_PATTERN_REG,
-								mira050_test_pattern_val[ctrl->val]);
-			break;
-		case V4L2_CID_HFLIP:
-			// TODO: HFLIP requires multiple register writes
-			// ret = mira050_write(mira050, MIRA050_HFLIP_REG,
-			//		        ctrl->val);
-			break;
-		case V4L2_CID_VFLIP:
-			// TODO: VFLIP seems not supported in Mira050
-			// ret = mira050_write(mira050, MIRA050_VFLIP_REG,
-			//		        ctrl->val);
-			break;
-		case V4L2_CID_VBLANK:
-			/*
-			 * In libcamera, frame time (== 1/framerate) is controlled by VBLANK:
-			 * TARGET_FRAME_TIME (us) = 1000000 * ((1/PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+VBLANK))
-			 */
-			mira050->target_frame_time_us = (u32)((u64)(1000000 * (u64)(mira050->mode->width + mira050->mode->hblank) * (u64)(mira050->mode->height + ctrl->val)) / MIRA050_PIXEL_RATE);
-			// Debug print
-			printk(KERN_INFO "[MIRA050]: mira050_write_target_frame_time_reg target_frame_time_us = %u.\n",
-				   mira050->target_frame_time_us);
-			printk(KERN_INFO "[MIRA050]: width %d, hblank %d, vblank %d, height %d, ctrl->val %d.\n",
-				   mira050->mode->width, mira050->mode->hblank, mira050->mode->min_vblank, mira050->mode->height, ctrl->val);
-			ret = mira050_write_target_frame_time_reg(mira050, mira050->target_frame_time_us);
-			break;
-		case V4L2_CID_HBLANK:
-			break;
-		default:
-			dev_info(&client->dev,
-					 "ctrl(id:0x%x,val:0x%x) is not handled\n",
-					 ctrl->id, ctrl->val);
-			ret = -EINVAL;
-			break;
+			/* Keep register accesses ordered with the control worker */
+			mira050_flush_ctrl_work(mira050);
+			ret = mira050_apply_ctrl(mira050, ctrl->id, ctrl->val);
 		}
 	}
 
@@ -4192,10 +4239,16 @@ static int mira050_s_ctrl(struct v4l2_ctrl *ctrl)
 	 * Users need to make sure first power on then write register.
 	 */
 
+	/* Raw accesses would interleave with the table upload */
+	if (mira050->hw_busy)
+		return -EBUSY;
+
+	mira050_flush_ctrl_work(mira050);
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_W:
-		ret = mira050_v4l2_reg_w(mira050, ctrl->val);
+		ret = ams_sensor_reg_w(&mira050->ams, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -4225,10 +4278,15 @@ static int mira050_g_ctrl(struct v4l2_ctrl *ctrl)
 	 * Therefore, the check of "powered" flag is disabled for now.
 	 */
 
+	if (mira050->hw_busy)
+		return -EBUSY;
+
+	mira050_flush_ctrl_work(mira050);
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_R:
-		ret = mira050_v4l2_reg_r(mira050, (u32 *)&ctrl->cur.val);
+		ret = ams_sensor_reg_r(&mira050->ams, (u32 *)&ctrl->cur.val);
 		ctrl->val = ctrl->cur.val;
 		break;
 	default:
@@ -4277,6 +4335,46 @@ static struct v4l2_ctrl_config custom_ctrl_config_list[] = {
 		.def = 0,
 		.step = 1,
 	},
+	{
+		.id = AMS_CAMERA_CID_EXPOSURE_DELAY,
+		.name = "exposure_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA050_EXPOSURE_DELAY,
+		.max = MIRA050_EXPOSURE_DELAY,
+		.def = MIRA050_EXPOSURE_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_GAIN_DELAY,
+		.name = "gain_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA050_GAIN_DELAY,
+		.max = MIRA050_GAIN_DELAY,
+		.def = MIRA050_GAIN_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_VBLANK_DELAY,
+		.name = "vblank_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA050_VBLANK_DELAY,
+		.max = MIRA050_VBLANK_DELAY,
+		.def = MIRA050_VBLANK_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_STARTUP_FRAMES,
+		.name = "startup_frames",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA050_STARTUP_FRAMES,
+		.max = MIRA050_STARTUP_FRAMES,
+		.def = MIRA050_STARTUP_FRAMES,
+		.step = 1,
+	},
 
 };
 
@@ -4293,11 +4391,11 @@ static int mira050_enum_mbus_code(struct v4l2_subdev *sd,
 
 	if (code->pad == IMAGE_PAD)
 	{
-		if (code->index >= ARRAY_SIZE(codes))
+		if (code->index >= mira050->variant->num_codes)
 			return -EINVAL;
 
 		code->code = mira050_validate_format_code_or_default(mira050,
-															 codes[code->index]);
+															 mira050->variant->codes[code->index]);
 	}
 	else
 	{
@@ -4351,6 +4449,80 @@ static int mira050_enum_frame_size(struct v4l2_subdev *sd,
 	return 0;
 }
 
+/*
+ * Report the shortest frame interval of the mode matching code and size.
+ * Any longer interval up to max_vblank can be set with s_frame_interval.
+ */
+static int mira050_enum_frame_interval(struct v4l2_subdev *sd,
+									   struct v4l2_subdev_state *sd_state,
+									   struct v4l2_subdev_frame_interval_enum *fie)
+{
+	unsigned int i;
+
+	if (fie->pad != IMAGE_PAD || fie->index > 0)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(supported_modes); i++)
+	{
+		const struct mira050_mode *mode = &supported_modes[i];
+
+		if (mode->code == fie->code && mode->width == fie->width &&
+			mode->height == fie->height)
+		{
+			mira050_frame_interval(mode, mode->height, mode->min_vblank,
+								   &fie->interval);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int mira050_g_frame_interval(struct v4l2_subdev *sd,
+									struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira050 *mira050 = to_mira050(sd);
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira050->mutex);
+	mira050_frame_interval(mira050->mode, mira050->fmt.height,
+						   mira050->vblank->val, &fi->interval);
+	mutex_unlock(&mira050->mutex);
+
+	return 0;
+}
+
+/* Frame interval is set through VBLANK, the closest achievable one is returned */
+static int mira050_s_frame_interval(struct v4l2_subdev *sd,
+									struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira050 *mira050 = to_mira050(sd);
+	const struct mira050_mode *mode;
+	int ret = 0;
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira050->mutex);
+	mode = mira050->mode;
+	if (fi->interval.numerator && fi->interval.denominator)
+	{
+		u32 us = (u32)div_u64((u64)fi->interval.numerator * 1000000,
+							  fi->interval.denominator);
+
+		ret = __v4l2_ctrl_s_ctrl(mira050->vblank,
+								 mira050_frame_time_to_vblank(mode,
+															  mira050->fmt.height, us));
+	}
+	mira050_frame_interval(mode, mira050->fmt.height, mira050->vblank->val,
+						   &fi->interval);
+	mutex_unlock(&mira050->mutex);
+
+	return ret;
+}
+
 static void mira050_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
 {
 	fmt->colorspace = V4L2_COLORSPACE_RAW;
@@ -4398,10 +4570,16 @@ static int __mira050_get_pad_format(struct mira050 *mira050,
 	{
 		if (fmt->pad == IMAGE_PAD)
 		{
-			mira050_update_image_pad_format(mira050, mira050->mode,
-											fmt);
+			const struct mira050_mode *mode;
+			struct v4l2_mbus_framefmt active;
+			struct v4l2_rect crop;
+
+			mira050_read_format(mira050, &mode, &active, &crop);
+			mira050_update_image_pad_format(mira050, mode, fmt);
+			/* Rows of the vertical window after subsampling */
+			fmt->format.height = active.height;
 			fmt->format.code = mira050_validate_format_code_or_default(mira050,
-																	   mira050->fmt.code);
+																	   active.code);
 		}
 		else
 		{
@@ -4417,13 +4595,9 @@ static int mira050_get_pad_format(struct v4l2_subdev *sd,
 								  struct v4l2_subdev_format *fmt)
 {
 	struct mira050 *mira050 = to_mira050(sd);
-	int ret;
-
-	mutex_lock(&mira050->mutex);
-	ret = __mira050_get_pad_format(mira050, sd_state, fmt);
-	mutex_unlock(&mira050->mutex);
 
-	return ret;
+	/* Lockless: ACTIVE reads the published snapshot, TRY is per file handle */
+	return __mira050_get_pad_format(mira050, sd_state, fmt);
 }
 
 static int mira050_set_pad_format(struct v4l2_subdev *sd,
@@ -4433,14 +4607,31 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	struct mira050 *mira050 = to_mira050(sd);
 	const struct mira050_mode *mode;
+	const struct mira050_mode *new_mode = mira050->mode;
+	u8 new_bit_depth = mira050->bit_depth;
 	struct v4l2_mbus_framefmt *framefmt;
 	u32 max_exposure = 0, default_exp = 0;
+	u32 exposure_us;
+	u32 gain_linear;
 	int rc = 0;
 
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
 
-	mutex_lock(&mira050->mutex);
+	/* TRY formats live in the file handle state and need no locking */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		mutex_lock(&mira050->hw_lock);
+		mutex_lock(&mira050->mutex);
+
+		/* Buffers and the control worker use the mode while streaming */
+		if (mira050->streaming)
+		{
+			mutex_unlock(&mira050->mutex);
+			mutex_unlock(&mira050->hw_lock);
+			return -EBUSY;
+		}
+	}
 
 	if (fmt->pad == IMAGE_PAD)
 	{
@@ -4452,22 +4643,22 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 		{
 		case MEDIA_BUS_FMT_SGRBG10_1X10:
 			printk(KERN_INFO "[MIRA050]: fmt->format.code() selects 10 bit mode.\n");
-			mira050->mode = &supported_modes[1];
-			mira050->bit_depth = 10;
+			new_mode = &supported_modes[1];
+			new_bit_depth = 10;
 			// return 0;
 			break;
 
 		case MEDIA_BUS_FMT_SGRBG12_1X12:
 			printk(KERN_INFO "[MIRA050]: fmt->format.code() selects 12 bit mode.\n");
-			mira050->mode = &supported_modes[0];
-			mira050->bit_depth = 12;
+			new_mode = &supported_modes[0];
+			new_bit_depth = 12;
 			// return 0;
 			break;
 
 		case MEDIA_BUS_FMT_SGRBG8_1X8:
 			printk(KERN_INFO "[MIRA050]: fmt->format.code() selects 8 bit mode.\n");
-			mira050->mode = &supported_modes[2];
-			mira050->bit_depth = 8;
+			new_mode = &supported_modes[2];
+			new_bit_depth = 8;
 			// return 0;
 			break;
 		default:
@@ -4484,29 +4675,55 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 			framefmt = v4l2_subdev_get_try_format(sd, sd_state,
 												  fmt->pad);
 			*framefmt = fmt->format;
+			*v4l2_subdev_get_try_crop(sd, sd_state, fmt->pad) = mode->crop;
 		}
-		else if (mira050->mode != mode ||
-				 mira050->fmt.code != fmt->format.code)
+		else if (new_mode != mode ||
+				 mira050->fmt.code != fmt->format.code ||
+				 mira050->ysubs != 1 ||
+				 !v4l2_rect_equal(&mira050->crop, &new_mode->crop))
 		{
+			/* Row time differs per bit depth, keep the exposure time */
+			exposure_us = mira050_exposure_lines_to_us(mira050->mode,
+													   mira050->exposure->val);
+			gain_linear = mira050->ams.gain_linear->val;
 
-			mira050->fmt = fmt->format;
-			// mira050->mode = mode;
+			/* No control write may see half of the new mode */
+			mira050_flush_ctrl_work(mira050);
+			mira050_publish_format(mira050, new_mode, &fmt->format,
+								   new_bit_depth);
+			mira050_publish_window(mira050, &new_mode->crop, 1);
 
 			// Update controls based on new mode (range and current value).
-			max_exposure = mira050_calculate_max_exposure_time(MIRA050_MIN_ROW_LENGTH,
-															   mira050->mode->height,
+			max_exposure = mira050_calculate_max_exposure_time(mira050->mode,
 															   mira050->mode->min_vblank);
 
-			default_exp = MIRA050_DEFAULT_EXPOSURE_LINES > max_exposure ? max_exposure : MIRA050_DEFAULT_EXPOSURE_LINES;
+			default_exp = mira050_exposure_us_to_lines(mira050->mode,
+													   MIRA050_DEFAULT_EXPOSURE_US);
+			default_exp = default_exp > max_exposure ? max_exposure : default_exp;
 			rc = __v4l2_ctrl_modify_range(mira050->exposure,
-										  mira050->exposure->minimum,
-										  (int)(1 + max_exposure), mira050->exposure->step,
-										  (int)(1 + default_exp));
+										  mira050_calculate_min_exposure_time(mira050->mode),
+										  (int)max_exposure, mira050->exposure->step,
+										  (int)default_exp);
+			if (!rc)
+				rc = __v4l2_ctrl_s_ctrl(mira050->exposure,
+										clamp_t(s32, mira050_exposure_us_to_lines(mira050->mode, exposure_us),
+												mira050->exposure->minimum,
+												mira050->exposure->maximum));
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting exposure range");
 			}
 
+			// Row time differs per bit depth, so does hblank.
+			rc = __v4l2_ctrl_modify_range(mira050->hblank,
+										  mira050->mode->hblank,
+										  mira050->mode->hblank, 1,
+										  mira050->mode->hblank);
+			if (rc)
+			{
+				dev_err(&client->dev, "Error setting hblank range");
+			}
+
 			printk(KERN_INFO "[MIRA050]: Mira050 SETTING ANA GAIN RANGE  = %u.\n",
 				   ARRAY_SIZE(fine_gain_lut_8bit_16x) - 1);
 			// #FIXME #TODO
@@ -4517,6 +4734,8 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 										  mira050->mode->gain_max,
 										  1,
 										  0);
+			if (!rc)
+				rc = ams_sensor_gain_linear_update(&mira050->ams, gain_linear);
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting gain range");
@@ -4529,17 +4748,18 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 										  mira050->mode->min_vblank,
 										  mira050->mode->max_vblank,
 										  1,
-										  MIRA050_MIN_VBLANK_60);
+										  mira050_default_vblank(mira050->mode));
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting exposure range");
 			}
 			// Set the current vblank value
-			rc = __v4l2_ctrl_s_ctrl(mira050->vblank, MIRA050_MIN_VBLANK_60);
+			rc = __v4l2_ctrl_s_ctrl(mira050->vblank,
+									mira050_default_vblank(mira050->mode));
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting vblank value to %u",
-						mira050->mode->min_vblank);
+						mira050_default_vblank(mira050->mode));
 			}
 		}
 	}
@@ -4558,7 +4778,15 @@ static int mira050_set_pad_format(struct v4l2_subdev *sd,
 		}
 	}
 
-	mutex_unlock(&mira050->mutex);
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		/* Get the new mode onto the sensor before stream-on */
+		if (mira050->preload && fmt->pad == IMAGE_PAD && !mira050->streaming)
+			schedule_work(&mira050->preload_work);
+
+		mutex_unlock(&mira050->mutex);
+		mutex_unlock(&mira050->hw_lock);
+	}
 
 	return 0;
 }
@@ -4570,22 +4798,19 @@ static int mira050_set_framefmt(struct mira050 *mira050)
 	{
 	case MEDIA_BUS_FMT_SGRBG8_1X8:
 		printk(KERN_INFO "[MIRA050]: mira050_set_framefmt() selects 8 bit mode.\n");
-		mira050->mode = &supported_modes[2];
-		mira050->bit_depth = 8;
+		mira050_publish_format(mira050, &supported_modes[2], NULL, 8);
 		__v4l2_ctrl_modify_range(mira050->gain,
 								 0, ARRAY_SIZE(fine_gain_lut_8bit_16x) - 1, 1, 0);
 		return 0;
 	case MEDIA_BUS_FMT_SGRBG10_1X10:
 		printk(KERN_INFO "[MIRA050]: mira050_set_framefmt() selects 10 bit mode.\n");
-		mira050->mode = &supported_modes[1];
-		mira050->bit_depth = 10;
+		mira050_publish_format(mira050, &supported_modes[1], NULL, 10);
 		__v4l2_ctrl_modify_range(mira050->gain,
 								 0, ARRAY_SIZE(fine_gain_lut_10bit_hs_4x) - 1, 1, 0);
 		return 0;
 	case MEDIA_BUS_FMT_SGRBG12_1X12:
 		printk(KERN_INFO "[MIRA050]: mira050_set_framefmt() selects 12 bit mode.\n");
-		mira050->mode = &supported_modes[0];
-		mira050->bit_depth = 12;
+		mira050_publish_format(mira050, &supported_modes[0], NULL, 12);
 		__v4l2_ctrl_modify_range(mira050->gain,
 								 mira050->mode->gain_min, mira050->mode->gain_max,
 								 MIRA050_ANALOG_GAIN_STEP, MIRA050_ANALOG_GAIN_DEFAULT);
@@ -4594,76 +4819,292 @@ static int mira050_set_framefmt(struct mira050 *mira050)
 		printk(KERN_ERR "Unknown format requested %d", mira050->fmt.code);
 	}
 
-	return -EINVAL;
-}
-
-static const struct v4l2_rect *
-__mira050_get_pad_crop(struct mira050 *mira050, struct v4l2_subdev_state *sd_state,
-					   unsigned int pad, enum v4l2_subdev_format_whence which)
-{
-	switch (which)
+	return -EINVAL;
+}
+
+/* Window and output size (compose) of the image pad */
+static void
+__mira050_get_pad_window(struct mira050 *mira050, struct v4l2_subdev_state *sd_state,
+						 unsigned int pad, enum v4l2_subdev_format_whence which,
+						 struct v4l2_rect *crop, struct v4l2_rect *compose)
+{
+	struct v4l2_mbus_framefmt fmt;
+
+	switch (which)
+	{
+	case V4L2_SUBDEV_FORMAT_TRY:
+		*crop = *v4l2_subdev_get_try_crop(&mira050->sd, sd_state, pad);
+		fmt = *v4l2_subdev_get_try_format(&mira050->sd, sd_state, pad);
+		break;
+	case V4L2_SUBDEV_FORMAT_ACTIVE:
+	default:
+	{
+		const struct mira050_mode *mode;
+
+		mira050_read_format(mira050, &mode, &fmt, crop);
+		break;
+	}
+	}
+
+	compose->left = 0;
+	compose->top = 0;
+	compose->width = crop->width;
+	compose->height = fmt.height;
+}
+
+static int mira050_get_selection(struct v4l2_subdev *sd,
+								 struct v4l2_subdev_state *sd_state,
+								 struct v4l2_subdev_selection *sel)
+{
+	struct mira050 *mira050 = to_mira050(sd);
+	struct v4l2_rect crop, compose;
+
+	switch (sel->target)
+	{
+	case V4L2_SEL_TGT_CROP:
+		__mira050_get_pad_window(mira050, sd_state, sel->pad, sel->which,
+								 &sel->r, &compose);
+
+		return 0;
+
+	case V4L2_SEL_TGT_COMPOSE:
+		__mira050_get_pad_window(mira050, sd_state, sel->pad, sel->which,
+								 &crop, &sel->r);
+
+		return 0;
+
+	case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+	case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+		__mira050_get_pad_window(mira050, sd_state, sel->pad, sel->which,
+								 &crop, &compose);
+		sel->r.top = 0;
+		sel->r.left = 0;
+		sel->r.width = crop.width;
+		sel->r.height = crop.height;
+
+		return 0;
+
+	case V4L2_SEL_TGT_NATIVE_SIZE:
+		sel->r.top = 0;
+		sel->r.left = 0;
+		sel->r.width = MIRA050_NATIVE_WIDTH;
+		sel->r.height = MIRA050_NATIVE_HEIGHT;
+
+		return 0;
+
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		sel->r.top = MIRA050_PIXEL_ARRAY_TOP;
+		sel->r.left = MIRA050_PIXEL_ARRAY_LEFT;
+		sel->r.width = MIRA050_PIXEL_ARRAY_WIDTH;
+		sel->r.height = MIRA050_PIXEL_ARRAY_HEIGHT;
+
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/* Full width window of aligned rows within the pixel array */
+static void mira050_adjust_ywin(const struct v4l2_rect *req, struct v4l2_rect *crop)
+{
+	crop->left = MIRA050_PIXEL_ARRAY_LEFT;
+	crop->width = MIRA050_PIXEL_ARRAY_WIDTH;
+	crop->height = clamp_t(u32, round_down(req->height, MIRA050_YWIN_ALIGN),
+						   MIRA050_YWIN_MIN_HEIGHT, MIRA050_PIXEL_ARRAY_HEIGHT);
+	crop->top = clamp_t(s32, round_down(req->top, MIRA050_YWIN_ALIGN),
+						MIRA050_PIXEL_ARRAY_TOP,
+						MIRA050_PIXEL_ARRAY_TOP + MIRA050_PIXEL_ARRAY_HEIGHT - crop->height);
+}
+
+/* Subsampling closest to crop_height / height that gives whole row pairs */
+static u32 mira050_ywin_subs(u32 crop_height, u32 height)
+{
+	u32 subs = height ? DIV_ROUND_CLOSEST(crop_height, height) : 1;
+
+	subs = clamp_t(u32, subs, 1, MIRA050_YWIN_MAX_SUBS);
+	while (subs > 1 && crop_height % (subs * MIRA050_YWIN_ALIGN))
+		subs--;
+
+	return subs;
+}
+
+/*
+ * CROP sets the vertical window (YWIN0) and resets the subsampling.
+ * COMPOSE sets the output height, which selects the row subsampling
+ * (YWIN0_SUBS). The frame time is (height + VBLANK) rows, so reading
+ * fewer rows raises the frame rate at the same VBLANK. While streaming
+ * the window can only move, its registers are then written without a
+ * table upload.
+ */
+static int mira050_set_selection(struct v4l2_subdev *sd,
+								 struct v4l2_subdev_state *sd_state,
+								 struct v4l2_subdev_selection *sel)
+{
+	struct mira050 *mira050 = to_mira050(sd);
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct v4l2_mbus_framefmt *try_fmt;
+	struct v4l2_rect crop, compose;
+	bool preloaded = false;
+	bool write = false;
+	u32 ysubs;
+	int ret = 0;
+
+	if (sel->pad != IMAGE_PAD ||
+		(sel->target != V4L2_SEL_TGT_CROP && sel->target != V4L2_SEL_TGT_COMPOSE))
+		return -EINVAL;
+
+	/* TRY windows live in the file handle state and need no locking */
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY)
+	{
+		crop = *v4l2_subdev_get_try_crop(sd, sd_state, sel->pad);
+		if (sel->target == V4L2_SEL_TGT_CROP)
+		{
+			mira050_adjust_ywin(&sel->r, &crop);
+			ysubs = 1;
+		}
+		else
+		{
+			ysubs = mira050_ywin_subs(crop.height, sel->r.height);
+		}
+		*v4l2_subdev_get_try_crop(sd, sd_state, sel->pad) = crop;
+		try_fmt = v4l2_subdev_get_try_format(sd, sd_state, sel->pad);
+		try_fmt->width = crop.width;
+		try_fmt->height = crop.height / ysubs;
+		__mira050_get_pad_window(mira050, sd_state, sel->pad, sel->which,
+								 &crop, &compose);
+		sel->r = sel->target == V4L2_SEL_TGT_CROP ? crop : compose;
+		return 0;
+	}
+
+	mutex_lock(&mira050->hw_lock);
+	mutex_lock(&mira050->mutex);
+
+	crop = mira050->crop;
+	ysubs = mira050->ysubs;
+	if (sel->target == V4L2_SEL_TGT_CROP)
+	{
+		mira050_adjust_ywin(&sel->r, &crop);
+		if (!mira050->streaming)
+			ysubs = 1;
+	}
+	else
+	{
+		ysubs = mira050_ywin_subs(crop.height, sel->r.height);
+	}
+
+	/* Buffers are sized for the current window while streaming */
+	if (mira050->streaming &&
+		(crop.height != mira050->crop.height || ysubs != mira050->ysubs))
 	{
-	case V4L2_SUBDEV_FORMAT_TRY:
-		return v4l2_subdev_get_try_crop(&mira050->sd, sd_state, pad);
-	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &mira050->mode->crop;
+		ret = -EBUSY;
+		goto out;
 	}
 
-	return NULL;
-}
+	printk(KERN_INFO "[MIRA050]: mira050_set_selection() %u rows at %d, subsampling %u.\n",
+		   crop.height, crop.top, ysubs);
+	mira050_publish_window(mira050, &crop, ysubs);
 
-static int mira050_get_selection(struct v4l2_subdev *sd,
-								 struct v4l2_subdev_state *sd_state,
-								 struct v4l2_subdev_selection *sel)
-{
-	switch (sel->target)
+	/* A preloaded sensor is only written while it is still powered */
+	preloaded = !mira050->streaming &&
+				pm_runtime_get_if_active(&client->dev, true) > 0;
+	if (preloaded && !mira050->preloaded)
 	{
-	case V4L2_SEL_TGT_CROP:
+		mira050_pm_put(mira050);
+		preloaded = false;
+	}
+
+	/*
+	 * The control worker writes the window and then TARGET_FRAME_TIME,
+	 * which counts its rows. Otherwise the window is written after the
+	 * next table upload.
+	 */
+	if (mira050->skip_reg_upload == 0 &&
+		(mira050->streaming || preloaded))
 	{
-		struct mira050 *mira050 = to_mira050(sd);
+		spin_lock(&mira050->ctrl_pending_lock);
+		mira050->ctrl_pending_val[MIRA050_DEFERRED_VBLANK] = mira050->vblank->val;
+		set_bit(MIRA050_DEFERRED_VBLANK, &mira050->ctrl_pending);
+		set_bit(MIRA050_PENDING_WINDOW, &mira050->ctrl_pending);
+		spin_unlock(&mira050->ctrl_pending_lock);
+		queue_work(mira050->ctrl_wq, &mira050->ctrl_work);
+		write = true;
+	}
 
-		mutex_lock(&mira050->mutex);
-		sel->r = *__mira050_get_pad_crop(mira050, sd_state, sel->pad,
-										 sel->which);
-		mutex_unlock(&mira050->mutex);
+out:
+	__mira050_get_pad_window(mira050, sd_state, sel->pad, sel->which,
+							 &crop, &compose);
+	sel->r = sel->target == V4L2_SEL_TGT_CROP ? crop : compose;
+	mutex_unlock(&mira050->mutex);
 
-		return 0;
+	/* Wait for the window write with hw_lock only, controls stay readable */
+	if (write)
+	{
+		mira050_flush_ctrl_work(mira050);
+		ret = mira050->window_ret;
+		if (ret)
+		{
+			dev_err(&client->dev, "%s failed to set window\n", __func__);
+		}
+		else if (preloaded)
+		{
+			mira050->preload_crop = crop;
+			mira050->preload_ysubs = ysubs;
+		}
 	}
+	if (preloaded)
+		mira050_pm_put(mira050);
 
-	case V4L2_SEL_TGT_NATIVE_SIZE:
-		sel->r.top = 0;
-		sel->r.left = 0;
-		sel->r.width = MIRA050_NATIVE_WIDTH;
-		sel->r.height = MIRA050_NATIVE_HEIGHT;
+	mutex_unlock(&mira050->hw_lock);
 
-		return 0;
+	return ret;
+}
 
-	case V4L2_SEL_TGT_CROP_DEFAULT:
-	case V4L2_SEL_TGT_CROP_BOUNDS:
-		sel->r.top = MIRA050_PIXEL_ARRAY_TOP;
-		sel->r.left = MIRA050_PIXEL_ARRAY_LEFT;
-		sel->r.width = MIRA050_PIXEL_ARRAY_WIDTH;
-		sel->r.height = MIRA050_PIXEL_ARRAY_HEIGHT;
+/* Whether ams_sensor_write_table() writes a full table of mode from firmware */
+static bool mira050_full_tables_from_fw(struct mira050 *mira050,
+										const struct mira050_mode *mode)
+{
+	return ams_sensor_table_from_fw(&mira050->ams, mode,
+									mode->reg_list_pre_soft_reset.fw_name) ||
+		   ams_sensor_table_from_fw(&mira050->ams, mode,
+									mode->reg_list_post_soft_reset.fw_name);
+}
 
-		return 0;
-	}
+/*
+ * Whether the sensor holding the tables of uploaded_mode gets to mode with
+ * the bit depth table of mode. That table is the difference of the
+ * built-in full tables, so not if a full table of either mode came from
+ * firmware. Caller holds hw_lock.
+ */
+static bool mira050_bit_depth_switchable(struct mira050 *mira050)
+{
+	const struct mira050_mode *from = mira050->uploaded_mode;
+	const struct mira050_mode *to = mira050->mode;
 
-	return -EINVAL;
+	return from && !from->exclusive_regs && !mira050->uploaded_fw &&
+		   from->width == to->width && from->height == to->height &&
+		   !mira050_full_tables_from_fw(mira050, to);
 }
 
-static int mira050_start_streaming(struct mira050 *mira050)
+/*
+ * Power on, upload the register tables of the current mode and write all
+ * control values. Caller holds hw_lock. On success the runtime PM
+ * reference is held and the sensor is ready for the stream-on sequence.
+ */
+static int mira050_power_up_mode(struct mira050 *mira050)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
 	const struct mira050_reg_list *reg_list;
+	struct v4l2_rect crop;
+	u32 ysubs;
 
 	u32 otp_dark_cal_8bit;
 	u32 otp_dark_cal_10bit_hs;
 	u32 otp_dark_cal_10bit;
 	u32 otp_dark_cal_12bit;
+	bool delta = false;
 	int ret;
 
-	printk(KERN_INFO "[MIRA050]: Entering START STREAMING function !!!!!!!!!!.\n");
-
 	/* Follow examples of other camera driver, here use pm_runtime_resume_and_get */
 	ret = pm_runtime_resume_and_get(&client->dev);
 
@@ -4675,7 +5116,13 @@ static int mira050_start_streaming(struct mira050 *mira050)
 	}
 
 	/* Set current mode according to frame format bit depth */
+	mutex_lock(&mira050->mutex);
 	ret = mira050_set_framefmt(mira050);
+	if (!ret)
+		mira050->hw_busy = true;
+	crop = mira050->crop;
+	ysubs = mira050->ysubs;
+	mutex_unlock(&mira050->mutex);
 	if (ret)
 	{
 		dev_err(&client->dev, "%s failed to set frame format: %d\n",
@@ -4686,46 +5133,96 @@ static int mira050_start_streaming(struct mira050 *mira050)
 
 	if (mira050->skip_reg_upload == 0)
 	{
-		/* Apply pre soft reset default values of current mode */
-		reg_list = &mira050->mode->reg_list_pre_soft_reset;
-		printk(KERN_INFO "[MIRA050]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = mira050_write_regs(mira050, reg_list->regs, reg_list->num_of_regs);
-		if (ret)
+		delta = mira050_bit_depth_switchable(mira050);
+		mira050->uploaded_mode = NULL;
+
+		if (delta)
 		{
-			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			/* The sensor holds a mode of the same size, write what differs */
+			reg_list = &mira050->mode->reg_list_bit_depth;
+			printk(KERN_INFO "[MIRA050]: Switch bit depth, write %d regs.\n", reg_list->num_of_regs);
+			ret = ams_sensor_write_table(&mira050->ams, mira050->mode, reg_list->fw_name,
+							     reg_list->regs, reg_list->num_of_regs);
+			if (ret)
+			{
+				dev_err(&client->dev, "%s failed to switch bit depth\n", __func__);
+				goto err_busy;
+			}
 		}
+		else
+		{
+			/* Registers the full tables do not write must be at reset value */
+			if (mira050->needs_reset && !mira050->mode->exclusive_regs)
+			{
+				ret = mira050_power_cycle(mira050);
+				if (ret)
+				{
+					dev_err(&client->dev, "%s failed to power cycle\n", __func__);
+					goto err_busy;
+				}
+			}
+			if (mira050->mode->exclusive_regs)
+				mira050->needs_reset = true;
+
+			/* Apply pre soft reset default values of current mode */
+			reg_list = &mira050->mode->reg_list_pre_soft_reset;
+			printk(KERN_INFO "[MIRA050]: Write %d regs.\n", reg_list->num_of_regs);
+			ret = ams_sensor_write_table(&mira050->ams, mira050->mode, reg_list->fw_name,
+							     reg_list->regs, reg_list->num_of_regs);
+			if (ret)
+			{
+				dev_err(&client->dev, "%s failed to set mode\n", __func__);
+				goto err_busy;
+			}
 
-		usleep_range(10, 50);
+			usleep_range(10, 50);
 
-		/* Apply post soft reset default values of current mode */
-		reg_list = &mira050->mode->reg_list_post_soft_reset;
-		printk(KERN_INFO "[MIRA050]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = mira050_write_regs(mira050, reg_list->regs, reg_list->num_of_regs);
-		if (ret)
+			/* Apply post soft reset default values of current mode */
+			reg_list = &mira050->mode->reg_list_post_soft_reset;
+			printk(KERN_INFO "[MIRA050]: Write %d regs.\n", reg_list->num_of_regs);
+			ret = ams_sensor_write_table(&mira050->ams, mira050->mode, reg_list->fw_name,
+							     reg_list->regs, reg_list->num_of_regs);
+			if (ret)
+			{
+				dev_err(&client->dev, "%s failed to set mode\n", __func__);
+				goto err_busy;
+			}
+
+			/* Already loaded by the writes above */
+			mira050->uploaded_fw = mira050_full_tables_from_fw(mira050, mira050->mode);
+		}
+
+		/*
+		 * Window set with set_selection replaces the one of the tables.
+		 * After a bit depth switch the previous window is still set.
+		 */
+		if (delta || ysubs != 1 || !v4l2_rect_equal(&crop, &mira050->mode->crop))
 		{
-			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			ret = mira050_write_ywin(mira050, &crop, ysubs);
+			if (ret)
+			{
+				dev_err(&client->dev, "%s failed to set window\n", __func__);
+				goto err_busy;
+			}
 		}
+
+		mira050->uploaded_mode = mira050->mode;
 	}
 	else
 	{
 		printk(KERN_INFO "[MIRA050]: Skip base register sequence upload, due to mira050->skip_reg_upload=%u.\n", mira050->skip_reg_upload);
 	}
 
-	printk(KERN_INFO "[MIRA050]: Entering v4l2 ctrl handler setup function.\n");
-
-	/* Apply customized values from user */
-	ret = __v4l2_ctrl_handler_setup(mira050->sd.ctrl_handler);
-	printk(KERN_INFO "[MIRA050]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
-	if (ret)
-		goto err_rpm_put;
-
-
-
+	/*
+	 * ********* READ OTP VALUES for revB - all modes **********
+	 * Read before the control values are applied, the gain path uses the
+	 * OFFSET_CLIPPING tables computed from them.
+	 * A bit depth switch keeps the values read at the full upload.
+	 */
+	if (delta)
+		goto ctrl_setup;
 
 	usleep_range(10, 50);
-	/* ********* READ OTP VALUES for revB - all modes ********** */
 	ret = mira050_otp_read(mira050, 0x04, &otp_dark_cal_8bit);
 	/* OTP_CALIBRATION_VALUE is little-endian, LSB at [7:0], MSB at [15:8] */
 	mira050->otp_dark_cal_8bit = (u16)(otp_dark_cal_8bit & 0x0000FFFF);
@@ -4773,7 +5270,137 @@ static int mira050_start_streaming(struct mira050 *mira050)
 	{
 		printk(KERN_INFO "[MIRA050]: OTP_CALIBRATION_VALUE 12b: %u, extracted from 32-bit 0x%X.\n", mira050->otp_dark_cal_12bit, otp_dark_cal_12bit);
 	}
+	mira050_update_offset_clipping(mira050);
+
+ctrl_setup:
+	printk(KERN_INFO "[MIRA050]: Entering v4l2 ctrl handler setup function.\n");
+
+	/*
+	 * Apply customized values from user. Control writes that came in
+	 * during the upload were cached and are written here.
+	 */
+	mutex_lock(&mira050->mutex);
+	mira050->hw_busy = false;
+	ret = __v4l2_ctrl_handler_setup(mira050->sd.ctrl_handler);
+	printk(KERN_INFO "[MIRA050]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
+	mutex_unlock(&mira050->mutex);
+	if (ret)
+		goto err_rpm_put;
+
+	return 0;
+
+err_busy:
+	mutex_lock(&mira050->mutex);
+	mira050->hw_busy = false;
+	mutex_unlock(&mira050->mutex);
+err_rpm_put:
+	pm_runtime_put(&client->dev);
+	return ret;
+}
+
+/* Forget a background upload that no longer matches. Caller holds hw_lock. */
+static void mira050_drop_preload(struct mira050 *mira050)
+{
+	mira050->preloaded = false;
+}
+
+/* Record the uploaded mode as a background upload. Caller holds hw_lock. */
+static void mira050_set_preloaded(struct mira050 *mira050)
+{
+	mira050->preloaded = true;
+	mira050->preload_code = mira050->fmt.code;
+	mira050->preload_crop = mira050->crop;
+	mira050->preload_ysubs = mira050->ysubs;
+}
+
+/* Whether the background upload matches the format and window */
+static bool mira050_preload_matches(struct mira050 *mira050)
+{
+	return mira050->preloaded &&
+		   mira050->preload_code == mira050->fmt.code &&
+		   mira050->preload_ysubs == mira050->ysubs &&
+		   v4l2_rect_equal(&mira050->preload_crop, &mira050->crop);
+}
+
+/*
+ * Background upload after an ACTIVE set_fmt,
+ * enabled with the "preload" device tree property. Stream-on then only
+ * writes the start sequence.
+ */
+static void mira050_preload_work(struct work_struct *work)
+{
+	struct mira050 *mira050 = container_of(work, struct mira050, preload_work);
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+	int ret;
+
+	mutex_lock(&mira050->hw_lock);
+
+	if (mira050->streaming || mira050->skip_reg_upload)
+		goto out;
+
+	/* Keeps a previous upload from powering off while it is checked */
+	ret = pm_runtime_resume_and_get(&client->dev);
+	if (ret < 0)
+		goto out;
+
+	/* Format or window changed since the last upload */
+	if (!mira050_preload_matches(mira050))
+	{
+		mira050_drop_preload(mira050);
+
+		printk(KERN_INFO "[MIRA050]: Uploading mode in the background.\n");
+		ret = mira050_power_up_mode(mira050);
+		if (ret)
+		{
+			dev_err(&client->dev, "%s background upload failed: %d\n",
+					__func__, ret);
+		}
+		else
+		{
+			mira050_set_preloaded(mira050);
+			/* Drop the reference of mira050_power_up_mode(), ours is released below */
+			pm_runtime_put_noidle(&client->dev);
+		}
+	}
+
+	mira050_pm_put(mira050);
+
+out:
+	mutex_unlock(&mira050->hw_lock);
+}
+
+static int mira050_start_streaming(struct mira050 *mira050)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+	int ret;
+
+	printk(KERN_INFO "[MIRA050]: Entering START STREAMING function !!!!!!!!!!.\n");
+
+	/* Keeps a preloaded sensor from powering off while it is checked */
+	ret = pm_runtime_resume_and_get(&client->dev);
+	if (ret < 0)
+		return ret;
+
+	if (mira050_preload_matches(mira050))
+	{
+		/* The mode is already uploaded, the stream keeps this reference */
+		printk(KERN_INFO "[MIRA050]: Using background uploaded mode.\n");
+		mira050->preloaded = false;
+	}
+	else
+	{
+		mira050_drop_preload(mira050);
+		ret = mira050_power_up_mode(mira050);
+		if (ret)
+		{
+			mira050_pm_put(mira050);
+			return ret;
+		}
+		/* The stream keeps the reference of mira050_power_up_mode() */
+		pm_runtime_put_noidle(&client->dev);
+	}
 
+	mutex_lock(&mira050->mutex);
 
 	// ret = mira050_write_analog_gain_reg(mira050, 0);
 	if (mira050->skip_reg_upload == 0 ||
@@ -4784,7 +5411,7 @@ static int mira050_start_streaming(struct mira050 *mira050)
 		if (ret)
 		{
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_unlock;
 		}
 	}
 	else
@@ -4798,11 +5425,13 @@ static int mira050_start_streaming(struct mira050 *mira050)
 	__v4l2_ctrl_grab(mira050->vflip, true);
 	printk(KERN_INFO "[MIRA050]: Entering v4l2 ctrl grab vflip grab hflip.\n");
 	__v4l2_ctrl_grab(mira050->hflip, true);
+	mutex_unlock(&mira050->mutex);
 
 	return 0;
 
-err_rpm_put:
-	pm_runtime_put(&client->dev);
+err_unlock:
+	mutex_unlock(&mira050->mutex);
+	mira050_pm_put(mira050);
 	return ret;
 }
 
@@ -4812,8 +5441,14 @@ static void mira050_stop_streaming(struct mira050 *mira050)
 	int ret = 0;
 
 	/* Unlock controls for vflip and hflip */
+	mutex_lock(&mira050->mutex);
 	__v4l2_ctrl_grab(mira050->vflip, false);
 	__v4l2_ctrl_grab(mira050->hflip, false);
+	mira050->hw_busy = true;
+	mutex_unlock(&mira050->mutex);
+
+	/* Let the control worker finish before the sensor stops */
+	mira050_flush_ctrl_work(mira050);
 
 	if (mira050->skip_reset == 0)
 	{
@@ -4838,7 +5473,18 @@ static void mira050_stop_streaming(struct mira050 *mira050)
 		printk(KERN_INFO "[MIRA050]: Skip write_stop_streaming_regs due to mira050->skip_reset == %d.\n", mira050->skip_reset);
 	}
 
-	pm_runtime_put(&client->dev);
+	/*
+	 * With preload, the sensor stays powered with the mode uploaded for the
+	 * autosuspend delay, so a stream-on or bit depth switch within it does
+	 * not upload the full tables.
+	 */
+	if (mira050->preload && mira050->uploaded_mode)
+		mira050_set_preloaded(mira050);
+	mira050_pm_put(mira050);
+
+	mutex_lock(&mira050->mutex);
+	mira050->hw_busy = false;
+	mutex_unlock(&mira050->mutex);
 }
 
 static int mira050_set_stream(struct v4l2_subdev *sd, int enable)
@@ -4846,15 +5492,31 @@ static int mira050_set_stream(struct v4l2_subdev *sd, int enable)
 	struct mira050 *mira050 = to_mira050(sd);
 	int ret = 0;
 
+	/* A queued background upload is finished first and reused */
+	if (enable)
+		flush_work(&mira050->preload_work);
+
+	/*
+	 * The sequence runs under hw_lock. mutex is only taken for the
+	 * short state updates, so queries and control reads do not wait
+	 * for the power-on and the register table upload.
+	 */
+	mutex_lock(&mira050->hw_lock);
 	mutex_lock(&mira050->mutex);
 	if (mira050->streaming == enable)
 	{
 		mutex_unlock(&mira050->mutex);
+		mutex_unlock(&mira050->hw_lock);
 		return 0;
 	}
 
 	printk(KERN_INFO "[MIRA050]: Entering mira050_set_stream enable: %d.\n", enable);
 
+	/* Control writes are synchronous again once stop begins */
+	if (!enable)
+		mira050->streaming = false;
+	mutex_unlock(&mira050->mutex);
+
 	if (enable)
 	{
 		/*
@@ -4864,22 +5526,24 @@ static int mira050_set_stream(struct v4l2_subdev *sd, int enable)
 		ret = mira050_start_streaming(mira050);
 		if (ret)
 			goto err_unlock;
+
+		mutex_lock(&mira050->mutex);
+		mira050->streaming = true;
+		mutex_unlock(&mira050->mutex);
 	}
 	else
 	{
 		mira050_stop_streaming(mira050);
 	}
 
-	mira050->streaming = enable;
-
-	mutex_unlock(&mira050->mutex);
+	mutex_unlock(&mira050->hw_lock);
 
 	printk(KERN_INFO "[MIRA050]: Returning mira050_set_stream with ret: %d.\n", ret);
 
 	return ret;
 
 err_unlock:
-	mutex_unlock(&mira050->mutex);
+	mutex_unlock(&mira050->hw_lock);
 
 	return ret;
 }
@@ -4892,8 +5556,11 @@ static int __maybe_unused mira050_suspend(struct device *dev)
 
 	printk(KERN_INFO "[MIRA050]: Entering suspend function.\n");
 
+	mutex_lock(&mira050->hw_lock);
 	if (mira050->streaming)
 		mira050_stop_streaming(mira050);
+	mira050_drop_preload(mira050);
+	mutex_unlock(&mira050->hw_lock);
 
 	return 0;
 }
@@ -4907,18 +5574,22 @@ static int __maybe_unused mira050_resume(struct device *dev)
 
 	printk(KERN_INFO "[MIRA050]: Entering resume function.\n");
 
+	mutex_lock(&mira050->hw_lock);
 	if (mira050->streaming)
 	{
 		ret = mira050_start_streaming(mira050);
 		if (ret)
 			goto error;
 	}
+	mutex_unlock(&mira050->hw_lock);
 
 	return 0;
 
 error:
-	mira050_stop_streaming(mira050);
+	mutex_lock(&mira050->mutex);
 	mira050->streaming = false;
+	mutex_unlock(&mira050->mutex);
+	mutex_unlock(&mira050->hw_lock);
 
 	return ret;
 }
@@ -4942,26 +5613,37 @@ static int mira050_identify_module(struct mira050 *mira050)
 	int ret;
 	u8 val;
 
-	ret = mira050_read(mira050, 0x25, &val);
+	ret = ams_sensor_read(&mira050->ams, 0x25, &val);
 	printk(KERN_INFO "[MIRA050]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x25, val);
-	ret = mira050_read(mira050, 0x3, &val);
+	ret = ams_sensor_read(&mira050->ams, 0x3, &val);
 	printk(KERN_INFO "[MIRA050]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x3, val);
-	ret = mira050_read(mira050, 0x4, &val);
+	ret = ams_sensor_read(&mira050->ams, 0x4, &val);
 	printk(KERN_INFO "[MIRA050]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x4, val);
 
 	return 0;
 }
 
+static int mira050_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+								   struct v4l2_event_subscription *sub)
+{
+	if (sub->type == AMS_CAMERA_EVENT_CTRL_APPLIED)
+		return v4l2_event_subscribe(fh, sub, MIRA050_CTRL_APPLIED_EVENTS, NULL);
+
+	return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+}
+
 static const struct v4l2_subdev_core_ops mira050_core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+	.subscribe_event = mira050_subscribe_event,
 	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
 static const struct v4l2_subdev_video_ops mira050_video_ops = {
 	.s_stream = mira050_set_stream,
+	.g_frame_interval = mira050_g_frame_interval,
+	.s_frame_interval = mira050_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops mira050_pad_ops = {
@@ -4969,7 +5651,9 @@ static const struct v4l2_subdev_pad_ops mira050_pad_ops = {
 	.get_fmt = mira050_get_pad_format,
 	.set_fmt = mira050_set_pad_format,
 	.get_selection = mira050_get_selection,
+	.set_selection = mira050_set_selection,
 	.enum_frame_size = mira050_enum_frame_size,
+	.enum_frame_interval = mira050_enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops mira050_subdev_ops = {
@@ -4991,10 +5675,11 @@ static int mira050_init_controls(struct mira050 *mira050)
 	int ret;
 	struct v4l2_ctrl_config *mira050_reg_w;
 	struct v4l2_ctrl_config *mira050_reg_r;
+	unsigned int i;
 
 	ctrl_hdlr = &mira050->ctrl_handler;
 	/* v4l2_ctrl_handler_init gives a hint/guess of the number of v4l2_ctrl_new */
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 21);
 	if (ret)
 		return ret;
 
@@ -5011,12 +5696,24 @@ static int mira050_init_controls(struct mira050 *mira050)
 											MIRA050_PIXEL_RATE, 1,
 											MIRA050_PIXEL_RATE);
 
+	/* Limited to the rates listed in DT */
+	mira050->link_freq = v4l2_ctrl_new_int_menu(ctrl_hdlr, &mira050_ctrl_ops,
+												V4L2_CID_LINK_FREQ,
+												ARRAY_SIZE(link_freq_menu) - 1,
+												__ffs(mira050->link_freq_mask),
+												link_freq_menu);
+	if (mira050->link_freq)
+	{
+		mira050->link_freq->menu_skip_mask = ~mira050->link_freq_mask;
+		mira050->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	}
+
 	printk(KERN_INFO "[MIRA050]: %s V4L2_CID_VBLANK %X.\n", __func__, V4L2_CID_VBLANK);
 
 	mira050->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &mira050_ctrl_ops,
 										V4L2_CID_VBLANK, mira050->mode->min_vblank,
 										mira050->mode->max_vblank, 1,
-										MIRA050_MIN_VBLANK_60);
+										mira050_default_vblank(mira050->mode));
 
 	printk(KERN_INFO "[MIRA050]: %s V4L2_CID_HBLANK %X.\n", __func__, V4L2_CID_HBLANK);
 
@@ -5034,9 +5731,12 @@ static int mira050_init_controls(struct mira050 *mira050)
 	printk(KERN_INFO "[MIRA050]: %s V4L2_CID_EXPOSURE %X.\n", __func__, V4L2_CID_EXPOSURE);
 	mira050->exposure = v4l2_ctrl_new_std(ctrl_hdlr, &mira050_ctrl_ops,
 										  V4L2_CID_EXPOSURE,
-										  MIRA050_EXPOSURE_MIN_LINES, MIRA050_EXPOSURE_MAX_LINES,
+										  mira050_calculate_min_exposure_time(mira050->mode),
+										  mira050_calculate_max_exposure_time(mira050->mode,
+																			  mira050->mode->min_vblank),
 										  1,
-										  MIRA050_DEFAULT_EXPOSURE_LINES);
+										  mira050_exposure_us_to_lines(mira050->mode,
+																	   MIRA050_DEFAULT_EXPOSURE_US));
 	printk(KERN_INFO "[MIRA050]: %s V4L2_CID_ANALOGUE_GAIN %X.\n", __func__, V4L2_CID_ANALOGUE_GAIN);
 
 	mira050->gain = v4l2_ctrl_new_std(ctrl_hdlr, &mira050_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
@@ -5076,6 +5776,13 @@ static int mira050_init_controls(struct mira050 *mira050)
 	if (mira050->mira050_reg_r)
 		mira050->mira050_reg_r->flags |= (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_READ_ONLY);
 
+	/* Control delays and startup frames, read-only */
+	for (i = 2; i < ARRAY_SIZE(custom_ctrl_config_list); i++)
+		v4l2_ctrl_new_custom(ctrl_hdlr, &custom_ctrl_config_list[i], NULL);
+
+	ams_sensor_gain_linear_init(&mira050->ams, ctrl_hdlr, &mira050_ctrl_ops,
+								mira050->gain);
+
 	if (ctrl_hdlr->error)
 	{
 		ret = ctrl_hdlr->error;
@@ -5110,11 +5817,12 @@ static void mira050_free_controls(struct mira050 *mira050)
 	mutex_destroy(&mira050->mutex);
 }
 
-static int mira050_check_hwcfg(struct device *dev)
+static int mira050_check_hwcfg(struct device *dev, struct mira050 *mira050)
 {
 	struct fwnode_handle *endpoint;
 	struct v4l2_fwnode_endpoint ep_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY};
+	unsigned int i, j;
 	int ret = -EINVAL;
 
 	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -5144,11 +5852,25 @@ static int mira050_check_hwcfg(struct device *dev)
 		goto error_out;
 	}
 
-	if (ep_cfg.nr_of_link_frequencies != 1 ||
-		ep_cfg.link_frequencies[0] != MIRA050_DEFAULT_LINK_FREQ)
+	mira050->link_freq_mask = 0;
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++)
+	{
+		for (j = 0; j < ARRAY_SIZE(link_freq_menu); j++)
+		{
+			if (ep_cfg.link_frequencies[i] == link_freq_menu[j])
+			{
+				mira050->link_freq_mask |= BIT(j);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(link_freq_menu))
+			dev_warn(dev, "Link frequency not supported: %lld\n",
+					 ep_cfg.link_frequencies[i]);
+	}
+
+	if (!mira050->link_freq_mask)
 	{
-		dev_err(dev, "Link frequency not supported: %lld\n",
-				ep_cfg.link_frequencies[0]);
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto error_out;
 	}
 
@@ -5162,11 +5884,8 @@ error_out:
 	return ret;
 }
 
-static int mira050pmic_init_controls(struct i2c_client *pmic_client, struct i2c_client *uc_client)
-{
-	int ret;
-	u8 val;
-
+/* Board bring-up: uC, PMIC supplies and the green LED */
+static const struct ams_pmic_step mira050_pmic_init_seq[] = {
 	// uC, set atb and jtag high
 	// according to old uC fw (svn rev41)
 	// 12[3] ldo en
@@ -5174,156 +5893,201 @@ static int mira050pmic_init_controls(struct i2c_client *pmic_client, struct i2c_
 	// 11/12 i/o direction, 15/16 output high/low
 	// uC, set atb and jtag high
 	// WARNING this only works on interposer v2 if R307 is not populated. otherwise, invert the bit for ldo
-	ret = mira050pmic_write(uc_client, 12, 0xF7);
-	ret = mira050pmic_write(uc_client, 16, 0xFF); // ldo en:1
-	ret = mira050pmic_write(uc_client, 11, 0XCF);
-	ret = mira050pmic_write(uc_client, 15, 0xFF);
-	ret = mira050pmic_write(uc_client, 6, 1); // write
+	AMS_UC_W(12, 0xF7),
+	AMS_UC_W(16, 0xFF), // ldo en:1
+	AMS_UC_W(11, 0xCF),
+	AMS_UC_W(15, 0xFF),
+	AMS_UC_W(6, 1), // write
 
 	// Disable master switch //
-	ret = mira050pmic_write(pmic_client, 0x62, 0x00);
+	AMS_PMIC_W(0x62, 0x00),
 
 	// Set all voltages to 0
 
 	// DCDC1=0V
-	ret = mira050pmic_write(pmic_client, 0x05, 0x00);
+	AMS_PMIC_W(0x05, 0x00),
 	// DCDC4=0V
-	ret = mira050pmic_write(pmic_client, 0x0E, 0x0);
+	AMS_PMIC_W(0x0E, 0x0),
 	// LDO1=0V VDDLO_PLL
-	ret = mira050pmic_write(pmic_client, 0x11, 0x0);
+	AMS_PMIC_W(0x11, 0x0),
 	// LDO2=0.0V
-	ret = mira050pmic_write(pmic_client, 0x14, 0x00);
+	AMS_PMIC_W(0x14, 0x00),
 	// LDO3=0.0V
-	ret = mira050pmic_write(pmic_client, 0x17, 0x00);
+	AMS_PMIC_W(0x17, 0x00),
 	// LDO4=0V
-	ret = mira050pmic_write(pmic_client, 0x1A, 0x00);
+	AMS_PMIC_W(0x1A, 0x00),
 	// LDO5=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1C, 0x00);
+	AMS_PMIC_W(0x1C, 0x00),
 	// LDO6=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1D, 0x00);
+	AMS_PMIC_W(0x1D, 0x00),
 	// LDO7=0V
-	ret = mira050pmic_write(pmic_client, 0x1E, 0x0);
+	AMS_PMIC_W(0x1E, 0x0),
 	// LDO8=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1F, 0x00);
+	AMS_PMIC_W(0x1F, 0x00),
 	// Disable LDO9 Lock
-	ret = mira050pmic_write(pmic_client, 0x24, 0x48);
+	AMS_PMIC_W(0x24, 0x48),
 	// LDO9=0V VDDHI
-	ret = mira050pmic_write(pmic_client, 0x20, 0x00);
+	AMS_PMIC_W(0x20, 0x00),
 	// LDO10=0V VDDLO_ANA
-	ret = mira050pmic_write(pmic_client, 0x21, 0x0);
+	AMS_PMIC_W(0x21, 0x0),
 
 	// Enable master switch //
-	usleep_range(50, 60);
-	ret = mira050pmic_write(pmic_client, 0x62, 0x0D); // enable master switch
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_W(0x62, 0x0D), // enable master switch
+	AMS_PMIC_SLEEP(50, 60),
 
 	// start PMIC
 	// Keep LDOs always on
-	ret = mira050pmic_write(pmic_client, 0x27, 0xFF);
-	ret = mira050pmic_write(pmic_client, 0x28, 0xFF);
-	ret = mira050pmic_write(pmic_client, 0x29, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x2A, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x2B, 0x00);
+	AMS_PMIC_W(0x27, 0xFF),
+	AMS_PMIC_W(0x28, 0xFF),
+	AMS_PMIC_W(0x29, 0x00),
+	AMS_PMIC_W(0x2A, 0x00),
+	AMS_PMIC_W(0x2B, 0x00),
 
 	// Unused LDO off //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// set GPIO1=0
-	ret = mira050pmic_write(pmic_client, 0x41, 0x04);
+	AMS_PMIC_W(0x41, 0x04),
 	// DCDC2=0.0V SPARE_PWR1
-	ret = mira050pmic_write(pmic_client, 0x01, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x08, 0x00);
+	AMS_PMIC_W(0x01, 0x00),
+	AMS_PMIC_W(0x08, 0x00),
 	// DCDC3=0V SPARE_PWR1
-	ret = mira050pmic_write(pmic_client, 0x02, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x0B, 0x00);
+	AMS_PMIC_W(0x02, 0x00),
+	AMS_PMIC_W(0x0B, 0x00),
 	// LDO2=0.0V
-	ret = mira050pmic_write(pmic_client, 0x14, 0x00);
+	AMS_PMIC_W(0x14, 0x00),
 	// LDO3=0.0V
-	ret = mira050pmic_write(pmic_client, 0x17, 0x00);
+	AMS_PMIC_W(0x17, 0x00),
 	// LDO5=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1C, 0x00);
+	AMS_PMIC_W(0x1C, 0x00),
 	// LDO6=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1D, 0x00);
+	AMS_PMIC_W(0x1D, 0x00),
 	// LDO8=0.0V
-	ret = mira050pmic_write(pmic_client, 0x1F, 0x00);
+	AMS_PMIC_W(0x1F, 0x00),
 
-	ret = mira050pmic_write(pmic_client, 0x42, 4);
+	AMS_PMIC_W(0x42, 4),
 
 	// Enable 1.80V //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// DCDC1=1.8V VINLDO1p8 >=1P8
-	ret = mira050pmic_write(pmic_client, 0x00, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x04, 0x34);
-	ret = mira050pmic_write(pmic_client, 0x06, 0xBF);
-	ret = mira050pmic_write(pmic_client, 0x05, 0xB4);
+	AMS_PMIC_W(0x00, 0x00),
+	AMS_PMIC_W(0x04, 0x34),
+	AMS_PMIC_W(0x06, 0xBF),
+	AMS_PMIC_W(0x05, 0xB4),
 	// DCDC4=1.8V VDDIO
-	ret = mira050pmic_write(pmic_client, 0x03, 0x00);
-	ret = mira050pmic_write(pmic_client, 0x0D, 0x34);
-	ret = mira050pmic_write(pmic_client, 0x0F, 0xBF);
-	ret = mira050pmic_write(pmic_client, 0x0E, 0xB4);
+	AMS_PMIC_W(0x03, 0x00),
+	AMS_PMIC_W(0x0D, 0x34),
+	AMS_PMIC_W(0x0F, 0xBF),
+	AMS_PMIC_W(0x0E, 0xB4),
 
 	// Enable 2.85V //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// LDO4=2.85V VDDHI alternativ
-	ret = mira050pmic_write(pmic_client, 0x1A, 0xB8); // Either 0x00 or 0xB8
+	AMS_PMIC_W(0x1A, 0xB8), // Either 0x00 or 0xB8
 	// Disable LDO9 Lock
-	ret = mira050pmic_write(pmic_client, 0x24, 0x48);
+	AMS_PMIC_W(0x24, 0x48),
 	// LDO9=2.85V VDDHI
-	ret = mira050pmic_read(pmic_client, 0x20, &val);
-	dev_err(&pmic_client->dev, "Read 0x20 with val %x\n", val);
-	ret = mira050pmic_write(pmic_client, 0x20, 0xB9);
-	ret = mira050pmic_read(pmic_client, 0x20, &val);
-	dev_err(&pmic_client->dev, "Read 0x20 with val %x\n", val);
+	AMS_PMIC_W(0x20, 0xB9),
 
 	// VPIXH on cob = vdd25A on interposer = LDO4 on pmic
 	// VPIXH should connect to VDD28 on pcb, or enable 4th supply
-	ret = mira050pmic_read(pmic_client, 0x19, &val);
-	dev_err(&pmic_client->dev, "Read 0x19 with val %x\n", val);
-	ret = mira050pmic_write(pmic_client, 0x19, 0x38);
-	ret = mira050pmic_read(pmic_client, 0x19, &val);
-	dev_err(&pmic_client->dev, "Read 0x19 with val %x\n", val);
+	AMS_PMIC_W(0x19, 0x38),
 
 	// Enable 1.2V //
-	usleep_range(700, 710);
+	AMS_PMIC_SLEEP(700, 710),
 	// LDO1=1.2V VDDLO_PLL
-	ret = mira050pmic_write(pmic_client, 0x12, 0x16);
-	ret = mira050pmic_write(pmic_client, 0x10, 0x16);
-	ret = mira050pmic_write(pmic_client, 0x11, 0x90);
+	AMS_PMIC_W(0x12, 0x16),
+	AMS_PMIC_W(0x10, 0x16),
+	AMS_PMIC_W(0x11, 0x90),
 	// LDO7=1.2V VDDLO_DIG
-	ret = mira050pmic_write(pmic_client, 0x1E, 0x90);
+	AMS_PMIC_W(0x1E, 0x90),
 	// LDO10=1.2V VDDLO_ANA
-	ret = mira050pmic_write(pmic_client, 0x21, 0x90);
+	AMS_PMIC_W(0x21, 0x90),
 
 	// Enable green LED //
-	usleep_range(50, 60);
-	ret = mira050pmic_write(pmic_client, 0x42, 0x15); // gpio2
-	// ret = mira050pmic_write(pmic_client, 0x43, 0x40); // leda
-	// ret = mira050pmic_write(pmic_client, 0x44, 0x40); // ledb
-	ret = mira050pmic_write(pmic_client, 0x45, 0x40); // ledc
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_W(0x42, 0x15), // gpio2
+	// AMS_PMIC_W(0x43, 0x40), // leda
+	// AMS_PMIC_W(0x44, 0x40), // ledb
+	AMS_PMIC_W(0x45, 0x40), // ledc
 
-	// ret = mira050pmic_write(pmic_client, 0x47, 0x02); // leda ctrl1
-	// ret = mira050pmic_write(pmic_client, 0x4F, 0x02); // ledb ctrl1
-	ret = mira050pmic_write(pmic_client, 0x57, 0x02); // ledc ctrl1
+	// AMS_PMIC_W(0x47, 0x02), // leda ctrl1
+	// AMS_PMIC_W(0x4F, 0x02), // ledb ctrl1
+	AMS_PMIC_W(0x57, 0x02), // ledc ctrl1
 
-	// ret = mira050pmic_write(pmic_client, 0x4D, 0x01); // leda ctrl1
-	// ret = mira050pmic_write(pmic_client, 0x55, 0x10); // ledb ctrl7
-	ret = mira050pmic_write(pmic_client, 0x5D, 0x10); // ledc ctrl7
-	ret = mira050pmic_write(pmic_client, 0x61, 0x10); // led seq -- use this to turn on leds. abc0000- 1110000 for all leds
+	// AMS_PMIC_W(0x4D, 0x01), // leda ctrl1
+	// AMS_PMIC_W(0x55, 0x10), // ledb ctrl7
+	AMS_PMIC_W(0x5D, 0x10), // ledc ctrl7
+	AMS_PMIC_W(0x61, 0x10), // led seq -- use this to turn on leds. abc0000- 1110000 for all leds
 
 	// uC, set atb and jtag high and ldo_en
-	ret = mira050pmic_write(uc_client, 12, 0xF7);
-	ret = mira050pmic_write(uc_client, 16, 0xF7); // ldo en:0
+	AMS_UC_W(12, 0xF7),
+	AMS_UC_W(16, 0xF7), // ldo en:0
 	/*
 	 * In Mira050-bringup.py, write 11, 0xCF; 15: 0x30.
 	 * In mira050.py, write 11, 0x8D; 15, 0xFD.
 	 */
-	ret = mira050pmic_write(uc_client, 11, 0X8D);
-	ret = mira050pmic_write(uc_client, 15, 0xFD);
-	ret = mira050pmic_write(uc_client, 6, 1); // write
+	AMS_UC_W(11, 0x8D),
+	AMS_UC_W(15, 0xFD),
+	AMS_UC_W(6, 1), // write
+
+	AMS_PMIC_SLEEP(2000000, 2001000),
+};
+
+/* OFFSET_CLIPPING tables of the last OTP read, for calibration audits */
+static int mira050_offset_clipping_show(struct seq_file *s, void *data)
+{
+	struct mira050 *mira050 = s->private;
+	unsigned int i;
+
+	mutex_lock(&mira050->hw_lock);
+	if (!mira050->offset_clipping_valid)
+	{
+		seq_puts(s, "OTP not read yet, stream once to compute the tables\n");
+		goto out;
+	}
 
-	usleep_range(2000000, 2001000);
+	seq_printf(s, "otp_dark_cal 12bit %u 10bit_hs %u 8bit %u\n",
+			   mira050->otp_dark_cal_12bit, mira050->otp_dark_cal_10bit_hs,
+			   mira050->otp_dark_cal_8bit);
+	seq_puts(s, "bit_depth gain_index analog_gain offset_clipping\n");
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_12bit); i++)
+		seq_printf(s, "12 %u %u %u\n", i, AMS_CAMERA_GAIN_LINEAR_UNITY << i,
+				   mira050->offset_clipping_12bit[i]);
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_10bit_hs); i++)
+		seq_printf(s, "10 %u %u %u\n", i, fine_gain_lut_10bit_hs_4x[i].analog_gain,
+				   mira050->offset_clipping_10bit_hs[i]);
+	for (i = 0; i < ARRAY_SIZE(mira050->offset_clipping_8bit); i++)
+		seq_printf(s, "8 %u %u %u\n", i, fine_gain_lut_8bit_16x[i].analog_gain,
+				   mira050->offset_clipping_8bit[i]);
+out:
+	mutex_unlock(&mira050->hw_lock);
 
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mira050_offset_clipping);
+
+static void mira050_debugfs_init(struct mira050 *mira050)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira050->sd);
+	char name[32];
+
+	snprintf(name, sizeof(name), "mira050-%s", dev_name(&client->dev));
+	mira050->debugfs = debugfs_create_dir(name, NULL);
+	ams_sensor_trace_init(&mira050->ams, mira050->debugfs);
+	debugfs_create_file("offset_clipping", 0400, mira050->debugfs, mira050,
+						&mira050_offset_clipping_fops);
+}
+
+static void mira050_debugfs_cleanup(struct mira050 *mira050)
+{
+	debugfs_remove_recursive(mira050->debugfs);
+	mira050->debugfs = NULL;
+	ams_sensor_trace_cleanup(&mira050->ams);
+}
+
+/* Defined next to the device id tables in mira050.c */
+static const struct mira050_variant *mira050_get_variant(struct i2c_client *client);
 
 static int mira050_probe(struct i2c_client *client)
 {
@@ -5342,16 +6106,31 @@ static int mira050_probe(struct i2c_client *client)
 
 	v4l2_i2c_subdev_init(&mira050->sd, client, &mira050_subdev_ops);
 
+	mira050->variant = mira050_get_variant(client);
+	if (!mira050->variant)
+		return -ENODEV;
+	printk(KERN_INFO "[MIRA050]: %s variant.\n", mira050->variant->name);
+
+	mira050->ams.client = client;
+	mira050->ams.ops = &mira050_ams_ops;
+	mira050->ams.bank_sel_reg = AMS_SENSOR_SEL_REG(MIRA050_BANK_SEL_REG);
+	mira050->ams.context_sel_reg = AMS_SENSOR_SEL_REG(MIRA050_RW_CONTEXT_REG);
+	mutex_init(&mira050->hw_lock);
+	seqlock_init(&mira050->fmt_seqlock);
+
 	/* Check the hardware configuration in device tree */
-	if (mira050_check_hwcfg(dev))
+	if (mira050_check_hwcfg(dev, mira050))
 		return -EINVAL;
 
 	/* Parse device tree to check if dtoverlay has param skip-reg-upload=1 */
 	device_property_read_u32(dev, "skip-reg-upload", &mira050->skip_reg_upload);
 	printk(KERN_INFO "[MIRA050]: skip-reg-upload %d.\n", mira050->skip_reg_upload);
+	/* Opt-in background mode upload, dtoverlay param preload=1 */
+	device_property_read_u32(dev, "preload", &mira050->preload);
+	printk(KERN_INFO "[MIRA050]: preload %d.\n", mira050->preload);
 	/* Set default TBD I2C device address to LED I2C Address*/
-	mira050->tbd_client_i2c_addr = MIRA050LED_I2C_ADDR;
-	printk(KERN_INFO "[MIRA050]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira050->tbd_client_i2c_addr);
+	mira050->ams.tbd_client_i2c_addr = MIRA050LED_I2C_ADDR;
+	printk(KERN_INFO "[MIRA050]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira050->ams.tbd_client_i2c_addr);
 
 	/* Get system clock (xclk) */
 	mira050->xclk = devm_clk_get(dev, NULL);
@@ -5378,19 +6157,20 @@ static int mira050_probe(struct i2c_client *client)
 
 	{
 		printk(KERN_INFO "[MIRA050]: Init PMIC and uC and led driver.\n");
-		mira050->pmic_client = i2c_new_dummy_device(client->adapter,
+		mira050->ams.pmic_client = i2c_new_dummy_device(client->adapter,
 													MIRA050PMIC_I2C_ADDR);
-		if (IS_ERR(mira050->pmic_client))
-			return PTR_ERR(mira050->pmic_client);
-		mira050->uc_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira050->ams.pmic_client))
+			return PTR_ERR(mira050->ams.pmic_client);
+		mira050->ams.uc_client = i2c_new_dummy_device(client->adapter,
 												  MIRA050UC_I2C_ADDR);
-		if (IS_ERR(mira050->uc_client))
-			return PTR_ERR(mira050->uc_client);
-		mira050->led_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira050->ams.uc_client))
+			return PTR_ERR(mira050->ams.uc_client);
+		mira050->ams.led_client = i2c_new_dummy_device(client->adapter,
 												   MIRA050LED_I2C_ADDR);
-		if (IS_ERR(mira050->led_client))
-			return PTR_ERR(mira050->led_client);
-		mira050pmic_init_controls(mira050->pmic_client, mira050->uc_client);
+		if (IS_ERR(mira050->ams.led_client))
+			return PTR_ERR(mira050->ams.led_client);
+		ams_pmic_run_seq(&mira050->ams, mira050_pmic_init_seq,
+						 ARRAY_SIZE(mira050_pmic_init_seq));
 	}
 
 	dev_err(dev, "[MIRA050] Sleep for 1 second to let PMIC driver complete init.\n");
@@ -5423,11 +6203,21 @@ static int mira050_probe(struct i2c_client *client)
 	/* Set default mode to max resolution */
 	mira050->mode = &supported_modes[0];
 
+	spin_lock_init(&mira050->ctrl_pending_lock);
+	INIT_WORK(&mira050->ctrl_work, mira050_ctrl_work);
+	INIT_WORK(&mira050->preload_work, mira050_preload_work);
+	mira050->ctrl_wq = alloc_ordered_workqueue("mira050-ctrl", 0);
+	if (!mira050->ctrl_wq)
+	{
+		ret = -ENOMEM;
+		goto error_power_off;
+	}
+
 	printk(KERN_INFO "[MIRA050]: Entering init controls function.\n");
 
 	ret = mira050_init_controls(mira050);
 	if (ret)
-		goto error_power_off;
+		goto error_destroy_wq;
 
 	/* Initialize subdev */
 	mira050->sd.internal_ops = &mira050_internal_ops;
@@ -5465,6 +6255,15 @@ static int mira050_probe(struct i2c_client *client)
 	/* For debug purpose */
 	// mira050_start_streaming(mira050);
 
+	mira050_debugfs_init(mira050);
+
+	/* An unused preload powers off after a bounded delay */
+	if (mira050->preload)
+	{
+		pm_runtime_set_autosuspend_delay(dev, MIRA050_PRELOAD_AUTOSUSPEND_MS);
+		pm_runtime_use_autosuspend(dev);
+	}
+
 	/* Enable runtime PM and turn off the device */
 	pm_runtime_set_active(dev);
 	pm_runtime_enable(dev);
@@ -5478,12 +6277,15 @@ error_media_entity:
 error_handler_free:
 	mira050_free_controls(mira050);
 
+error_destroy_wq:
+	destroy_workqueue(mira050->ctrl_wq);
+
 error_power_off:
 	mira050_power_off(dev);
 
-	i2c_unregister_device(mira050->pmic_client);
-	i2c_unregister_device(mira050->uc_client);
-	i2c_unregister_device(mira050->led_client);
+	i2c_unregister_device(mira050->ams.pmic_client);
+	i2c_unregister_device(mira050->ams.uc_client);
+	i2c_unregister_device(mira050->ams.led_client);
 
 	return ret;
 }
@@ -5493,14 +6295,22 @@ static void mira050_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct mira050 *mira050 = to_mira050(sd);
 
-	i2c_unregister_device(mira050->pmic_client);
-	i2c_unregister_device(mira050->uc_client);
-	i2c_unregister_device(mira050->led_client);
+	i2c_unregister_device(mira050->ams.pmic_client);
+	i2c_unregister_device(mira050->ams.uc_client);
+	i2c_unregister_device(mira050->ams.led_client);
+
+	mira050_debugfs_cleanup(mira050);
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	cancel_work_sync(&mira050->ctrl_work);
+	cancel_work_sync(&mira050->preload_work);
+	mira050_drop_preload(mira050);
+	destroy_workqueue(mira050->ctrl_wq);
 	mira050_free_controls(mira050);
+	ams_sensor_fw_release(&mira050->ams);
 
+	pm_runtime_dont_use_autosuspend(&client->dev);
 	pm_runtime_disable(&client->dev);
 	if (!pm_runtime_status_suspended(&client->dev))
 		mira050_power_off(&client->dev);
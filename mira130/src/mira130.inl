@@ -12,6 +12,7 @@
 
 #include <linux/clk.h>
 #include <linux/delay.h>
+#include <linux/gcd.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
 #include <linux/module.h>
@@ -24,13 +25,24 @@
 #include <media/v4l2-mediabus.h>
 #include <asm/unaligned.h>
 
+#include "ams_sensor_core.h"
+
 /*
- * Introduce new v4l2 control
+ * Frames until a control written during frame N is used, and frames to
+ * drop after stream-on. Exposure and gain are launched together by the
+ * group hold and taken at the start of frame N + 1, whose rows the
+ * rolling shutter has already started exposing with the old exposure,
+ * so frame N + 2 is the first to use them. The group hold keeps the
+ * gain on that same frame. The frame length is written outside the hold
+ * and sets the length of frame N + 1. HDR modes write the short
+ * exposure and gain in the same hold, so no mode changes this. The
+ * first frame after stream-on runs with the sensor still settling.
+ * Check with tools/ctrl_latency -c.
  */
-#include <linux/v4l2-controls.h>
-#define AMS_CAMERA_CID_BASE		(V4L2_CTRL_CLASS_CAMERA | 0x2000)
-#define AMS_CAMERA_CID_MIRA_REG_W	(AMS_CAMERA_CID_BASE+0)
-#define AMS_CAMERA_CID_MIRA_REG_R	(AMS_CAMERA_CID_BASE+1)
+#define MIRA130_EXPOSURE_DELAY	2
+#define MIRA130_GAIN_DELAY	2
+#define MIRA130_VBLANK_DELAY	1
+#define MIRA130_STARTUP_FRAMES	2
 
 /* Most significant Byte is flag, and most significant bit is unused. */
 #define AMS_CAMERA_CID_MIRA130_REG_FLAG_FOR_READ        0b00000001
@@ -64,7 +76,7 @@
  * The TBD I2C address is default to MIRA130LED_I2C_ADDR.
  * To change the TBD I2C address, set bit 6&7 to 0b10,
  * then the reg_val will become TBD I2C address.
- * The TBD I2C address is stored in mira130->tbd_client_i2c_addr.
+ * The TBD I2C address is stored in mira130->ams.tbd_client_i2c_addr.
  */
 #define AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL         0b01100000
 #define AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_MIRA        0b00000000
@@ -116,11 +128,36 @@
 #define MIRA130_EXP_TIME_HI_REG			0x3E00
 #define MIRA130_EXP_TIME_LO_REG			0x3E02
 
+/*
+ * Group hold. Writes between START and LAUNCH are buffered and taken
+ * together at the next frame start.
+ */
+#define MIRA130_GROUP_HOLD_REG			0x3812
+#define MIRA130_GROUP_HOLD_START		0x00
+#define MIRA130_GROUP_HOLD_LAUNCH		0x30
+
 #define MIRA130_AGC_MODE_REG			0x3E03
 #define MIRA130_ANA_GAIN_REG			0x3E08
 #define MIRA130_ANA_FINE_GAIN_REG		0x3E09
 #define MIRA130_HDR_ANA_GAIN_REG		0x3E12
 #define MIRA130_HDR_ANA_FINE_GAIN_REG		0x3E13
+/* Each bit of the coarse gain doubles the gain, fine gain 0x20 is x1 */
+#define MIRA130_ANA_GAIN_COARSE_MASK		0x3C
+#define MIRA130_ANA_FINE_GAIN_UNITY		0x20
+
+/*
+ * Line interleaved HDR. Every sensor row is exposed twice, long with
+ * EXP_TIME and ANA_GAIN, short with HDR_EXP_TIME and HDR_ANA_GAIN. No
+ * HDR mode is registered in supported_modes[] until the vendor HDR
+ * sequence is in the tree: the enable bit, the short exposure window
+ * registers and the row accounting are not known. The enable shares
+ * its register with other settings, so it has to be a read-modify-write
+ * in start_streaming, not an hdr_reg_list entry.
+ */
+#define MIRA130_HDR_EXP_TIME_HI_REG		0x3E04
+#define MIRA130_HDR_EXP_TIME_LO_REG		0x3E05
+#define MIRA130_HDR_SHORT_EXPOSURE_MAX		128
+#define MIRA130_HDR_SHORT_EXPOSURE_DEFAULT	32
 
 // VBLANK is indicated in number of rows
 #define MIRA130_VBLANK_HI_REG			0x320E
@@ -149,35 +186,22 @@
 #define MIRA130_XCLR_MIN_DELAY_US		100000
 #define MIRA130_XCLR_DELAY_RANGE_US		30
 
-// pixel_rate = link_freq * 2 * nr_of_lanes / bits_per_sample
-// 0.6Gb/s * 2 * 2 / 10 = 257698038
-#define MIRA130_PIXEL_RATE		(257698037)
-/* Should match device tree link freq */
+// Row time is ROW_LENGTH (0x320C, 0x320D) cycles of the row clock.
+// The 60 fps table runs ROW_LENGTH=750 and 1400 rows per frame,
+// so the row clock is 750 * 1400 * 60 = 63 MHz and a row takes 11.9 us.
+#define MIRA130_ROW_CLK_FREQ		63000000
+
+// PIXEL_RATE is the row clock scaled by 2, so that a line of WIDTH + HBLANK
+// pixels takes exactly one row time.
+#define MIRA130_PIXEL_RATE		(2 * MIRA130_ROW_CLK_FREQ)
+#define MIRA130_LINE_LENGTH(row_length)	\
+	((row_length) * (MIRA130_PIXEL_RATE / MIRA130_ROW_CLK_FREQ))
+/* Link freq of the PLL and CSI settings in the mode tables */
 #define MIRA130_DEFAULT_LINK_FREQ	456000000
 
-/* Trick the libcamera with achievable fps via hblank */
-
-/* Formular in libcamera to derive TARGET_FPS:
- * TARGET_FPS=1/((1/MIRA130_PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+MIRA130_MIN_VBLANK))
- * Example: 1080x1280 with HBLANK=0 and MIRA130_MIN_VBLANK=120
- * TARGET_FPS=1/((1/257698037)*1080*(1280+120))=170
- * 
- * Inverse the above formula to derive HBLANK from TARGET_FPS:
- * HBLANK=1/((1/MIRA130_PIXEL_RATE)*TARGET_FPS*(HEIGHT+MIRA130_MIN_VBLANK))-WIDTH
- * Example with TARGET_FPS of 60 fps for 1080x1280
- * HBLANK=1/((1/257698037)*60*(1280+120))-1080=1988
- */
-#define MIRA130_HBLANK_1080x1280_60FPS		1988
-
 /* Set max VBLANK to be 2 fps */
-/*
- * TARGET_FPS=1/((1/MIRA130_PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+VBLANK))
- * VBLANK=1/((1/MIRA130_PIXEL_RATE)*TARGET_FPS*(WIDTH+HBLANK))-HEIGHT
- * Example with TARGET_FPS of 2 fps and HBLANK of 1988
- * VBLANK=1/((1/257698037)*2*(1080+1988))-1280=40717
- */
-#define MIRA130_VBLANK_1080x1280_2FPS		40717
-#define MIRA130_MAX_VBLANK			MIRA130_VBLANK_1080x1280_2FPS
+#define MIRA130_MAX_VBLANK	\
+	(MIRA130_ROW_CLK_FREQ / (2 * MIRA130_ROW_LENGTH_MIN) - MIRA130_MIN_V_SIZE)
 
 #define MIRA130_REG_TEST_PATTERN	0x4501
 #define	MIRA130_TEST_PATTERN_DISABLE	0x00
@@ -201,11 +225,6 @@ enum pad_types {
 	NUM_PADS
 };
 
-struct mira130_reg {
-	u16 address;
-	u8 val;
-};
-
 struct mira130_analog_gain_lut {
 	u8 gain;
 	u8 fine_gain;
@@ -214,7 +233,7 @@ struct mira130_analog_gain_lut {
 
 struct mira130_reg_list {
 	unsigned int num_of_regs;
-	const struct mira130_reg *regs;
+	const struct ams_sensor_reg *regs;
 };
 
 struct mira130_v4l2_reg {
@@ -238,10 +257,14 @@ struct mira130_mode {
 	u32 vblank;
 	u32 hblank;
 	u32 code;
+
+	/* Line interleaved HDR, hdr_reg_list is written after reg_list */
+	bool hdr;
+	struct mira130_reg_list hdr_reg_list;
 };
 
 // 1080_1280_60fps_10b_2lanes
-static const struct mira130_reg full_1080_1280_60fps_10b_2lanes_reg[] = {
+static const struct ams_sensor_reg full_1080_1280_60fps_10b_2lanes_reg[] = {
 	{0x0103,0x01},
 	{0x0100,0x00},
 	{0x36e9,0x80},
@@ -529,6 +552,16 @@ static const char * const mira130_supply_name[] = {
 
 #define MIRA130_NUM_SUPPLIES ARRAY_SIZE(mira130_supply_name)
 
+/*
+ * MIPI link frequencies, in V4L2_CID_LINK_FREQ menu order. The mode tables
+ * program MIRA130_DEFAULT_LINK_FREQ. Other rates need their CSI PLL
+ * and D-PHY timing registers, which are not known yet, so the control is
+ * read-only until then.
+ */
+static const s64 link_freq_menu[] = {
+	MIRA130_DEFAULT_LINK_FREQ,
+};
+
 /*
  * The supported formats. All flip/mirror combinations have the same byte order because the sensor
  * is monochrome
@@ -556,7 +589,7 @@ static const struct mira130_mode supported_modes[] = {
 		// ROW_LENGTH is configured by register 0x320C, 0x320D.
 		.row_length = MIRA130_ROW_LENGTH_MIN,
 		.vblank = MIRA130_MIN_VBLANK,
-		.hblank = MIRA130_HBLANK_1080x1280_60FPS,
+		.hblank = MIRA130_LINE_LENGTH(MIRA130_ROW_LENGTH_MIN) - 1080,
 		.code = MEDIA_BUS_FMT_SGRBG10_1X10,
 	},
 };
@@ -575,17 +608,25 @@ struct mira130 {
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *link_freq;
+	/* Entries of link_freq_menu listed in device tree */
+	unsigned long link_freq_mask;
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
 	struct v4l2_ctrl *hblank;
+	/*
+	 * Exposure and gain cluster, written in one group hold.
+	 * Keep the four pointers together, exposure is the cluster master.
+	 */
 	struct v4l2_ctrl *exposure;
 	struct v4l2_ctrl *gain;
+	/* Short exposure and gain of HDR modes */
+	struct v4l2_ctrl *exposure_short;
+	struct v4l2_ctrl *gain_short;
 	// custom v4l2 control
 	struct v4l2_ctrl *mira130_reg_w;
 	struct v4l2_ctrl *mira130_reg_r;
-	u16 mira130_reg_w_cached_addr;
-	u8 mira130_reg_w_cached_flag;
 
 
 	/* Current mode */
@@ -602,19 +643,28 @@ struct mira130 {
 
 	/*
 	 * Mutex for serialized access:
-	 * Protect sensor module set pad format and start/stop streaming safely.
+	 * Control handler lock, protects driver state and control ranges.
+	 * Not held across power-on and register table upload.
 	 */
 	struct mutex mutex;
+	/*
+	 * Serializes hardware sequences (stream on/off, suspend/resume) and
+	 * ACTIVE format changes. Lock order: hw_lock, then mutex.
+	 */
+	struct mutex hw_lock;
+	/* Set while a hardware sequence runs without mutex */
+	bool hw_busy;
+	/*
+	 * Publishes mode and fmt so format and selection queries
+	 * can read them without taking mutex.
+	 */
+	seqlock_t fmt_seqlock;
 
 	/* Streaming on/off */
 	bool streaming;
 
-	/* pmic, uC, LED */
-	struct i2c_client *pmic_client;
-	struct i2c_client *uc_client;
-	struct i2c_client *led_client;
-	/* User specified I2C device address */
-	u32 tbd_client_i2c_addr;
+	/* I2C transport, pmic, uC, LED and the REG_W/REG_R state */
+	struct ams_sensor ams;
 
 };
 
@@ -623,195 +673,6 @@ static inline struct mira130 *to_mira130(struct v4l2_subdev *_sd)
 	return container_of(_sd, struct mira130, sd);
 }
 
-static int mira130_read(struct mira130 *mira130, u16 reg, u8 *val)
-{
-	int ret;
-	unsigned char data_w[2] = { reg >> 8, reg & 0xff };
-	struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2) {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-			__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, val, 1);
-	/*
-	 * The only return value indicating success is 1. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 1) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira130_write(struct mira130 *mira130, u16 reg, u8 val)
-{
-	int ret;
-	unsigned char data[3] = { reg >> 8, reg & 0xff, val};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
-
-	ret = i2c_master_send(client, data, 3);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 3) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * mira130 is big-endian: msb of val goes to lower reg addr
- */
-static int mira130_write16(struct mira130 *mira130, u16 reg, u16 val)
-{
-       int ret;
-       unsigned char data[4] = { reg >> 8, reg & 0xff, (val >> 8) & 0xff, val & 0xff };
-       struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
-
-       ret = i2c_master_send(client, data, 4);
-       /*
-        * Writing the wrong number of bytes also needs to be flagged as an
-        * error. Success needs to produce a 0 return code.
-        */
-       if (ret == 4) {
-               ret = 0;
-       } else {
-               dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-                               __func__, reg);
-               if (ret >= 0)
-                       ret = -EINVAL;
-       }
-
-       return ret;
-}
-
-/*
- * mira130 is big-endian: msb of val goes to lower reg addr
- */
-static int mira130_write24(struct mira130 *mira130, u16 reg, u32 val)
-{
-       int ret;
-       unsigned char data[5] = { reg >> 8, reg & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff };
-       struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
-
-       ret = i2c_master_send(client, data, 5);
-       /*
-        * Writing the wrong number of bytes also needs to be flagged as an
-        * error. Success needs to produce a 0 return code.
-        */
-       if (ret == 5) {
-               ret = 0;
-       } else {
-               dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-                               __func__, reg);
-               if (ret >= 0)
-                       ret = -EINVAL;
-       }
-
-       return ret;
-}
-
-
-/* Write a list of registers */
-static int mira130_write_regs(struct mira130 *mira130,
-			     const struct mira130_reg *regs, u32 len)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++) {
-		ret = mira130_write(mira130, regs[i].address, regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "Failed to write reg 0x%4.4x. error = %d\n",
-					    regs[i].address, ret);
-
-			return ret;
-		} else {
-			// Debug code below
-			//u8 val;
-			//ret = mira130_read(mira130, regs[i].address, &val);
-			//printk(KERN_INFO "[MIRA130]: Read reg 0x%4.4x, val = 0x%x.\n",
-			//		regs[i].address, val);
-		}
-	}
-
-	return 0;
-}
-
-static int mira130pmic_write(struct i2c_client *client, u8 reg, u8 val)
-{
-	int ret;
-	unsigned char data[2] = { reg & 0xff, val};
-
-	ret = i2c_master_send(client, data, 2);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 2) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira130pmic_read(struct i2c_client *client, u8 reg, u8 *val)
-{
-	struct i2c_msg msgs[2];
-	u8 addr_buf[1] = { reg & 0xff };
-	u8 data_buf[1] = { 0 };
-	int ret;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = 1;
-	msgs[1].buf = &data_buf[0];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = (u8)(data_buf[0]);
-
-	return 0;
-}
 
 /* Power/clock management functions */
 static int mira130_power_on(struct device *dev)
@@ -886,7 +747,7 @@ static int mira130_write_illum_trig_regs(struct mira130* mira130, u8 enable) {
 		enable_reg = 0b11000000;
 	}
 	printk(KERN_INFO "[MIRA130]: Writing EN_TRIG_ILLUM to %d.\n", enable_reg);
-	ret = mira130_write(mira130, MIRA130_EN_TRIG_ILLUM_REG, enable_reg);
+	ret = ams_sensor_write(&mira130->ams, MIRA130_EN_TRIG_ILLUM_REG, enable_reg);
 	if (ret) {
 		dev_err(&client->dev, "Error setting EN_TRIG_ILLUM to %d.", enable_reg);
 		return ret;
@@ -934,178 +795,101 @@ static int mira130_write_stop_streaming_regs(struct mira130* mira130) {
 }
 
 
-static int mira130_v4l2_reg_w(struct mira130 *mira130, u32 value) {
-	struct i2c_client* const client = v4l2_get_subdevdata(&mira130->sd);
-	u32 ret = 0;
+/* AMS_CAMERA_CID_MIRA_REG_W commands, the protocol is in ams_sensor_reg_w() */
+static void mira130_reg_cmd(struct ams_sensor *ams, u8 reg_flag, u32 value)
+{
+	struct mira130 *mira130 = container_of(ams, struct mira130, ams);
+	struct i2c_client *const client = ams->client;
 	u32 tmp_flag;
 
-	u16 reg_addr = (value >> 8) & 0xFFFF;
-	u8 reg_val = value & 0xFF;
-	u8 reg_flag = (value >> 24) & 0xFF;
-
-	// printk(KERN_INFO "[MIRA130]: %s reg_flag: 0x%02X; reg_addr: 0x%04X; reg_val: 0x%02X.\n",
-	// 		__func__, reg_flag, reg_addr, reg_val);
-
-	if (reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_CMD_SEL) {
-		if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_SLEEP_US) {
-			// If it is for sleep, combine all 24 bits of reg_addr and reg_val as sleep us.
-			u32 sleep_us_val = value & 0x00FFFFFF;
-			// Sleep range needs an interval, default to 1/8 of the sleep value.
-			u32 sleep_us_interval = sleep_us_val >> 3;
-			printk(KERN_INFO "[MIRA130]: %s sleep_us: %u.\n", __func__, sleep_us_val);
-			usleep_range(sleep_us_val, sleep_us_val + sleep_us_interval);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_RESET_ON) {
-			printk(KERN_INFO "[MIRA130]: %s Enable reset at stream on/off.\n", __func__);
-			mira130->skip_reset = 0;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_RESET_OFF) {
-			printk(KERN_INFO "[MIRA130]: %s Disable reset at stream on/off.\n", __func__);
-			mira130->skip_reset = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_REG_UP_ON) {
-			printk(KERN_INFO "[MIRA130]: %s Enable base register sequence upload.\n", __func__);
-			mira130->skip_reg_upload = 0;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_REG_UP_OFF) {
-			printk(KERN_INFO "[MIRA130]: %s Disable base register sequence upload.\n", __func__);
-			mira130->skip_reg_upload = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_POWER_ON) {
-			printk(KERN_INFO "[MIRA130]: %s Call power on function mira130_power_on().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira130->skip_reset;
-			mira130->skip_reset = 0;
-			mira130_power_on(&client->dev);
-			mira130->skip_reset = tmp_flag;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_POWER_OFF) {
-			printk(KERN_INFO "[MIRA130]: %s Call power off function mira130_power_off().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira130->skip_reset;
-			mira130->skip_reset = 0;
-			mira130_power_off(&client->dev);
-			mira130->skip_reset = tmp_flag;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_ILLUM_TRIG_ON) {
-			printk(KERN_INFO "[MIRA130]: %s Enable illumination trigger.\n", __func__);
-			mira130_write_illum_trig_regs(mira130, 1);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_ILLUM_TRIG_OFF) {
-			printk(KERN_INFO "[MIRA130]: %s Disable illumination trigger.\n", __func__);
-			mira130_write_illum_trig_regs(mira130, 0);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_STREAM_CTRL_ON) {
-			printk(KERN_INFO "[MIRA130]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
-			mira130->force_stream_ctrl = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_STREAM_CTRL_OFF) {
-			printk(KERN_INFO "[MIRA130]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
-			mira130->force_stream_ctrl = 0;
-		} else {
-			printk(KERN_INFO "[MIRA130]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
-		}
-	} else if (reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_FOR_READ) {
-		// If it is for read, skip reagister write, cache addr and flag for read.
-		mira130->mira130_reg_w_cached_addr = reg_addr;
-		mira130->mira130_reg_w_cached_flag = reg_flag;
+	if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_RESET_ON) {
+		printk(KERN_INFO "[MIRA130]: %s Enable reset at stream on/off.\n", __func__);
+		mira130->skip_reset = 0;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_RESET_OFF) {
+		printk(KERN_INFO "[MIRA130]: %s Disable reset at stream on/off.\n", __func__);
+		mira130->skip_reset = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_REG_UP_ON) {
+		printk(KERN_INFO "[MIRA130]: %s Enable base register sequence upload.\n", __func__);
+		mira130->skip_reg_upload = 0;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_REG_UP_OFF) {
+		printk(KERN_INFO "[MIRA130]: %s Disable base register sequence upload.\n", __func__);
+		mira130->skip_reg_upload = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_POWER_ON) {
+		printk(KERN_INFO "[MIRA130]: %s Call power on function mira130_power_on().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira130->skip_reset;
+		mira130->skip_reset = 0;
+		mira130_power_on(&client->dev);
+		mira130->skip_reset = tmp_flag;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_POWER_OFF) {
+		printk(KERN_INFO "[MIRA130]: %s Call power off function mira130_power_off().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira130->skip_reset;
+		mira130->skip_reset = 0;
+		mira130_power_off(&client->dev);
+		mira130->skip_reset = tmp_flag;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_ILLUM_TRIG_ON) {
+		printk(KERN_INFO "[MIRA130]: %s Enable illumination trigger.\n", __func__);
+		mira130_write_illum_trig_regs(mira130, 1);
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_ILLUM_TRIG_OFF) {
+		printk(KERN_INFO "[MIRA130]: %s Disable illumination trigger.\n", __func__);
+		mira130_write_illum_trig_regs(mira130, 0);
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_STREAM_CTRL_ON) {
+		printk(KERN_INFO "[MIRA130]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
+		mira130->force_stream_ctrl = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA130_REG_FLAG_STREAM_CTRL_OFF) {
+		printk(KERN_INFO "[MIRA130]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
+		mira130->force_stream_ctrl = 0;
 	} else {
-		// If it is for write, select which I2C device by the flag "I2C_SEL".
-		if ((reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_MIRA) {
-			// Writing the actual Mira130 register
-			// printk(KERN_INFO "[MIRA130]: %s write reg_addr: 0x%04X; reg_val: 0x%02X.\n", __func__, reg_addr, reg_val);
-			ret = mira130_write(mira130, reg_addr, reg_val);
-			if (ret) {
-				dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n", reg_addr);
-				return -EINVAL;
-			}
-		} else if ((reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SET_TBD) {
-			/* User tries to set TBD I2C address, store reg_val to mira130->tbd_client_i2c_addr. Skip write. */
-			printk(KERN_INFO "[MIRA130]: mira130->tbd_client_i2c_addr = 0x%X.\n", reg_val);
-			mira130->tbd_client_i2c_addr = reg_val;
-		} else if ((reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_TBD) {
-			if (mira130->tbd_client_i2c_addr == MIRA130PMIC_I2C_ADDR) {
-				// Write PMIC. Use pre-allocated mira130->pmic_client.
-				printk(KERN_INFO "[MIRA130]: write pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira130pmic_write(mira130->pmic_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else if (mira130->tbd_client_i2c_addr == MIRA130UC_I2C_ADDR) {
-				// Write micro-controller. Use pre-allocated mira130->uc_client.
-				printk(KERN_INFO "[MIRA130]: write uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira130pmic_write(mira130->uc_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else if (mira130->tbd_client_i2c_addr == MIRA130LED_I2C_ADDR) {
-				// Write LED driver. Use pre-allocated mira130->led_client.
-				printk(KERN_INFO "[MIRA130]: write led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira130pmic_write(mira130->led_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else {
-				/* Write other TBD I2C address.
-				 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SET_TBD.
-				 * The TBD I2C address is stored in mira130->tbd_client_i2c_addr.
-				 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-				 */
-				struct i2c_client *tmp_client;
-				tmp_client = i2c_new_dummy_device(client->adapter, mira130->tbd_client_i2c_addr);
-				if (IS_ERR(tmp_client))
-					return PTR_ERR(tmp_client);
-				printk(KERN_INFO "[MIRA130]: write tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-						mira130->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira130pmic_write(tmp_client, (u8)(reg_addr & 0xFF), reg_val);
-				i2c_unregister_device(tmp_client);
-			}
-		}
+		printk(KERN_INFO "[MIRA130]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
 	}
-
-	return 0;
 }
 
-static int mira130_v4l2_reg_r(struct mira130 *mira130, u32 *value) {
-	struct i2c_client* const client = v4l2_get_subdevdata(&mira130->sd);
-	u32 ret = 0;
+/* Gain of an analog_gain_lut entry in 1/256 */
+static u32 mira130_gain_to_linear(struct ams_sensor *ams, u32 index)
+{
+	const struct mira130_analog_gain_lut *lut = &analog_gain_lut[index];
 
-	u16 reg_addr = mira130->mira130_reg_w_cached_addr;
-	u8 reg_flag = mira130->mira130_reg_w_cached_flag;
-	u8 reg_val = 0;
+	return (lut->fine_gain * AMS_CAMERA_GAIN_LINEAR_UNITY / MIRA130_ANA_FINE_GAIN_UNITY)
+		<< hweight8(lut->gain & MIRA130_ANA_GAIN_COARSE_MASK);
+}
 
-	*value = 0;
+static const struct ams_sensor_ops mira130_ams_ops = {
+	.reg_cmd = mira130_reg_cmd,
+	.gain_to_linear = mira130_gain_to_linear,
+};
 
-	if ((reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_MIRA) {
-		ret = mira130_read(mira130, reg_addr, &reg_val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n", reg_addr);
-			return -EINVAL;
-		}
-	} else if ((reg_flag & AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_TBD) {
-		if (mira130->tbd_client_i2c_addr == MIRA130PMIC_I2C_ADDR) {
-			// Read PMIC. Use pre-allocated mira130->pmic_client.
-			ret = mira130pmic_read(mira130->pmic_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA130]: read pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else if (mira130->tbd_client_i2c_addr == MIRA130UC_I2C_ADDR) {
-			// Read micro-controller. Use pre-allocated mira130->uc_client.
-			ret = mira130pmic_read(mira130->uc_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA130]: read uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else if (mira130->tbd_client_i2c_addr == MIRA130LED_I2C_ADDR) {
-			// Read LED driver. Use pre-allocated mira130->led_client.
-			ret = mira130pmic_read(mira130->led_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA130]: read led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else {
-			/* Read other TBD I2C address.
-			 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA130_REG_FLAG_I2C_SET_TBD.
-			 * The TBD I2C address is stored in mira130->tbd_client_i2c_addr.
-			 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-			 */
-			struct i2c_client *tmp_client;
-			tmp_client = i2c_new_dummy_device(client->adapter, mira130->tbd_client_i2c_addr);
-			if (IS_ERR(tmp_client))
-				return PTR_ERR(tmp_client);
-			ret = mira130pmic_read(tmp_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA130]: read tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-					mira130->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-			i2c_unregister_device(tmp_client);
-		}
-	}
+// Returns the maximum exposure time in row_length (reg value).
+static u32 mira130_calculate_max_exposure_time(const struct mira130_mode *mode,
+					       u32 vblank) {
+	/* HDR modes keep the short exposure window free */
+	if (mode->hdr)
+		return mode->height + vblank - MIRA130_HDR_SHORT_EXPOSURE_MAX;
 
-	// Return 32-bit value that includes flags, addr, and register value
-	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
+	return (mode->height + vblank);
+}
 
-	// printk(KERN_INFO "[MIRA130]: mira130_v4l2_reg_r() reg_flag: 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
-	// 		reg_flag, reg_addr, reg_val);
+// Returns the vblank of the given mode closest to a frame time in microseconds.
+static u32 mira130_frame_time_to_vblank(const struct mira130_mode *mode, u32 us)
+{
+	u32 line_length = mode->width + mode->hblank;
+	u32 frame_length = (u32)div_u64((u64)us * (MIRA130_PIXEL_RATE / 1000) +
+					line_length * 500, line_length * 1000);
+	u32 vblank = frame_length > mode->height ? frame_length - mode->height : 0;
 
-	return 0;
+	return clamp_t(u32, vblank, MIRA130_MIN_VBLANK, MIRA130_MAX_VBLANK);
 }
 
-// Returns the maximum exposure time in row_length (reg value).
-static u32 mira130_calculate_max_exposure_time(u32 row_length, u32 vsize,
-					       u32 vblank) {
-	return (vsize + vblank);
+// Frame interval of the given mode and vblank, in seconds.
+static void mira130_frame_interval(const struct mira130_mode *mode, u32 vblank,
+				   struct v4l2_fract *interval)
+{
+	u32 num = (mode->width + mode->hblank) * (mode->height + vblank);
+	u32 den = MIRA130_PIXEL_RATE;
+	u32 div = gcd(num, den);
+
+	interval->numerator = num / div;
+	interval->denominator = den / div;
 }
 
 static int mira130_write_analog_gain_reg(struct mira130 *mira130, u8 gain) {
@@ -1115,11 +899,14 @@ static int mira130_write_analog_gain_reg(struct mira130 *mira130, u8 gain) {
 	if (gain < ARRAY_SIZE(analog_gain_lut)) {
 		u8 lut_gain = analog_gain_lut[gain].gain;
 		u8 lut_fine_gain = analog_gain_lut[gain].fine_gain;
-		ret |= mira130_write(mira130, MIRA130_AGC_MODE_REG, 0x0B);
-		ret |= mira130_write(mira130, MIRA130_ANA_GAIN_REG, lut_gain);
-		ret |= mira130_write(mira130, MIRA130_ANA_FINE_GAIN_REG, lut_fine_gain);
-		ret |= mira130_write(mira130, MIRA130_HDR_ANA_GAIN_REG, lut_gain);
-		ret |= mira130_write(mira130, MIRA130_HDR_ANA_FINE_GAIN_REG, lut_fine_gain);
+		ret |= ams_sensor_write(&mira130->ams, MIRA130_AGC_MODE_REG, 0x0B);
+		ret |= ams_sensor_write(&mira130->ams, MIRA130_ANA_GAIN_REG, lut_gain);
+		ret |= ams_sensor_write(&mira130->ams, MIRA130_ANA_FINE_GAIN_REG, lut_fine_gain);
+		/* HDR modes set the short gain with gain_short */
+		if (!mira130->mode->hdr) {
+			ret |= ams_sensor_write(&mira130->ams, MIRA130_HDR_ANA_GAIN_REG, lut_gain);
+			ret |= ams_sensor_write(&mira130->ams, MIRA130_HDR_ANA_FINE_GAIN_REG, lut_fine_gain);
+		}
 	}
 	if (ret) {
 		dev_err(&client->dev, "%s failed to set mode\n", __func__);
@@ -1127,10 +914,26 @@ static int mira130_write_analog_gain_reg(struct mira130 *mira130, u8 gain) {
 	return 0;
 }
 
+static int mira130_write_hdr_analog_gain_reg(struct mira130 *mira130, u8 gain) {
+	struct i2c_client* const client = v4l2_get_subdevdata(&mira130->sd);
+	int ret;
+
+	if (gain >= ARRAY_SIZE(analog_gain_lut))
+		return -EINVAL;
+
+	ret = ams_sensor_write(&mira130->ams, MIRA130_HDR_ANA_GAIN_REG, analog_gain_lut[gain].gain);
+	if (!ret)
+		ret = ams_sensor_write(&mira130->ams, MIRA130_HDR_ANA_FINE_GAIN_REG,
+				    analog_gain_lut[gain].fine_gain);
+	if (ret)
+		dev_err_ratelimited(&client->dev, "Error setting short gain to %u", gain);
+
+	return ret;
+}
+
 static int mira130_write_exposure_reg(struct mira130 *mira130, u32 exposure) {
 	struct i2c_client* const client = v4l2_get_subdevdata(&mira130->sd);
-	const u32 max_exposure = mira130_calculate_max_exposure_time(mira130->mode->row_length,
-		mira130->mode->height, mira130->mode->vblank);
+	const u32 max_exposure = mira130_calculate_max_exposure_time(mira130->mode, mira130->vblank->val);
 	u32 ret = 0;
 	u32 capped_exposure = exposure;
 
@@ -1139,7 +942,7 @@ static int mira130_write_exposure_reg(struct mira130 *mira130, u32 exposure) {
 	}
 
 	// Mira130 exposure time register is in the unit of 1/16 line
-	ret = mira130_write24(mira130, MIRA130_EXP_TIME_HI_REG, capped_exposure << 4);
+	ret = ams_sensor_write_be24(&mira130->ams, MIRA130_EXP_TIME_HI_REG, capped_exposure << 4);
 	if (ret) {
 		dev_err_ratelimited(&client->dev, "Error setting exposure time to %d", capped_exposure);
 		return -EINVAL;
@@ -1148,14 +951,79 @@ static int mira130_write_exposure_reg(struct mira130 *mira130, u32 exposure) {
 	return 0;
 }
 
+static int mira130_write_hdr_exposure_reg(struct mira130 *mira130, u32 exposure) {
+	struct i2c_client* const client = v4l2_get_subdevdata(&mira130->sd);
+	int ret;
+
+	// Short exposure is in the unit of 1/16 line as well
+	ret = ams_sensor_write_be16(&mira130->ams, MIRA130_HDR_EXP_TIME_HI_REG,
+			      min_t(u32, exposure, MIRA130_HDR_SHORT_EXPOSURE_MAX) << 4);
+	if (ret) {
+		dev_err_ratelimited(&client->dev, "Error setting short exposure time to %d", exposure);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the changed controls of the exposure and gain cluster in one
+ * group hold, so a frame never uses a new exposure with an old gain.
+ */
+static int mira130_write_exposure_gain_regs(struct mira130 *mira130)
+{
+	int ret, launch;
+
+	ret = ams_sensor_write(&mira130->ams, MIRA130_GROUP_HOLD_REG, MIRA130_GROUP_HOLD_START);
+	if (ret)
+		return ret;
+
+	if (mira130->exposure->is_new)
+		ret = mira130_write_exposure_reg(mira130, mira130->exposure->val);
+	if (!ret && mira130->gain->is_new)
+		ret = mira130_write_analog_gain_reg(mira130, mira130->gain->val);
+	if (!ret && mira130->mode->hdr && mira130->exposure_short->is_new)
+		ret = mira130_write_hdr_exposure_reg(mira130, mira130->exposure_short->val);
+	if (!ret && mira130->mode->hdr && mira130->gain_short->is_new)
+		ret = mira130_write_hdr_analog_gain_reg(mira130, mira130->gain_short->val);
+
+	/* Launch even after an error, the hold must not stay open */
+	launch = ams_sensor_write(&mira130->ams, MIRA130_GROUP_HOLD_REG, MIRA130_GROUP_HOLD_LAUNCH);
+
+	return ret ? ret : launch;
+}
+
+/* Publish a new active mode and format. Caller holds hw_lock. */
+static void mira130_publish_format(struct mira130 *mira130,
+				   const struct mira130_mode *mode,
+				   const struct v4l2_mbus_framefmt *fmt)
+{
+	write_seqlock(&mira130->fmt_seqlock);
+	mira130->mode = mode;
+	mira130->fmt = *fmt;
+	write_sequnlock(&mira130->fmt_seqlock);
+}
+
+/* Read a consistent copy of the active mode and format without mutex */
+static void mira130_read_format(struct mira130 *mira130,
+				const struct mira130_mode **mode,
+				struct v4l2_mbus_framefmt *fmt)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&mira130->fmt_seqlock);
+		*mode = mira130->mode;
+		*fmt = mira130->fmt;
+	} while (read_seqretry(&mira130->fmt_seqlock, seq));
+}
+
 // Gets the format code if supported. Otherwise returns the default format code `codes[0]`
 static u32 mira130_validate_format_code_or_default(struct mira130 *mira130, u32 code)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
 	unsigned int i;
 
-	lockdep_assert_held(&mira130->mutex);
-
 	for (i = 0; i < ARRAY_SIZE(codes); i++)
 		if (codes[i] == code)
 			break;
@@ -1195,7 +1063,7 @@ static int mira130_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
 	struct v4l2_rect *try_crop;
 
-	mutex_lock(&mira130->mutex);
+	/* Only the file handle's own try state is touched, mutex is not needed */
 
 	/* Initialize try_fmt for the image pad */
 	try_fmt_img->width = supported_modes[0].width;
@@ -1219,8 +1087,6 @@ static int mira130_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	try_crop->width = supported_modes[0].crop.width;
 	try_crop->height = supported_modes[0].crop.height;
 
-	mutex_unlock(&mira130->mutex);
-
 	return 0;
 }
 
@@ -1232,12 +1098,21 @@ static int mira130_set_ctrl(struct v4l2_ctrl *ctrl)
 	int ret = 0;
 	u8 val;
 
+	if (ctrl->id == AMS_CAMERA_CID_ANALOG_GAIN_LINEAR)
+		return ams_sensor_gain_linear_s_ctrl(&mira130->ams, ctrl);
+
+	/* The gain is set with its cluster master */
+	if (ctrl->id == V4L2_CID_EXPOSURE && mira130->gain->is_new) {
+		ret = ams_sensor_gain_linear_sync(&mira130->ams);
+		if (ret)
+			return ret;
+	}
+
 	if (ctrl->id == V4L2_CID_VBLANK) {
 		int exposure_max, exposure_def;
 
 		/* Update max exposure while meeting expected vblanking */
-		exposure_max = mira130_calculate_max_exposure_time(mira130->mode->row_length,
-				                mira130->mode->height, ctrl->val);
+		exposure_max = mira130_calculate_max_exposure_time(mira130->mode, ctrl->val);
 		exposure_def = (exposure_max < MIRA130_DEFAULT_EXPOSURE) ?
 			exposure_max : MIRA130_DEFAULT_EXPOSURE;
 		__v4l2_ctrl_modify_range(mira130->exposure,
@@ -1247,6 +1122,13 @@ static int mira130_set_ctrl(struct v4l2_ctrl *ctrl)
 	}
 
 
+	/*
+	 * The running hardware sequence writes all control values
+	 * with __v4l2_ctrl_handler_setup() once the tables are uploaded.
+	 */
+	if (mira130->hw_busy)
+		return 0;
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -1260,44 +1142,42 @@ static int mira130_set_ctrl(struct v4l2_ctrl *ctrl)
 
 	if (mira130->skip_reg_upload == 0) {
 		switch (ctrl->id) {
-		case V4L2_CID_ANALOGUE_GAIN:
-			ret = mira130_write_analog_gain_reg(mira130, ctrl->val);
-			break;
 		case V4L2_CID_EXPOSURE:
-			ret = mira130_write_exposure_reg(mira130, ctrl->val);
+			/* Cluster master, also writes gain and the HDR short controls */
+			ret = mira130_write_exposure_gain_regs(mira130);
 			break;
 		case V4L2_CID_TEST_PATTERN:
-			ret = mira130_write(mira130, MIRA130_REG_TEST_PATTERN,
+			ret = ams_sensor_write(&mira130->ams, MIRA130_REG_TEST_PATTERN,
 					       mira130_test_pattern_val[ctrl->val]);
 			break;
 		case V4L2_CID_HFLIP:
 			if (ctrl->val != 0) {
-				val = mira130_read(mira130, MIRA130_HFLIP_REG, &val);
+				val = ams_sensor_read(&mira130->ams, MIRA130_HFLIP_REG, &val);
 				val = val | MIRA130_HFLIP_ENABLE_MIRROR;
-				ret = mira130_write(mira130, MIRA130_HFLIP_REG,
+				ret = ams_sensor_write(&mira130->ams, MIRA130_HFLIP_REG,
 						val);
 			} else {
-				val = mira130_read(mira130, MIRA130_HFLIP_REG, &val);
+				val = ams_sensor_read(&mira130->ams, MIRA130_HFLIP_REG, &val);
 				val = val & (~ MIRA130_HFLIP_ENABLE_MIRROR);
-				ret = mira130_write(mira130, MIRA130_HFLIP_REG,
+				ret = ams_sensor_write(&mira130->ams, MIRA130_HFLIP_REG,
 						val);
 			}
 			break;
 		case V4L2_CID_VFLIP:
 			if (ctrl->val != 0) {
-				val = mira130_read(mira130, MIRA130_VFLIP_REG, &val);
+				val = ams_sensor_read(&mira130->ams, MIRA130_VFLIP_REG, &val);
 				val = val | MIRA130_VFLIP_ENABLE_FLIP;
-				ret = mira130_write(mira130, MIRA130_VFLIP_REG,
+				ret = ams_sensor_write(&mira130->ams, MIRA130_VFLIP_REG,
 						val);
 			} else {
-				val = mira130_read(mira130, MIRA130_VFLIP_REG, &val);
+				val = ams_sensor_read(&mira130->ams, MIRA130_VFLIP_REG, &val);
 				val = val & (~ MIRA130_VFLIP_ENABLE_FLIP);
-				ret = mira130_write(mira130, MIRA130_VFLIP_REG,
+				ret = ams_sensor_write(&mira130->ams, MIRA130_VFLIP_REG,
 						val);
 			}
 			break;
 		case V4L2_CID_VBLANK:
-			ret = mira130_write16(mira130, MIRA130_VBLANK_HI_REG,
+			ret = ams_sensor_write_be16(&mira130->ams, MIRA130_VBLANK_HI_REG,
 						ctrl->val + mira130->mode->height);
 			break;
 		case V4L2_CID_HBLANK:
@@ -1333,9 +1213,13 @@ static int mira130_s_ctrl(struct v4l2_ctrl *ctrl)
 	 * Users need to make sure first power on then write register.
 	 */
 
+	/* Raw accesses would interleave with the table upload */
+	if (mira130->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id) {
 	case AMS_CAMERA_CID_MIRA_REG_W:
-		ret = mira130_v4l2_reg_w(mira130, ctrl->val);
+		ret = ams_sensor_reg_w(&mira130->ams, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -1365,9 +1249,12 @@ static int mira130_g_ctrl(struct v4l2_ctrl *ctrl)
 	 * Therefore, the check of "powered" flag is disabled for now.
 	 */
 
+	if (mira130->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id) {
 	case AMS_CAMERA_CID_MIRA_REG_R:
-		ret = mira130_v4l2_reg_r(mira130, (u32 *)&ctrl->cur.val);
+		ret = ams_sensor_reg_r(&mira130->ams, (u32 *)&ctrl->cur.val);
 		ctrl->val = ctrl->cur.val;
 		break;
 	default:
@@ -1418,10 +1305,74 @@ static struct v4l2_ctrl_config custom_ctrl_config_list[] = {
 		.def = 0,
 		.step = 1,
 	},
+	{
+		.id = AMS_CAMERA_CID_EXPOSURE_DELAY,
+		.name = "exposure_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA130_EXPOSURE_DELAY,
+		.max = MIRA130_EXPOSURE_DELAY,
+		.def = MIRA130_EXPOSURE_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_GAIN_DELAY,
+		.name = "gain_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA130_GAIN_DELAY,
+		.max = MIRA130_GAIN_DELAY,
+		.def = MIRA130_GAIN_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_VBLANK_DELAY,
+		.name = "vblank_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA130_VBLANK_DELAY,
+		.max = MIRA130_VBLANK_DELAY,
+		.def = MIRA130_VBLANK_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_STARTUP_FRAMES,
+		.name = "startup_frames",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA130_STARTUP_FRAMES,
+		.max = MIRA130_STARTUP_FRAMES,
+		.def = MIRA130_STARTUP_FRAMES,
+		.step = 1,
+	},
 
 };
 
 
+/* Short exposure of HDR modes in lines */
+static const struct v4l2_ctrl_config mira130_exposure_short_ctrl = {
+	.ops = &mira130_ctrl_ops,
+	.id = AMS_CAMERA_CID_EXPOSURE_SHORT,
+	.name = "exposure_short",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = MIRA130_EXPOSURE_MIN,
+	.max = MIRA130_HDR_SHORT_EXPOSURE_MAX,
+	.def = MIRA130_HDR_SHORT_EXPOSURE_DEFAULT,
+	.step = 1,
+};
+
+/* Short analog gain of HDR modes, same steps as V4L2_CID_ANALOGUE_GAIN */
+static const struct v4l2_ctrl_config mira130_gain_short_ctrl = {
+	.ops = &mira130_ctrl_ops,
+	.id = AMS_CAMERA_CID_GAIN_SHORT,
+	.name = "gain_short",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = ARRAY_SIZE(analog_gain_lut) - 1,
+	.def = 0,
+	.step = 1,
+};
+
 // This function should enumerate all the media bus formats for the requested pads. If the requested
 // format index is beyond the number of avaialble formats it shall return -EINVAL;
 static int mira130_enum_mbus_code(struct v4l2_subdev *sd,
@@ -1482,6 +1433,73 @@ static int mira130_enum_frame_size(struct v4l2_subdev *sd,
 	return 0;
 }
 
+/*
+ * Report the shortest frame interval of the mode matching code and size.
+ * Any longer interval up to MIRA130_MAX_VBLANK can be set with s_frame_interval.
+ */
+static int mira130_enum_frame_interval(struct v4l2_subdev *sd,
+				       struct v4l2_subdev_state *sd_state,
+				       struct v4l2_subdev_frame_interval_enum *fie)
+{
+	unsigned int i;
+
+	if (fie->pad != IMAGE_PAD || fie->index > 0)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(supported_modes); i++) {
+		const struct mira130_mode *mode = &supported_modes[i];
+
+		if (mode->code == fie->code && mode->width == fie->width &&
+		    mode->height == fie->height) {
+			mira130_frame_interval(mode, mode->vblank, &fie->interval);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int mira130_g_frame_interval(struct v4l2_subdev *sd,
+				    struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira130 *mira130 = to_mira130(sd);
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira130->mutex);
+	mira130_frame_interval(mira130->mode, mira130->vblank->val, &fi->interval);
+	mutex_unlock(&mira130->mutex);
+
+	return 0;
+}
+
+/* Frame interval is set through VBLANK, the closest achievable one is returned */
+static int mira130_s_frame_interval(struct v4l2_subdev *sd,
+				    struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira130 *mira130 = to_mira130(sd);
+	const struct mira130_mode *mode;
+	int ret = 0;
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira130->mutex);
+	mode = mira130->mode;
+	if (fi->interval.numerator && fi->interval.denominator) {
+		u32 us = (u32)div_u64((u64)fi->interval.numerator * 1000000,
+				      fi->interval.denominator);
+
+		ret = __v4l2_ctrl_s_ctrl(mira130->vblank,
+					 mira130_frame_time_to_vblank(mode, us));
+	}
+	mira130_frame_interval(mode, mira130->vblank->val, &fi->interval);
+	mutex_unlock(&mira130->mutex);
+
+	return ret;
+}
+
 static void mira130_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
 {
 	fmt->colorspace = V4L2_COLORSPACE_RAW;
@@ -1534,10 +1552,13 @@ static int __mira130_get_pad_format(struct mira130 *mira130,
 		fmt->format = *try_fmt;
 	} else {
 		if (fmt->pad == IMAGE_PAD) {
-			mira130_update_image_pad_format(mira130, mira130->mode,
-						       fmt);
+			const struct mira130_mode *mode;
+			struct v4l2_mbus_framefmt active;
+
+			mira130_read_format(mira130, &mode, &active);
+			mira130_update_image_pad_format(mira130, mode, fmt);
 			fmt->format.code = mira130_validate_format_code_or_default(mira130,
-							      mira130->fmt.code);
+							      active.code);
 		} else {
 			mira130_update_metadata_pad_format(fmt);
 		}
@@ -1551,13 +1572,9 @@ static int mira130_get_pad_format(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_format *fmt)
 {
 	struct mira130 *mira130 = to_mira130(sd);
-	int ret;
 
-	mutex_lock(&mira130->mutex);
-	ret = __mira130_get_pad_format(mira130, sd_state, fmt);
-	mutex_unlock(&mira130->mutex);
-
-	return ret;
+	/* Lockless: ACTIVE reads the published snapshot, TRY is per file handle */
+	return __mira130_get_pad_format(mira130, sd_state, fmt);
 }
 
 static int mira130_set_pad_format(struct v4l2_subdev *sd,
@@ -1572,7 +1589,11 @@ static int mira130_set_pad_format(struct v4l2_subdev *sd,
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
 
-	mutex_lock(&mira130->mutex);
+	/* TRY formats live in the file handle state and need no locking */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		mutex_lock(&mira130->hw_lock);
+		mutex_lock(&mira130->mutex);
+	}
 
 	if (fmt->pad == IMAGE_PAD) {
 		/* Validate format or use default */
@@ -1597,13 +1618,10 @@ static int mira130_set_pad_format(struct v4l2_subdev *sd,
 			printk(KERN_INFO "[MIRA130]: mira130->mode %p mode %p.\n", (void *)mira130->mode, (void *)mode);
 			printk(KERN_INFO "[MIRA130]: mira130->fmt.code 0x%x fmt->format.code 0x%x.\n", mira130->fmt.code, fmt->format.code);
 
-			mira130->fmt = fmt->format;
-			mira130->mode = mode;
+			mira130_publish_format(mira130, mode, &fmt->format);
 
 			// Update controls based on new mode (range and current value).
-			max_exposure = mira130_calculate_max_exposure_time(mira130->mode->row_length,
-									   mira130->mode->height,
-									   mira130->mode->vblank);
+			max_exposure = mira130_calculate_max_exposure_time(mira130->mode, mira130->mode->vblank);
 			default_exp = MIRA130_DEFAULT_EXPOSURE > max_exposure ? max_exposure : MIRA130_DEFAULT_EXPOSURE;
 			printk(KERN_INFO "[MIRA130]: mira130_set_pad_format() min_exp %d max_exp %d, default_exp %d\n",
 					MIRA130_EXPOSURE_MIN, max_exposure, default_exp);
@@ -1617,6 +1635,10 @@ static int mira130_set_pad_format(struct v4l2_subdev *sd,
 					mira130->mode->vblank);
 
 			__v4l2_ctrl_s_ctrl(mira130->vblank, mira130->mode->vblank);
+
+			/* Short exposure and gain only apply to HDR modes */
+			v4l2_ctrl_activate(mira130->exposure_short, mira130->mode->hdr);
+			v4l2_ctrl_activate(mira130->gain_short, mira130->mode->hdr);
 		}
 	} else {
 		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
@@ -1631,7 +1653,10 @@ static int mira130_set_pad_format(struct v4l2_subdev *sd,
 
 	printk(KERN_INFO "[MIRA130]: mira130_set_pad_format() to unlock and return.\n");
 
-	mutex_unlock(&mira130->mutex);
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		mutex_unlock(&mira130->mutex);
+		mutex_unlock(&mira130->hw_lock);
+	}
 
 	return 0;
 }
@@ -1643,8 +1668,8 @@ static int mira130_set_framefmt(struct mira130 *mira130)
 		case MEDIA_BUS_FMT_Y10_1X10:
 		case MEDIA_BUS_FMT_SGRBG10_1X10:
 			printk(KERN_INFO "[MIRA130]: mira130_set_framefmt() write 10 bpp regs.\n");
-			mira130_write(mira130, MIRA130_BIT_DEPTH_REG,MIRA130_BIT_DEPTH_10_BIT);
-			mira130_write(mira130, MIRA130_CSI_DATA_TYPE_REG,
+			ams_sensor_write(&mira130->ams, MIRA130_BIT_DEPTH_REG,MIRA130_BIT_DEPTH_10_BIT);
+			ams_sensor_write(&mira130->ams, MIRA130_CSI_DATA_TYPE_REG,
 				MIRA130_CSI_DATA_TYPE_10_BIT);
 			return 0;
 		default:
@@ -1662,8 +1687,14 @@ __mira130_get_pad_crop(struct mira130 *mira130, struct v4l2_subdev_state *sd_sta
 	switch (which) {
 	case V4L2_SUBDEV_FORMAT_TRY:
 		return v4l2_subdev_get_try_crop(&mira130->sd, sd_state, pad);
-	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &mira130->mode->crop;
+	case V4L2_SUBDEV_FORMAT_ACTIVE: {
+		const struct mira130_mode *mode;
+		struct v4l2_mbus_framefmt fmt;
+
+		/* Modes are static, only the pointer needs a consistent read */
+		mira130_read_format(mira130, &mode, &fmt);
+		return &mode->crop;
+	}
 	}
 
 	return NULL;
@@ -1677,10 +1708,8 @@ static int mira130_get_selection(struct v4l2_subdev *sd,
 	case V4L2_SEL_TGT_CROP: {
 		struct mira130 *mira130 = to_mira130(sd);
 
-		mutex_lock(&mira130->mutex);
 		sel->r = *__mira130_get_pad_crop(mira130, sd_state, sel->pad,
 						sel->which);
-		mutex_unlock(&mira130->mutex);
 
 		return 0;
 	}
@@ -1723,6 +1752,11 @@ static int mira130_start_streaming(struct mira130 *mira130)
 		return ret;
 	}
 
+	/* Control writes are cached until the upload is done */
+	mutex_lock(&mira130->mutex);
+	mira130->hw_busy = true;
+	mutex_unlock(&mira130->mutex);
+
 	/* Apply default values of current mode */
 	if (mira130->skip_reg_upload == 0) {
 		/* Stop treaming before uploading register sequence */
@@ -1730,22 +1764,29 @@ static int mira130_start_streaming(struct mira130 *mira130)
 		ret = mira130_write_stop_streaming_regs(mira130);
 		if (ret) {
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_busy;
 		}
 
 		reg_list = &mira130->mode->reg_list;
 		printk(KERN_INFO "[MIRA130]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = mira130_write_regs(mira130, reg_list->regs, reg_list->num_of_regs);
+		ret = ams_sensor_write_regs(&mira130->ams, reg_list->regs, reg_list->num_of_regs);
 		if (ret) {
 			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			goto err_busy;
+		}
+
+		reg_list = &mira130->mode->hdr_reg_list;
+		ret = ams_sensor_write_regs(&mira130->ams, reg_list->regs, reg_list->num_of_regs);
+		if (ret) {
+			dev_err(&client->dev, "%s failed to set HDR mode\n", __func__);
+			goto err_busy;
 		}
 
 		ret = mira130_set_framefmt(mira130);
 		if (ret) {
 			dev_err(&client->dev, "%s failed to set frame format: %d\n",
 				__func__, ret);
-			goto err_rpm_put;
+			goto err_busy;
 		}
 	} else {
 		printk(KERN_INFO "[MIRA130]: Skip base register sequence upload, due to mira130->skip_reg_upload=%u.\n", mira130->skip_reg_upload);
@@ -1754,11 +1795,16 @@ static int mira130_start_streaming(struct mira130 *mira130)
 
 	printk(KERN_INFO "[MIRA130]: Entering v4l2 ctrl handler setup function.\n");
 
-	/* Apply customized values from user */
+	/*
+	 * Apply customized values from user. Control writes that came in
+	 * during the upload were cached and are written here.
+	 */
+	mutex_lock(&mira130->mutex);
+	mira130->hw_busy = false;
 	ret =  __v4l2_ctrl_handler_setup(mira130->sd.ctrl_handler);
 	printk(KERN_INFO "[MIRA130]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
 	if (ret)
-		goto err_rpm_put;
+		goto err_unlock;
 
 	if (mira130->skip_reg_upload == 0 ||
 		(mira130->skip_reg_upload == 1 && mira130->force_stream_ctrl == 1) ) {
@@ -1766,7 +1812,7 @@ static int mira130_start_streaming(struct mira130 *mira130)
 		ret = mira130_write_start_streaming_regs(mira130);
 		if (ret) {
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_unlock;
 		}
 	} else {
 		printk(KERN_INFO "[MIRA130]: Skip write_start_streaming_regs due to skip_reg_upload == %d and force_stream_ctrl == %d.\n",
@@ -1778,9 +1824,15 @@ static int mira130_start_streaming(struct mira130 *mira130)
 	__v4l2_ctrl_grab(mira130->vflip, true);
 	printk(KERN_INFO "[MIRA130]: Entering v4l2 ctrl grab vflip grab hflip.\n");
 	__v4l2_ctrl_grab(mira130->hflip, true);
+	mutex_unlock(&mira130->mutex);
 
 	return 0;
 
+err_busy:
+	mutex_lock(&mira130->mutex);
+	mira130->hw_busy = false;
+err_unlock:
+	mutex_unlock(&mira130->mutex);
 err_rpm_put:
 	pm_runtime_put(&client->dev);
 	return ret;
@@ -1792,8 +1844,11 @@ static void mira130_stop_streaming(struct mira130 *mira130)
 	int ret = 0;
 
 	/* Unlock controls for vflip and hflip */
+	mutex_lock(&mira130->mutex);
 	__v4l2_ctrl_grab(mira130->vflip, false);
 	__v4l2_ctrl_grab(mira130->hflip, false);
+	mira130->hw_busy = true;
+	mutex_unlock(&mira130->mutex);
 
 	if (mira130->skip_reset == 0) {
 		if (mira130->skip_reg_upload == 0 ||
@@ -1812,6 +1867,10 @@ static void mira130_stop_streaming(struct mira130 *mira130)
 	}
 
 	pm_runtime_put(&client->dev);
+
+	mutex_lock(&mira130->mutex);
+	mira130->hw_busy = false;
+	mutex_unlock(&mira130->mutex);
 }
 
 static int mira130_set_stream(struct v4l2_subdev *sd, int enable)
@@ -1819,14 +1878,25 @@ static int mira130_set_stream(struct v4l2_subdev *sd, int enable)
 	struct mira130 *mira130 = to_mira130(sd);
 	int ret = 0;
 
+	/*
+	 * The sequence runs under hw_lock. mutex is only taken for the
+	 * short state updates, so queries and control reads do not wait
+	 * for the power-on and the register table upload.
+	 */
+	mutex_lock(&mira130->hw_lock);
 	mutex_lock(&mira130->mutex);
 	if (mira130->streaming == enable) {
 		mutex_unlock(&mira130->mutex);
+		mutex_unlock(&mira130->hw_lock);
 		return 0;
 	}
 
 	printk(KERN_INFO "[MIRA130]: Entering mira130_set_stream enable: %d.\n", enable);
 
+	if (!enable)
+		mira130->streaming = false;
+	mutex_unlock(&mira130->mutex);
+
 	if (enable) {
 		/*
 		 * Apply default & customized values
@@ -1835,20 +1905,22 @@ static int mira130_set_stream(struct v4l2_subdev *sd, int enable)
 		ret = mira130_start_streaming(mira130);
 		if (ret)
 			goto err_unlock;
+
+		mutex_lock(&mira130->mutex);
+		mira130->streaming = true;
+		mutex_unlock(&mira130->mutex);
 	} else {
 		mira130_stop_streaming(mira130);
 	}
 
-	mira130->streaming = enable;
-
-	mutex_unlock(&mira130->mutex);
+	mutex_unlock(&mira130->hw_lock);
 
 	printk(KERN_INFO "[MIRA130]: Returning mira130_set_stream with ret: %d.\n", ret);
 
 	return ret;
 
 err_unlock:
-	mutex_unlock(&mira130->mutex);
+	mutex_unlock(&mira130->hw_lock);
 
 	return ret;
 }
@@ -1861,8 +1933,10 @@ static int __maybe_unused mira130_suspend(struct device *dev)
 
 	printk(KERN_INFO "[MIRA130]: Entering suspend function.\n");
 
+	mutex_lock(&mira130->hw_lock);
 	if (mira130->streaming)
 		mira130_stop_streaming(mira130);
+	mutex_unlock(&mira130->hw_lock);
 
 	return 0;
 }
@@ -1876,17 +1950,21 @@ static int __maybe_unused mira130_resume(struct device *dev)
 
 	printk(KERN_INFO "[MIRA130]: Entering resume function.\n");
 
+	mutex_lock(&mira130->hw_lock);
 	if (mira130->streaming) {
 		ret = mira130_start_streaming(mira130);
 		if (ret)
 			goto error;
 	}
+	mutex_unlock(&mira130->hw_lock);
 
 	return 0;
 
 error:
-	mira130_stop_streaming(mira130);
+	mutex_lock(&mira130->mutex);
 	mira130->streaming = false;
+	mutex_unlock(&mira130->mutex);
+	mutex_unlock(&mira130->hw_lock);
 
 	return ret;
 }
@@ -1909,7 +1987,7 @@ static int mira130_otp_power_on(struct mira130 *mira130)
 {
 	int ret;
 
-	ret = mira130_write(mira130, 0x0080, 0x04);
+	ret = ams_sensor_write(&mira130->ams, 0x0080, 0x04);
 
 	return 0;
 }
@@ -1919,7 +1997,7 @@ static int mira130_otp_power_off(struct mira130 *mira130)
 {
 	int ret;
 
-	ret = mira130_write(mira130, 0x0080, 0x08);
+	ret = ams_sensor_write(&mira130->ams, 0x0080, 0x08);
 
 	return 0;
 }
@@ -1929,9 +2007,9 @@ static int mira130_otp_read(struct mira130 *mira130, u8 addr, u8 offset, u8 *val
 {
 	int ret;
 
-	ret = mira130_write(mira130, 0x0086, addr);
-	ret = mira130_write(mira130, 0x0080, 0x02);
-	ret = mira130_read(mira130, 0x0082 + offset, val);
+	ret = ams_sensor_write(&mira130->ams, 0x0086, addr);
+	ret = ams_sensor_write(&mira130->ams, 0x0080, 0x02);
+	ret = ams_sensor_read(&mira130->ams, 0x0082 + offset, val);
 	return 0;
 }
 
@@ -1953,9 +2031,9 @@ static int mira130_identify_module(struct mira130 *mira130)
 	mira130_otp_power_off(mira130);
 
 	val = 0;
-	mira130_read(mira130, 0x3107, &val);
+	ams_sensor_read(&mira130->ams, 0x3107, &val);
 	printk(KERN_INFO "[MIRA130]: %s Sensor ID high byte %X.\n", __func__, val);
-	mira130_read(mira130, 0x3108, &val);
+	ams_sensor_read(&mira130->ams, 0x3108, &val);
 	printk(KERN_INFO "[MIRA130]: %s Sensor ID low byte %X.\n", __func__, val);
 
 	return 0;
@@ -1968,6 +2046,8 @@ static const struct v4l2_subdev_core_ops mira130_core_ops = {
 
 static const struct v4l2_subdev_video_ops mira130_video_ops = {
 	.s_stream = mira130_set_stream,
+	.g_frame_interval = mira130_g_frame_interval,
+	.s_frame_interval = mira130_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops mira130_pad_ops = {
@@ -1976,6 +2056,7 @@ static const struct v4l2_subdev_pad_ops mira130_pad_ops = {
 	.set_fmt = mira130_set_pad_format,
 	.get_selection = mira130_get_selection,
 	.enum_frame_size = mira130_enum_frame_size,
+	.enum_frame_interval = mira130_enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops mira130_subdev_ops = {
@@ -1989,6 +2070,17 @@ static const struct v4l2_subdev_internal_ops mira130_internal_ops = {
 };
 
 /* Initialize control handlers */
+static bool mira130_has_hdr_mode(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_modes); i++)
+		if (supported_modes[i].hdr)
+			return true;
+
+	return false;
+}
+
 static int mira130_init_controls(struct mira130 *mira130)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira130->sd);
@@ -1997,12 +2089,13 @@ static int mira130_init_controls(struct mira130 *mira130)
 	int ret;
 	struct v4l2_ctrl_config *mira130_reg_w;
 	struct v4l2_ctrl_config *mira130_reg_r;
+	unsigned int i;
 
 	u32 max_exposure = 0;
 
 	ctrl_hdlr = &mira130->ctrl_handler;
 	/* v4l2_ctrl_handler_init gives a hint/guess of the number of v4l2_ctrl_new */
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 23);
 	if (ret)
 		return ret;
 
@@ -2018,6 +2111,17 @@ static int mira130_init_controls(struct mira130 *mira130)
 					        MIRA130_PIXEL_RATE, 1,
 					        MIRA130_PIXEL_RATE);
 
+	/* Limited to the rates listed in DT */
+	mira130->link_freq = v4l2_ctrl_new_int_menu(ctrl_hdlr, &mira130_ctrl_ops,
+						    V4L2_CID_LINK_FREQ,
+						    ARRAY_SIZE(link_freq_menu) - 1,
+						    __ffs(mira130->link_freq_mask),
+						    link_freq_menu);
+	if (mira130->link_freq) {
+		mira130->link_freq->menu_skip_mask = ~mira130->link_freq_mask;
+		mira130->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	}
+
 	printk(KERN_INFO "[MIRA130]: %s V4L2_CID_VBLANK %X.\n", __func__, V4L2_CID_VBLANK);
 
 	mira130->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &mira130_ctrl_ops,
@@ -2038,9 +2142,7 @@ static int mira130_init_controls(struct mira130 *mira130)
 
 	// Exposure is indicated in number of lines here
 	// Max is determined by vblank + vsize and Tglob.
-	max_exposure = mira130_calculate_max_exposure_time(mira130->mode->row_length,
-	                                                   mira130->mode->height,
-	                                                   mira130->mode->vblank);
+	max_exposure = mira130_calculate_max_exposure_time(mira130->mode, mira130->mode->vblank);
 
 	printk(KERN_INFO "[MIRA130]: %s V4L2_CID_EXPOSURE %X.\n", __func__, V4L2_CID_EXPOSURE);
 
@@ -2088,6 +2190,26 @@ static int mira130_init_controls(struct mira130 *mira130)
 	if (mira130->mira130_reg_r)
 		mira130->mira130_reg_r->flags |= (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_READ_ONLY);
 
+	/* Control delays and startup frames, read-only */
+	for (i = 2; i < ARRAY_SIZE(custom_ctrl_config_list); i++)
+		v4l2_ctrl_new_custom(ctrl_hdlr, &custom_ctrl_config_list[i], NULL);
+
+	/* The short controls stay NULL in the cluster without an HDR mode */
+	if (mira130_has_hdr_mode()) {
+		mira130->exposure_short = v4l2_ctrl_new_custom(ctrl_hdlr,
+							       &mira130_exposure_short_ctrl, NULL);
+		mira130->gain_short = v4l2_ctrl_new_custom(ctrl_hdlr,
+							   &mira130_gain_short_ctrl, NULL);
+	}
+	v4l2_ctrl_activate(mira130->exposure_short, mira130->mode->hdr);
+	v4l2_ctrl_activate(mira130->gain_short, mira130->mode->hdr);
+
+	/* Exposure and gains set in one VIDIOC_S_EXT_CTRLS take the same frame */
+	v4l2_ctrl_cluster(4, &mira130->exposure);
+
+	ams_sensor_gain_linear_init(&mira130->ams, ctrl_hdlr, &mira130_ctrl_ops,
+				    mira130->gain);
+
 	if (ctrl_hdlr->error) {
 		ret = ctrl_hdlr->error;
 		dev_err(&client->dev, "%s control init failed (%d)\n",
@@ -2121,12 +2243,13 @@ static void mira130_free_controls(struct mira130 *mira130)
 	mutex_destroy(&mira130->mutex);
 }
 
-static int mira130_check_hwcfg(struct device *dev)
+static int mira130_check_hwcfg(struct device *dev, struct mira130 *mira130)
 {
 	struct fwnode_handle *endpoint;
 	struct v4l2_fwnode_endpoint ep_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY
 	};
+	unsigned int i, j;
 	int ret = -EINVAL;
 
 	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -2152,10 +2275,21 @@ static int mira130_check_hwcfg(struct device *dev)
 		goto error_out;
 	}
 
-	if (ep_cfg.nr_of_link_frequencies != 1 ||
-	    ep_cfg.link_frequencies[0] != MIRA130_DEFAULT_LINK_FREQ) {
-		dev_err(dev, "Link frequency not supported: %lld\n",
-			ep_cfg.link_frequencies[0]);
+	mira130->link_freq_mask = 0;
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++) {
+		for (j = 0; j < ARRAY_SIZE(link_freq_menu); j++) {
+			if (ep_cfg.link_frequencies[i] == link_freq_menu[j]) {
+				mira130->link_freq_mask |= BIT(j);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(link_freq_menu))
+			dev_warn(dev, "Link frequency not supported: %lld\n",
+				 ep_cfg.link_frequencies[i]);
+	}
+
+	if (!mira130->link_freq_mask) {
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto error_out;
 	}
 
@@ -2170,101 +2304,86 @@ error_out:
 	return ret;
 }
 
-static int mira130pmic_init_controls(struct i2c_client *client)
-{
-	int ret;
-	u8 val;
-
-	ret = mira130pmic_write(client, 0x62, 0x00);
-	ret = mira130pmic_write(client, 0x61, 0x00);
-
-	ret = mira130pmic_read(client, 0x61, &val);
-	dev_err(&client->dev, "Read 0x61 with val %x\n", val);
-
-
-	usleep_range(100, 110);
-
-	ret = mira130pmic_write(client, 0x05, 0x00);
-	ret = mira130pmic_write(client, 0x0e, 0x00);
-	ret = mira130pmic_write(client, 0x11, 0x00);
-	ret = mira130pmic_write(client, 0x14, 0x00);
-	ret = mira130pmic_write(client, 0x17, 0x00);
-	ret = mira130pmic_write(client, 0x1a, 0x00);
-	ret = mira130pmic_write(client, 0x1c, 0x00);
-	ret = mira130pmic_write(client, 0x1d, 0x00);
-	ret = mira130pmic_write(client, 0x1e, 0x00);
-	ret = mira130pmic_write(client, 0x1f, 0x00);
-
-	ret = mira130pmic_write(client, 0x24, 0x48);
-	ret = mira130pmic_write(client, 0x20, 0x00);
-	ret = mira130pmic_write(client, 0x21, 0x00);
-	ret = mira130pmic_write(client, 0x1a, 0x00);
-	ret = mira130pmic_write(client, 0x01, 0x00);
-	ret = mira130pmic_write(client, 0x08, 0x00);
-	ret = mira130pmic_write(client, 0x02, 0x00);
-	ret = mira130pmic_write(client, 0x0b, 0x00);
-	ret = mira130pmic_write(client, 0x14, 0x00);
-	ret = mira130pmic_write(client, 0x17, 0x00);
-	ret = mira130pmic_write(client, 0x1c, 0x00);
-	ret = mira130pmic_write(client, 0x1d, 0x00);
-	ret = mira130pmic_write(client, 0x1f, 0x00);
-
-	usleep_range(50, 60);
-
-	ret = mira130pmic_write(client, 0x62, 0x0d);
-
-	usleep_range(50, 60);
-	usleep_range(50000, 50000+100);
-
-	ret = mira130pmic_write(client, 0x27, 0xff);
-	ret = mira130pmic_write(client, 0x28, 0xff);
-	ret = mira130pmic_write(client, 0x29, 0xff);
-	ret = mira130pmic_write(client, 0x2a, 0xff);
-	ret = mira130pmic_write(client, 0x2b, 0xff);
-
-	ret = mira130pmic_write(client, 0x41, 0x04);
-	usleep_range(50, 60);
-
-	ret = mira130pmic_read(client, 0x20, &val);
-	dev_err(&client->dev, "Read 0x20 with val %x\n", val);
+/* Board bring-up: PMIC supplies and the green LED */
+static const struct ams_pmic_step mira130_pmic_init_seq[] = {
+	AMS_PMIC_W(0x62, 0x00),
+	AMS_PMIC_W(0x61, 0x00),
+
+	AMS_PMIC_SLEEP(100, 110),
+
+	AMS_PMIC_W(0x05, 0x00),
+	AMS_PMIC_W(0x0e, 0x00),
+	AMS_PMIC_W(0x11, 0x00),
+	AMS_PMIC_W(0x14, 0x00),
+	AMS_PMIC_W(0x17, 0x00),
+	AMS_PMIC_W(0x1a, 0x00),
+	AMS_PMIC_W(0x1c, 0x00),
+	AMS_PMIC_W(0x1d, 0x00),
+	AMS_PMIC_W(0x1e, 0x00),
+	AMS_PMIC_W(0x1f, 0x00),
+
+	AMS_PMIC_W(0x24, 0x48),
+	AMS_PMIC_W(0x20, 0x00),
+	AMS_PMIC_W(0x21, 0x00),
+	AMS_PMIC_W(0x1a, 0x00),
+	AMS_PMIC_W(0x01, 0x00),
+	AMS_PMIC_W(0x08, 0x00),
+	AMS_PMIC_W(0x02, 0x00),
+	AMS_PMIC_W(0x0b, 0x00),
+	AMS_PMIC_W(0x14, 0x00),
+	AMS_PMIC_W(0x17, 0x00),
+	AMS_PMIC_W(0x1c, 0x00),
+	AMS_PMIC_W(0x1d, 0x00),
+	AMS_PMIC_W(0x1f, 0x00),
+
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x62, 0x0d),
+
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_SLEEP(50000, 50000 + 100),
+
+	AMS_PMIC_W(0x27, 0xff),
+	AMS_PMIC_W(0x28, 0xff),
+	AMS_PMIC_W(0x29, 0xff),
+	AMS_PMIC_W(0x2a, 0xff),
+	AMS_PMIC_W(0x2b, 0xff),
+
+	AMS_PMIC_W(0x41, 0x04),
+	AMS_PMIC_SLEEP(50, 60),
 
 	// PCB V2.0 or above, enable LDO9=2.50V for VDD25
-	ret = mira130pmic_write(client, 0x20, 0xb2);
+	AMS_PMIC_W(0x20, 0xb2),
 	// For PCB V1.0, VDD28 on 2.85V for older PCBs
-	// ret = mira130pmic_write(client, 0x20, 0xb9);
-
-	ret = mira130pmic_read(client, 0x20, &val);
-	dev_err(&client->dev, "Read 0x20 with val %x\n", val);
-
-	usleep_range(700, 710);
-
-	ret = mira130pmic_write(client, 0x12, 0x16);
-	ret = mira130pmic_write(client, 0x10, 0x16);
-	ret = mira130pmic_write(client, 0x11, 0x96);
-	ret = mira130pmic_write(client, 0x1e, 0x96);
-	ret = mira130pmic_write(client, 0x21, 0x96);
-	usleep_range(50, 60);
-
-	ret = mira130pmic_write(client, 0x00, 0x04);
-	ret = mira130pmic_write(client, 0x04, 0x34);
-	ret = mira130pmic_write(client, 0x06, 0xbf);
-	ret = mira130pmic_write(client, 0x05, 0xb4);
-	ret = mira130pmic_write(client, 0x03, 0x00);
-	ret = mira130pmic_write(client, 0x0d, 0x34);
-	ret = mira130pmic_write(client, 0x0f, 0xbf);
-	ret = mira130pmic_write(client, 0x0e, 0xb4);
-	usleep_range(50, 60);
-
-	ret = mira130pmic_write(client, 0x42, 0x05);
-	usleep_range(50, 60);
-
-	ret = mira130pmic_write(client, 0x45, 0x40);
-	ret = mira130pmic_write(client, 0x57, 0x02);
-	ret = mira130pmic_write(client, 0x5d, 0x10);
-	ret = mira130pmic_write(client, 0x61, 0x10);
-
-	return 0;
-}
+	// AMS_PMIC_W(0x20, 0xb9),
+
+	AMS_PMIC_SLEEP(700, 710),
+
+	AMS_PMIC_W(0x12, 0x16),
+	AMS_PMIC_W(0x10, 0x16),
+	AMS_PMIC_W(0x11, 0x96),
+	AMS_PMIC_W(0x1e, 0x96),
+	AMS_PMIC_W(0x21, 0x96),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x00, 0x04),
+	AMS_PMIC_W(0x04, 0x34),
+	AMS_PMIC_W(0x06, 0xbf),
+	AMS_PMIC_W(0x05, 0xb4),
+	AMS_PMIC_W(0x03, 0x00),
+	AMS_PMIC_W(0x0d, 0x34),
+	AMS_PMIC_W(0x0f, 0xbf),
+	AMS_PMIC_W(0x0e, 0xb4),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x42, 0x05),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x45, 0x40),
+	AMS_PMIC_W(0x57, 0x02),
+	AMS_PMIC_W(0x5d, 0x10),
+	AMS_PMIC_W(0x61, 0x10),
+};
 
 
 static int mira130_probe(struct i2c_client *client)
@@ -2283,17 +2402,21 @@ static int mira130_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	v4l2_i2c_subdev_init(&mira130->sd, client, &mira130_subdev_ops);
+	mira130->ams.client = client;
+	mira130->ams.ops = &mira130_ams_ops;
+	mutex_init(&mira130->hw_lock);
+	seqlock_init(&mira130->fmt_seqlock);
 
 	/* Check the hardware configuration in device tree */
-	if (mira130_check_hwcfg(dev))
+	if (mira130_check_hwcfg(dev, mira130))
 		return -EINVAL;
 
 	/* Parse device tree to check if dtoverlay has param skip-reg-upload=1 */
         device_property_read_u32(dev, "skip-reg-upload", &mira130->skip_reg_upload);
 	printk(KERN_INFO "[MIRA130]: skip-reg-upload %d.\n", mira130->skip_reg_upload);
 	/* Set default TBD I2C device address to LED I2C Address*/
-	mira130->tbd_client_i2c_addr = MIRA130LED_I2C_ADDR;
-	printk(KERN_INFO "[MIRA130]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira130->tbd_client_i2c_addr);
+	mira130->ams.tbd_client_i2c_addr = MIRA130LED_I2C_ADDR;
+	printk(KERN_INFO "[MIRA130]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira130->ams.tbd_client_i2c_addr);
 
 
 	/* Get system clock (xclk) */
@@ -2322,20 +2445,21 @@ static int mira130_probe(struct i2c_client *client)
 
 	{
 		printk(KERN_INFO "[MIRA130]: Init PMIC.\n");
-		mira130->pmic_client = i2c_new_dummy_device(client->adapter,
+		mira130->ams.pmic_client = i2c_new_dummy_device(client->adapter,
 				MIRA130PMIC_I2C_ADDR);
-		if (IS_ERR(mira130->pmic_client))
-			return PTR_ERR(mira130->pmic_client);
-		mira130->uc_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira130->ams.pmic_client))
+			return PTR_ERR(mira130->ams.pmic_client);
+		mira130->ams.uc_client = i2c_new_dummy_device(client->adapter,
 				MIRA130UC_I2C_ADDR);
-		if (IS_ERR(mira130->uc_client))
-			return PTR_ERR(mira130->uc_client);
-		mira130->led_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira130->ams.uc_client))
+			return PTR_ERR(mira130->ams.uc_client);
+		mira130->ams.led_client = i2c_new_dummy_device(client->adapter,
 				MIRA130LED_I2C_ADDR);
-		if (IS_ERR(mira130->led_client))
-			return PTR_ERR(mira130->led_client);
+		if (IS_ERR(mira130->ams.led_client))
+			return PTR_ERR(mira130->ams.led_client);
 
-		mira130pmic_init_controls(mira130->pmic_client);
+		ams_pmic_run_seq(&mira130->ams, mira130_pmic_init_seq,
+				 ARRAY_SIZE(mira130_pmic_init_seq));
 	}
 
 	dev_err(dev, "[MIRA130] Sleep for 1 second to let PMIC driver complete init.\n");
@@ -2413,9 +2537,9 @@ error_handler_free:
 error_power_off:
 	mira130_power_off(dev);
 
-	i2c_unregister_device(mira130->pmic_client);
-	i2c_unregister_device(mira130->uc_client);
-	i2c_unregister_device(mira130->led_client);
+	i2c_unregister_device(mira130->ams.pmic_client);
+	i2c_unregister_device(mira130->ams.uc_client);
+	i2c_unregister_device(mira130->ams.led_client);
 
 	return ret;
 }
@@ -2425,9 +2549,9 @@ static void mira130_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct mira130 *mira130 = to_mira130(sd);
 
-	i2c_unregister_device(mira130->pmic_client);
-	i2c_unregister_device(mira130->uc_client);
-	i2c_unregister_device(mira130->led_client);
+	i2c_unregister_device(mira130->ams.pmic_client);
+	i2c_unregister_device(mira130->ams.uc_client);
+	i2c_unregister_device(mira130->ams.led_client);
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
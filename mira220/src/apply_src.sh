@@ -5,4 +5,3 @@ cp $PATCH_PATH/mira220-overlay.dts $LINUX_PATH/arch/arm/boot/dts/overlays/
 cp $PATCH_PATH/mira220color-overlay.dts $LINUX_PATH/arch/arm/boot/dts/overlays/
 cp $PATCH_PATH/mira220.inl $LINUX_PATH/drivers/media/i2c/
 cp $PATCH_PATH/mira220.c $LINUX_PATH/drivers/media/i2c/
-cp $PATCH_PATH/mira220color.c $LINUX_PATH/drivers/media/i2c/
@@ -10,17 +10,34 @@
 #include "mira220.inl"
 
 static const struct of_device_id mira220_dt_ids[] = {
-	{ .compatible = "ams,mira220" },
+	{ .compatible = "ams,mira220", .data = &mira220_mono },
+	{ .compatible = "ams,mira220color", .data = &mira220_color },
 	{ /* sentinel */ }
 };
 MODULE_DEVICE_TABLE(of, mira220_dt_ids);
 
 static const struct i2c_device_id mira220_ids[] = {
-	{ "mira220", 0 },
+	{ "mira220", (kernel_ulong_t)&mira220_mono },
+	{ "mira220color", (kernel_ulong_t)&mira220_color },
 	{ }
 };
 MODULE_DEVICE_TABLE(i2c, mira220_ids);
 
+/* The DT compatible, or the i2c device id without DT */
+static const struct mira220_variant *mira220_get_variant(struct i2c_client *client)
+{
+	const struct mira220_variant *variant;
+	const struct i2c_device_id *id;
+
+	variant = device_get_match_data(&client->dev);
+	if (variant)
+		return variant;
+
+	id = i2c_match_id(mira220_ids, client);
+
+	return id ? (const struct mira220_variant *)id->driver_data : NULL;
+}
+
 static struct i2c_driver mira220_i2c_driver = {
 	.driver = {
 		.name = "mira220",
@@ -11,26 +11,40 @@
 #define __MIRA220_INL__
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/gcd.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
+#include <media/v4l2-rect.h>
 #include <asm/unaligned.h>
 
+#include "ams_sensor_core.h"
+
 /*
- * Introduce new v4l2 control
+ * Frames until a control written during frame N is used, and frames to
+ * drop after stream-on. EXP_TIME, ANALOG_GAIN and VBLANK of context A
+ * are latched at the frame boundary, where the readout of frame N + 1
+ * starts. The exposure of frame N + 1 overlaps the readout of frame N
+ * (see mira220_calculate_max_exposure_time()) and has already run with
+ * the old EXP_TIME. The gain is applied at readout and VBLANK sets the
+ * length of the frame it is latched for, so both reach frame N + 1. No
+ * mode changes this. Check with tools/ctrl_latency -c.
  */
-#include <linux/v4l2-controls.h>
-#define AMS_CAMERA_CID_BASE		(V4L2_CTRL_CLASS_CAMERA | 0x2000)
-#define AMS_CAMERA_CID_MIRA_REG_W	(AMS_CAMERA_CID_BASE+0)
-#define AMS_CAMERA_CID_MIRA_REG_R	(AMS_CAMERA_CID_BASE+1)
+#define MIRA220_EXPOSURE_DELAY	2
+#define MIRA220_GAIN_DELAY	1
+#define MIRA220_VBLANK_DELAY	1
+#define MIRA220_STARTUP_FRAMES	1
 
 /* Most significant Byte is flag, and most significant bit is unused. */
 #define AMS_CAMERA_CID_MIRA220_REG_FLAG_FOR_READ        0b00000001
@@ -69,7 +83,7 @@
  * The TBD I2C address is default to MIRA220LED_I2C_ADDR.
  * To change the TBD I2C address, set bit 6&7 to 0b10,
  * then the reg_val will become TBD I2C address.
- * The TBD I2C address is stored in mira220->tbd_client_i2c_addr.
+ * The TBD I2C address is stored in mira220->ams.tbd_client_i2c_addr.
  */
 #define AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL         0b01100000
 #define AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_MIRA        0b00000000
@@ -90,9 +104,18 @@
 #define MIRA220_PIXEL_ARRAY_WIDTH		1600U
 #define MIRA220_PIXEL_ARRAY_HEIGHT		1400U
 
+/*
+ * ANALOG_GAIN of context A holds 8 / gain, for gains x1, x2 and x4.
+ * V4L2_CID_ANALOGUE_GAIN is the coarse gain index, gain = 1 << index,
+ * as in the Mira050 12 bit mode. The register is one byte latched at
+ * the frame boundary, so a frame never sees a partial update. Row noise
+ * correction (RNC_EN) clamps the dark rows to RNC_DARK_TARGET after the
+ * gain stage, so the black level stays at the same code for every gain.
+ */
 #define MIRA220_ANALOG_GAIN_REG			0x400A
-#define MIRA220_ANALOG_GAIN_MIN			1
-#define MIRA220_ANALOG_GAIN_MAX			1 /* Fixed analog gain to 1, to avoid unexpected behavior. */
+#define MIRA220_ANALOG_GAIN_REG_UNITY		8
+#define MIRA220_ANALOG_GAIN_MIN			0
+#define MIRA220_ANALOG_GAIN_MAX			2
 #define MIRA220_ANALOG_GAIN_STEP		1
 #define MIRA220_ANALOG_GAIN_DEFAULT		MIRA220_ANALOG_GAIN_MIN
 
@@ -110,6 +133,11 @@
 #define MIRA220_IMAGER_STATE_STOP_AT_ROW	0x02
 #define MIRA220_IMAGER_STATE_STOP_AT_FRAME	0x04
 #define MIRA220_IMAGER_STATE_MASTER_CONTROL	0x10
+/*
+ * The register map and tables in this tree give no IMAGER_STATE value
+ * for slave (TRIGGER input) operation, so the external trigger and pulse
+ * width exposure modes are not offered.
+ */
 
 #define MIRA220_IMAGER_RUN_REG			0x10F0
 #define MIRA220_IMAGER_RUN_START		0x01
@@ -121,6 +149,7 @@
 
 #define MIRA220_NB_OF_FRAMES_LO_REG		0x10F2
 #define MIRA220_NB_OF_FRAMES_HI_REG		0x10F3
+#define MIRA220_NB_OF_FRAMES_MAX		0xFFFF
 
 #define MIRA220_POWER_MODE_REG			0x0043
 #define MIRA220_POWER_MODE_SLEEP		0x01
@@ -170,6 +199,12 @@
 #define MIRA220_MIPI_HSIZE_HI_REG		0x207E
 #define MIRA220_MIPI_HSIZE_MASK			0xFFFF
 
+// Window set with set_selection. Columns go in pairs (HSTART/HSIZE units),
+// rows too, so that the Bayer order of the color variant is kept.
+#define MIRA220_CROP_ALIGN			2
+#define MIRA220_MIN_CROP_WIDTH			64
+#define MIRA220_MIN_CROP_HEIGHT			8
+
 #define MIRA220_HFLIP_REG			0x209C
 #define MIRA220_HFLIP_ENABLE_MIRROR		1
 #define MIRA220_HFLIP_DISABLE_MIRROR		0
@@ -221,54 +256,27 @@
 
 
 
-// Outdated. See below.
-// pixel_rate = link_freq * 2 * nr_of_lanes / bits_per_sample
-// 1.0Gb/s * 2 * 2 / 12 = 357913941
-// #define MIRA220_PIXEL_RATE		(357913941)
-
-// Mira220 PIXEL_RATE is derived from ROW_LENGTH. See datasheet Section 9.2.
+// Mira220 row time is derived from ROW_LENGTH. See datasheet Section 9.2.
 // ROW_LENGTH is set by registers: 0x102B, 0x102C. Unit is number of CLK_IN cycles.
-// PIXEL_RATE = 1000000000 * WIDTH / (ROW_LENGTH * CLK_IN_PERIOD_NS)
-// ROW_LENGTH_1600x1400_1000GBS=300
-// ROW_LENGTH_640x480_1000GBS=450
-// CLK_IN_PERIOD_NS = 1.0 s / 38.4 Mhz = 26.04 ns
-// MIRA220_PIXEL_RATE = 1000000000 * 1600 / (300 * 26.04) = 204813108
-// MIRA220_PIXEL_RATE = 1000000000 * 640 / (450 * 26.04) = 54616828
-#define MIRA220_PIXEL_RATE   384000000 //384M (x10)
-// Row time in microseconds. Not used in driver, but used in libcamera cam_helper.
-// ROW_TIME_US = ROW_LENGTH * CLK_IN_PERIOD_NS / 1000
-// MIRA220_ROW_TIME_1600x1400_1000GBS_US=(300*26.04/1000)=7.8us
-// MIRA220_ROW_TIME_640x480_1000GBS_US=(450*26.04/1000)=11.7us
-
-/* Should match device tree link freq */
+// All register tables use ROW_LENGTH=304, independent of bit depth.
+// ROW_TIME = ROW_LENGTH / CLK_IN = 304 / 38.4 MHz = 7.92 us
+#define MIRA220_CLK_IN_FREQ		38400000
+#define MIRA220_ROW_LENGTH		304
+
+// PIXEL_RATE is CLK_IN scaled by 10, so that a line of WIDTH + HBLANK
+// pixels takes exactly one row time at every width up to 10 * ROW_LENGTH.
+#define MIRA220_PIXEL_RATE		(10 * MIRA220_CLK_IN_FREQ)
+#define MIRA220_LINE_LENGTH(row_length)	\
+	((row_length) * (MIRA220_PIXEL_RATE / MIRA220_CLK_IN_FREQ))
+
+// Global shutter readout takes GLOB_NUM_CLK_CYCLES plus 11 rows of VBLANK.
+#define MIRA220_MIN_VBLANK(row_length)	\
+	(DIV_ROUND_UP(MIRA220_GLOB_NUM_CLK_CYCLES, (row_length)) + 11)
+#define MIRA220_MAX_VBLANK		50000
+
+/* Link freq of the PLL and CSI settings in the mode tables */
 #define MIRA220_DEFAULT_LINK_FREQ	456000000
 
-/* Trick the libcamera with achievable fps via hblank */
-
-/* Formular in libcamera to derive TARGET_FPS:
- * TARGET_FPS=1/((1/MIRA220_PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+MIRA220_MIN_VBLANK))
- * Example: 640x480 with HBLANK=0 and MIRA220_MIN_VBLANK=13
- * TARGET_FPS=1/((1/54616828)*640*(480+13))=173
- * Example: 1600x1400 with HBLANK=0 and MIRA220_MIN_VBLANK=13
- * TARGET_FPS=1/((1/204813108)*1600*(1400+13))=91
- * 
- * Inverse the above formula to derive HBLANK from TARGET_FPS:
- * HBLANK=1/((1/MIRA220_PIXEL_RATE)*TARGET_FPS*(HEIGHT+MIRA220_MIN_VBLANK))-WIDTH
- * Example with TARGET_FPS of 120 fps for 640x480
- * HBLANK=1/((1/54616828)*120*(480+13))-640=283
- * Example with TARGET_FPS of 30 fps for 1600x1400
- * HBLANK=1/((1/204813108)*30*(1400+13))-1600=3232
- */
-
-#define MIRA220_HBLANK_640x480_120FPS		3860
-#define MIRA220_HBLANK_1600x1400_30FPS		2900
-#define MIRA220_HBLANK_1600x1400_1500		1400
-
-#define MIRA220_HBLANK_400x400_304			2640
-#define MIRA220_HBLANK_640x480_304			2400
-#define MIRA220_HBLANK_1600x1400_304		1440
-
-
 #define MIRA220_REG_TEST_PATTERN	0x2091
 #define	MIRA220_TEST_PATTERN_DISABLE	0x00
 #define	MIRA220_TEST_PATTERN_VERTICAL_GRADIENT	0x01
@@ -296,16 +304,19 @@ enum pad_types {
 	NUM_PADS
 };
 
-struct mira220_reg {
-	u16 address;
-	u8 val;
-};
-
 struct mira220_reg_list {
 	unsigned int num_of_regs;
-	const struct mira220_reg *regs;
+	const struct ams_sensor_reg *regs;
+	/* Firmware replacing regs, NULL for a built-in only table */
+	const char *fw_name;
 };
 
+/*
+ * Firmware replacing a built-in mode table, loaded from
+ * /lib/firmware/ams/mira220_<table>.bin. Pack it with tools/regfw.
+ */
+#define MIRA220_FW_NAME(table) "ams/mira220_" #table ".bin"
+
 struct mira220_v4l2_reg {
 	u32 val;
 };
@@ -332,7 +343,7 @@ struct mira220_mode {
 };
 
 // 1600_1400_30fps_12b_2lanes
-static const struct mira220_reg full_1600_1400_1500_12b_2lanes_reg[] = {
+static const struct ams_sensor_reg full_1600_1400_1500_12b_2lanes_reg[] = {
 
 	{0x1003,0x2}, //,Initial Upload
 	{0x6006,0x0}, //,Initial Upload
@@ -1184,7 +1195,7 @@ static const struct mira220_reg full_1600_1400_1500_12b_2lanes_reg[] = {
 
 
 // vga_640_480_120fps_12b_2lanes
-static const struct mira220_reg vga_640_480_120fps_12b_2lanes_reg[] = {
+static const struct ams_sensor_reg vga_640_480_120fps_12b_2lanes_reg[] = {
 	{0x1003,0x2}, //,Initial Upload
 	{0x6006,0x0}, //,Initial Upload
 	{0x6012,0x1}, //,Initial Upload
@@ -2032,7 +2043,7 @@ static const struct mira220_reg vga_640_480_120fps_12b_2lanes_reg[] = {
 
 };
 
-static const struct mira220_reg full_400_400_250fps_12b_2lanes_reg[] = {
+static const struct ams_sensor_reg full_400_400_250fps_12b_2lanes_reg[] = {
 	{0x1003,0x2}, //,Initial Upload
 	{0x6006,0x0}, //,Initial Upload
 	{0x6012,0x1}, //,Initial Upload
@@ -2911,6 +2922,16 @@ static const char * const mira220_supply_name[] = {
 
 #define MIRA220_NUM_SUPPLIES ARRAY_SIZE(mira220_supply_name)
 
+/*
+ * MIPI link frequencies, in V4L2_CID_LINK_FREQ menu order. The mode tables
+ * program MIRA220_DEFAULT_LINK_FREQ. Other rates need their CSI PLL
+ * and D-PHY timing registers, which are not known yet, so the control is
+ * read-only until then.
+ */
+static const s64 link_freq_menu[] = {
+	MIRA220_DEFAULT_LINK_FREQ,
+};
+
 /*
  * The supported formats. All flip/mirror combinations have the same byte order because the sensor
  * is monochrome
@@ -2924,6 +2945,29 @@ static const u32 codes[] = {
 	MEDIA_BUS_FMT_SGRBG12_1X12,
 };
 
+/*
+ * Mono and color variant, the match data of both device tables. Both
+ * report the Bayer codes above, as the separate mira220 and
+ * mira220color modules did, so existing userspace tuning keeps working.
+ */
+struct mira220_variant {
+	const char *name;
+	const u32 *codes;
+	unsigned int num_codes;
+};
+
+static const struct mira220_variant mira220_mono = {
+	.name = "mira220",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
+static const struct mira220_variant mira220_color = {
+	.name = "mira220color",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
 /* Mode configs */
 static const struct mira220_mode supported_modes[] = {
 
@@ -2940,14 +2984,14 @@ static const struct mira220_mode supported_modes[] = {
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(full_1600_1400_1500_12b_2lanes_reg),
 			.regs = full_1600_1400_1500_12b_2lanes_reg,
+			.fw_name = MIRA220_FW_NAME(full_1600_1400_1500_12b_2lanes_reg),
 		},
-		// vblank is ceil(MIRA220_GLOB_NUM_CLK_CYCLES / ROW_LENGTH)  + 11
 		// ROW_LENGTH is configured by register 0x102B, 0x102C.
-		.row_length = 304,
+		.row_length = MIRA220_ROW_LENGTH,
 		.pixel_rate = MIRA220_PIXEL_RATE,
-		.min_vblank = 20, // ceil(1928 / 300) + 11
-		.max_vblank = 50000, // ceil(1928 / 300) + 11
-		.hblank = MIRA220_HBLANK_1600x1400_304, // TODO
+		.min_vblank = MIRA220_MIN_VBLANK(MIRA220_ROW_LENGTH),
+		.max_vblank = MIRA220_MAX_VBLANK,
+		.hblank = MIRA220_LINE_LENGTH(MIRA220_ROW_LENGTH) - 1600,
 		.code = MEDIA_BUS_FMT_SGRBG12_1X12,
 	},
 
@@ -2964,14 +3008,14 @@ static const struct mira220_mode supported_modes[] = {
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(vga_640_480_120fps_12b_2lanes_reg),
 			.regs = vga_640_480_120fps_12b_2lanes_reg,
+			.fw_name = MIRA220_FW_NAME(vga_640_480_120fps_12b_2lanes_reg),
 		},
-		// vblank is ceil(MIRA220_GLOB_NUM_CLK_CYCLES / ROW_LENGTH)  + 11
 		// ROW_LENGTH is configured by register 0x102B, 0x102C.
-		.row_length = 304,
+		.row_length = MIRA220_ROW_LENGTH,
 		.pixel_rate = MIRA220_PIXEL_RATE,
-		.min_vblank = 20, // ceil(1928 / 300) + 11
-		.max_vblank = 50000, // ceil(1928 / 300) + 11
-		.hblank = MIRA220_HBLANK_640x480_304, // TODO
+		.min_vblank = MIRA220_MIN_VBLANK(MIRA220_ROW_LENGTH),
+		.max_vblank = MIRA220_MAX_VBLANK,
+		.hblank = MIRA220_LINE_LENGTH(MIRA220_ROW_LENGTH) - 640,
 		.code = MEDIA_BUS_FMT_SGRBG12_1X12,
 	},
 	
@@ -2987,14 +3031,14 @@ static const struct mira220_mode supported_modes[] = {
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(full_400_400_250fps_12b_2lanes_reg),
 			.regs = full_400_400_250fps_12b_2lanes_reg,
+			.fw_name = MIRA220_FW_NAME(full_400_400_250fps_12b_2lanes_reg),
 		},
-		// vblank is ceil(MIRA220_GLOB_NUM_CLK_CYCLES / ROW_LENGTH)  + 11
 		// ROW_LENGTH is configured by register 0x102B, 0x102C.
-		.row_length = 304,
+		.row_length = MIRA220_ROW_LENGTH,
 		.pixel_rate = MIRA220_PIXEL_RATE,
-		.min_vblank = 20, // ceil(1928 / 300) + 11
-		.max_vblank = 50000, // ceil(1928 / 300) + 11
-		.hblank = MIRA220_HBLANK_400x400_304, // TODO
+		.min_vblank = MIRA220_MIN_VBLANK(MIRA220_ROW_LENGTH),
+		.max_vblank = MIRA220_MAX_VBLANK,
+		.hblank = MIRA220_LINE_LENGTH(MIRA220_ROW_LENGTH) - 400,
 		.code = MEDIA_BUS_FMT_SGRBG12_1X12,
 	}
 
@@ -3002,9 +3046,13 @@ static const struct mira220_mode supported_modes[] = {
 
 struct mira220 {
 	struct v4l2_subdev sd;
+	/* Mono or color, from the device match data */
+	const struct mira220_variant *variant;
 	struct media_pad pad[NUM_PADS];
 
 	struct v4l2_mbus_framefmt fmt;
+	/* Readout window, mode->crop unless changed with set_selection */
+	struct v4l2_rect crop;
 
 	struct clk *xclk; /* system clock to MIRA220 */
 	u32 xclk_freq;
@@ -3014,23 +3062,34 @@ struct mira220 {
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *link_freq;
+	/* Entries of link_freq_menu listed in device tree */
+	unsigned long link_freq_mask;
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
 	struct v4l2_ctrl *hblank;
 	struct v4l2_ctrl *exposure;
 	struct v4l2_ctrl *gain;
+	/* Frames per IMAGER_RUN, 0 for continuous streaming */
+	struct v4l2_ctrl *burst_count;
 	// custom v4l2 control
 	struct v4l2_ctrl *mira220_reg_w;
 	struct v4l2_ctrl *mira220_reg_r;
-	u16 mira220_reg_w_cached_addr;
-	u8 mira220_reg_w_cached_flag;
 
 
 	/* Current mode */
 	const struct mira220_mode *mode;
 	/* Whether to skip base register sequence upload */
 	u32 skip_reg_upload;
+	/* Upload the mode in the background after an ACTIVE set_fmt */
+	u32 preload;
+	/* preload_mode/preload_code are uploaded and hold a runtime PM reference */
+	bool preloaded;
+	const struct mira220_mode *preload_mode;
+	u32 preload_code;
+	struct v4l2_rect preload_crop;
+	struct work_struct preload_work;
 	/* Whether to reset sensor when stream on/off */
 	u32 skip_reset;
 	/* Whether regulator and clk are powered on */
@@ -3046,20 +3105,31 @@ struct mira220 {
 
 	/*
 	 * Mutex for serialized access:
-	 * Protect sensor module set pad format and start/stop streaming safely.
+	 * Control handler lock, protects driver state and control ranges.
+	 * Not held across power-on and register table upload.
 	 */
 	struct mutex mutex;
+	/*
+	 * Serializes hardware sequences (stream on/off, suspend/resume) and
+	 * ACTIVE format changes. Lock order: hw_lock, then mutex.
+	 */
+	struct mutex hw_lock;
+	/* Set while a hardware sequence runs without mutex */
+	bool hw_busy;
+	/*
+	 * Publishes mode, fmt and crop so format and selection queries
+	 * can read them without taking mutex.
+	 */
+	seqlock_t fmt_seqlock;
 
 	/* Streaming on/off */
 	bool streaming;
 
-	/* pmic, uC, LED */
-	struct i2c_client *pmic_client;
-	struct i2c_client *uc_client;
-	struct i2c_client *led_client;
-	/* User specified I2C device address */
-	u32 tbd_client_i2c_addr;
+	/* I2C transport, pmic, uC, LED and the REG_W/REG_R state */
+	struct ams_sensor ams;
 
+	/* debugfs directory, holds the I2C transaction trace */
+	struct dentry *debugfs;
 };
 
 static inline struct mira220 *to_mira220(struct v4l2_subdev *_sd)
@@ -3067,166 +3137,6 @@ static inline struct mira220 *to_mira220(struct v4l2_subdev *_sd)
 	return container_of(_sd, struct mira220, sd);
 }
 
-static int mira220_read(struct mira220 *mira220, u16 reg, u8 *val)
-{
-	int ret;
-	unsigned char data_w[2] = { reg >> 8, reg & 0xff };
-	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2) {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-			__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, val, 1);
-	/*
-	 * The only return value indicating success is 1. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 1) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira220_write(struct mira220 *mira220, u16 reg, u8 val)
-{
-	int ret;
-	unsigned char data[3] = { reg >> 8, reg & 0xff, val};
-	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
-
-	ret = i2c_master_send(client, data, 3);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 3) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira220_write16(struct mira220 *mira220, u16 reg, u16 val)
-{
-       int ret;
-       unsigned char data[4] = { reg >> 8, reg & 0xff, val & 0xff, val >> 8};
-       struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
-
-       ret = i2c_master_send(client, data, 4);
-       /*
-        * Writing the wrong number of bytes also needs to be flagged as an
-        * error. Success needs to produce a 0 return code.
-        */
-       if (ret == 4) {
-               ret = 0;
-       } else {
-               dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-                               __func__, reg);
-               if (ret >= 0)
-                       ret = -EINVAL;
-       }
-
-       return ret;
-}
-
-/* Write a list of registers */
-static int mira220_write_regs(struct mira220 *mira220,
-			     const struct mira220_reg *regs, u32 len)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++) {
-		ret = mira220_write(mira220, regs[i].address, regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "Failed to write reg 0x%4.4x. error = %d\n",
-					    regs[i].address, ret);
-
-			return ret;
-		} else {
-			// Debug code below
-			//u8 val;
-			//ret = mira220_read(mira220, regs[i].address, &val);
-			//printk(KERN_INFO "[MIRA220]: Read reg 0x%4.4x, val = 0x%x.\n",
-			//		regs[i].address, val);
-		}
-	}
-
-	return 0;
-}
-
-static int mira220pmic_write(struct i2c_client *client, u8 reg, u8 val)
-{
-	int ret;
-	unsigned char data[2] = { reg & 0xff, val};
-
-	ret = i2c_master_send(client, data, 2);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 2) {
-		ret = 0;
-	} else {
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-static int mira220pmic_read(struct i2c_client *client, u8 reg, u8 *val)
-{
-	struct i2c_msg msgs[2];
-	u8 addr_buf[1] = { reg & 0xff };
-	u8 data_buf[1] = { 0 };
-	int ret;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = 1;
-	msgs[1].buf = &data_buf[0];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = (u8)(data_buf[0]);
-
-	return 0;
-}
-
 /* Power/clock management functions */
 static int mira220_power_on(struct device *dev)
 {
@@ -3311,7 +3221,7 @@ static int mira220_write_illum_trig_regs(struct mira220* mira220, u8 enable) {
 
 	// Enable or disable illumination trigger
 	printk(KERN_INFO "[MIRA220]: Writing EN_TRIG_ILLUM to %d.\n", enable);
-	ret = mira220_write(mira220, MIRA220_EN_TRIG_ILLUM_REG, enable);
+	ret = ams_sensor_write(&mira220->ams, MIRA220_EN_TRIG_ILLUM_REG, enable);
 	if (ret) {
 		dev_err(&client->dev, "Error setting EN_TRIG_ILLUM to %d.", enable);
 		return ret;
@@ -3320,7 +3230,7 @@ static int mira220_write_illum_trig_regs(struct mira220* mira220, u8 enable) {
 	// Set illumination width. Write 16 bits [15:0].
 	illum_width_reg = (u16)(mira220->illum_width & 0x0000FFFF);
 	printk(KERN_INFO "[MIRA220]: Writing ILLUM_WIDTH to %u.\n", illum_width_reg);
-	ret = mira220_write16(mira220, MIRA220_ILLUM_WIDTH_REG, illum_width_reg);
+	ret = ams_sensor_write_le16(&mira220->ams, MIRA220_ILLUM_WIDTH_REG, illum_width_reg);
 	if (ret) {
 		dev_err(&client->dev, "Error setting ILLUM_WIDTH to %u.", illum_width_reg);
 		return ret;
@@ -3329,7 +3239,7 @@ static int mira220_write_illum_trig_regs(struct mira220* mira220, u8 enable) {
 	// Set illumination delay. Write 16 bits [15:0] as absolute delay, and bit [16] as sign.
 	illum_delay_reg = (u16)(mira220->illum_delay & 0x0000FFFF);
 	printk(KERN_INFO "[MIRA220]: Writing ILLUM_DELAY to %u.\n", illum_delay_reg);
-	ret = mira220_write16(mira220, MIRA220_ILLUM_DELAY_REG, illum_delay_reg);
+	ret = ams_sensor_write_le16(&mira220->ams, MIRA220_ILLUM_DELAY_REG, illum_delay_reg);
 	if (ret) {
 		dev_err(&client->dev, "Error setting ILLUM_DELAY to %u.", illum_delay_reg);
 		return ret;
@@ -3337,7 +3247,7 @@ static int mira220_write_illum_trig_regs(struct mira220* mira220, u8 enable) {
 	// Set illumination delay sign. Extract bit [16] as sign.
 	illum_delay_sign = (u8)((mira220->illum_delay >> 16) & 0x1);
 	printk(KERN_INFO "[MIRA220]: Writing ILLUM_DELAY_SIGN to %u.\n", illum_delay_sign);
-	ret = mira220_write(mira220, MIRA220_ILLUM_DELAY_SIGN_REG, illum_delay_sign);
+	ret = ams_sensor_write(&mira220->ams, MIRA220_ILLUM_DELAY_SIGN_REG, illum_delay_sign);
 	if (ret) {
 		dev_err(&client->dev, "Error setting ILLUM_DELAY_SIGN to %u.", illum_delay_sign);
 		return ret;
@@ -3351,23 +3261,34 @@ static int mira220_write_start_streaming_regs(struct mira220* mira220) {
 	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
 	int ret = 0;
 
+	u32 burst = mira220->burst_count->val;
+
+	// Frames per IMAGER_RUN, one by default
+	ret = ams_sensor_write_le16(&mira220->ams, MIRA220_NB_OF_FRAMES_LO_REG,
+				burst ? burst : 1);
+	if (ret) {
+		dev_err(&client->dev, "Error setting burst count to %u", burst);
+		return ret;
+	}
+
 	// Setting master control
-	ret = mira220_write(mira220, MIRA220_IMAGER_STATE_REG,
+	ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_STATE_REG,
 				MIRA220_IMAGER_STATE_MASTER_CONTROL);
 	if (ret) {
 		dev_err(&client->dev, "Error setting master control");
 		return ret;
 	}
 
-	// Enable continuous streaming
-	ret = mira220_write(mira220, MIRA220_IMAGER_RUN_CONT_REG, 
+	// Continuous streaming, or a burst of NB_OF_FRAMES per IMAGER_RUN
+	ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_RUN_CONT_REG,
+				burst ? MIRA220_IMAGER_RUN_CONT_DISABLE :
 				MIRA220_IMAGER_RUN_CONT_ENABLE);
 	if (ret) {
 		dev_err(&client->dev, "Error enabling continuous streaming");
 		return ret;
 	}
 
-	ret = mira220_write(mira220, MIRA220_IMAGER_RUN_REG,
+	ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_RUN_REG,
 				MIRA220_IMAGER_RUN_START);
 	if (ret) {
 		dev_err(&client->dev, "Error setting internal trigger");
@@ -3377,6 +3298,27 @@ static int mira220_write_start_streaming_regs(struct mira220* mira220) {
 	return ret;
 }
 
+/*
+ * Start another burst of NB_OF_FRAMES without reloading the tables. The
+ * imager idles after a burst, IMAGER_RUN goes low and high again to
+ * restart it. A burst still running is restarted.
+ */
+static int mira220_write_burst_trigger_regs(struct mira220 *mira220)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
+	int ret;
+
+	ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_RUN_REG,
+			    MIRA220_IMAGER_RUN_STOP);
+	if (!ret)
+		ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_RUN_REG,
+				    MIRA220_IMAGER_RUN_START);
+	if (ret)
+		dev_err(&client->dev, "Error starting burst");
+
+	return ret;
+}
+
 static int mira220_write_stop_streaming_regs(struct mira220* mira220) {
 	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
 	int ret = 0;
@@ -3384,7 +3326,7 @@ static int mira220_write_stop_streaming_regs(struct mira220* mira220) {
 	int try_cnt;
 
 	for (try_cnt = 0; try_cnt < 5; try_cnt++) {
-		ret = mira220_write(mira220, MIRA220_IMAGER_STATE_REG,
+		ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_STATE_REG,
 					MIRA220_IMAGER_STATE_STOP_AT_ROW);
 		if (ret) {
 			dev_err(&client->dev, "Error setting stop-at-row imager state at try %d", try_cnt);
@@ -3398,7 +3340,7 @@ static int mira220_write_stop_streaming_regs(struct mira220* mira220) {
 		return ret;
 	}
 
-	ret = mira220_write(mira220, MIRA220_IMAGER_RUN_REG,
+	ret = ams_sensor_write(&mira220->ams, MIRA220_IMAGER_RUN_REG,
 				MIRA220_IMAGER_RUN_STOP);
 	if (ret) {
 		dev_err(&client->dev, "Error setting run reg to stop");
@@ -3421,183 +3363,76 @@ static int mira220_write_stop_streaming_regs(struct mira220* mira220) {
 }
 
 
-static int mira220_v4l2_reg_w(struct mira220 *mira220, u32 value) {
-	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
-	u32 ret = 0;
+/* AMS_CAMERA_CID_MIRA_REG_W commands, the protocol is in ams_sensor_reg_w() */
+static void mira220_reg_cmd(struct ams_sensor *ams, u8 reg_flag, u32 value)
+{
+	struct mira220 *mira220 = container_of(ams, struct mira220, ams);
+	struct i2c_client *const client = ams->client;
 	u32 tmp_flag;
 
-	u16 reg_addr = (value >> 8) & 0xFFFF;
-	u8 reg_val = value & 0xFF;
-	u8 reg_flag = (value >> 24) & 0xFF;
-
-	// printk(KERN_INFO "[MIRA220]: %s reg_flag: 0x%02X; reg_addr: 0x%04X; reg_val: 0x%02X.\n",
-	// 		__func__, reg_flag, reg_addr, reg_val);
-
-	if (reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_CMD_SEL) {
-		if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_SLEEP_US) {
-			// If it is for sleep, combine all 24 bits of reg_addr and reg_val as sleep us.
-			u32 sleep_us_val = value & 0x00FFFFFF;
-			// Sleep range needs an interval, default to 1/8 of the sleep value.
-			u32 sleep_us_interval = sleep_us_val >> 3;
-			printk(KERN_INFO "[MIRA220]: %s sleep_us: %u.\n", __func__, sleep_us_val);
-			usleep_range(sleep_us_val, sleep_us_val + sleep_us_interval);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_RESET_ON) {
-			printk(KERN_INFO "[MIRA220]: %s Enable reset at stream on/off.\n", __func__);
-			mira220->skip_reset = 0;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_RESET_OFF) {
-			printk(KERN_INFO "[MIRA220]: %s Disable reset at stream on/off.\n", __func__);
-			mira220->skip_reset = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_REG_UP_ON) {
-			printk(KERN_INFO "[MIRA220]: %s Enable base register sequence upload.\n", __func__);
-			mira220->skip_reg_upload = 0;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_REG_UP_OFF) {
-			printk(KERN_INFO "[MIRA220]: %s Disable base register sequence upload.\n", __func__);
-			mira220->skip_reg_upload = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_POWER_ON) {
-			printk(KERN_INFO "[MIRA220]: %s Call power on function mira220_power_on().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = mira220->skip_reset;
-			mira220->skip_reset = 0;
-			mira220_power_on(&client->dev);
-			mira220->skip_reset = tmp_flag;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_POWER_OFF) {
-			printk(KERN_INFO "[MIRA220]: %s Call power off function mira220_power_off().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			mira220->force_power_off = 1;
-			mira220_power_off(&client->dev);
-			mira220->force_power_off = 0;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_TRIG_ON) {
-			printk(KERN_INFO "[MIRA220]: %s Enable illumination trigger.\n", __func__);
-			mira220_write_illum_trig_regs(mira220, 1);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_TRIG_OFF) {
-			printk(KERN_INFO "[MIRA220]: %s Disable illumination trigger.\n", __func__);
-			mira220_write_illum_trig_regs(mira220, 0);
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_WIDTH) {
-			// Combine 16 bits, [15:0], of reg_addr and reg_val as ILLUM_WIDTH.
-			u32 illum_width = value & 0x0000FFFF;
-			printk(KERN_INFO "[MIRA220]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
-			mira220->illum_width = illum_width;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_DELAY) {
-			// Combine 17 bits, [16:0], of reg_addr and reg_val as ILLUM_DELAY. Bit [16] is sign.
-			u32 illum_delay = value & 0x0001FFFF;
-			printk(KERN_INFO "[MIRA220]: %s Set ILLUM_DELAY with sign bit to 0x%X.\n", __func__, illum_delay);
-			mira220->illum_delay = illum_delay;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_STREAM_CTRL_ON) {
-			printk(KERN_INFO "[MIRA220]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
-			mira220->force_stream_ctrl = 1;
-		} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_STREAM_CTRL_OFF) {
-			printk(KERN_INFO "[MIRA220]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
-			mira220->force_stream_ctrl = 0;
-		} else {
-			printk(KERN_INFO "[MIRA220]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
-		}
-	} else if (reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_FOR_READ) {
-		// If it is for read, skip reagister write, cache addr and flag for read.
-		mira220->mira220_reg_w_cached_addr = reg_addr;
-		mira220->mira220_reg_w_cached_flag = reg_flag;
+	if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_RESET_ON) {
+		printk(KERN_INFO "[MIRA220]: %s Enable reset at stream on/off.\n", __func__);
+		mira220->skip_reset = 0;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_RESET_OFF) {
+		printk(KERN_INFO "[MIRA220]: %s Disable reset at stream on/off.\n", __func__);
+		mira220->skip_reset = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_REG_UP_ON) {
+		printk(KERN_INFO "[MIRA220]: %s Enable base register sequence upload.\n", __func__);
+		mira220->skip_reg_upload = 0;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_REG_UP_OFF) {
+		printk(KERN_INFO "[MIRA220]: %s Disable base register sequence upload.\n", __func__);
+		mira220->skip_reg_upload = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_POWER_ON) {
+		printk(KERN_INFO "[MIRA220]: %s Call power on function mira220_power_on().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = mira220->skip_reset;
+		mira220->skip_reset = 0;
+		mira220_power_on(&client->dev);
+		mira220->skip_reset = tmp_flag;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_POWER_OFF) {
+		printk(KERN_INFO "[MIRA220]: %s Call power off function mira220_power_off().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		mira220->force_power_off = 1;
+		mira220_power_off(&client->dev);
+		mira220->force_power_off = 0;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_TRIG_ON) {
+		printk(KERN_INFO "[MIRA220]: %s Enable illumination trigger.\n", __func__);
+		mira220_write_illum_trig_regs(mira220, 1);
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_TRIG_OFF) {
+		printk(KERN_INFO "[MIRA220]: %s Disable illumination trigger.\n", __func__);
+		mira220_write_illum_trig_regs(mira220, 0);
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_WIDTH) {
+		// Combine 16 bits, [15:0], of reg_addr and reg_val as ILLUM_WIDTH.
+		u32 illum_width = value & 0x0000FFFF;
+		printk(KERN_INFO "[MIRA220]: %s Set ILLUM_WIDTH to 0x%X.\n", __func__, illum_width);
+		mira220->illum_width = illum_width;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_ILLUM_DELAY) {
+		// Combine 17 bits, [16:0], of reg_addr and reg_val as ILLUM_DELAY. Bit [16] is sign.
+		u32 illum_delay = value & 0x0001FFFF;
+		printk(KERN_INFO "[MIRA220]: %s Set ILLUM_DELAY with sign bit to 0x%X.\n", __func__, illum_delay);
+		mira220->illum_delay = illum_delay;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_STREAM_CTRL_ON) {
+		printk(KERN_INFO "[MIRA220]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
+		mira220->force_stream_ctrl = 1;
+	} else if (reg_flag == AMS_CAMERA_CID_MIRA220_REG_FLAG_STREAM_CTRL_OFF) {
+		printk(KERN_INFO "[MIRA220]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
+		mira220->force_stream_ctrl = 0;
 	} else {
-		// If it is for write, select which I2C device by the flag "I2C_SEL".
-		if ((reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_MIRA) {
-			// Writing the actual Mira220 register
-			// printk(KERN_INFO "[MIRA220]: %s write reg_addr: 0x%04X; reg_val: 0x%02X.\n", __func__, reg_addr, reg_val);
-			ret = mira220_write(mira220, reg_addr, reg_val);
-			if (ret) {
-				dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n", reg_addr);
-				return -EINVAL;
-			}
-		} else if ((reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SET_TBD) {
-			/* User tries to set TBD I2C address, store reg_val to mira220->tbd_client_i2c_addr. Skip write. */
-			printk(KERN_INFO "[MIRA220]: mira220->tbd_client_i2c_addr = 0x%X.\n", reg_val);
-			mira220->tbd_client_i2c_addr = reg_val;
-		} else if ((reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_TBD) {
-			if (mira220->tbd_client_i2c_addr == MIRA220PMIC_I2C_ADDR) {
-				// Write PMIC. Use pre-allocated mira220->pmic_client.
-				printk(KERN_INFO "[MIRA220]: write pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira220pmic_write(mira220->pmic_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else if (mira220->tbd_client_i2c_addr == MIRA220UC_I2C_ADDR) {
-				// Write micro-controller. Use pre-allocated mira220->uc_client.
-				printk(KERN_INFO "[MIRA220]: write uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira220pmic_write(mira220->uc_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else if (mira220->tbd_client_i2c_addr == MIRA220LED_I2C_ADDR) {
-				// Write LED driver. Use pre-allocated mira220->led_client.
-				printk(KERN_INFO "[MIRA220]: write led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira220pmic_write(mira220->led_client, (u8)(reg_addr & 0xFF), reg_val);
-			} else {
-				/* Write other TBD I2C address.
-				 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SET_TBD.
-				 * The TBD I2C address is stored in mira220->tbd_client_i2c_addr.
-				 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-				 */
-				struct i2c_client *tmp_client;
-				tmp_client = i2c_new_dummy_device(client->adapter, mira220->tbd_client_i2c_addr);
-				if (IS_ERR(tmp_client))
-					return PTR_ERR(tmp_client);
-				printk(KERN_INFO "[MIRA220]: write tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-						mira220->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-				ret = mira220pmic_write(tmp_client, (u8)(reg_addr & 0xFF), reg_val);
-				i2c_unregister_device(tmp_client);
-			}
-		}
+		printk(KERN_INFO "[MIRA220]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
 	}
-
-	return 0;
 }
 
-static int mira220_v4l2_reg_r(struct mira220 *mira220, u32 *value) {
-	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
-	u32 ret = 0;
-
-	u16 reg_addr = mira220->mira220_reg_w_cached_addr;
-	u8 reg_flag = mira220->mira220_reg_w_cached_flag;
-	u8 reg_val = 0;
-
-	*value = 0;
-
-	if ((reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_MIRA) {
-		ret = mira220_read(mira220, reg_addr, &reg_val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n", reg_addr);
-			return -EINVAL;
-		}
-	} else if ((reg_flag & AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_TBD) {
-		if (mira220->tbd_client_i2c_addr == MIRA220PMIC_I2C_ADDR) {
-			// Read PMIC. Use pre-allocated mira220->pmic_client.
-			ret = mira220pmic_read(mira220->pmic_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA220]: read pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else if (mira220->tbd_client_i2c_addr == MIRA220UC_I2C_ADDR) {
-			// Read micro-controller. Use pre-allocated mira220->uc_client.
-			ret = mira220pmic_read(mira220->uc_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA220]: read uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else if (mira220->tbd_client_i2c_addr == MIRA220LED_I2C_ADDR) {
-			// Read LED driver. Use pre-allocated mira220->led_client.
-			ret = mira220pmic_read(mira220->led_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA220]: read led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		} else {
-			/* Read other TBD I2C address.
-			 * The TBD I2C address is set via AMS_CAMERA_CID_MIRA220_REG_FLAG_I2C_SET_TBD.
-			 * The TBD I2C address is stored in mira220->tbd_client_i2c_addr.
-			 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-			 */
-			struct i2c_client *tmp_client;
-			tmp_client = i2c_new_dummy_device(client->adapter, mira220->tbd_client_i2c_addr);
-			if (IS_ERR(tmp_client))
-				return PTR_ERR(tmp_client);
-			ret = mira220pmic_read(tmp_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[MIRA220]: read tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-					mira220->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-			i2c_unregister_device(tmp_client);
-		}
-	}
-
-	// Return 32-bit value that includes flags, addr, and register value
-	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
-
-	// printk(KERN_INFO "[MIRA220]: mira220_v4l2_reg_r() reg_flag: 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
-	// 		reg_flag, reg_addr, reg_val);
-
-	return 0;
+/* Gain of an analog gain index in 1/256 */
+static u32 mira220_gain_to_linear(struct ams_sensor *ams, u32 index)
+{
+	return AMS_CAMERA_GAIN_LINEAR_UNITY << index;
 }
 
+static const struct ams_sensor_ops mira220_ams_ops = {
+	.reg_cmd = mira220_reg_cmd,
+	.gain_to_linear = mira220_gain_to_linear,
+};
+
 // Returns the maximum exposure time in row_length (reg value).
 // Calculation is baded on Mira220 datasheet Section 9.2.
 static u32 mira220_calculate_max_exposure_time(u32 vsize,
@@ -3605,6 +3440,31 @@ static u32 mira220_calculate_max_exposure_time(u32 vsize,
 	return (vsize + vblank) - (int)(MIRA220_GLOB_NUM_CLK_CYCLES / row_length);
 }
 
+// Returns the vblank of the given mode and window height closest to a frame
+// time in microseconds.
+static u32 mira220_frame_time_to_vblank(const struct mira220_mode *mode,
+					u32 height, u32 us)
+{
+	u32 line_length = mode->width + mode->hblank;
+	u32 frame_length = (u32)div_u64((u64)us * (mode->pixel_rate / 1000) +
+					line_length * 500, line_length * 1000);
+	u32 vblank = frame_length > height ? frame_length - height : 0;
+
+	return clamp(vblank, mode->min_vblank, mode->max_vblank);
+}
+
+// Frame interval of the given mode, window height and vblank, in seconds.
+static void mira220_frame_interval(const struct mira220_mode *mode, u32 height,
+				   u32 vblank, struct v4l2_fract *interval)
+{
+	u32 num = (mode->width + mode->hblank) * (height + vblank);
+	u32 den = mode->pixel_rate;
+	u32 div = gcd(num, den);
+
+	interval->numerator = num / div;
+	interval->denominator = den / div;
+}
+
 static int mira220_write_analog_gain_reg(struct mira220 *mira220, u8 gain) {
 	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
 	u8 reg_value;
@@ -3614,9 +3474,9 @@ static int mira220_write_analog_gain_reg(struct mira220 *mira220, u8 gain) {
 		return -EINVAL;
 	}
 
-	reg_value = (u8)(8 / gain);
+	reg_value = MIRA220_ANALOG_GAIN_REG_UNITY >> gain;
 
-	ret = mira220_write(mira220, MIRA220_ANALOG_GAIN_REG, reg_value);
+	ret = ams_sensor_write(&mira220->ams, MIRA220_ANALOG_GAIN_REG, reg_value);
 
 	if (ret) {
 		dev_err_ratelimited(&client->dev, "Error setting analog gain register to %d",
@@ -3629,7 +3489,7 @@ static int mira220_write_analog_gain_reg(struct mira220 *mira220, u8 gain) {
 static int mira220_write_exposure_reg(struct mira220 *mira220, u32 exposure) {
 	struct i2c_client* const client = v4l2_get_subdevdata(&mira220->sd);
 	const u32 max_exposure = mira220_calculate_max_exposure_time(
-		mira220->mode->height, mira220->vblank->val, mira220->mode->row_length);
+		mira220->fmt.height, mira220->vblank->val, mira220->mode->row_length);
 	u32 ret = 0;
 	u32 capped_exposure = exposure;
 
@@ -3639,7 +3499,7 @@ static int mira220_write_exposure_reg(struct mira220 *mira220, u32 exposure) {
 	
 	printk(KERN_INFO "[MIRA220]: exposure fun width %d, hblank %d, vblank %d, row len %d, ctrl->val %d capped to %d.\n",
 				mira220->mode->width, mira220->hblank->val, mira220->vblank->val, mira220->mode->row_length, exposure, capped_exposure);
-	ret = mira220_write16(mira220, MIRA220_EXP_TIME_LO_REG, capped_exposure);
+	ret = ams_sensor_write_le16(&mira220->ams, MIRA220_EXP_TIME_LO_REG, capped_exposure);
 	if (ret) {
 		dev_err_ratelimited(&client->dev, "Error setting exposure time to %d", capped_exposure);
 		return -EINVAL;
@@ -3648,25 +3508,52 @@ static int mira220_write_exposure_reg(struct mira220 *mira220, u32 exposure) {
 	return 0;
 }
 
-// Gets the format code if supported. Otherwise returns the default format code `codes[0]`
+/* Publish a new active mode, format and window. Caller holds hw_lock. */
+static void mira220_publish_format(struct mira220 *mira220,
+				   const struct mira220_mode *mode,
+				   const struct v4l2_mbus_framefmt *fmt,
+				   const struct v4l2_rect *crop)
+{
+	write_seqlock(&mira220->fmt_seqlock);
+	mira220->mode = mode;
+	mira220->fmt = *fmt;
+	mira220->crop = *crop;
+	write_sequnlock(&mira220->fmt_seqlock);
+}
+
+/* Read a consistent copy of the active mode, format and window without mutex */
+static void mira220_read_format(struct mira220 *mira220,
+				const struct mira220_mode **mode,
+				struct v4l2_mbus_framefmt *fmt,
+				struct v4l2_rect *crop)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&mira220->fmt_seqlock);
+		*mode = mira220->mode;
+		*fmt = mira220->fmt;
+		*crop = mira220->crop;
+	} while (read_seqretry(&mira220->fmt_seqlock, seq));
+}
+
+// Gets the format code if supported. Otherwise returns the variant's first code
 static u32 mira220_validate_format_code_or_default(struct mira220 *mira220, u32 code)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
 	unsigned int i;
 
-	lockdep_assert_held(&mira220->mutex);
-
-	for (i = 0; i < ARRAY_SIZE(codes); i++)
-		if (codes[i] == code)
+	for (i = 0; i < mira220->variant->num_codes; i++)
+		if (mira220->variant->codes[i] == code)
 			break;
 
-	if (i >= ARRAY_SIZE(codes)) {
+	if (i >= mira220->variant->num_codes) {
 		dev_err_ratelimited(&client->dev, "Could not set requested format code %u", code);
-		dev_err_ratelimited(&client->dev, "Using default format %u", codes[0]);
+		dev_err_ratelimited(&client->dev, "Using default format %u", mira220->variant->codes[0]);
 		i = 0;
 	}
 
-	return codes[i];
+	return mira220->variant->codes[i];
 }
 
 static void mira220_set_default_format(struct mira220 *mira220)
@@ -3684,6 +3571,7 @@ static void mira220_set_default_format(struct mira220 *mira220)
 	fmt->width = supported_modes[0].width;
 	fmt->height = supported_modes[0].height;
 	fmt->field = V4L2_FIELD_NONE;
+	mira220->crop = supported_modes[0].crop;
 }
 
 static int mira220_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
@@ -3695,7 +3583,7 @@ static int mira220_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
 	struct v4l2_rect *try_crop;
 
-	mutex_lock(&mira220->mutex);
+	/* Only the file handle's own try state is touched, mutex is not needed */
 
 	/* Initialize try_fmt for the image pad */
 	try_fmt_img->width = supported_modes[0].width;
@@ -3719,8 +3607,6 @@ static int mira220_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	try_crop->width = supported_modes[0].crop.width;
 	try_crop->height = supported_modes[0].crop.height;
 
-	mutex_unlock(&mira220->mutex);
-
 	return 0;
 }
 
@@ -3731,12 +3617,33 @@ static int mira220_set_ctrl(struct v4l2_ctrl *ctrl)
 	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
 	int ret = 0;
 
+	if (ctrl->id == AMS_CAMERA_CID_ANALOG_GAIN_LINEAR)
+		return ams_sensor_gain_linear_s_ctrl(&mira220->ams, ctrl);
+
+	if (ctrl->id == V4L2_CID_ANALOGUE_GAIN) {
+		ret = ams_sensor_gain_linear_sync(&mira220->ams);
+		if (ret)
+			return ret;
+	}
+
+	if (ctrl->id == AMS_CAMERA_CID_BURST_COUNT) {
+		/* Run mode is set at stream-on, only the frame count can change */
+		if (mira220->streaming && !ctrl->val != !ctrl->cur.val)
+			return -EBUSY;
+	}
+
+	if (ctrl->id == AMS_CAMERA_CID_BURST_TRIGGER) {
+		/* Bursts are started by IMAGER_RUN only while free running */
+		if (!mira220->streaming || !mira220->burst_count->val)
+			return -EBUSY;
+	}
+
 	if (ctrl->id == V4L2_CID_VBLANK) {
 		int exposure_max, exposure_def;
 
 		/* Update max exposure while meeting expected vblanking */
 		exposure_max = mira220_calculate_max_exposure_time(
-				                mira220->mode->height, ctrl->val, mira220->mode->row_length);
+				                mira220->fmt.height, ctrl->val, mira220->mode->row_length);
 		exposure_def = (exposure_max < MIRA220_DEFAULT_EXPOSURE) ?
 			exposure_max : MIRA220_DEFAULT_EXPOSURE;
 		__v4l2_ctrl_modify_range(mira220->exposure,
@@ -3746,6 +3653,13 @@ static int mira220_set_ctrl(struct v4l2_ctrl *ctrl)
 	}
 
 
+	/*
+	 * The running hardware sequence writes all control values
+	 * with __v4l2_ctrl_handler_setup() once the tables are uploaded.
+	 */
+	if (mira220->hw_busy)
+		return 0;
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -3760,31 +3674,40 @@ static int mira220_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (mira220->skip_reg_upload == 0) {
 		switch (ctrl->id) {
 		case V4L2_CID_ANALOGUE_GAIN:
-			// ret = mira220_write_analog_gain_reg(mira220, ctrl->val);
+			ret = mira220_write_analog_gain_reg(mira220, ctrl->val);
 			break;
 		case V4L2_CID_EXPOSURE:
 			ret = mira220_write_exposure_reg(mira220, ctrl->val);
 			break;
 		case V4L2_CID_TEST_PATTERN:
-			ret = mira220_write(mira220, MIRA220_REG_TEST_PATTERN,
+			ret = ams_sensor_write(&mira220->ams, MIRA220_REG_TEST_PATTERN,
 					       mira220_test_pattern_val[ctrl->val]);
 			break;
 		case V4L2_CID_HFLIP:
-			ret = mira220_write(mira220, MIRA220_HFLIP_REG,
+			ret = ams_sensor_write(&mira220->ams, MIRA220_HFLIP_REG,
 						ctrl->val);
 			break;
 		case V4L2_CID_VFLIP:
-			ret = mira220_write(mira220, MIRA220_VFLIP_REG,
+			ret = ams_sensor_write(&mira220->ams, MIRA220_VFLIP_REG,
 						ctrl->val);
 			break;
 		case V4L2_CID_VBLANK:
-			ret = mira220_write16(mira220, MIRA220_VBLANK_LO_REG,
+			ret = ams_sensor_write_le16(&mira220->ams, MIRA220_VBLANK_LO_REG,
 						ctrl->val);
 			printk(KERN_INFO "[MIRA220]: width %d, hblank %d, vblank %d, height %d, ctrl->val %d.\n",
 				   mira220->mode->width, mira220->mode->hblank, mira220->mode->min_vblank, mira220->mode->height, ctrl->val);
 			break;
 		case V4L2_CID_HBLANK:
 			break;
+		case AMS_CAMERA_CID_BURST_COUNT:
+			/* Used from the next IMAGER_RUN */
+			if (ctrl->val)
+				ret = ams_sensor_write_le16(&mira220->ams, MIRA220_NB_OF_FRAMES_LO_REG,
+							ctrl->val);
+			break;
+		case AMS_CAMERA_CID_BURST_TRIGGER:
+			ret = mira220_write_burst_trigger_regs(mira220);
+			break;
 		default:
 			dev_info(&client->dev,
 				 "ctrl(id:0x%x,val:0x%x) is not handled\n",
@@ -3816,9 +3739,13 @@ static int mira220_s_ctrl(struct v4l2_ctrl *ctrl)
 	 * Users need to make sure first power on then write register.
 	 */
 
+	/* Raw accesses would interleave with the table upload */
+	if (mira220->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id) {
 	case AMS_CAMERA_CID_MIRA_REG_W:
-		ret = mira220_v4l2_reg_w(mira220, ctrl->val);
+		ret = ams_sensor_reg_w(&mira220->ams, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -3848,9 +3775,12 @@ static int mira220_g_ctrl(struct v4l2_ctrl *ctrl)
 	 * Therefore, the check of "powered" flag is disabled for now.
 	 */
 
+	if (mira220->hw_busy)
+		return -EBUSY;
+
 	switch (ctrl->id) {
 	case AMS_CAMERA_CID_MIRA_REG_R:
-		ret = mira220_v4l2_reg_r(mira220, (u32 *)&ctrl->cur.val);
+		ret = ams_sensor_reg_r(&mira220->ams, (u32 *)&ctrl->cur.val);
 		ctrl->val = ctrl->cur.val;
 		break;
 	default:
@@ -3870,6 +3800,28 @@ static const struct v4l2_ctrl_ops mira220_ctrl_ops = {
 	.s_ctrl = mira220_set_ctrl,
 };
 
+/* Frames per stream-on or burst trigger, 0 for continuous */
+static const struct v4l2_ctrl_config mira220_burst_count_ctrl = {
+	.ops = &mira220_ctrl_ops,
+	.id = AMS_CAMERA_CID_BURST_COUNT,
+	.name = "burst_count",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = MIRA220_NB_OF_FRAMES_MAX,
+	.def = 0,
+	.step = 1,
+};
+
+/* Starts another burst while streaming free running */
+static const struct v4l2_ctrl_config mira220_burst_trigger_ctrl = {
+	.ops = &mira220_ctrl_ops,
+	.id = AMS_CAMERA_CID_BURST_TRIGGER,
+	.name = "burst_trigger",
+	.type = V4L2_CTRL_TYPE_BUTTON,
+	.max = 1,
+	.step = 1,
+};
+
 static const struct v4l2_ctrl_ops mira220_custom_ctrl_ops = {
 	.g_volatile_ctrl = mira220_g_ctrl,
 	.s_ctrl = mira220_s_ctrl,
@@ -3901,6 +3853,46 @@ static struct v4l2_ctrl_config custom_ctrl_config_list[] = {
 		.def = 0,
 		.step = 1,
 	},
+	{
+		.id = AMS_CAMERA_CID_EXPOSURE_DELAY,
+		.name = "exposure_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA220_EXPOSURE_DELAY,
+		.max = MIRA220_EXPOSURE_DELAY,
+		.def = MIRA220_EXPOSURE_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_GAIN_DELAY,
+		.name = "gain_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA220_GAIN_DELAY,
+		.max = MIRA220_GAIN_DELAY,
+		.def = MIRA220_GAIN_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_VBLANK_DELAY,
+		.name = "vblank_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA220_VBLANK_DELAY,
+		.max = MIRA220_VBLANK_DELAY,
+		.def = MIRA220_VBLANK_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_STARTUP_FRAMES,
+		.name = "startup_frames",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = MIRA220_STARTUP_FRAMES,
+		.max = MIRA220_STARTUP_FRAMES,
+		.def = MIRA220_STARTUP_FRAMES,
+		.step = 1,
+	},
 
 };
 
@@ -3917,11 +3909,11 @@ static int mira220_enum_mbus_code(struct v4l2_subdev *sd,
 		return -EINVAL;
 
 	if (code->pad == IMAGE_PAD) {
-		if (code->index >= ARRAY_SIZE(codes))
+		if (code->index >= mira220->variant->num_codes)
 			return -EINVAL;
 
 		code->code = mira220_validate_format_code_or_default(mira220,
-						    codes[code->index]);
+						    mira220->variant->codes[code->index]);
 	} else {
 		if (code->index > 0)
 			return -EINVAL;
@@ -3965,6 +3957,80 @@ static int mira220_enum_frame_size(struct v4l2_subdev *sd,
 	return 0;
 }
 
+/*
+ * Report the shortest frame interval of the mode matching the size.
+ * Any longer interval up to max_vblank can be set with s_frame_interval.
+ */
+static int mira220_enum_frame_interval(struct v4l2_subdev *sd,
+				       struct v4l2_subdev_state *sd_state,
+				       struct v4l2_subdev_frame_interval_enum *fie)
+{
+	struct mira220 *mira220 = to_mira220(sd);
+	unsigned int i;
+
+	if (fie->pad != IMAGE_PAD || fie->index > 0)
+		return -EINVAL;
+
+	if (fie->code != mira220_validate_format_code_or_default(mira220, fie->code))
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(supported_modes); i++) {
+		const struct mira220_mode *mode = &supported_modes[i];
+
+		if (mode->width == fie->width && mode->height == fie->height) {
+			mira220_frame_interval(mode, mode->height, mode->min_vblank,
+					       &fie->interval);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int mira220_g_frame_interval(struct v4l2_subdev *sd,
+				    struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira220 *mira220 = to_mira220(sd);
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira220->mutex);
+	mira220_frame_interval(mira220->mode, mira220->fmt.height,
+			       mira220->vblank->val, &fi->interval);
+	mutex_unlock(&mira220->mutex);
+
+	return 0;
+}
+
+/* Frame interval is set through VBLANK, the closest achievable one is returned */
+static int mira220_s_frame_interval(struct v4l2_subdev *sd,
+				    struct v4l2_subdev_frame_interval *fi)
+{
+	struct mira220 *mira220 = to_mira220(sd);
+	const struct mira220_mode *mode;
+	int ret = 0;
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&mira220->mutex);
+	mode = mira220->mode;
+	if (fi->interval.numerator && fi->interval.denominator) {
+		u32 us = (u32)div_u64((u64)fi->interval.numerator * 1000000,
+				      fi->interval.denominator);
+
+		ret = __v4l2_ctrl_s_ctrl(mira220->vblank,
+					 mira220_frame_time_to_vblank(mode,
+						mira220->fmt.height, us));
+	}
+	mira220_frame_interval(mode, mira220->fmt.height, mira220->vblank->val,
+			       &fi->interval);
+	mutex_unlock(&mira220->mutex);
+
+	return ret;
+}
+
 static void mira220_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
 {
 	fmt->colorspace = V4L2_COLORSPACE_RAW;
@@ -4017,10 +4083,17 @@ static int __mira220_get_pad_format(struct mira220 *mira220,
 		fmt->format = *try_fmt;
 	} else {
 		if (fmt->pad == IMAGE_PAD) {
-			mira220_update_image_pad_format(mira220, mira220->mode,
-						       fmt);
+			const struct mira220_mode *mode;
+			struct v4l2_mbus_framefmt active;
+			struct v4l2_rect crop;
+
+			mira220_read_format(mira220, &mode, &active, &crop);
+			mira220_update_image_pad_format(mira220, mode, fmt);
+			/* The size follows the window, there is no scaling */
+			fmt->format.width = crop.width;
+			fmt->format.height = crop.height;
 			fmt->format.code = mira220_validate_format_code_or_default(mira220,
-							      mira220->fmt.code);
+							      active.code);
 		} else {
 			mira220_update_metadata_pad_format(fmt);
 		}
@@ -4034,13 +4107,9 @@ static int mira220_get_pad_format(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_format *fmt)
 {
 	struct mira220 *mira220 = to_mira220(sd);
-	int ret;
 
-	mutex_lock(&mira220->mutex);
-	ret = __mira220_get_pad_format(mira220, sd_state, fmt);
-	mutex_unlock(&mira220->mutex);
-
-	return ret;
+	/* Lockless: ACTIVE reads the published snapshot, TRY is per file handle */
+	return __mira220_get_pad_format(mira220, sd_state, fmt);
 }
 
 static int mira220_set_pad_format(struct v4l2_subdev *sd,
@@ -4055,7 +4124,11 @@ static int mira220_set_pad_format(struct v4l2_subdev *sd,
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
 
-	mutex_lock(&mira220->mutex);
+	/* TRY formats live in the file handle state and need no locking */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		mutex_lock(&mira220->hw_lock);
+		mutex_lock(&mira220->mutex);
+	}
 
 	if (fmt->pad == IMAGE_PAD) {
 		/* Validate format or use default */
@@ -4073,15 +4146,16 @@ static int mira220_set_pad_format(struct v4l2_subdev *sd,
 			framefmt = v4l2_subdev_get_try_format(sd, sd_state,
 							      fmt->pad);
 			*framefmt = fmt->format;
+			*v4l2_subdev_get_try_crop(sd, sd_state, fmt->pad) = mode->crop;
 		} else if (mira220->mode != mode ||
-			mira220->fmt.code != fmt->format.code) {
+			mira220->fmt.code != fmt->format.code ||
+			!v4l2_rect_equal(&mira220->crop, &mode->crop)) {
 
 			printk(KERN_INFO "[MIRA220]: mira220_set_pad_format() use new mode.\n");
 			printk(KERN_INFO "[MIRA220]: mira220->mode %p mode %p.\n", (void *)mira220->mode, (void *)mode);
 			printk(KERN_INFO "[MIRA220]: mira220->fmt.code 0x%x fmt->format.code 0x%x.\n", mira220->fmt.code, fmt->format.code);
 
-			mira220->fmt = fmt->format;
-			mira220->mode = mode;
+			mira220_publish_format(mira220, mode, &fmt->format, &mode->crop);
 
 			// Update controls based on new mode (range and current value).
 			max_exposure = mira220_calculate_max_exposure_time(
@@ -4138,7 +4212,14 @@ static int mira220_set_pad_format(struct v4l2_subdev *sd,
 
 	printk(KERN_INFO "[MIRA220]: mira220_set_pad_format() to unlock and return.\n");
 
-	mutex_unlock(&mira220->mutex);
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		/* Get the new mode onto the sensor before stream-on */
+		if (mira220->preload && fmt->pad == IMAGE_PAD && !mira220->streaming)
+			schedule_work(&mira220->preload_work);
+
+		mutex_unlock(&mira220->mutex);
+		mutex_unlock(&mira220->hw_lock);
+	}
 
 	return 0;
 }
@@ -4150,22 +4231,22 @@ static int mira220_set_framefmt(struct mira220 *mira220)
 		case MEDIA_BUS_FMT_Y8_1X8:
 		case MEDIA_BUS_FMT_SGRBG8_1X8:
 			printk(KERN_INFO "[MIRA220]: mira220_set_framefmt() write 8 bpp regs.\n");
-			mira220_write(mira220, MIRA220_BIT_DEPTH_REG, MIRA220_BIT_DEPTH_8_BIT);
-			mira220_write(mira220, MIRA220_CSI_DATA_TYPE_REG,
+			ams_sensor_write(&mira220->ams, MIRA220_BIT_DEPTH_REG, MIRA220_BIT_DEPTH_8_BIT);
+			ams_sensor_write(&mira220->ams, MIRA220_CSI_DATA_TYPE_REG,
 				MIRA220_CSI_DATA_TYPE_8_BIT);
 			return 0;
 		case MEDIA_BUS_FMT_Y10_1X10:
 		case MEDIA_BUS_FMT_SGRBG10_1X10:
 			printk(KERN_INFO "[MIRA220]: mira220_set_framefmt() write 10 bpp regs.\n");
-			mira220_write(mira220, MIRA220_BIT_DEPTH_REG,MIRA220_BIT_DEPTH_10_BIT);
-			mira220_write(mira220, MIRA220_CSI_DATA_TYPE_REG,
+			ams_sensor_write(&mira220->ams, MIRA220_BIT_DEPTH_REG,MIRA220_BIT_DEPTH_10_BIT);
+			ams_sensor_write(&mira220->ams, MIRA220_CSI_DATA_TYPE_REG,
 				MIRA220_CSI_DATA_TYPE_10_BIT);
 			return 0;
 		case MEDIA_BUS_FMT_Y12_1X12:
 		case MEDIA_BUS_FMT_SGRBG12_1X12:
 			printk(KERN_INFO "[MIRA220]: mira220_set_framefmt() write 12 bpp regs.\n");
-			mira220_write(mira220, MIRA220_BIT_DEPTH_REG, MIRA220_BIT_DEPTH_12_BIT);
-			mira220_write(mira220, MIRA220_CSI_DATA_TYPE_REG,
+			ams_sensor_write(&mira220->ams, MIRA220_BIT_DEPTH_REG, MIRA220_BIT_DEPTH_12_BIT);
+			ams_sensor_write(&mira220->ams, MIRA220_CSI_DATA_TYPE_REG,
 				MIRA220_CSI_DATA_TYPE_12_BIT);
 			return 0;
 		default:
@@ -4176,18 +4257,23 @@ static int mira220_set_framefmt(struct mira220 *mira220)
 	return -EINVAL;
 }
 
-static const struct v4l2_rect *
+static void
 __mira220_get_pad_crop(struct mira220 *mira220, struct v4l2_subdev_state *sd_state,
-		      unsigned int pad, enum v4l2_subdev_format_whence which)
+		      unsigned int pad, enum v4l2_subdev_format_whence which,
+		      struct v4l2_rect *r)
 {
 	switch (which) {
 	case V4L2_SUBDEV_FORMAT_TRY:
-		return v4l2_subdev_get_try_crop(&mira220->sd, sd_state, pad);
-	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &mira220->mode->crop;
-	}
+		*r = *v4l2_subdev_get_try_crop(&mira220->sd, sd_state, pad);
+		break;
+	case V4L2_SUBDEV_FORMAT_ACTIVE: {
+		const struct mira220_mode *mode;
+		struct v4l2_mbus_framefmt fmt;
 
-	return NULL;
+		mira220_read_format(mira220, &mode, &fmt, r);
+		break;
+	}
+	}
 }
 
 static int mira220_get_selection(struct v4l2_subdev *sd,
@@ -4198,10 +4284,8 @@ static int mira220_get_selection(struct v4l2_subdev *sd,
 	case V4L2_SEL_TGT_CROP: {
 		struct mira220 *mira220 = to_mira220(sd);
 
-		mutex_lock(&mira220->mutex);
-		sel->r = *__mira220_get_pad_crop(mira220, sd_state, sel->pad,
-						sel->which);
-		mutex_unlock(&mira220->mutex);
+		__mira220_get_pad_crop(mira220, sd_state, sel->pad, sel->which,
+				       &sel->r);
 
 		return 0;
 	}
@@ -4227,14 +4311,135 @@ static int mira220_get_selection(struct v4l2_subdev *sd,
 	return -EINVAL;
 }
 
-static int mira220_start_streaming(struct mira220 *mira220)
+/* Program the readout window. The sensor is powered with the tables uploaded. */
+static int mira220_write_window(struct mira220 *mira220, const struct v4l2_rect *crop)
+{
+	int ret;
+
+	ret = ams_sensor_write_le16(&mira220->ams, MIRA220_VSTART1_LO_REG,
+			      crop->top & MIRA220_VSTART1_MASK);
+	if (!ret)
+		ret = ams_sensor_write_le16(&mira220->ams, MIRA220_VSIZE1_LO_REG,
+				      crop->height & MIRA220_VSIZE1_MASK);
+	if (!ret)
+		ret = ams_sensor_write_le16(&mira220->ams, MIRA220_HSTART_LO_REG,
+				      (crop->left / 2) & MIRA220_HSTART_MASK);
+	if (!ret)
+		ret = ams_sensor_write_le16(&mira220->ams, MIRA220_HSIZE_LO_REG,
+				      (crop->width / 2) & MIRA220_HSIZE_MASK);
+	if (!ret)
+		ret = ams_sensor_write_le16(&mira220->ams, MIRA220_MIPI_HSIZE_LO_REG,
+				      crop->width & MIRA220_MIPI_HSIZE_MASK);
+
+	return ret;
+}
+
+/*
+ * Set the readout window within the pixel array. The format size follows
+ * the window. The row time is fixed by ROW_LENGTH, so the frame time
+ * scales with the window height at the same vblank. While streaming the
+ * window can only move: its registers are written without a table upload.
+ */
+static int mira220_set_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_state *sd_state,
+				struct v4l2_subdev_selection *sel)
+{
+	struct mira220 *mira220 = to_mira220(sd);
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct v4l2_mbus_framefmt *try_fmt;
+	struct v4l2_mbus_framefmt fmt;
+	struct v4l2_rect rect;
+	u32 max_exposure, default_exp, hblank;
+	int ret = 0;
+
+	if (sel->pad != IMAGE_PAD || sel->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	rect.width = clamp_t(u32, round_down(sel->r.width, MIRA220_CROP_ALIGN),
+			     MIRA220_MIN_CROP_WIDTH, MIRA220_PIXEL_ARRAY_WIDTH);
+	rect.height = clamp_t(u32, round_down(sel->r.height, MIRA220_CROP_ALIGN),
+			      MIRA220_MIN_CROP_HEIGHT, MIRA220_PIXEL_ARRAY_HEIGHT);
+	rect.left = clamp_t(s32, round_down(sel->r.left, MIRA220_CROP_ALIGN),
+			    MIRA220_PIXEL_ARRAY_LEFT,
+			    MIRA220_PIXEL_ARRAY_LEFT + MIRA220_PIXEL_ARRAY_WIDTH - rect.width);
+	rect.top = clamp_t(s32, round_down(sel->r.top, MIRA220_CROP_ALIGN),
+			   MIRA220_PIXEL_ARRAY_TOP,
+			   MIRA220_PIXEL_ARRAY_TOP + MIRA220_PIXEL_ARRAY_HEIGHT - rect.height);
+
+	/* TRY windows live in the file handle state and need no locking */
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY) {
+		*v4l2_subdev_get_try_crop(sd, sd_state, sel->pad) = rect;
+		try_fmt = v4l2_subdev_get_try_format(sd, sd_state, sel->pad);
+		try_fmt->width = rect.width;
+		try_fmt->height = rect.height;
+		sel->r = rect;
+		return 0;
+	}
+
+	mutex_lock(&mira220->hw_lock);
+	mutex_lock(&mira220->mutex);
+
+	/* Buffers are sized for the current window while streaming */
+	if (mira220->streaming && (rect.width != mira220->crop.width ||
+				   rect.height != mira220->crop.height)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	printk(KERN_INFO "[MIRA220]: mira220_set_selection() window %ux%u at %d,%d.\n",
+	       rect.width, rect.height, rect.left, rect.top);
+
+	fmt = mira220->fmt;
+	fmt.width = rect.width;
+	fmt.height = rect.height;
+	mira220_publish_format(mira220, mira220->mode, &fmt, &rect);
+
+	// The line length stays the same, hblank fills the rest of the row.
+	hblank = MIRA220_LINE_LENGTH(mira220->mode->row_length) - rect.width;
+	__v4l2_ctrl_modify_range(mira220->hblank, hblank, hblank, 1, hblank);
+
+	// Min VBLANK only depends on ROW_LENGTH, max exposure on the height.
+	__v4l2_ctrl_modify_range(mira220->vblank,
+				 MIRA220_MIN_VBLANK(mira220->mode->row_length),
+				 mira220->mode->max_vblank, 1,
+				 MIRA220_MIN_VBLANK(mira220->mode->row_length));
+	max_exposure = mira220_calculate_max_exposure_time(rect.height,
+							   mira220->vblank->val,
+							   mira220->mode->row_length);
+	default_exp = min_t(u32, max_exposure, MIRA220_DEFAULT_EXPOSURE);
+	__v4l2_ctrl_modify_range(mira220->exposure, MIRA220_EXPOSURE_MIN,
+				 max_exposure, 1, default_exp);
+
+	/* Otherwise the window is written after the next table upload */
+	if (mira220->skip_reg_upload == 0 &&
+	    (mira220->streaming || mira220->preloaded)) {
+		ret = mira220_write_window(mira220, &rect);
+		if (ret)
+			dev_err(&client->dev, "%s failed to set window\n", __func__);
+		else if (mira220->preloaded)
+			mira220->preload_crop = rect;
+	}
+
+out:
+	sel->r = mira220->crop;
+	mutex_unlock(&mira220->mutex);
+	mutex_unlock(&mira220->hw_lock);
+
+	return ret;
+}
+
+/*
+ * Power on, upload the register table of the current mode and write all
+ * control values. Caller holds hw_lock. On success the runtime PM
+ * reference is held and the sensor is ready for the stream-on sequence.
+ */
+static int mira220_power_up_mode(struct mira220 *mira220)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
 	const struct mira220_reg_list *reg_list;
+	struct v4l2_rect crop;
 	int ret;
 
-	printk(KERN_INFO "[MIRA220]: Entering start streaming function.\n");
-
 	/* Follow examples of other camera driver, here use pm_runtime_resume_and_get */
 	ret = pm_runtime_resume_and_get(&client->dev);
 
@@ -4244,6 +4449,12 @@ static int mira220_start_streaming(struct mira220 *mira220)
 		return ret;
 	}
 
+	/* Control writes are cached until the upload is done */
+	mutex_lock(&mira220->mutex);
+	mira220->hw_busy = true;
+	crop = mira220->crop;
+	mutex_unlock(&mira220->mutex);
+
 	/* Apply default values of current mode */
 	if (mira220->skip_reg_upload == 0) {
 		/* Stop treaming before uploading register sequence */
@@ -4251,22 +4462,32 @@ static int mira220_start_streaming(struct mira220 *mira220)
 		ret = mira220_write_stop_streaming_regs(mira220);
 		if (ret) {
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_busy;
 		}
 
 		reg_list = &mira220->mode->reg_list;
 		printk(KERN_INFO "[MIRA220]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = mira220_write_regs(mira220, reg_list->regs, reg_list->num_of_regs);
+		ret = ams_sensor_write_table(&mira220->ams, mira220->mode, reg_list->fw_name,
+						     reg_list->regs, reg_list->num_of_regs);
 		if (ret) {
 			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			goto err_busy;
 		}
 
 		ret = mira220_set_framefmt(mira220);
 		if (ret) {
 			dev_err(&client->dev, "%s failed to set frame format: %d\n",
 				__func__, ret);
-			goto err_rpm_put;
+			goto err_busy;
+		}
+
+		/* Window set with set_selection replaces the one of the table */
+		if (!v4l2_rect_equal(&crop, &mira220->mode->crop)) {
+			ret = mira220_write_window(mira220, &crop);
+			if (ret) {
+				dev_err(&client->dev, "%s failed to set window\n", __func__);
+				goto err_busy;
+			}
 		}
 	} else {
 		printk(KERN_INFO "[MIRA220]: Skip base register sequence upload, due to mira220->skip_reg_upload=%u.\n", mira220->skip_reg_upload);
@@ -4275,12 +4496,105 @@ static int mira220_start_streaming(struct mira220 *mira220)
 
 	printk(KERN_INFO "[MIRA220]: Entering v4l2 ctrl handler setup function.\n");
 
-	/* Apply customized values from user */
+	/*
+	 * Apply customized values from user. Control writes that came in
+	 * during the upload were cached and are written here.
+	 */
+	mutex_lock(&mira220->mutex);
+	mira220->hw_busy = false;
 	ret =  __v4l2_ctrl_handler_setup(mira220->sd.ctrl_handler);
 	printk(KERN_INFO "[MIRA220]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
+	mutex_unlock(&mira220->mutex);
 	if (ret)
 		goto err_rpm_put;
 
+	return 0;
+
+err_busy:
+	mutex_lock(&mira220->mutex);
+	mira220->hw_busy = false;
+	mutex_unlock(&mira220->mutex);
+err_rpm_put:
+	pm_runtime_put(&client->dev);
+	return ret;
+}
+
+/* Drop a background upload that was not used by a stream. Caller holds hw_lock. */
+static void mira220_drop_preload(struct mira220 *mira220)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
+
+	if (!mira220->preloaded)
+		return;
+
+	mira220->preloaded = false;
+	pm_runtime_put(&client->dev);
+}
+
+static bool mira220_preload_matches(struct mira220 *mira220)
+{
+	return mira220->preloaded &&
+		mira220->preload_mode == mira220->mode &&
+		mira220->preload_code == mira220->fmt.code &&
+		v4l2_rect_equal(&mira220->preload_crop, &mira220->crop);
+}
+
+/*
+ * Background upload after an ACTIVE set_fmt,
+ * enabled with the "preload" device tree property. Stream-on then only
+ * writes the start sequence.
+ */
+static void mira220_preload_work(struct work_struct *work)
+{
+	struct mira220 *mira220 = container_of(work, struct mira220, preload_work);
+	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
+	int ret;
+
+	mutex_lock(&mira220->hw_lock);
+
+	if (mira220->streaming || mira220->skip_reg_upload ||
+	    mira220_preload_matches(mira220))
+		goto out;
+
+	/* Format or window changed since the last upload */
+	mira220_drop_preload(mira220);
+
+	printk(KERN_INFO "[MIRA220]: Uploading mode in the background.\n");
+	ret = mira220_power_up_mode(mira220);
+	if (ret) {
+		dev_err(&client->dev, "%s background upload failed: %d\n",
+			__func__, ret);
+		goto out;
+	}
+
+	mira220->preloaded = true;
+	mira220->preload_mode = mira220->mode;
+	mira220->preload_code = mira220->fmt.code;
+	mira220->preload_crop = mira220->crop;
+
+out:
+	mutex_unlock(&mira220->hw_lock);
+}
+
+static int mira220_start_streaming(struct mira220 *mira220)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
+	int ret;
+
+	printk(KERN_INFO "[MIRA220]: Entering start streaming function.\n");
+
+	if (mira220_preload_matches(mira220)) {
+		/* The worker already uploaded this mode, take over its PM reference */
+		printk(KERN_INFO "[MIRA220]: Using background uploaded mode.\n");
+		mira220->preloaded = false;
+	} else {
+		mira220_drop_preload(mira220);
+		ret = mira220_power_up_mode(mira220);
+		if (ret)
+			return ret;
+	}
+
+	mutex_lock(&mira220->mutex);
 
 	if (mira220->skip_reg_upload == 0 ||
 		(mira220->skip_reg_upload == 1 && mira220->force_stream_ctrl == 1) ) {
@@ -4288,7 +4602,7 @@ static int mira220_start_streaming(struct mira220 *mira220)
 		ret = mira220_write_start_streaming_regs(mira220);
 		if (ret) {
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_unlock;
 		}
 	} else {
 		printk(KERN_INFO "[MIRA220]: Skip write_start_streaming_regs due to skip_reg_upload == %d and force_stream_ctrl == %d.\n",
@@ -4300,10 +4614,12 @@ static int mira220_start_streaming(struct mira220 *mira220)
 	__v4l2_ctrl_grab(mira220->vflip, true);
 	printk(KERN_INFO "[MIRA220]: Entering v4l2 ctrl grab vflip grab hflip.\n");
 	__v4l2_ctrl_grab(mira220->hflip, true);
+	mutex_unlock(&mira220->mutex);
 
 	return 0;
 
-err_rpm_put:
+err_unlock:
+	mutex_unlock(&mira220->mutex);
 	pm_runtime_put(&client->dev);
 	return ret;
 }
@@ -4314,8 +4630,11 @@ static void mira220_stop_streaming(struct mira220 *mira220)
 	int ret = 0;
 
 	/* Unlock controls for vflip and hflip */
+	mutex_lock(&mira220->mutex);
 	__v4l2_ctrl_grab(mira220->vflip, false);
 	__v4l2_ctrl_grab(mira220->hflip, false);
+	mira220->hw_busy = true;
+	mutex_unlock(&mira220->mutex);
 
 	if (mira220->skip_reset == 0) {
 		if (mira220->skip_reg_upload == 0 ||
@@ -4334,6 +4653,10 @@ static void mira220_stop_streaming(struct mira220 *mira220)
 	}
 
 	pm_runtime_put(&client->dev);
+
+	mutex_lock(&mira220->mutex);
+	mira220->hw_busy = false;
+	mutex_unlock(&mira220->mutex);
 }
 
 static int mira220_set_stream(struct v4l2_subdev *sd, int enable)
@@ -4341,14 +4664,29 @@ static int mira220_set_stream(struct v4l2_subdev *sd, int enable)
 	struct mira220 *mira220 = to_mira220(sd);
 	int ret = 0;
 
+	/* A queued background upload is finished first and reused */
+	if (enable)
+		flush_work(&mira220->preload_work);
+
+	/*
+	 * The sequence runs under hw_lock. mutex is only taken for the
+	 * short state updates, so queries and control reads do not wait
+	 * for the power-on and the register table upload.
+	 */
+	mutex_lock(&mira220->hw_lock);
 	mutex_lock(&mira220->mutex);
 	if (mira220->streaming == enable) {
 		mutex_unlock(&mira220->mutex);
+		mutex_unlock(&mira220->hw_lock);
 		return 0;
 	}
 
 	printk(KERN_INFO "[MIRA220]: Entering mira220_set_stream enable: %d.\n", enable);
 
+	if (!enable)
+		mira220->streaming = false;
+	mutex_unlock(&mira220->mutex);
+
 	if (enable) {
 		/*
 		 * Apply default & customized values
@@ -4357,20 +4695,22 @@ static int mira220_set_stream(struct v4l2_subdev *sd, int enable)
 		ret = mira220_start_streaming(mira220);
 		if (ret)
 			goto err_unlock;
+
+		mutex_lock(&mira220->mutex);
+		mira220->streaming = true;
+		mutex_unlock(&mira220->mutex);
 	} else {
 		mira220_stop_streaming(mira220);
 	}
 
-	mira220->streaming = enable;
-
-	mutex_unlock(&mira220->mutex);
+	mutex_unlock(&mira220->hw_lock);
 
 	printk(KERN_INFO "[MIRA220]: Returning mira220_set_stream with ret: %d.\n", ret);
 
 	return ret;
 
 err_unlock:
-	mutex_unlock(&mira220->mutex);
+	mutex_unlock(&mira220->hw_lock);
 
 	return ret;
 }
@@ -4383,8 +4723,12 @@ static int __maybe_unused mira220_suspend(struct device *dev)
 
 	printk(KERN_INFO "[MIRA220]: Entering suspend function.\n");
 
+	mutex_lock(&mira220->hw_lock);
 	if (mira220->streaming)
 		mira220_stop_streaming(mira220);
+	else
+		mira220_drop_preload(mira220);
+	mutex_unlock(&mira220->hw_lock);
 
 	return 0;
 }
@@ -4398,17 +4742,21 @@ static int __maybe_unused mira220_resume(struct device *dev)
 
 	printk(KERN_INFO "[MIRA220]: Entering resume function.\n");
 
+	mutex_lock(&mira220->hw_lock);
 	if (mira220->streaming) {
 		ret = mira220_start_streaming(mira220);
 		if (ret)
 			goto error;
 	}
+	mutex_unlock(&mira220->hw_lock);
 
 	return 0;
 
 error:
-	mira220_stop_streaming(mira220);
+	mutex_lock(&mira220->mutex);
 	mira220->streaming = false;
+	mutex_unlock(&mira220->mutex);
+	mutex_unlock(&mira220->hw_lock);
 
 	return ret;
 }
@@ -4431,7 +4779,7 @@ static int mira220_otp_power_on(struct mira220 *mira220)
 {
 	int ret;
 
-	ret = mira220_write(mira220, 0x0080, 0x04);
+	ret = ams_sensor_write(&mira220->ams, 0x0080, 0x04);
 
 	return 0;
 }
@@ -4441,7 +4789,7 @@ static int mira220_otp_power_off(struct mira220 *mira220)
 {
 	int ret;
 
-	ret = mira220_write(mira220, 0x0080, 0x08);
+	ret = ams_sensor_write(&mira220->ams, 0x0080, 0x08);
 
 	return 0;
 }
@@ -4451,9 +4799,9 @@ static int mira220_otp_read(struct mira220 *mira220, u8 addr, u8 offset, u8 *val
 {
 	int ret;
 
-	ret = mira220_write(mira220, 0x0086, addr);
-	ret = mira220_write(mira220, 0x0080, 0x02);
-	ret = mira220_read(mira220, 0x0082 + offset, val);
+	ret = ams_sensor_write(&mira220->ams, 0x0086, addr);
+	ret = ams_sensor_write(&mira220->ams, 0x0080, 0x02);
+	ret = ams_sensor_read(&mira220->ams, 0x0082 + offset, val);
 	return 0;
 }
 
@@ -4484,6 +4832,8 @@ static const struct v4l2_subdev_core_ops mira220_core_ops = {
 
 static const struct v4l2_subdev_video_ops mira220_video_ops = {
 	.s_stream = mira220_set_stream,
+	.g_frame_interval = mira220_g_frame_interval,
+	.s_frame_interval = mira220_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops mira220_pad_ops = {
@@ -4491,7 +4841,9 @@ static const struct v4l2_subdev_pad_ops mira220_pad_ops = {
 	.get_fmt = mira220_get_pad_format,
 	.set_fmt = mira220_set_pad_format,
 	.get_selection = mira220_get_selection,
+	.set_selection = mira220_set_selection,
 	.enum_frame_size = mira220_enum_frame_size,
+	.enum_frame_interval = mira220_enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops mira220_subdev_ops = {
@@ -4513,12 +4865,13 @@ static int mira220_init_controls(struct mira220 *mira220)
 	int ret;
 	struct v4l2_ctrl_config *mira220_reg_w;
 	struct v4l2_ctrl_config *mira220_reg_r;
+	unsigned int i;
 
 	u32 max_exposure = 0;
 
 	ctrl_hdlr = &mira220->ctrl_handler;
 	/* v4l2_ctrl_handler_init gives a hint/guess of the number of v4l2_ctrl_new */
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 25);
 	if (ret)
 		return ret;
 
@@ -4534,6 +4887,17 @@ static int mira220_init_controls(struct mira220 *mira220)
 					        mira220->mode->pixel_rate, 1,
 					        mira220->mode->pixel_rate);
 
+	/* Limited to the rates listed in DT */
+	mira220->link_freq = v4l2_ctrl_new_int_menu(ctrl_hdlr, &mira220_ctrl_ops,
+						    V4L2_CID_LINK_FREQ,
+						    ARRAY_SIZE(link_freq_menu) - 1,
+						    __ffs(mira220->link_freq_mask),
+						    link_freq_menu);
+	if (mira220->link_freq) {
+		mira220->link_freq->menu_skip_mask = ~mira220->link_freq_mask;
+		mira220->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	}
+
 	printk(KERN_INFO "[MIRA220]: %s V4L2_CID_VBLANK %X.\n", __func__, V4L2_CID_VBLANK);
 
 	mira220->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &mira220_ctrl_ops,
@@ -4571,6 +4935,8 @@ static int mira220_init_controls(struct mira220 *mira220)
 	mira220->gain = v4l2_ctrl_new_std(ctrl_hdlr, &mira220_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
 			  MIRA220_ANALOG_GAIN_MIN, MIRA220_ANALOG_GAIN_MAX,
 			  MIRA220_ANALOG_GAIN_STEP, MIRA220_ANALOG_GAIN_DEFAULT);
+	ams_sensor_gain_linear_init(&mira220->ams, ctrl_hdlr, &mira220_ctrl_ops,
+				    mira220->gain);
 
 	printk(KERN_INFO "[MIRA220]: %s V4L2_CID_HFLIP %X.\n", __func__, V4L2_CID_HFLIP);
 
@@ -4604,6 +4970,14 @@ static int mira220_init_controls(struct mira220 *mira220)
 	if (mira220->mira220_reg_r)
 		mira220->mira220_reg_r->flags |= (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_READ_ONLY);
 
+	/* Control delays and startup frames, read-only */
+	for (i = 2; i < ARRAY_SIZE(custom_ctrl_config_list); i++)
+		v4l2_ctrl_new_custom(ctrl_hdlr, &custom_ctrl_config_list[i], NULL);
+
+	mira220->burst_count = v4l2_ctrl_new_custom(ctrl_hdlr,
+						    &mira220_burst_count_ctrl, NULL);
+	v4l2_ctrl_new_custom(ctrl_hdlr, &mira220_burst_trigger_ctrl, NULL);
+
 	if (ctrl_hdlr->error) {
 		ret = ctrl_hdlr->error;
 		dev_err(&client->dev, "%s control init failed (%d)\n",
@@ -4637,12 +5011,13 @@ static void mira220_free_controls(struct mira220 *mira220)
 	mutex_destroy(&mira220->mutex);
 }
 
-static int mira220_check_hwcfg(struct device *dev)
+static int mira220_check_hwcfg(struct device *dev, struct mira220 *mira220)
 {
 	struct fwnode_handle *endpoint;
 	struct v4l2_fwnode_endpoint ep_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY
 	};
+	unsigned int i, j;
 	int ret = -EINVAL;
 
 	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -4668,10 +5043,21 @@ static int mira220_check_hwcfg(struct device *dev)
 		goto error_out;
 	}
 
-	if (ep_cfg.nr_of_link_frequencies != 1 ||
-	    ep_cfg.link_frequencies[0] != MIRA220_DEFAULT_LINK_FREQ) {
-		dev_err(dev, "Link frequency not supported: %lld\n",
-			ep_cfg.link_frequencies[0]);
+	mira220->link_freq_mask = 0;
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++) {
+		for (j = 0; j < ARRAY_SIZE(link_freq_menu); j++) {
+			if (ep_cfg.link_frequencies[i] == link_freq_menu[j]) {
+				mira220->link_freq_mask |= BIT(j);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(link_freq_menu))
+			dev_warn(dev, "Link frequency not supported: %lld\n",
+				 ep_cfg.link_frequencies[i]);
+	}
+
+	if (!mira220->link_freq_mask) {
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto error_out;
 	}
 
@@ -4686,102 +5072,107 @@ error_out:
 	return ret;
 }
 
-static int mira220pmic_init_controls(struct i2c_client *client)
-{
-	int ret;
-	u8 val;
-
-	ret = mira220pmic_write(client, 0x62, 0x00);
-	ret = mira220pmic_write(client, 0x61, 0x00);
-
-	ret = mira220pmic_read(client, 0x61, &val);
-	dev_err(&client->dev, "Read 0x61 with val %x\n", val);
+/* Board bring-up: PMIC supplies and the green LED */
+static const struct ams_pmic_step mira220_pmic_init_seq[] = {
+	AMS_PMIC_W(0x62, 0x00),
+	AMS_PMIC_W(0x61, 0x00),
+
+	AMS_PMIC_SLEEP(100, 110),
+
+	AMS_PMIC_W(0x05, 0x00),
+	AMS_PMIC_W(0x0e, 0x00),
+	AMS_PMIC_W(0x11, 0x00),
+	AMS_PMIC_W(0x14, 0x00),
+	AMS_PMIC_W(0x17, 0x00),
+	AMS_PMIC_W(0x1a, 0x00),
+	AMS_PMIC_W(0x1c, 0x00),
+	AMS_PMIC_W(0x1d, 0x00),
+	AMS_PMIC_W(0x1e, 0x00),
+	AMS_PMIC_W(0x1f, 0x00),
+
+	AMS_PMIC_W(0x24, 0x48),
+	AMS_PMIC_W(0x20, 0x00),
+	AMS_PMIC_W(0x21, 0x00),
+	AMS_PMIC_W(0x1a, 0x00),
+	AMS_PMIC_W(0x01, 0x00),
+	AMS_PMIC_W(0x08, 0x00),
+	AMS_PMIC_W(0x02, 0x00),
+	AMS_PMIC_W(0x0b, 0x00),
+	AMS_PMIC_W(0x14, 0x00),
+	AMS_PMIC_W(0x17, 0x00),
+	AMS_PMIC_W(0x1c, 0x00),
+	AMS_PMIC_W(0x1d, 0x00),
+	AMS_PMIC_W(0x1f, 0x00),
+
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x62, 0x0d),
+
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_SLEEP(50000, 50000 + 100),
+
+	AMS_PMIC_W(0x27, 0xff),
+	AMS_PMIC_W(0x28, 0xff),
+	AMS_PMIC_W(0x29, 0xff),
+	AMS_PMIC_W(0x2a, 0xff),
+	AMS_PMIC_W(0x2b, 0xff),
+
+	AMS_PMIC_W(0x41, 0x04),
+	AMS_PMIC_SLEEP(50, 60),
 
+	// PCB V2.0 or above, enable LDO9=2.50V for VDD25
+	AMS_PMIC_W(0x20, 0xb2),
+	// For PCB V1.0, VDD28 on 2.85V for older PCBs
+	// AMS_PMIC_W(0x20, 0xb9),
+
+	AMS_PMIC_SLEEP(700, 710),
+
+	AMS_PMIC_W(0x12, 0x16),
+	AMS_PMIC_W(0x10, 0x16),
+	AMS_PMIC_W(0x11, 0x96),
+	AMS_PMIC_W(0x1e, 0x96),
+	AMS_PMIC_W(0x21, 0x96),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x00, 0x04),
+	AMS_PMIC_W(0x04, 0x34),
+	AMS_PMIC_W(0x06, 0xbf),
+	AMS_PMIC_W(0x05, 0xb4),
+	AMS_PMIC_W(0x03, 0x00),
+	AMS_PMIC_W(0x0d, 0x34),
+	AMS_PMIC_W(0x0f, 0xbf),
+	AMS_PMIC_W(0x0e, 0xb4),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x42, 0x05),
+	AMS_PMIC_SLEEP(50, 60),
+
+	AMS_PMIC_W(0x45, 0x40),
+	AMS_PMIC_W(0x57, 0x02),
+	AMS_PMIC_W(0x5d, 0x10),
+	AMS_PMIC_W(0x61, 0x10),
+};
 
-	usleep_range(100, 110);
 
-	ret = mira220pmic_write(client, 0x05, 0x00);
-	ret = mira220pmic_write(client, 0x0e, 0x00);
-	ret = mira220pmic_write(client, 0x11, 0x00);
-	ret = mira220pmic_write(client, 0x14, 0x00);
-	ret = mira220pmic_write(client, 0x17, 0x00);
-	ret = mira220pmic_write(client, 0x1a, 0x00);
-	ret = mira220pmic_write(client, 0x1c, 0x00);
-	ret = mira220pmic_write(client, 0x1d, 0x00);
-	ret = mira220pmic_write(client, 0x1e, 0x00);
-	ret = mira220pmic_write(client, 0x1f, 0x00);
-
-	ret = mira220pmic_write(client, 0x24, 0x48);
-	ret = mira220pmic_write(client, 0x20, 0x00);
-	ret = mira220pmic_write(client, 0x21, 0x00);
-	ret = mira220pmic_write(client, 0x1a, 0x00);
-	ret = mira220pmic_write(client, 0x01, 0x00);
-	ret = mira220pmic_write(client, 0x08, 0x00);
-	ret = mira220pmic_write(client, 0x02, 0x00);
-	ret = mira220pmic_write(client, 0x0b, 0x00);
-	ret = mira220pmic_write(client, 0x14, 0x00);
-	ret = mira220pmic_write(client, 0x17, 0x00);
-	ret = mira220pmic_write(client, 0x1c, 0x00);
-	ret = mira220pmic_write(client, 0x1d, 0x00);
-	ret = mira220pmic_write(client, 0x1f, 0x00);
-
-	usleep_range(50, 60);
-
-	ret = mira220pmic_write(client, 0x62, 0x0d);
-
-	usleep_range(50, 60);
-	usleep_range(50000, 50000+100);
-
-	ret = mira220pmic_write(client, 0x27, 0xff);
-	ret = mira220pmic_write(client, 0x28, 0xff);
-	ret = mira220pmic_write(client, 0x29, 0xff);
-	ret = mira220pmic_write(client, 0x2a, 0xff);
-	ret = mira220pmic_write(client, 0x2b, 0xff);
-
-	ret = mira220pmic_write(client, 0x41, 0x04);
-	usleep_range(50, 60);
-
-	ret = mira220pmic_read(client, 0x20, &val);
-	dev_err(&client->dev, "Read 0x20 with val %x\n", val);
+static void mira220_debugfs_init(struct mira220 *mira220)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&mira220->sd);
+	char name[32];
 
-	// PCB V2.0 or above, enable LDO9=2.50V for VDD25
-	ret = mira220pmic_write(client, 0x20, 0xb2);
-	// For PCB V1.0, VDD28 on 2.85V for older PCBs
-	// ret = mira220pmic_write(client, 0x20, 0xb9);
-
-	ret = mira220pmic_read(client, 0x20, &val);
-	dev_err(&client->dev, "Read 0x20 with val %x\n", val);
-
-	usleep_range(700, 710);
-
-	ret = mira220pmic_write(client, 0x12, 0x16);
-	ret = mira220pmic_write(client, 0x10, 0x16);
-	ret = mira220pmic_write(client, 0x11, 0x96);
-	ret = mira220pmic_write(client, 0x1e, 0x96);
-	ret = mira220pmic_write(client, 0x21, 0x96);
-	usleep_range(50, 60);
-
-	ret = mira220pmic_write(client, 0x00, 0x04);
-	ret = mira220pmic_write(client, 0x04, 0x34);
-	ret = mira220pmic_write(client, 0x06, 0xbf);
-	ret = mira220pmic_write(client, 0x05, 0xb4);
-	ret = mira220pmic_write(client, 0x03, 0x00);
-	ret = mira220pmic_write(client, 0x0d, 0x34);
-	ret = mira220pmic_write(client, 0x0f, 0xbf);
-	ret = mira220pmic_write(client, 0x0e, 0xb4);
-	usleep_range(50, 60);
-
-	ret = mira220pmic_write(client, 0x42, 0x05);
-	usleep_range(50, 60);
-
-	ret = mira220pmic_write(client, 0x45, 0x40);
-	ret = mira220pmic_write(client, 0x57, 0x02);
-	ret = mira220pmic_write(client, 0x5d, 0x10);
-	ret = mira220pmic_write(client, 0x61, 0x10);
+	snprintf(name, sizeof(name), "mira220-%s", dev_name(&client->dev));
+	mira220->debugfs = debugfs_create_dir(name, NULL);
+	ams_sensor_trace_init(&mira220->ams, mira220->debugfs);
+}
 
-	return 0;
+static void mira220_debugfs_cleanup(struct mira220 *mira220)
+{
+	debugfs_remove_recursive(mira220->debugfs);
+	mira220->debugfs = NULL;
+	ams_sensor_trace_cleanup(&mira220->ams);
 }
 
+/* Defined next to the device id tables in mira220.c */
+static const struct mira220_variant *mira220_get_variant(struct i2c_client *client);
 
 static int mira220_probe(struct i2c_client *client)
 {
@@ -4800,16 +5191,30 @@ static int mira220_probe(struct i2c_client *client)
 
 	v4l2_i2c_subdev_init(&mira220->sd, client, &mira220_subdev_ops);
 
+	mira220->variant = mira220_get_variant(client);
+	if (!mira220->variant)
+		return -ENODEV;
+	printk(KERN_INFO "[MIRA220]: %s variant.\n", mira220->variant->name);
+
+	mira220->ams.client = client;
+	mira220->ams.ops = &mira220_ams_ops;
+	mutex_init(&mira220->hw_lock);
+	seqlock_init(&mira220->fmt_seqlock);
+	INIT_WORK(&mira220->preload_work, mira220_preload_work);
+
 	/* Check the hardware configuration in device tree */
-	if (mira220_check_hwcfg(dev))
+	if (mira220_check_hwcfg(dev, mira220))
 		return -EINVAL;
 
 	/* Parse device tree to check if dtoverlay has param skip-reg-upload=1 */
         device_property_read_u32(dev, "skip-reg-upload", &mira220->skip_reg_upload);
 	printk(KERN_INFO "[MIRA220]: skip-reg-upload %d.\n", mira220->skip_reg_upload);
+	/* Opt-in background mode upload, dtoverlay param preload=1 */
+	device_property_read_u32(dev, "preload", &mira220->preload);
+	printk(KERN_INFO "[MIRA220]: preload %d.\n", mira220->preload);
 	/* Set default TBD I2C device address to LED I2C Address*/
-	mira220->tbd_client_i2c_addr = MIRA220LED_I2C_ADDR;
-	printk(KERN_INFO "[MIRA220]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira220->tbd_client_i2c_addr);
+	mira220->ams.tbd_client_i2c_addr = MIRA220LED_I2C_ADDR;
+	printk(KERN_INFO "[MIRA220]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", mira220->ams.tbd_client_i2c_addr);
 
 
 	/* Get system clock (xclk) */
@@ -4838,20 +5243,21 @@ static int mira220_probe(struct i2c_client *client)
 
 	{
 		printk(KERN_INFO "[MIRA220]: Init PMIC.\n");
-		mira220->pmic_client = i2c_new_dummy_device(client->adapter,
+		mira220->ams.pmic_client = i2c_new_dummy_device(client->adapter,
 				MIRA220PMIC_I2C_ADDR);
-		if (IS_ERR(mira220->pmic_client))
-			return PTR_ERR(mira220->pmic_client);
-		mira220->uc_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira220->ams.pmic_client))
+			return PTR_ERR(mira220->ams.pmic_client);
+		mira220->ams.uc_client = i2c_new_dummy_device(client->adapter,
 				MIRA220UC_I2C_ADDR);
-		if (IS_ERR(mira220->uc_client))
-			return PTR_ERR(mira220->uc_client);
-		mira220->led_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(mira220->ams.uc_client))
+			return PTR_ERR(mira220->ams.uc_client);
+		mira220->ams.led_client = i2c_new_dummy_device(client->adapter,
 				MIRA220LED_I2C_ADDR);
-		if (IS_ERR(mira220->led_client))
-			return PTR_ERR(mira220->led_client);
+		if (IS_ERR(mira220->ams.led_client))
+			return PTR_ERR(mira220->ams.led_client);
 
-		mira220pmic_init_controls(mira220->pmic_client);
+		ams_pmic_run_seq(&mira220->ams, mira220_pmic_init_seq,
+				 ARRAY_SIZE(mira220_pmic_init_seq));
 	}
 
 	dev_err(dev, "[MIRA220] Sleep for 1 second to let PMIC driver complete init.\n");
@@ -4919,6 +5325,8 @@ static int mira220_probe(struct i2c_client *client)
 		goto error_media_entity;
 	}
 
+	mira220_debugfs_init(mira220);
+
 	/* Enable runtime PM and turn off the device */
 	pm_runtime_set_active(dev);
 	pm_runtime_enable(dev);
@@ -4935,9 +5343,9 @@ error_handler_free:
 error_power_off:
 	mira220_power_off(dev);
 
-	i2c_unregister_device(mira220->pmic_client);
-	i2c_unregister_device(mira220->uc_client);
-	i2c_unregister_device(mira220->led_client);
+	i2c_unregister_device(mira220->ams.pmic_client);
+	i2c_unregister_device(mira220->ams.uc_client);
+	i2c_unregister_device(mira220->ams.led_client);
 
 	return ret;
 }
@@ -4947,13 +5355,18 @@ static void mira220_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct mira220 *mira220 = to_mira220(sd);
 
-	i2c_unregister_device(mira220->pmic_client);
-	i2c_unregister_device(mira220->uc_client);
-	i2c_unregister_device(mira220->led_client);
+	i2c_unregister_device(mira220->ams.pmic_client);
+	i2c_unregister_device(mira220->ams.uc_client);
+	i2c_unregister_device(mira220->ams.led_client);
+
+	mira220_debugfs_cleanup(mira220);
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	cancel_work_sync(&mira220->preload_work);
+	mira220_drop_preload(mira220);
 	mira220_free_controls(mira220);
+	ams_sensor_fw_release(&mira220->ams);
 
 	pm_runtime_disable(&client->dev);
 	if (!pm_runtime_status_suspended(&client->dev))
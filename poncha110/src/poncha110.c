@@ -10,17 +10,34 @@
 #include "poncha110.inl"
 
 static const struct of_device_id poncha110_dt_ids[] = {
-	{ .compatible = "ams,poncha110" },
+	{ .compatible = "ams,poncha110", .data = &poncha110_mono },
+	{ .compatible = "ams,poncha110color", .data = &poncha110_color },
 	{ /* sentinel */ }
 };
 MODULE_DEVICE_TABLE(of, poncha110_dt_ids);
 
 static const struct i2c_device_id poncha110_ids[] = {
-	{ "poncha110", 0 },
+	{ "poncha110", (kernel_ulong_t)&poncha110_mono },
+	{ "poncha110color", (kernel_ulong_t)&poncha110_color },
 	{ }
 };
 MODULE_DEVICE_TABLE(i2c, poncha110_ids);
 
+/* The DT compatible, or the i2c device id without DT */
+static const struct poncha110_variant *poncha110_get_variant(struct i2c_client *client)
+{
+	const struct poncha110_variant *variant;
+	const struct i2c_device_id *id;
+
+	variant = device_get_match_data(&client->dev);
+	if (variant)
+		return variant;
+
+	id = i2c_match_id(poncha110_ids, client);
+
+	return id ? (const struct poncha110_variant *)id->driver_data : NULL;
+}
+
 static struct i2c_driver poncha110_i2c_driver = {
 	.driver = {
 		.name = "poncha110",
@@ -17,20 +17,31 @@
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
+#include <media/v4l2-rect.h>
 #include <asm/unaligned.h>
 
+#include "ams_sensor_core.h"
+
 /*
- * Introduce new v4l2 control/
+ * Frames until a control written during frame N is used, and frames to
+ * drop after stream-on. Exposure and gain are written to context 0 and
+ * TARGET_FRAME_TIME without a context select, without stopping the
+ * sensor. The tree does not document when Poncha110 takes them, so
+ * these follow the Mira050 context registers, taken at the next frame
+ * start. No mode changes the write paths. Controls deferred to the
+ * worker are written within the frame they were set in. Check with
+ * tools/ctrl_latency -c.
  */
-#include <linux/v4l2-controls.h>
-#define AMS_CAMERA_CID_BASE (V4L2_CTRL_CLASS_CAMERA | 0x2000)
-#define AMS_CAMERA_CID_MIRA_REG_W (AMS_CAMERA_CID_BASE + 0)
-#define AMS_CAMERA_CID_MIRA_REG_R (AMS_CAMERA_CID_BASE + 1)
+#define PONCHA110_EXPOSURE_DELAY 1
+#define PONCHA110_GAIN_DELAY 1
+#define PONCHA110_VBLANK_DELAY 1
+#define PONCHA110_STARTUP_FRAMES 1
 
 /* Most significant Byte is flag, and most significant bit is unused. */
 #define AMS_CAMERA_CID_PONCHA110_REG_FLAG_FOR_READ 0b00000001
@@ -75,7 +86,7 @@
  * The TBD I2C address is default to PONCHA110LED_I2C_ADDR.
  * To change the TBD I2C address, set bit 6&7 to 0b10,
  * then the reg_val will become TBD I2C address.
- * The TBD I2C address is stored in poncha110->tbd_client_i2c_addr.
+ * The TBD I2C address is stored in poncha110->ams.tbd_client_i2c_addr.
  */
 #define AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL 0b01100000
 #define AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_MIRA 0b00000000
@@ -116,6 +127,25 @@ F = fine
 
 #define PONCHA110_CONTEXT_REG 0x0000
 
+/*
+ * Vertical ROI, context 0. Window 0 reads the rows from YWIN0_START to
+ * YWIN0_END, which starts PONCHA110_YWIN_ROW_OFFSET rows into the array
+ * and has PONCHA110_YWIN_MARGIN extra rows on either side. The margin
+ * is dropped again with YWIN0_CROP_OFFSET and YWIN0_CROP_HEIGHT.
+ */
+#define PONCHA110_YWIN0_START_REG 0x0022
+#define PONCHA110_YWIN0_END_REG 0x0024
+#define PONCHA110_YWIN0_SUBS_REG 0x0026
+#define PONCHA110_YWIN0_CROP_OFFSET_REG 0x0027
+#define PONCHA110_YWIN0_CROP_HEIGHT_REG 0x0029
+#define PONCHA110_YWIN_ROW_OFFSET 10
+#define PONCHA110_YWIN_MARGIN 2
+// Rows go in pairs to keep the Bayer order
+#define PONCHA110_YWIN_ALIGN 2
+#define PONCHA110_YWIN_MIN_HEIGHT 8
+// Larger factors would not divide the margin
+#define PONCHA110_YWIN_MAX_SUBS 2
+
 // Exposure time is indicated in us
 #define PONCHA110_EXP_TIME_L_REG 0x000E
 #define PONCHA110_EXP_TIME_S_REG 0x0012
@@ -164,6 +194,9 @@ F = fine
 #define PONCHA110_TEST_PATTERN_FIXED_DATA 0x01
 #define PONCHA110_TEST_PATTERN_2D_GRADIENT 0x02
 
+/* Max number of queued AMS_CAMERA_EVENT_CTRL_APPLIED events per file handle */
+#define PONCHA110_CTRL_APPLIED_EVENTS 8
+
 /* Embedded metadata stream structure */
 #define PONCHA110_EMBEDDED_LINE_WIDTH 0
 #define PONCHA110_NUM_EMBEDDED_LINES 0
@@ -181,7 +214,7 @@ F = fine
 
 /*relevant params for poncha */
 #define PONCHA110_PIXEL_RATE (100000000) //=sequencer clock. row time = row_len /pixel rate
-/* Should match device tree link freq */
+/* Link freq of the PLL and CSI settings in the mode tables */
 #define PONCHA110_DEFAULT_LINK_FREQ 456000000
 
 /*relevant registers for Poncha*/
@@ -217,12 +250,6 @@ enum pad_types
 	NUM_PADS
 };
 
-struct poncha110_reg
-{
-	u16 address;
-	u8 val;
-};
-
 struct poncha110_fine_gain_lut
 {
 	u8 gdig_amp;
@@ -233,7 +260,7 @@ struct poncha110_fine_gain_lut
 struct poncha110_reg_list
 {
 	unsigned int num_of_regs;
-	const struct poncha110_reg *regs;
+	const struct ams_sensor_reg *regs;
 };
 
 struct poncha110_v4l2_reg
@@ -241,6 +268,20 @@ struct poncha110_v4l2_reg
 	u32 val;
 };
 
+/* Controls written by the control worker while streaming, in write order */
+enum poncha110_deferred_ctrl
+{
+	PONCHA110_DEFERRED_VBLANK,
+	PONCHA110_DEFERRED_EXPOSURE,
+	PONCHA110_DEFERRED_GAIN,
+	PONCHA110_NUM_DEFERRED_CTRLS
+};
+
+/* ctrl_pending bit of a window written by the control worker */
+#define PONCHA110_PENDING_WINDOW PONCHA110_NUM_DEFERRED_CTRLS
+
+static_assert(PONCHA110_NUM_DEFERRED_CTRLS <= AMS_CAMERA_CTRL_APPLIED_MAX);
+
 /* Mode : resolution and related config&values */
 struct poncha110_mode
 {
@@ -270,7 +311,7 @@ struct poncha110_mode
 // 
 
 //30 fps
-static const struct poncha110_reg full_10b_2lane_gain1_4_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg full_10b_2lane_gain1_4_reg_pre_soft_reset[] = {
 	//POLAR_PIX
 	{0x0106, 0x2},
 	{0x0107, 0x83},
@@ -1049,7 +1090,7 @@ static const struct poncha110_reg full_10b_2lane_gain1_4_reg_pre_soft_reset[] =
 };
 
 //60 fps crop
-static const struct poncha110_reg crop_980_10b_2lane_gain1_reg_pre_soft_reset[] = {
+static const struct ams_sensor_reg crop_980_10b_2lane_gain1_reg_pre_soft_reset[] = {
 	//POLAR_PIX
 	{ 0x0106, 0x02 },
 	{ 0x0107, 0x83 },
@@ -1868,6 +1909,16 @@ static const char *const poncha110_supply_name[] = {
 
 #define PONCHA110_NUM_SUPPLIES ARRAY_SIZE(poncha110_supply_name)
 
+/*
+ * MIPI link frequencies, in V4L2_CID_LINK_FREQ menu order. The mode tables
+ * program PONCHA110_DEFAULT_LINK_FREQ. Other rates need their CSI PLL
+ * and D-PHY timing registers, which are not known yet, so the control is
+ * read-only until then.
+ */
+static const s64 link_freq_menu[] = {
+	PONCHA110_DEFAULT_LINK_FREQ,
+};
+
 /*
  * The supported formats. All flip/mirror combinations have the same byte order because the sensor
  * is monochrome
@@ -1876,6 +1927,30 @@ static const u32 codes[] = {
 	MEDIA_BUS_FMT_SBGGR10_1X10,
 };
 
+/*
+ * Mono and color variant, the match data of both device tables. Both
+ * report the Bayer codes above, as the separate poncha110 and
+ * poncha110color modules did, so existing userspace tuning keeps working.
+ */
+struct poncha110_variant
+{
+	const char *name;
+	const u32 *codes;
+	unsigned int num_codes;
+};
+
+static const struct poncha110_variant poncha110_mono = {
+	.name = "poncha110",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
+static const struct poncha110_variant poncha110_color = {
+	.name = "poncha110color",
+	.codes = codes,
+	.num_codes = ARRAY_SIZE(codes),
+};
+
 /* Mode configs */
 /*
  * Only one mode is exposed to the public (400x400 at 10 bit).
@@ -1906,7 +1981,7 @@ static const struct poncha110_mode supported_modes[] = {
 		.bit_depth = 10,
 		.code = MEDIA_BUS_FMT_SBGGR10_1X10,
 		.gain_min = 0,
-		.gain_max = 3, // this is means 0,1,2 correspond to 1x 2x 4x gain
+		.gain_max = 3, // coarse gain x1 to x4, see PONCHA110_ANALOG_GAIN_REG
 	},
 	 {
 	 	/* gain 1 10bit 60 fps crop mode */
@@ -1929,7 +2004,7 @@ static const struct poncha110_mode supported_modes[] = {
 	 	.bit_depth = 10,
 	 	.code = MEDIA_BUS_FMT_SBGGR10_1X10,
 	 	.gain_min = 0,
-	 	.gain_max = 0, // this is means 0,1,2 correspond to 1x 2x 4x gain
+	 	.gain_max = 0, // coarse gain x1 only
 	 },
 
 
@@ -1938,9 +2013,15 @@ static const struct poncha110_mode supported_modes[] = {
 struct poncha110
 {
 	struct v4l2_subdev sd;
+	/* Mono or color, from the device match data */
+	const struct poncha110_variant *variant;
 	struct media_pad pad[NUM_PADS];
 
 	struct v4l2_mbus_framefmt fmt;
+	/* Vertical window, mode->crop unless changed with set_selection */
+	struct v4l2_rect crop;
+	/* Row subsampling of the window, fmt.height is crop.height / ysubs */
+	u32 ysubs;
 
 	struct clk *xclk; /* system clock to PONCHA110 */
 	u32 xclk_freq;
@@ -1950,6 +2031,9 @@ struct poncha110
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *link_freq;
+	/* Entries of link_freq_menu listed in device tree */
+	unsigned long link_freq_mask;
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
@@ -1959,8 +2043,6 @@ struct poncha110
 	// custom v4l2 control
 	struct v4l2_ctrl *mira_reg_w;
 	struct v4l2_ctrl *mira_reg_r;
-	u16 mira_reg_w_cached_addr;
-	u8 mira_reg_w_cached_flag;
 
 	/* Current mode */
 	const struct poncha110_mode *mode;
@@ -1974,289 +2056,57 @@ struct poncha110
 	u32 powered;
 
 	/* A flag to force write_start/stop_streaming_regs even if (skip_reg_upload==1) */
-	u32 target_frame_time;
 	u32 row_length;
 	u8 force_stream_ctrl;
 
 	/*
 	 * Mutex for serialized access:
-	 * Protect sensor module set pad format and start/stop streaming safely.
+	 * Control handler lock, protects driver state and control ranges.
+	 * Not held across power-on and register table upload.
 	 */
 	struct mutex mutex;
-
-	/* Streaming on/off */
-	bool streaming;
-
-	/* pmic and uC */
-	struct i2c_client *pmic_client;
-	struct i2c_client *uc_client;
-	struct i2c_client *led_client;
-	/* User specified I2C device address */
-	u32 tbd_client_i2c_addr;
-};
-
-static inline struct poncha110 *to_poncha110(struct v4l2_subdev *_sd)
-{
-	return container_of(_sd, struct poncha110, sd);
-}
-
-static int poncha110_read(struct poncha110 *poncha110, u16 reg, u8 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
 	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
+	 * Serializes hardware sequences (stream on/off, suspend/resume) and
+	 * ACTIVE format changes. Lock order: hw_lock, then mutex.
 	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, val, 1);
+	struct mutex hw_lock;
+	/* Set while a hardware sequence runs without mutex */
+	bool hw_busy;
 	/*
-	 * The only return value indicating success is 1. Anything else, even
-	 * a non-negative value, indicates something went wrong.
+	 * Publishes mode, fmt and the window so format and selection
+	 * queries can read them without taking mutex.
 	 */
-	if (ret == 1)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
+	seqlock_t fmt_seqlock;
 
-static int poncha110_write(struct poncha110 *poncha110, u16 reg, u8 val)
-{
-	int ret;
-	unsigned char data[3] = {reg >> 8, reg & 0xff, val};
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	ret = i2c_master_send(client, data, 3);
+	/* Streaming on/off */
+	bool streaming;
 
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 3)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
+	/* I2C transport, pmic, uC, LED and the REG_W/REG_R state */
+	struct ams_sensor ams;
 
 	/*
-	 * The code below is for debug purpose.
-	 * It reads back the written values.
-	 * Some registers have different read and write addresses.
-	 * These registers typically have WR addr 0xE... but RD addr 0x4...
+	 * Slow control writes are deferred to an ordered worker while streaming.
+	 * Only the latest value of each pending control is written.
 	 */
-	/*
-	{
-		usleep_range(50, 300);
-		u8 ret_val;
-		u16 ret_reg;
-		if (((reg >>12) & 0x000F) == 0x000E) {
-			ret_reg = ((reg & 0x0FFF) | 0x4000);
-		} else {
-			ret_reg = reg;
-		}
-		ret = poncha110_read(poncha110, ret_reg, &ret_val);
-		printk(KERN_INFO "[PONCHA110]: Write reg 0x%4.4x, Read ret_reg 0x%4.4x, val = 0x%x.\n",
-				reg, ret_reg, ret_val);
-		if (val != ret_val) {
-			printk(KERN_INFO "[PONCHA110]: WARNING Write reg 0x%4.4x, val = 0x%x, read ret_reg = 0x%4.4x, ret_val = 0x%x.\n",
-				reg, val, ret_reg, ret_val);
-		}
-	}
-	*/
-
-	return ret;
-}
-
-/*
- * poncha110 is big-endian: msb of val goes to lower reg addr
- */
-/* Temporary commented out, because it is not yet used. */
-
-static int poncha110_write_be16(struct poncha110 *poncha110, u16 reg, u16 val)
-{
-	   int ret;
-	   unsigned char data[4] = { reg >> 8, reg & 0xff, (val >> 8) & 0xff, val & 0xff };
-	   struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	   ret = i2c_master_send(client, data, 4);
-	   //
-	   // Writing the wrong number of bytes also needs to be flagged as an
-	   // error. Success needs to produce a 0 return code.
-	   //
-	   if (ret == 4) {
-			   ret = 0;
-	   } else {
-			   dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-							   __func__, reg);
-			   if (ret >= 0)
-					   ret = -EINVAL;
-	   }
-
-	   return ret;
-}
+	struct workqueue_struct *ctrl_wq;
+	struct work_struct ctrl_work;
+	spinlock_t ctrl_pending_lock;
+	unsigned long ctrl_pending;
+	s32 ctrl_pending_val[PONCHA110_NUM_DEFERRED_CTRLS];
+	u32 ctrl_applied_seq;
+	/* Result of the last PONCHA110_PENDING_WINDOW write */
+	int window_ret;
+};
 
-/*
- * poncha110 is big-endian: msb of val goes to lower reg addr
- */
-static int poncha110_write_be24(struct poncha110 *poncha110, u16 reg, u32 val)
+static inline struct poncha110 *to_poncha110(struct v4l2_subdev *_sd)
 {
-	int ret;
-	unsigned char data[5] = {reg >> 8, reg & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	ret = i2c_master_send(client, data, 5);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 5)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
+	return container_of(_sd, struct poncha110, sd);
 }
 
 /*
  * poncha110 is big-endian: msb of val goes to lower reg addr
  */
-static int poncha110_write_be32(struct poncha110 *poncha110, u16 reg, u32 val)
-{
-	int ret;
-	unsigned char data[6] = {reg >> 8, reg & 0xff, (val >> 24) & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff};
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	ret = i2c_master_send(client, data, 6);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 6)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/*
- * poncha110 OTP 32-bit val on I2C is big-endian. However, val content can be little-endian.
- */
-static int poncha110_read_be32(struct poncha110 *poncha110, u16 reg, u32 *val)
-{
-	int ret;
-	unsigned char data_w[2] = {reg >> 8, reg & 0xff};
-	/* Big-endian 32-bit buffer. */
-	unsigned char data_r[4];
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-
-	ret = i2c_master_send(client, data_w, 2);
-	/*
-	 * A negative return code, or sending the wrong number of bytes, both
-	 * count as an error.
-	 */
-	if (ret != 2)
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-		return ret;
-	}
-
-	ret = i2c_master_recv(client, data_r, 4);
-	*val = (u32)((data_r[0] << 24) | (data_r[1] << 16) | (data_r[2] << 8) | data_r[3]);
-	/*
-	 * The only return value indicating success is 4. Anything else, even
-	 * a non-negative value, indicates something went wrong.
-	 */
-	if (ret == 4)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c read error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
-
-	return ret;
-}
-
-/* Write a list of registers */
-static int poncha110_write_regs(struct poncha110 *poncha110,
-							  const struct poncha110_reg *regs, u32 len)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++)
-	{
-		ret = poncha110_write(poncha110, regs[i].address, regs[i].val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev,
-								"Failed to write reg 0x%4.4x. error = %d\n",
-								regs[i].address, ret);
-
-			return ret;
-		}
-		else
-		{
-			// Debug code below
-			// u8 val;
-			// ret = poncha110_read(poncha110, regs[i].address, &val);
-			// printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
-			// 		regs[i].address, val);
-
-		}
-	}
-
-	return 0;
-}
+/* Temporary commented out, because it is not yet used. */
 
 
 static int poncha110_otp_read(struct poncha110 *poncha110, u16 addr, u8* val)
@@ -2266,10 +2116,10 @@ static int poncha110_otp_read(struct poncha110 *poncha110, u16 addr, u8* val)
 	int poll_cnt = 0;
 	int poll_cnt_max = 10;
 	int ret;
-	poncha110_write(poncha110, PONCHA110_OTP_ENABLE, 1);
+	ams_sensor_write(&poncha110->ams, PONCHA110_OTP_ENABLE, 1);
 	for (poll_cnt = 0; poll_cnt < poll_cnt_max; poll_cnt++)
 	{
-		poncha110_read(poncha110, PONCHA110_OTP_BUSY, &busy_status);
+		ams_sensor_read(&poncha110->ams, PONCHA110_OTP_BUSY, &busy_status);
 		if (busy_status == 0)
 		{
 			break;
@@ -2277,9 +2127,9 @@ static int poncha110_otp_read(struct poncha110 *poncha110, u16 addr, u8* val)
 	}
 	if (poll_cnt < poll_cnt_max && busy_status == 0)
 	{
-		// ret = poncha110_read_be32(poncha110, PONCHA110_OTP_DOUT, val);
-		poncha110_read(poncha110, PONCHA110_OTP_BUSY, &busy_status);
-		ret = poncha110_read(poncha110, addr, val);
+		// ret = ams_sensor_read_be32(&poncha110->ams, PONCHA110_OTP_DOUT, val);
+		ams_sensor_read(&poncha110->ams, PONCHA110_OTP_BUSY, &busy_status);
+		ret = ams_sensor_read(&poncha110->ams, addr, val);
 		printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   addr, *val);
 
@@ -2290,65 +2140,11 @@ static int poncha110_otp_read(struct poncha110 *poncha110, u16 addr, u8* val)
 				__func__, addr);
 		ret = -EINVAL;
 	}
-	poncha110_write(poncha110, PONCHA110_OTP_ENABLE, 0);
-
-	return ret;
-}
-
-/* Write PMIC registers, and can be reused to write microcontroller reg. */
-static int poncha110pmic_write(struct i2c_client *client, u8 reg, u8 val)
-{
-	int ret;
-	unsigned char data[2] = {reg & 0xff, val};
-
-	ret = i2c_master_send(client, data, 2);
-	/*
-	 * Writing the wrong number of bytes also needs to be flagged as an
-	 * error. Success needs to produce a 0 return code.
-	 */
-	if (ret == 2)
-	{
-		ret = 0;
-	}
-	else
-	{
-		dev_dbg(&client->dev, "%s: i2c write error, reg: %x\n",
-				__func__, reg);
-		if (ret >= 0)
-			ret = -EINVAL;
-	}
+	ams_sensor_write(&poncha110->ams, PONCHA110_OTP_ENABLE, 0);
 
 	return ret;
 }
 
-static int poncha110pmic_read(struct i2c_client *client, u8 reg, u8 *val)
-{
-	struct i2c_msg msgs[2];
-	u8 addr_buf[1] = {reg & 0xff};
-	u8 data_buf[1] = {0};
-	int ret;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = 1;
-	msgs[1].buf = &data_buf[0];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = (u8)(data_buf[0]);
-
-	return 0;
-}
-
 /* Power/clock management functions */
 static int poncha110_power_on(struct device *dev)
 {
@@ -2421,317 +2217,110 @@ static int poncha110_power_off(struct device *dev)
 	return 0;
 }
 
-static int poncha110_v4l2_reg_w(struct poncha110 *poncha110, u32 value)
+/* AMS_CAMERA_CID_MIRA_REG_W commands, the protocol is in ams_sensor_reg_w() */
+static void poncha110_reg_cmd(struct ams_sensor *ams, u8 reg_flag, u32 value)
 {
-	struct i2c_client *const client = v4l2_get_subdevdata(&poncha110->sd);
-	u32 ret = 0;
+	struct poncha110 *poncha110 = container_of(ams, struct poncha110, ams);
+	struct i2c_client *const client = ams->client;
 	u32 tmp_flag;
 
-	u16 reg_addr = (value >> 8) & 0xFFFF;
-	u8 reg_val = value & 0xFF;
-	u8 reg_flag = (value >> 24) & 0xFF;
-
-	// printk(KERN_INFO "[PONCHA110]: %s reg_flag: 0x%02X; reg_addr: 0x%04X; reg_val: 0x%02X.\n",
-	// 		__func__, reg_flag, reg_addr, reg_val);
-
-	if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_CMD_SEL)
+	if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_RESET_ON)
 	{
-		if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_SLEEP_US)
-		{
-			// If it is for sleep, combine all 24 bits of reg_addr and reg_val as sleep us.
-			u32 sleep_us_val = value & 0x00FFFFFF;
-			// Sleep range needs an interval, default to 1/8 of the sleep value.
-			u32 sleep_us_interval = sleep_us_val >> 3;
-			printk(KERN_INFO "[PONCHA110]: %s sleep_us: %u.\n", __func__, sleep_us_val);
-			usleep_range(sleep_us_val, sleep_us_val + sleep_us_interval);
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_RESET_ON)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Enable reset at stream on/off.\n", __func__);
-			poncha110->skip_reset = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_RESET_OFF)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Disable reset at stream on/off.\n", __func__);
-			poncha110->skip_reset = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_REG_UP_ON)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Enable base register sequence upload.\n", __func__);
-			poncha110->skip_reg_upload = 0;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_REG_UP_OFF)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Disable base register sequence upload.\n", __func__);
-			poncha110->skip_reg_upload = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_POWER_ON)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Call power on function poncha110_power_on().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = poncha110->skip_reset;
-			poncha110->skip_reset = 0;
-			poncha110_power_on(&client->dev);
-			poncha110->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_POWER_OFF)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Call power off function poncha110_power_off().\n", __func__);
-			/* Temporarily disable skip_reset if manually doing power on/off */
-			tmp_flag = poncha110->skip_reset;
-			poncha110->skip_reset = 0;
-			poncha110_power_off(&client->dev);
-			poncha110->skip_reset = tmp_flag;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_STREAM_CTRL_ON)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
-			poncha110->force_stream_ctrl = 1;
-		}
-		else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_STREAM_CTRL_OFF)
-		{
-			printk(KERN_INFO "[PONCHA110]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
-			poncha110->force_stream_ctrl = 0;
-		}
-		else
-		{
-			printk(KERN_INFO "[PONCHA110]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
-		}
+		printk(KERN_INFO "[PONCHA110]: %s Enable reset at stream on/off.\n", __func__);
+		poncha110->skip_reset = 0;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_RESET_OFF)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Disable reset at stream on/off.\n", __func__);
+		poncha110->skip_reset = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_REG_UP_ON)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Enable base register sequence upload.\n", __func__);
+		poncha110->skip_reg_upload = 0;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_REG_UP_OFF)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Disable base register sequence upload.\n", __func__);
+		poncha110->skip_reg_upload = 1;
 	}
-	else if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_FOR_READ)
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_POWER_ON)
 	{
-		// If it is for read, skip reagister write, cache addr and flag for read.
-		poncha110->mira_reg_w_cached_addr = reg_addr;
-		poncha110->mira_reg_w_cached_flag = reg_flag;
+		printk(KERN_INFO "[PONCHA110]: %s Call power on function poncha110_power_on().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = poncha110->skip_reset;
+		poncha110->skip_reset = 0;
+		poncha110_power_on(&client->dev);
+		poncha110->skip_reset = tmp_flag;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_POWER_OFF)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Call power off function poncha110_power_off().\n", __func__);
+		/* Temporarily disable skip_reset if manually doing power on/off */
+		tmp_flag = poncha110->skip_reset;
+		poncha110->skip_reset = 0;
+		poncha110_power_off(&client->dev);
+		poncha110->skip_reset = tmp_flag;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_STREAM_CTRL_ON)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Force stream control even if (skip_reg_upload == 1).\n", __func__);
+		poncha110->force_stream_ctrl = 1;
+	}
+	else if (reg_flag == AMS_CAMERA_CID_PONCHA110_REG_FLAG_STREAM_CTRL_OFF)
+	{
+		printk(KERN_INFO "[PONCHA110]: %s Disable stream control if (skip_reg_upload == 1).\n", __func__);
+		poncha110->force_stream_ctrl = 0;
 	}
 	else
 	{
-		// If it is for write, select which I2C device by the flag "I2C_SEL".
-		if ((reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_MIRA)
-		{
-			// Before writing Poncha110 register, first optionally select BANK and CONTEXT
-			if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_USE_BANK)
-			{
-				u8 bank;
-				u8 context;
-				// Set conetxt bank 0 or 1
-				if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_BANK)
-				{
-					bank = 1;
-				}
-				else
-				{
-					bank = 0;
-				}
-				// printk(KERN_INFO "[PONCHA110]: %s select bank: %u.\n", __func__, bank);
-
-				// Set context bank 1A or bank 1B
-				if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_CONTEXT)
-				{
-					context = 1;
-				}
-				else
-				{
-					context = 0;
-				}
-				// printk(KERN_INFO "[PONCHA110]: %s select context: %u.\n", __func__, context);
-				ret = poncha110_write(poncha110, PONCHA110_CONTEXT_REG, context);
-				if (ret)
-				{
-					dev_err(&client->dev, "Error setting RW_CONTEXT.");
-					return ret;
-				}
-			}
-			// Writing the actual Poncha110 register
-			// printk(KERN_INFO "[PONCHA110]: %s write reg_addr: 0x%04X; reg_val: 0x%02X.\n", __func__, reg_addr, reg_val);
-			ret = poncha110_write(poncha110, reg_addr, reg_val);
-			if (ret)
-			{
-				dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_W reg_addr %X.\n", reg_addr);
-				return -EINVAL;
-			}
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SET_TBD)
-		{
-			/* User tries to set TBD I2C address, store reg_val to poncha110->tbd_client_i2c_addr. Skip write. */
-			printk(KERN_INFO "[PONCHA110]: poncha110->tbd_client_i2c_addr = 0x%X.\n", reg_val);
-			poncha110->tbd_client_i2c_addr = reg_val;
-		}
-		else if ((reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_TBD)
-		{
-			if (poncha110->tbd_client_i2c_addr == PONCHA110PMIC_I2C_ADDR)
-			{
-				// Write PMIC. Use pre-allocated poncha110->pmic_client.
-				printk(KERN_INFO "[PONCHA110]: write pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = poncha110pmic_write(poncha110->pmic_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (poncha110->tbd_client_i2c_addr == PONCHA110UC_I2C_ADDR)
-			{
-				// Write micro-controller. Use pre-allocated poncha110->uc_client.
-				printk(KERN_INFO "[PONCHA110]: write uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = poncha110pmic_write(poncha110->uc_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else if (poncha110->tbd_client_i2c_addr == PONCHA110LED_I2C_ADDR)
-			{
-				// Write LED driver. Use pre-allocated poncha110->led_client.
-				printk(KERN_INFO "[PONCHA110]: write led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-				ret = poncha110pmic_write(poncha110->led_client, (u8)(reg_addr & 0xFF), reg_val);
-			}
-			else
-			{
-				/* Write other TBD I2C address.
-				 * The TBD I2C address is set via AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SET_TBD.
-				 * The TBD I2C address is stored in poncha110->tbd_client_i2c_addr.
-				 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-				 */
-				struct i2c_client *tmp_client;
-				tmp_client = i2c_new_dummy_device(client->adapter, poncha110->tbd_client_i2c_addr);
-				if (IS_ERR(tmp_client))
-					return PTR_ERR(tmp_client);
-				printk(KERN_INFO "[PONCHA110]: write tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-					   poncha110->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-				ret = poncha110pmic_write(tmp_client, (u8)(reg_addr & 0xFF), reg_val);
-				i2c_unregister_device(tmp_client);
-			}
-		}
+		printk(KERN_INFO "[PONCHA110]: %s unknown command from flag %u, ignored.\n", __func__, reg_flag);
 	}
-
-	return 0;
 }
 
-static int poncha110_v4l2_reg_r(struct poncha110 *poncha110, u32 *value)
+/*
+ * Gain of an analog gain index in 1/256. The index is the coarse gain
+ * code of PONCHA110_ANALOG_GAIN_REG, 000 to 011 for x1 to x4 in the
+ * table above it, and the fine bits stay at PONCHA110_ANALOG_GAIN_TRIM,
+ * so index N is x(N + 1). That table is the only source in this tree,
+ * the gains have not been measured.
+ */
+static u32 poncha110_gain_to_linear(struct ams_sensor *ams, u32 index)
 {
-	struct i2c_client *const client = v4l2_get_subdevdata(&poncha110->sd);
-	u32 ret = 0;
+	return (index + 1) * AMS_CAMERA_GAIN_LINEAR_UNITY;
+}
 
-	u16 reg_addr = poncha110->mira_reg_w_cached_addr;
-	u8 reg_flag = poncha110->mira_reg_w_cached_flag;
-	u8 reg_val = 0;
-
-	*value = 0;
-
-	if ((reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_MIRA)
-	{
-		if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_USE_BANK)
-		{
-			u8 bank;
-			u8 context;
-			// Set conetxt bank 0 or 1
-			if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_BANK)
-			{
-				bank = 1;
-			}
-			else
-			{
-				bank = 0;
-			}
-			// printk(KERN_INFO "[PONCHA110]: %s select bank: %u.\n", __func__, bank);
-			// Set context bank 1A or bank 1B
-			if (reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_CONTEXT)
-			{
-				context = 1;
-			}
-			else
-			{
-				context = 0;
-			}
-			// printk(KERN_INFO "[PONCHA110]: %s select context: %u.\n", __func__, context);
-			ret = poncha110_write(poncha110, PONCHA110_CONTEXT_REG, context);
-			if (ret)
-			{
-				dev_err(&client->dev, "Error setting RW_CONTEXT.");
-				return ret;
-			}
-		}
-		ret = poncha110_read(poncha110, reg_addr, &reg_val);
-		if (ret)
-		{
-			dev_err_ratelimited(&client->dev, "Error AMS_CAMERA_CID_MIRA_REG_R reg_addr %X.\n", reg_addr);
-			return -EINVAL;
-		}
-	}
-	else if ((reg_flag & AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SEL) == AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_TBD)
-	{
-		if (poncha110->tbd_client_i2c_addr == PONCHA110PMIC_I2C_ADDR)
-		{
-			// Read PMIC. Use pre-allocated poncha110->pmic_client.
-			ret = poncha110pmic_read(poncha110->pmic_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[PONCHA110]: read pmic_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (poncha110->tbd_client_i2c_addr == PONCHA110UC_I2C_ADDR)
-		{
-			// Read micro-controller. Use pre-allocated poncha110->uc_client.
-			ret = poncha110pmic_read(poncha110->uc_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[PONCHA110]: read uc_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else if (poncha110->tbd_client_i2c_addr == PONCHA110LED_I2C_ADDR)
-		{
-			// Read LED driver. Use pre-allocated poncha110->led_client.
-			ret = poncha110pmic_read(poncha110->led_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[PONCHA110]: read led_client, reg_addr 0x%X, reg_val 0x%X.\n", (u8)(reg_addr & 0xFF), reg_val);
-		}
-		else
-		{
-			/* Read other TBD I2C address.
-			 * The TBD I2C address is set via AMS_CAMERA_CID_PONCHA110_REG_FLAG_I2C_SET_TBD.
-			 * The TBD I2C address is stored in poncha110->tbd_client_i2c_addr.
-			 * A temporary I2C client, tmp_client, is created and then destroyed (unregistered).
-			 */
-			struct i2c_client *tmp_client;
-			tmp_client = i2c_new_dummy_device(client->adapter, poncha110->tbd_client_i2c_addr);
-			if (IS_ERR(tmp_client))
-				return PTR_ERR(tmp_client);
-			ret = poncha110pmic_read(tmp_client, (u8)(reg_addr & 0xFF), &reg_val);
-			printk(KERN_INFO "[PONCHA110]: read tbd_client, i2c_addr %u, reg_addr 0x%X, reg_val 0x%X.\n",
-				   poncha110->tbd_client_i2c_addr, (u8)(reg_addr & 0xFF), reg_val);
-			i2c_unregister_device(tmp_client);
-		}
-	}
-
-	// Return 32-bit value that includes flags, addr, and register value
-	*value = ((u32)reg_flag << 24) | ((u32)reg_addr << 8) | (u32)reg_val;
-
-	// printk(KERN_INFO "[PONCHA110]: poncha110_v4l2_reg_r() reg_flag: 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
-	// 		reg_flag, reg_addr, reg_val);
-
-	return 0;
-}
+static const struct ams_sensor_ops poncha110_ams_ops = {
+	.reg_cmd = poncha110_reg_cmd,
+	.gain_to_linear = poncha110_gain_to_linear,
+};
 
 
 
-static int poncha110_write_analog_gain_reg(struct poncha110 *poncha110, u8 gain) {
-	struct i2c_client* const client = v4l2_get_subdevdata(&poncha110->sd);
-	u32 ret = 0;
+/*
+ * The gain is one register of context 0, written without stopping the
+ * sensor. While streaming it is written by the control worker, which
+ * sends AMS_CAMERA_EVENT_CTRL_APPLIED once the register is written. When
+ * the sensor then uses it is not documented in this tree, see
+ * PONCHA110_GAIN_DELAY.
+ */
+static int poncha110_write_analog_gain_reg(struct poncha110 *poncha110, u8 gain)
+{
+	struct i2c_client *const client = v4l2_get_subdevdata(&poncha110->sd);
 	u8 gainval;
-	if (gain | PONCHA110_ANALOG_GAIN_MAX) {
-		//MODE_SELECT
-
-
-		int poll_cnt = 0;
-		int poll_cnt_max = 4;
-		int ret;
-		// poncha110_write(poncha110, PONCHA110_OTP_COMMAND, 0);
-		// poncha110_write(poncha110, PONCHA110_OTP_ADDR, addr);
-		// poncha110_write(poncha110, PONCHA110_OTP_START, 1);
-		// poncha110_write(poncha110, PONCHA110_OTP_START, 0);
-
-		usleep_range(70000, 150000);
-		ret |= poncha110_write(poncha110, PONCHA110_CONTEXT_REG, 0);
-		gainval = (gain<<5) | PONCHA110_ANALOG_GAIN_TRIM;
-		ret |= poncha110_write(poncha110, PONCHA110_ANALOG_GAIN_REG, gainval);
-		printk(KERN_INFO "[PONCHA110]: ANALOG GAIN gainval reg %u, gain %u.\n",gainval, gain);
-
-
+	int ret;
 
-	// ret |= poncha110_write(poncha110, 0x0007, 0x00);
+	if (gain > PONCHA110_ANALOG_GAIN_MAX)
+		return -EINVAL;
 
-	// ret |= poncha110_write(poncha110, 0x0007, 0x01);
+	gainval = (gain << 5) | PONCHA110_ANALOG_GAIN_TRIM;
+	ret = ams_sensor_write(&poncha110->ams, PONCHA110_CONTEXT_REG, 0);
+	if (!ret)
+		ret = ams_sensor_write(&poncha110->ams, PONCHA110_ANALOG_GAIN_REG, gainval);
+	if (ret)
+		dev_err_ratelimited(&client->dev, "Error setting analog gain to %u", gain);
 
-	}
-	if (ret) {
-		dev_err(&client->dev, "%s failed to set mode\n", __func__);
-	}
-	return 0;
+	return ret;
 }
 
 
@@ -2769,14 +2358,14 @@ static int poncha110_write_exposure_reg(struct poncha110 *poncha110, u32 exposur
 	// printk(KERN_INFO "[PONCHA110]: poncha110 write exp reg 0x%02X; reg_addr: 0x%04X, reg_val: 0x%02X.\n",
 	/* Write Bank 1 context 0 */
 
-	ret = poncha110_write_be16(poncha110, PONCHA110_CONTEXT_REG, 0);
+	ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_CONTEXT_REG, 0);
 
-	ret = poncha110_write_be16(poncha110, PONCHA110_EXPOSURE_REG, exposure);
-	// ret = poncha110_write(poncha110, PONCHA110_BANK_SEL_REG, 1);
-	// ret = poncha110_write_be32(poncha110, PONCHA110_EXP_TIME_L_REG, exposure);
+	ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_EXPOSURE_REG, exposure);
+	// ret = ams_sensor_write(&poncha110->ams, PONCHA110_BANK_SEL_REG, 1);
+	// ret = ams_sensor_write_be32(&poncha110->ams, PONCHA110_EXP_TIME_L_REG, exposure);
 	// /* Write Bank 1 context 1 */
-	// ret = poncha110_write(poncha110, PONCHA110_CONTEXT_REG, 1);
-	// ret = poncha110_write_be32(poncha110, PONCHA110_EXP_TIME_L_REG, exposure);
+	// ret = ams_sensor_write(&poncha110->ams, PONCHA110_CONTEXT_REG, 1);
+	// ret = ams_sensor_write_be32(&poncha110->ams, PONCHA110_EXP_TIME_L_REG, exposure);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting exposure time to %d", exposure);
@@ -2785,10 +2374,10 @@ static int poncha110_write_exposure_reg(struct poncha110 *poncha110, u32 exposur
 
 	u8 val;
 
-	ret = poncha110_read(poncha110, 0x00E, &val);
+	ret = ams_sensor_read(&poncha110->ams, 0x00E, &val);
 	printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x00E, val);
-	ret = poncha110_read(poncha110, 0x00F, &val);
+	ret = ams_sensor_read(&poncha110->ams, 0x00F, &val);
 	printk(KERN_INFO "[PONCHA110]: Read reg  0x%4.4x, val = 0x%x.\n",
 		   0x00F, val);
 	// if (poncha110->illum_width_auto == 1)
@@ -2811,8 +2400,8 @@ static int poncha110_write_target_frame_time_reg(struct poncha110 *poncha110, u1
 	u32 ret = 0;
 
 	/* Write Bank 1 context 1 */
-	//ret = poncha110_write(poncha110, PONCHA110_CONTEXT_REG, 1);
-	ret = poncha110_write_be16(poncha110, PONCHA110_TARGET_FRAME_TIME_REG, target_frame_time);
+	//ret = ams_sensor_write(&poncha110->ams, PONCHA110_CONTEXT_REG, 1);
+	ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_TARGET_FRAME_TIME_REG, target_frame_time);
 	if (ret)
 	{
 		dev_err_ratelimited(&client->dev, "Error setting target frame time to %d", target_frame_time);
@@ -2833,7 +2422,7 @@ static int poncha110_write_start_streaming_regs(struct poncha110 *poncha110)
 	// {0x0007, 0x01},
 
 	// Raising CMD_REQ_1 to 1 for REQ_EXP
-	ret = poncha110_write(poncha110, 0x0007,
+	ret = ams_sensor_write(&poncha110->ams, 0x0007,
 						0);
 	if (ret)
 	{
@@ -2844,7 +2433,7 @@ static int poncha110_write_start_streaming_regs(struct poncha110 *poncha110)
 	usleep_range(10, 20);
 
 	// Setting CMD_REQ_1 tp 0 for REQ_EXP
-	ret = poncha110_write(poncha110, 0x0007,
+	ret = ams_sensor_write(&poncha110->ams, 0x0007,
 						1);
 	if (ret)
 	{
@@ -2866,27 +2455,64 @@ static int poncha110_write_stop_streaming_regs(struct poncha110 *poncha110)
 	return ret;
 }
 
-// Gets the format code if supported. Otherwise returns the default format code `codes[0]`
+/* Publish a new active mode and format. Caller holds hw_lock. */
+static void poncha110_publish_format(struct poncha110 *poncha110,
+									 const struct poncha110_mode *mode,
+									 const struct v4l2_mbus_framefmt *fmt)
+{
+	write_seqlock(&poncha110->fmt_seqlock);
+	poncha110->mode = mode;
+	poncha110->fmt = *fmt;
+	write_sequnlock(&poncha110->fmt_seqlock);
+}
+
+/* Publish a new vertical window and the format height it gives. Caller holds hw_lock. */
+static void poncha110_publish_window(struct poncha110 *poncha110,
+									 const struct v4l2_rect *crop, u32 ysubs)
+{
+	write_seqlock(&poncha110->fmt_seqlock);
+	poncha110->crop = *crop;
+	poncha110->ysubs = ysubs;
+	poncha110->fmt.height = crop->height / ysubs;
+	write_sequnlock(&poncha110->fmt_seqlock);
+}
+
+/* Read a consistent copy of the active mode, format and window without mutex */
+static void poncha110_read_format(struct poncha110 *poncha110,
+								  const struct poncha110_mode **mode,
+								  struct v4l2_mbus_framefmt *fmt,
+								  struct v4l2_rect *crop)
+{
+	unsigned int seq;
+
+	do
+	{
+		seq = read_seqbegin(&poncha110->fmt_seqlock);
+		*mode = poncha110->mode;
+		*fmt = poncha110->fmt;
+		*crop = poncha110->crop;
+	} while (read_seqretry(&poncha110->fmt_seqlock, seq));
+}
+
+// Gets the format code if supported. Otherwise returns the variant's first code
 static u32 poncha110_validate_format_code_or_default(struct poncha110 *poncha110, u32 code)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
 	unsigned int i;
 	printk(KERN_INFO "[PONCHA110]: validate format code or default. .\n");
 
-	lockdep_assert_held(&poncha110->mutex);
-
-	for (i = 0; i < ARRAY_SIZE(codes); i++)
-		if (codes[i] == code)
+	for (i = 0; i < poncha110->variant->num_codes; i++)
+		if (poncha110->variant->codes[i] == code)
 			break;
 
-	if (i >= ARRAY_SIZE(codes))
+	if (i >= poncha110->variant->num_codes)
 	{
 		dev_err_ratelimited(&client->dev, "Could not set requested format code %u", code);
-		dev_err_ratelimited(&client->dev, "Using default format %u", codes[0]);
+		dev_err_ratelimited(&client->dev, "Using default format %u", poncha110->variant->codes[0]);
 		i = 0;
 	}
 
-	return codes[i];
+	return poncha110->variant->codes[i];
 }
 
 static void poncha110_set_default_format(struct poncha110 *poncha110)
@@ -2906,6 +2532,8 @@ static void poncha110_set_default_format(struct poncha110 *poncha110)
 	fmt->width = supported_modes[0].width;
 	fmt->height = supported_modes[0].height;
 	fmt->field = V4L2_FIELD_NONE;
+	poncha110->crop = supported_modes[0].crop;
+	poncha110->ysubs = 1;
 }
 
 static int poncha110_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
@@ -2917,7 +2545,7 @@ static int poncha110_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 		v4l2_subdev_get_try_format(sd, fh->state, METADATA_PAD);
 	struct v4l2_rect *try_crop;
 
-	mutex_lock(&poncha110->mutex);
+	/* Only the file handle's own try state is touched, mutex is not needed */
 
 	/* Initialize try_fmt for the image pad */
 	try_fmt_img->width = supported_modes[0].width;
@@ -2939,11 +2567,192 @@ static int poncha110_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	try_crop->width = PONCHA110_PIXEL_ARRAY_WIDTH;
 	try_crop->height = PONCHA110_PIXEL_ARRAY_HEIGHT;
 
-	mutex_unlock(&poncha110->mutex);
-
 	return 0;
 }
 
+/* Write the value of a standard control to the sensor */
+static int poncha110_apply_ctrl(struct poncha110 *poncha110, u32 id, s32 val)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
+	u32 target_frame_time;
+	int ret = 0;
+
+	switch (id)
+	{
+	case V4L2_CID_ANALOGUE_GAIN:
+		ret = poncha110_write_analog_gain_reg(poncha110, val);
+		break;
+	case V4L2_CID_EXPOSURE:
+		printk(KERN_INFO "[PONCHA110]: exposure line = %u, exposure us = %u.\n", val, val);
+		ret = poncha110_write_exposure_reg(poncha110, val);
+		break;
+	case V4L2_CID_TEST_PATTERN:
+		// Fixed data is hard coded to 0xAB.
+		ret = ams_sensor_write(&poncha110->ams, PONCHA110_TRAINING_WORD_REG, 0xAB);
+		// Gradient is hard coded to 45 degree.
+		ret = ams_sensor_write(&poncha110->ams, PONCHA110_DELTA_TEST_IMG_REG, 0x01);
+		ret = ams_sensor_write(&poncha110->ams, PONCHA110_TEST_PATTERN_REG,
+							poncha110_test_pattern_val[val]);
+		break;
+	case V4L2_CID_HFLIP:
+		// TODO: HFLIP requires multiple register writes
+		// ret = ams_sensor_write(&poncha110->ams, PONCHA110_HFLIP_REG,
+		//		        val);
+		break;
+	case V4L2_CID_VFLIP:
+		// TODO: VFLIP seems not supported in Poncha110
+		// ret = ams_sensor_write(&poncha110->ams, PONCHA110_VFLIP_REG,
+		//		        val);
+		break;
+	case V4L2_CID_VBLANK:
+		/*
+		 * In libcamera, frame time (== 1/framerate) is controlled by VBLANK:
+		 * TARGET_FRAME_TIME (us) = 1000000 * ((1/PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+VBLANK))
+		 */
+		target_frame_time = poncha110->fmt.height + val;
+		// // Debug print
+		printk(KERN_INFO "[PONCHA110]: poncha110_write_target_frame_time_reg target_frame_time = %u.\n",
+		 	   target_frame_time);
+		// printk(KERN_INFO "[PONCHA110]: width %d, hblank %d, vblank %d, height %d, val %d.\n",
+		// 	   poncha110->mode->width, poncha110->mode->hblank, poncha110->mode->min_vblank, poncha110->mode->height, val);
+		ret = poncha110_write_target_frame_time_reg(poncha110, target_frame_time);
+		break;
+	case V4L2_CID_HBLANK:
+		printk(KERN_INFO "[PONCHA110]: V4L2_CID_HBLANK CALLED = %d.\n",
+			val);
+		break;
+	default:
+		dev_info(&client->dev,
+				 "ctrl(id:0x%x,val:0x%x) is not handled\n",
+				 id, val);
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+/*
+ * Queue a slow control write to the control worker.
+ * A value that is still pending for the same control is replaced.
+ * Returns false if the control is written synchronously.
+ */
+static bool poncha110_defer_ctrl(struct poncha110 *poncha110, struct v4l2_ctrl *ctrl)
+{
+	int idx;
+
+	switch (ctrl->id)
+	{
+	case V4L2_CID_VBLANK:
+		idx = PONCHA110_DEFERRED_VBLANK;
+		break;
+	case V4L2_CID_EXPOSURE:
+		idx = PONCHA110_DEFERRED_EXPOSURE;
+		break;
+	case V4L2_CID_ANALOGUE_GAIN:
+		idx = PONCHA110_DEFERRED_GAIN;
+		break;
+	default:
+		return false;
+	}
+
+	spin_lock(&poncha110->ctrl_pending_lock);
+	poncha110->ctrl_pending_val[idx] = ctrl->val;
+	set_bit(idx, &poncha110->ctrl_pending);
+	spin_unlock(&poncha110->ctrl_pending_lock);
+
+	queue_work(poncha110->ctrl_wq, &poncha110->ctrl_work);
+
+	return true;
+}
+
+/* Program the vertical window. The sensor is powered with the tables uploaded. */
+static int poncha110_write_ywin(struct poncha110 *poncha110,
+								const struct v4l2_rect *crop, u32 ysubs)
+{
+	u32 start = PONCHA110_YWIN_ROW_OFFSET + crop->top;
+	u32 end = start + crop->height + 2 * PONCHA110_YWIN_MARGIN - 1;
+	int ret;
+
+	ret = ams_sensor_write(&poncha110->ams, PONCHA110_CONTEXT_REG, 0);
+	if (!ret)
+		ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_YWIN0_START_REG, start);
+	if (!ret)
+		ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_YWIN0_END_REG, end);
+	if (!ret)
+		ret = ams_sensor_write(&poncha110->ams, PONCHA110_YWIN0_SUBS_REG, ysubs);
+	if (!ret)
+		ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_YWIN0_CROP_OFFSET_REG,
+								   PONCHA110_YWIN_MARGIN / ysubs);
+	if (!ret)
+		ret = ams_sensor_write_be16(&poncha110->ams, PONCHA110_YWIN0_CROP_HEIGHT_REG,
+								   crop->height / ysubs);
+
+	return ret;
+}
+
+/*
+ * Runs without mutex and hw_lock. hw_lock holders flush it without
+ * mutex, set_ctrl flushes it with mutex before a synchronous write.
+ * Controls are only deferred while streaming, when the mode and format
+ * cannot change: set_pad_format refuses ACTIVE formats then, and every
+ * other writer of the mode or the context selects flushes this work
+ * first. A window from set_selection is written here, in order with the
+ * pending controls, and set_selection holds hw_lock until it is done.
+ */
+static void poncha110_ctrl_work(struct work_struct *work)
+{
+	static const u32 ids[PONCHA110_NUM_DEFERRED_CTRLS] = {
+		[PONCHA110_DEFERRED_VBLANK] = V4L2_CID_VBLANK,
+		[PONCHA110_DEFERRED_EXPOSURE] = V4L2_CID_EXPOSURE,
+		[PONCHA110_DEFERRED_GAIN] = V4L2_CID_ANALOGUE_GAIN,
+	};
+	struct poncha110 *poncha110 = container_of(work, struct poncha110, ctrl_work);
+	struct ams_camera_event_ctrl_applied *applied;
+	struct v4l2_event ev = {
+		.type = AMS_CAMERA_EVENT_CTRL_APPLIED,
+	};
+	s32 vals[PONCHA110_NUM_DEFERRED_CTRLS];
+	unsigned long pending;
+	int i;
+
+	spin_lock(&poncha110->ctrl_pending_lock);
+	pending = poncha110->ctrl_pending;
+	poncha110->ctrl_pending = 0;
+	memcpy(vals, poncha110->ctrl_pending_val, sizeof(vals));
+	spin_unlock(&poncha110->ctrl_pending_lock);
+
+	if (!pending)
+		return;
+
+	if (pending & BIT(PONCHA110_PENDING_WINDOW))
+		poncha110->window_ret = poncha110_write_ywin(poncha110, &poncha110->crop,
+													 poncha110->ysubs);
+
+	applied = (struct ams_camera_event_ctrl_applied *)ev.u.data;
+	for (i = 0; i < PONCHA110_NUM_DEFERRED_CTRLS; i++)
+	{
+		if (!(pending & BIT(i)))
+			continue;
+		applied->ctrls[applied->count].id = ids[i];
+		applied->ctrls[applied->count].value = vals[i];
+		applied->ctrls[applied->count].status = poncha110_apply_ctrl(poncha110, ids[i], vals[i]);
+		applied->count++;
+	}
+	/* Only a window was written */
+	if (!applied->count)
+		return;
+	applied->seq = ++poncha110->ctrl_applied_seq;
+
+	v4l2_subdev_notify_event(&poncha110->sd, &ev);
+}
+
+/* Wait until the control worker has written all pending values */
+static void poncha110_flush_ctrl_work(struct poncha110 *poncha110)
+{
+	flush_work(&poncha110->ctrl_work);
+}
+
 static int poncha110_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct poncha110 *poncha110 =
@@ -2952,6 +2761,23 @@ static int poncha110_set_ctrl(struct v4l2_ctrl *ctrl)
 	int ret = 0;
 	// u32 target_frame_time_us;
 
+	if (ctrl->id == AMS_CAMERA_CID_ANALOG_GAIN_LINEAR)
+		return ams_sensor_gain_linear_s_ctrl(&poncha110->ams, ctrl);
+
+	if (ctrl->id == V4L2_CID_ANALOGUE_GAIN)
+	{
+		ret = ams_sensor_gain_linear_sync(&poncha110->ams);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * The running hardware sequence writes all control values
+	 * with __v4l2_ctrl_handler_setup() once the tables are uploaded.
+	 */
+	if (poncha110->hw_busy)
+		return 0;
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -2966,58 +2792,15 @@ static int poncha110_set_ctrl(struct v4l2_ctrl *ctrl)
 
 	if (poncha110->skip_reg_upload == 0)
 	{
-		switch (ctrl->id)
+		/*
+		 * While streaming, slow writes are done by the control worker
+		 * and AMS_CAMERA_EVENT_CTRL_APPLIED reports when they are applied.
+		 */
+		if (!poncha110->streaming || !poncha110_defer_ctrl(poncha110, ctrl))
 		{
-		case V4L2_CID_ANALOGUE_GAIN:
-			ret = poncha110_write_analog_gain_reg(poncha110, ctrl->val);
-
-			printk(KERN_INFO "[PONCHA110]: exposure line = %u, exposure us = %u.\n", ctrl->val, ctrl->val);
-			break;
-		case V4L2_CID_EXPOSURE:
-			printk(KERN_INFO "[PONCHA110]: exposure line = %u, exposure us = %u.\n", ctrl->val, ctrl->val);
-			ret = poncha110_write_exposure_reg(poncha110, ctrl->val);
-			break;
-		case V4L2_CID_TEST_PATTERN:
-			// Fixed data is hard coded to 0xAB.
-			ret = poncha110_write(poncha110, PONCHA110_TRAINING_WORD_REG, 0xAB);
-			// Gradient is hard coded to 45 degree.
-			ret = poncha110_write(poncha110, PONCHA110_DELTA_TEST_IMG_REG, 0x01);
-			ret = poncha110_write(poncha110, PONCHA110_TEST_PATTERN_REG,
-								poncha110_test_pattern_val[ctrl->val]);
-			break;
-		case V4L2_CID_HFLIP:
-			// TODO: HFLIP requires multiple register writes
-			// ret = poncha110_write(poncha110, PONCHA110_HFLIP_REG,
-			//		        ctrl->val);
-			break;
-		case V4L2_CID_VFLIP:
-			// TODO: VFLIP seems not supported in Poncha110
-			// ret = poncha110_write(poncha110, PONCHA110_VFLIP_REG,
-			//		        ctrl->val);
-			break;
-		case V4L2_CID_VBLANK:
-			/*
-			 * In libcamera, frame time (== 1/framerate) is controlled by VBLANK:
-			 * TARGET_FRAME_TIME (us) = 1000000 * ((1/PIXEL_RATE)*(WIDTH+HBLANK)*(HEIGHT+VBLANK))
-			 */
-			poncha110->target_frame_time = poncha110->mode->height + ctrl->val;
-			// // Debug print
-			printk(KERN_INFO "[PONCHA110]: poncha110_write_target_frame_time_reg target_frame_time = %u.\n",
-			 	   poncha110->target_frame_time);
-			// printk(KERN_INFO "[PONCHA110]: width %d, hblank %d, vblank %d, height %d, ctrl->val %d.\n",
-			// 	   poncha110->mode->width, poncha110->mode->hblank, poncha110->mode->min_vblank, poncha110->mode->height, ctrl->val);
-			ret = poncha110_write_target_frame_time_reg(poncha110, poncha110->target_frame_time);
-			break;
-		case V4L2_CID_HBLANK:
-			printk(KERN_INFO "[PONCHA110]: V4L2_CID_HBLANK CALLED = %d.\n",
-				ctrl->val);
-			break;
-		default:
-			dev_info(&client->dev,
-					 "ctrl(id:0x%x,val:0x%x) is not handled\n",
-					 ctrl->id, ctrl->val);
-			ret = -EINVAL;
-			break;
+			/* Keep register accesses ordered with the control worker */
+			poncha110_flush_ctrl_work(poncha110);
+			ret = poncha110_apply_ctrl(poncha110, ctrl->id, ctrl->val);
 		}
 	}
 
@@ -3043,10 +2826,16 @@ static int poncha110_s_ctrl(struct v4l2_ctrl *ctrl)
 	 * Users need to make sure first power on then write register.
 	 */
 
+	/* Raw accesses would interleave with the table upload */
+	if (poncha110->hw_busy)
+		return -EBUSY;
+
+	poncha110_flush_ctrl_work(poncha110);
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_W:
-		ret = poncha110_v4l2_reg_w(poncha110, ctrl->val);
+		ret = ams_sensor_reg_w(&poncha110->ams, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -3076,10 +2865,15 @@ static int poncha110_g_ctrl(struct v4l2_ctrl *ctrl)
 	 * Therefore, the check of "powered" flag is disabled for now.
 	 */
 
+	if (poncha110->hw_busy)
+		return -EBUSY;
+
+	poncha110_flush_ctrl_work(poncha110);
+
 	switch (ctrl->id)
 	{
 	case AMS_CAMERA_CID_MIRA_REG_R:
-		ret = poncha110_v4l2_reg_r(poncha110, (u32 *)&ctrl->cur.val);
+		ret = ams_sensor_reg_r(&poncha110->ams, (u32 *)&ctrl->cur.val);
 		ctrl->val = ctrl->cur.val;
 		break;
 	default:
@@ -3128,6 +2922,46 @@ static struct v4l2_ctrl_config custom_ctrl_config_list[] = {
 		.def = 0,
 		.step = 1,
 	},
+	{
+		.id = AMS_CAMERA_CID_EXPOSURE_DELAY,
+		.name = "exposure_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = PONCHA110_EXPOSURE_DELAY,
+		.max = PONCHA110_EXPOSURE_DELAY,
+		.def = PONCHA110_EXPOSURE_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_GAIN_DELAY,
+		.name = "gain_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = PONCHA110_GAIN_DELAY,
+		.max = PONCHA110_GAIN_DELAY,
+		.def = PONCHA110_GAIN_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_VBLANK_DELAY,
+		.name = "vblank_delay",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = PONCHA110_VBLANK_DELAY,
+		.max = PONCHA110_VBLANK_DELAY,
+		.def = PONCHA110_VBLANK_DELAY,
+		.step = 1,
+	},
+	{
+		.id = AMS_CAMERA_CID_STARTUP_FRAMES,
+		.name = "startup_frames",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+		.min = PONCHA110_STARTUP_FRAMES,
+		.max = PONCHA110_STARTUP_FRAMES,
+		.def = PONCHA110_STARTUP_FRAMES,
+		.step = 1,
+	},
 
 };
 
@@ -3144,11 +2978,11 @@ static int poncha110_enum_mbus_code(struct v4l2_subdev *sd,
 
 	if (code->pad == IMAGE_PAD)
 	{
-		if (code->index >= ARRAY_SIZE(codes))
+		if (code->index >= poncha110->variant->num_codes)
 			return -EINVAL;
 
 		code->code = poncha110_validate_format_code_or_default(poncha110,
-															 codes[code->index]);
+															 poncha110->variant->codes[code->index]);
 	}
 	else
 	{
@@ -3249,10 +3083,16 @@ static int __poncha110_get_pad_format(struct poncha110 *poncha110,
 	{
 		if (fmt->pad == IMAGE_PAD)
 		{
-			poncha110_update_image_pad_format(poncha110, poncha110->mode,
-											fmt);
+			const struct poncha110_mode *mode;
+			struct v4l2_mbus_framefmt active;
+			struct v4l2_rect crop;
+
+			poncha110_read_format(poncha110, &mode, &active, &crop);
+			poncha110_update_image_pad_format(poncha110, mode, fmt);
+			/* Rows of the vertical window after subsampling */
+			fmt->format.height = active.height;
 			fmt->format.code = poncha110_validate_format_code_or_default(poncha110,
-																	   poncha110->fmt.code);
+																	   active.code);
 		}
 		else
 		{
@@ -3268,14 +3108,9 @@ static int poncha110_get_pad_format(struct v4l2_subdev *sd,
 								  struct v4l2_subdev_format *fmt)
 {
 	struct poncha110 *poncha110 = to_poncha110(sd);
-	int ret;
-	printk(KERN_INFO "[PONCHA110]: poncha110_get_pad_format\n");
-
-	mutex_lock(&poncha110->mutex);
-	ret = __poncha110_get_pad_format(poncha110, sd_state, fmt);
-	mutex_unlock(&poncha110->mutex);
 
-	return ret;
+	/* Lockless: ACTIVE reads the published snapshot, TRY is per file handle */
+	return __poncha110_get_pad_format(poncha110, sd_state, fmt);
 }
 
 static int poncha110_set_pad_format(struct v4l2_subdev *sd,
@@ -3294,7 +3129,20 @@ static int poncha110_set_pad_format(struct v4l2_subdev *sd,
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
 
-	mutex_lock(&poncha110->mutex);
+	/* TRY formats live in the file handle state and need no locking */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		mutex_lock(&poncha110->hw_lock);
+		mutex_lock(&poncha110->mutex);
+
+		/* Buffers and the control worker use the mode while streaming */
+		if (poncha110->streaming)
+		{
+			mutex_unlock(&poncha110->mutex);
+			mutex_unlock(&poncha110->hw_lock);
+			return -EBUSY;
+		}
+	}
 
 	if (fmt->pad == IMAGE_PAD)
 	{
@@ -3333,9 +3181,12 @@ static int poncha110_set_pad_format(struct v4l2_subdev *sd,
 			framefmt = v4l2_subdev_get_try_format(sd, sd_state,
 												  fmt->pad);
 			*framefmt = fmt->format;
+			*v4l2_subdev_get_try_crop(sd, sd_state, fmt->pad) = mode->crop;
 		}
 		else if (poncha110->mode != mode ||
-				 poncha110->fmt.code != fmt->format.code)
+				 poncha110->fmt.code != fmt->format.code ||
+				 poncha110->ysubs != 1 ||
+				 !v4l2_rect_equal(&poncha110->crop, &mode->crop))
 		{
 			printk(KERN_INFO "[PONCHA110]: Poncha110 bitdepth  = %d.   \n", poncha110->mode->bit_depth);
 
@@ -3343,8 +3194,10 @@ static int poncha110_set_pad_format(struct v4l2_subdev *sd,
 			printk(KERN_INFO "[PONCHA110]: Poncha110 fmt  = %d.   fmt is %d \n", poncha110->fmt.code, fmt->format.code);
 			printk(KERN_INFO "[PONCHA110]: Poncha110 width  = %d.   height is %d \n", poncha110->mode->width, poncha110->mode->height);
 
-			poncha110->fmt = fmt->format;
-			poncha110->mode = mode;
+			/* No control write may see half of the new mode */
+			poncha110_flush_ctrl_work(poncha110);
+			poncha110_publish_format(poncha110, mode, &fmt->format);
+			poncha110_publish_window(poncha110, &mode->crop, 1);
 
 			// Update controls based on new mode (range and current value).
 			// max_exposure = poncha110_calculate_max_exposure_time(PONCHA110_MIN_ROW_LENGTH,
@@ -3371,6 +3224,9 @@ static int poncha110_set_pad_format(struct v4l2_subdev *sd,
 										  poncha110->mode->gain_max,
 										  1,
 										  0);
+			if (!rc)
+				rc = ams_sensor_gain_linear_update(&poncha110->ams,
+												   poncha110->ams.gain_linear->val);
 			if (rc)
 			{
 				dev_err(&client->dev, "Error setting gain range");
@@ -3424,7 +3280,11 @@ static int poncha110_set_pad_format(struct v4l2_subdev *sd,
 		}
 	}
 
-	mutex_unlock(&poncha110->mutex);
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+	{
+		mutex_unlock(&poncha110->mutex);
+		mutex_unlock(&poncha110->hw_lock);
+	}
 
 	return 0;
 }
@@ -3447,38 +3307,67 @@ static int poncha110_set_framefmt(struct poncha110 *poncha110)
 	return -EINVAL;
 }
 
-static const struct v4l2_rect *
-__poncha110_get_pad_crop(struct poncha110 *poncha110, struct v4l2_subdev_state *sd_state,
-					   unsigned int pad, enum v4l2_subdev_format_whence which)
+/* Window and output size (compose) of the image pad */
+static void
+__poncha110_get_pad_window(struct poncha110 *poncha110, struct v4l2_subdev_state *sd_state,
+						   unsigned int pad, enum v4l2_subdev_format_whence which,
+						   struct v4l2_rect *crop, struct v4l2_rect *compose)
 {
+	struct v4l2_mbus_framefmt fmt;
+
 	switch (which)
 	{
 	case V4L2_SUBDEV_FORMAT_TRY:
-		return v4l2_subdev_get_try_crop(&poncha110->sd, sd_state, pad);
+		*crop = *v4l2_subdev_get_try_crop(&poncha110->sd, sd_state, pad);
+		fmt = *v4l2_subdev_get_try_format(&poncha110->sd, sd_state, pad);
+		break;
 	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &poncha110->mode->crop;
+	default:
+	{
+		const struct poncha110_mode *mode;
+
+		poncha110_read_format(poncha110, &mode, &fmt, crop);
+		break;
+	}
 	}
 
-	return NULL;
+	compose->left = 0;
+	compose->top = 0;
+	compose->width = crop->width;
+	compose->height = fmt.height;
 }
 
 static int poncha110_get_selection(struct v4l2_subdev *sd,
 								 struct v4l2_subdev_state *sd_state,
 								 struct v4l2_subdev_selection *sel)
 {
+	struct poncha110 *poncha110 = to_poncha110(sd);
+	struct v4l2_rect crop, compose;
+
 	switch (sel->target)
 	{
 	case V4L2_SEL_TGT_CROP:
-	{
-		struct poncha110 *poncha110 = to_poncha110(sd);
+		__poncha110_get_pad_window(poncha110, sd_state, sel->pad, sel->which,
+								   &sel->r, &compose);
 
-		mutex_lock(&poncha110->mutex);
-		sel->r = *__poncha110_get_pad_crop(poncha110, sd_state, sel->pad,
-										 sel->which);
-		mutex_unlock(&poncha110->mutex);
+		return 0;
+
+	case V4L2_SEL_TGT_COMPOSE:
+		__poncha110_get_pad_window(poncha110, sd_state, sel->pad, sel->which,
+								   &crop, &sel->r);
+
+		return 0;
+
+	case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+	case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+		__poncha110_get_pad_window(poncha110, sd_state, sel->pad, sel->which,
+								   &crop, &compose);
+		sel->r.top = 0;
+		sel->r.left = 0;
+		sel->r.width = crop.width;
+		sel->r.height = crop.height;
 
 		return 0;
-	}
 
 	case V4L2_SEL_TGT_NATIVE_SIZE:
 		sel->r.top = 0;
@@ -3501,6 +3390,138 @@ static int poncha110_get_selection(struct v4l2_subdev *sd,
 	return -EINVAL;
 }
 
+/* Full width window of aligned rows within the pixel array */
+static void poncha110_adjust_ywin(const struct v4l2_rect *req, struct v4l2_rect *crop)
+{
+	crop->left = PONCHA110_PIXEL_ARRAY_LEFT;
+	crop->width = PONCHA110_PIXEL_ARRAY_WIDTH;
+	crop->height = clamp_t(u32, round_down(req->height, PONCHA110_YWIN_ALIGN),
+						   PONCHA110_YWIN_MIN_HEIGHT, PONCHA110_PIXEL_ARRAY_HEIGHT);
+	crop->top = clamp_t(s32, round_down(req->top, PONCHA110_YWIN_ALIGN),
+						PONCHA110_PIXEL_ARRAY_TOP,
+						PONCHA110_PIXEL_ARRAY_TOP + PONCHA110_PIXEL_ARRAY_HEIGHT - crop->height);
+}
+
+/* Subsampling closest to crop_height / height that gives whole row pairs */
+static u32 poncha110_ywin_subs(u32 crop_height, u32 height)
+{
+	u32 subs = height ? DIV_ROUND_CLOSEST(crop_height, height) : 1;
+
+	subs = clamp_t(u32, subs, 1, PONCHA110_YWIN_MAX_SUBS);
+	while (subs > 1 && crop_height % (subs * PONCHA110_YWIN_ALIGN))
+		subs--;
+
+	return subs;
+}
+
+/*
+ * CROP sets the vertical window (YWIN0) and resets the subsampling.
+ * COMPOSE sets the output height, which selects the row subsampling
+ * (YWIN0_SUBS_FACTOR). TARGET_FRAME_TIME counts (height + VBLANK) rows,
+ * so a smaller window raises the frame rate at the same VBLANK. While
+ * streaming the window can only move, its registers are then written
+ * without a table upload.
+ */
+static int poncha110_set_selection(struct v4l2_subdev *sd,
+								   struct v4l2_subdev_state *sd_state,
+								   struct v4l2_subdev_selection *sel)
+{
+	struct poncha110 *poncha110 = to_poncha110(sd);
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct v4l2_mbus_framefmt *try_fmt;
+	struct v4l2_rect crop, compose;
+	bool write = false;
+	u32 ysubs;
+	int ret = 0;
+
+	if (sel->pad != IMAGE_PAD ||
+		(sel->target != V4L2_SEL_TGT_CROP && sel->target != V4L2_SEL_TGT_COMPOSE))
+		return -EINVAL;
+
+	/* TRY windows live in the file handle state and need no locking */
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY)
+	{
+		crop = *v4l2_subdev_get_try_crop(sd, sd_state, sel->pad);
+		if (sel->target == V4L2_SEL_TGT_CROP)
+		{
+			poncha110_adjust_ywin(&sel->r, &crop);
+			ysubs = 1;
+		}
+		else
+		{
+			ysubs = poncha110_ywin_subs(crop.height, sel->r.height);
+		}
+		*v4l2_subdev_get_try_crop(sd, sd_state, sel->pad) = crop;
+		try_fmt = v4l2_subdev_get_try_format(sd, sd_state, sel->pad);
+		try_fmt->width = crop.width;
+		try_fmt->height = crop.height / ysubs;
+		__poncha110_get_pad_window(poncha110, sd_state, sel->pad, sel->which,
+								   &crop, &compose);
+		sel->r = sel->target == V4L2_SEL_TGT_CROP ? crop : compose;
+		return 0;
+	}
+
+	mutex_lock(&poncha110->hw_lock);
+	mutex_lock(&poncha110->mutex);
+
+	crop = poncha110->crop;
+	ysubs = poncha110->ysubs;
+	if (sel->target == V4L2_SEL_TGT_CROP)
+	{
+		poncha110_adjust_ywin(&sel->r, &crop);
+		if (!poncha110->streaming)
+			ysubs = 1;
+	}
+	else
+	{
+		ysubs = poncha110_ywin_subs(crop.height, sel->r.height);
+	}
+
+	/* Buffers are sized for the current window while streaming */
+	if (poncha110->streaming &&
+		(crop.height != poncha110->crop.height || ysubs != poncha110->ysubs))
+	{
+		ret = -EBUSY;
+		goto out;
+	}
+
+	printk(KERN_INFO "[PONCHA110]: poncha110_set_selection() %u rows at %d, subsampling %u.\n",
+		   crop.height, crop.top, ysubs);
+	poncha110_publish_window(poncha110, &crop, ysubs);
+
+	/*
+	 * The control worker writes the window, in order with the pending
+	 * controls. Otherwise it is written at the next stream on.
+	 */
+	if (poncha110->streaming && poncha110->skip_reg_upload == 0)
+	{
+		spin_lock(&poncha110->ctrl_pending_lock);
+		set_bit(PONCHA110_PENDING_WINDOW, &poncha110->ctrl_pending);
+		spin_unlock(&poncha110->ctrl_pending_lock);
+		queue_work(poncha110->ctrl_wq, &poncha110->ctrl_work);
+		write = true;
+	}
+
+out:
+	__poncha110_get_pad_window(poncha110, sd_state, sel->pad, sel->which,
+							   &crop, &compose);
+	sel->r = sel->target == V4L2_SEL_TGT_CROP ? crop : compose;
+	mutex_unlock(&poncha110->mutex);
+
+	/* Wait for the window write with hw_lock only, controls stay readable */
+	if (write)
+	{
+		poncha110_flush_ctrl_work(poncha110);
+		ret = poncha110->window_ret;
+		if (ret)
+			dev_err(&client->dev, "%s failed to set window\n", __func__);
+	}
+
+	mutex_unlock(&poncha110->hw_lock);
+
+	return ret;
+}
+
 /*
  * Read OTP memory: 8-bit addr and 32-bit value
  * 0x1000,TRIM_VAL_VDD38,[0:2],TRIM_VAL_VDD28,[3:5],TRIM_VAL_VSS1N,[6:7]
@@ -3558,12 +3579,12 @@ static int poncha110_otp_calibration(struct poncha110 *poncha110)
 
 	printk(KERN_INFO "[PONCHA110]: OTP vdac set 0 %x 1 %x 2 %x 3 %x vss16n %x  \n", vdac_set0, vdac_set1, vdac_set2, vdac_set3, vss16n);
 
-	ret = poncha110_write(poncha110, 0x01EC, vss16n - 3); // Write VSS16N value minus 3
-	ret = poncha110_write(poncha110, 0x01E2, 72); // Write TRIM_SEL value, for vss16n and vdacset override
-	ret = poncha110_write(poncha110, 0x0214,vdac_set0); // Write vdac_set0 value
-	ret = poncha110_write(poncha110, 0x0215,vdac_set1); // Write vdac_set1 value
-	ret = poncha110_write(poncha110, 0x0216,vdac_set3+1); // Write vdac_set2 value
-	ret = poncha110_write(poncha110, 0x0217,vdac_set3); // Write vdac_set3 value
+	ret = ams_sensor_write(&poncha110->ams, 0x01EC, vss16n - 3); // Write VSS16N value minus 3
+	ret = ams_sensor_write(&poncha110->ams, 0x01E2, 72); // Write TRIM_SEL value, for vss16n and vdacset override
+	ret = ams_sensor_write(&poncha110->ams, 0x0214,vdac_set0); // Write vdac_set0 value
+	ret = ams_sensor_write(&poncha110->ams, 0x0215,vdac_set1); // Write vdac_set1 value
+	ret = ams_sensor_write(&poncha110->ams, 0x0216,vdac_set3+1); // Write vdac_set2 value
+	ret = ams_sensor_write(&poncha110->ams, 0x0217,vdac_set3); // Write vdac_set3 value
 
 
 
@@ -3573,6 +3594,8 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&poncha110->sd);
 	const struct poncha110_reg_list *reg_list;
+	struct v4l2_rect crop;
+	u32 ysubs;
 	u8 otp_cal_val;
 	int ret;
 
@@ -3589,7 +3612,13 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 	}
 
 	/* Set current mode according to frame format bit depth */
+	mutex_lock(&poncha110->mutex);
 	ret = poncha110_set_framefmt(poncha110);
+	if (!ret)
+		poncha110->hw_busy = true;
+	crop = poncha110->crop;
+	ysubs = poncha110->ysubs;
+	mutex_unlock(&poncha110->mutex);
 	if (ret)
 	{
 		dev_err(&client->dev, "%s failed to set frame format: %d\n",
@@ -3604,14 +3633,23 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 		/* Apply pre soft reset default values of current mode */
 		reg_list = &poncha110->mode->reg_list_pre_soft_reset;
 		printk(KERN_INFO "[PONCHA110]: Write %d regs.\n", reg_list->num_of_regs);
-		ret = poncha110_write_regs(poncha110, reg_list->regs, reg_list->num_of_regs);
+		ret = ams_sensor_write_regs(&poncha110->ams, reg_list->regs, reg_list->num_of_regs);
 		if (ret)
 		{
 			dev_err(&client->dev, "%s failed to set mode\n", __func__);
-			goto err_rpm_put;
+			goto err_busy;
 		}
 
-
+		/* Window set with set_selection replaces the one of the tables */
+		if (ysubs != 1 || !v4l2_rect_equal(&crop, &poncha110->mode->crop))
+		{
+			ret = poncha110_write_ywin(poncha110, &crop, ysubs);
+			if (ret)
+			{
+				dev_err(&client->dev, "%s failed to set window\n", __func__);
+				goto err_busy;
+			}
+		}
 	}
 	else
 	{
@@ -3620,16 +3658,21 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 
 	printk(KERN_INFO "[PONCHA110]: Entering v4l2 ctrl handler setup function.\n");
 
-	/* Apply customized values from user */
+	/*
+	 * Apply customized values from user. Control writes that came in
+	 * during the upload were cached and are written here.
+	 */
+	mutex_lock(&poncha110->mutex);
+	poncha110->hw_busy = false;
 	ret = __v4l2_ctrl_handler_setup(poncha110->sd.ctrl_handler);
 	printk(KERN_INFO "[PONCHA110]: __v4l2_ctrl_handler_setup ret = %d.\n", ret);
 	if (ret)
-		goto err_rpm_put;
+		goto err_unlock;
 
 	ret = poncha110_otp_calibration(poncha110);
 	printk(KERN_INFO "[PONCHA110]: OTP CAL STATUS = %d.\n", ret);
 	if (ret)
-		goto err_rpm_put;
+		goto err_unlock;
 
 	if (poncha110->skip_reg_upload == 0 ||
 		(poncha110->skip_reg_upload == 1 && poncha110->force_stream_ctrl == 1))
@@ -3639,7 +3682,7 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 		if (ret)
 		{
 			dev_err(&client->dev, "Could not write stream-on sequence");
-			goto err_rpm_put;
+			goto err_unlock;
 		}
 	}
 	else
@@ -3655,9 +3698,15 @@ static int poncha110_start_streaming(struct poncha110 *poncha110)
 	__v4l2_ctrl_grab(poncha110->hflip, true);
 
 	// poncha110_write_illum_trig_regs(poncha110);
+	mutex_unlock(&poncha110->mutex);
 
 	return 0;
 
+err_busy:
+	mutex_lock(&poncha110->mutex);
+	poncha110->hw_busy = false;
+err_unlock:
+	mutex_unlock(&poncha110->mutex);
 err_rpm_put:
 	pm_runtime_put(&client->dev);
 	return ret;
@@ -3669,8 +3718,14 @@ static void poncha110_stop_streaming(struct poncha110 *poncha110)
 	int ret = 0;
 
 	/* Unlock controls for vflip and hflip */
+	mutex_lock(&poncha110->mutex);
 	__v4l2_ctrl_grab(poncha110->vflip, false);
 	__v4l2_ctrl_grab(poncha110->hflip, false);
+	poncha110->hw_busy = true;
+	mutex_unlock(&poncha110->mutex);
+
+	/* Let the control worker finish before the sensor stops */
+	poncha110_flush_ctrl_work(poncha110);
 
 	if (poncha110->skip_reset == 0)
 	{
@@ -3696,6 +3751,10 @@ static void poncha110_stop_streaming(struct poncha110 *poncha110)
 	}
 
 	pm_runtime_put(&client->dev);
+
+	mutex_lock(&poncha110->mutex);
+	poncha110->hw_busy = false;
+	mutex_unlock(&poncha110->mutex);
 }
 
 static int poncha110_set_stream(struct v4l2_subdev *sd, int enable)
@@ -3703,15 +3762,27 @@ static int poncha110_set_stream(struct v4l2_subdev *sd, int enable)
 	struct poncha110 *poncha110 = to_poncha110(sd);
 	int ret = 0;
 
+	/*
+	 * The sequence runs under hw_lock. mutex is only taken for the
+	 * short state updates, so queries and control reads do not wait
+	 * for the power-on and the register table upload.
+	 */
+	mutex_lock(&poncha110->hw_lock);
 	mutex_lock(&poncha110->mutex);
 	if (poncha110->streaming == enable)
 	{
 		mutex_unlock(&poncha110->mutex);
+		mutex_unlock(&poncha110->hw_lock);
 		return 0;
 	}
 
 	printk(KERN_INFO "[PONCHA110]: Entering poncha110_set_stream enable: %d.\n", enable);
 
+	/* Control writes are synchronous again once stop begins */
+	if (!enable)
+		poncha110->streaming = false;
+	mutex_unlock(&poncha110->mutex);
+
 	if (enable)
 	{
 		/*
@@ -3721,22 +3792,24 @@ static int poncha110_set_stream(struct v4l2_subdev *sd, int enable)
 		ret = poncha110_start_streaming(poncha110);
 		if (ret)
 			goto err_unlock;
+
+		mutex_lock(&poncha110->mutex);
+		poncha110->streaming = true;
+		mutex_unlock(&poncha110->mutex);
 	}
 	else
 	{
 		poncha110_stop_streaming(poncha110);
 	}
 
-	poncha110->streaming = enable;
-
-	mutex_unlock(&poncha110->mutex);
+	mutex_unlock(&poncha110->hw_lock);
 
 	printk(KERN_INFO "[PONCHA110]: Returning poncha110_set_stream with ret: %d.\n", ret);
 
 	return ret;
 
 err_unlock:
-	mutex_unlock(&poncha110->mutex);
+	mutex_unlock(&poncha110->hw_lock);
 
 	return ret;
 }
@@ -3749,8 +3822,10 @@ static int __maybe_unused poncha110_suspend(struct device *dev)
 
 	printk(KERN_INFO "[PONCHA110]: Entering suspend function.\n");
 
+	mutex_lock(&poncha110->hw_lock);
 	if (poncha110->streaming)
 		poncha110_stop_streaming(poncha110);
+	mutex_unlock(&poncha110->hw_lock);
 
 	return 0;
 }
@@ -3764,18 +3839,22 @@ static int __maybe_unused poncha110_resume(struct device *dev)
 
 	printk(KERN_INFO "[PONCHA110]: Entering resume function.\n");
 
+	mutex_lock(&poncha110->hw_lock);
 	if (poncha110->streaming)
 	{
 		ret = poncha110_start_streaming(poncha110);
 		if (ret)
 			goto error;
 	}
+	mutex_unlock(&poncha110->hw_lock);
 
 	return 0;
 
 error:
-	poncha110_stop_streaming(poncha110);
+	mutex_lock(&poncha110->mutex);
 	poncha110->streaming = false;
+	mutex_unlock(&poncha110->mutex);
+	mutex_unlock(&poncha110->hw_lock);
 
 	return ret;
 }
@@ -3799,21 +3878,30 @@ static int poncha110_identify_module(struct poncha110 *poncha110)
 	int ret;
 	u8 val;
 
-	ret = poncha110_read(poncha110, 0x25, &val);
+	ret = ams_sensor_read(&poncha110->ams, 0x25, &val);
 	printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x25, val);
-	ret = poncha110_read(poncha110, 0x3, &val);
+	ret = ams_sensor_read(&poncha110->ams, 0x3, &val);
 	printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x3, val);
-	ret = poncha110_read(poncha110, 0x4, &val);
+	ret = ams_sensor_read(&poncha110->ams, 0x4, &val);
 	printk(KERN_INFO "[PONCHA110]: Read reg 0x%4.4x, val = 0x%x.\n",
 		   0x4, val);
 
 	return 0;
 }
 
+static int poncha110_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+								   struct v4l2_event_subscription *sub)
+{
+	if (sub->type == AMS_CAMERA_EVENT_CTRL_APPLIED)
+		return v4l2_event_subscribe(fh, sub, PONCHA110_CTRL_APPLIED_EVENTS, NULL);
+
+	return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+}
+
 static const struct v4l2_subdev_core_ops poncha110_core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+	.subscribe_event = poncha110_subscribe_event,
 	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
@@ -3826,6 +3914,7 @@ static const struct v4l2_subdev_pad_ops poncha110_pad_ops = {
 	.get_fmt = poncha110_get_pad_format,
 	.set_fmt = poncha110_set_pad_format,
 	.get_selection = poncha110_get_selection,
+	.set_selection = poncha110_set_selection,
 	.enum_frame_size = poncha110_enum_frame_size,
 };
 
@@ -3848,10 +3937,11 @@ static int poncha110_init_controls(struct poncha110 *poncha110)
 	int ret;
 	struct v4l2_ctrl_config *mira_reg_w;
 	struct v4l2_ctrl_config *mira_reg_r;
+	unsigned int i;
 
 	ctrl_hdlr = &poncha110->ctrl_handler;
 	/* v4l2_ctrl_handler_init gives a hint/guess of the number of v4l2_ctrl_new */
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 21);
 	if (ret)
 		return ret;
 
@@ -3867,6 +3957,18 @@ static int poncha110_init_controls(struct poncha110 *poncha110)
 											PONCHA110_PIXEL_RATE, 1,
 											PONCHA110_PIXEL_RATE);
 
+	/* Limited to the rates listed in DT */
+	poncha110->link_freq = v4l2_ctrl_new_int_menu(ctrl_hdlr, &poncha110_ctrl_ops,
+												  V4L2_CID_LINK_FREQ,
+												  ARRAY_SIZE(link_freq_menu) - 1,
+												  __ffs(poncha110->link_freq_mask),
+												  link_freq_menu);
+	if (poncha110->link_freq)
+	{
+		poncha110->link_freq->menu_skip_mask = ~poncha110->link_freq_mask;
+		poncha110->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	}
+
 	printk(KERN_INFO "[PONCHA110]: %s V4L2_CID_VBLANK %X.\n", __func__, V4L2_CID_VBLANK);
 
 	poncha110->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &poncha110_ctrl_ops,
@@ -3900,6 +4002,8 @@ static int poncha110_init_controls(struct poncha110 *poncha110)
 	poncha110->gain = v4l2_ctrl_new_std(ctrl_hdlr, &poncha110_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
 									  PONCHA110_ANALOG_GAIN_MIN, PONCHA110_ANALOG_GAIN_MAX,
 									  PONCHA110_ANALOG_GAIN_STEP, PONCHA110_ANALOG_GAIN_DEFAULT);
+	ams_sensor_gain_linear_init(&poncha110->ams, ctrl_hdlr, &poncha110_ctrl_ops,
+								poncha110->gain);
 
 	printk(KERN_INFO "[PONCHA110]: %s V4L2_CID_HFLIP %X.\n", __func__, V4L2_CID_HFLIP);
 
@@ -3933,6 +4037,10 @@ static int poncha110_init_controls(struct poncha110 *poncha110)
 	if (poncha110->mira_reg_r)
 		poncha110->mira_reg_r->flags |= (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_READ_ONLY);
 
+	/* Control delays and startup frames, read-only */
+	for (i = 2; i < ARRAY_SIZE(custom_ctrl_config_list); i++)
+		v4l2_ctrl_new_custom(ctrl_hdlr, &custom_ctrl_config_list[i], NULL);
+
 	if (ctrl_hdlr->error)
 	{
 		ret = ctrl_hdlr->error;
@@ -3967,11 +4075,12 @@ static void poncha110_free_controls(struct poncha110 *poncha110)
 	mutex_destroy(&poncha110->mutex);
 }
 
-static int poncha110_check_hwcfg(struct device *dev)
+static int poncha110_check_hwcfg(struct device *dev, struct poncha110 *poncha110)
 {
 	struct fwnode_handle *endpoint;
 	struct v4l2_fwnode_endpoint ep_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY};
+	unsigned int i, j;
 	int ret = -EINVAL;
 
 	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -3994,11 +4103,25 @@ static int poncha110_check_hwcfg(struct device *dev)
 		goto error_out;
 	}
 
-	if (ep_cfg.nr_of_link_frequencies != 1 ||
-		ep_cfg.link_frequencies[0] != PONCHA110_DEFAULT_LINK_FREQ)
+	poncha110->link_freq_mask = 0;
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++)
+	{
+		for (j = 0; j < ARRAY_SIZE(link_freq_menu); j++)
+		{
+			if (ep_cfg.link_frequencies[i] == link_freq_menu[j])
+			{
+				poncha110->link_freq_mask |= BIT(j);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(link_freq_menu))
+			dev_warn(dev, "Link frequency not supported: %lld\n",
+					 ep_cfg.link_frequencies[i]);
+	}
+
+	if (!poncha110->link_freq_mask)
 	{
-		dev_err(dev, "Link frequency not supported: %lld\n",
-				ep_cfg.link_frequencies[0]);
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto error_out;
 	}
 
@@ -4012,11 +4135,8 @@ error_out:
 	return ret;
 }
 
-static int poncha110pmic_init_controls(struct i2c_client *pmic_client, struct i2c_client *uc_client)
-{
-	int ret;
-	u8 val;
-
+/* Board bring-up: uC, PMIC supplies and LED C, not run at probe */
+static const struct ams_pmic_step poncha110_pmic_init_seq[] = {
 	// uC, set atb and jtag high
 	// according to old uC fw (svn rev41)
 	// 12[3] ldo en
@@ -4024,156 +4144,149 @@ static int poncha110pmic_init_controls(struct i2c_client *pmic_client, struct i2
 	// 11/12 i/o direction, 15/16 output high/low
 	// uC, set atb and jtag high
 	// WARNING this only works on interposer v2 if R307 is not populated. otherwise, invert the bit for ldo
-	ret = poncha110pmic_write(uc_client, 12, 0xF7);
-	ret = poncha110pmic_write(uc_client, 16, 0xFF); // ldo en:1
-	ret = poncha110pmic_write(uc_client, 11, 0XCF);
-	ret = poncha110pmic_write(uc_client, 15, 0xFF);
-	ret = poncha110pmic_write(uc_client, 6, 1); // write
+	AMS_UC_W(12, 0xF7),
+	AMS_UC_W(16, 0xFF), // ldo en:1
+	AMS_UC_W(11, 0xCF),
+	AMS_UC_W(15, 0xFF),
+	AMS_UC_W(6, 1), // write
 
 	// Disable master switch //
-	ret = poncha110pmic_write(pmic_client, 0x62, 0x00);
+	AMS_PMIC_W(0x62, 0x00),
 
 	// Set all voltages to 0
 
 	// DCDC1=0V
-	ret = poncha110pmic_write(pmic_client, 0x05, 0x00);
+	AMS_PMIC_W(0x05, 0x00),
 	// DCDC4=0V
-	ret = poncha110pmic_write(pmic_client, 0x0E, 0x0);
+	AMS_PMIC_W(0x0E, 0x0),
 	// LDO1=0V VDDLO_PLL
-	ret = poncha110pmic_write(pmic_client, 0x11, 0x0);
+	AMS_PMIC_W(0x11, 0x0),
 	// LDO2=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x14, 0x00);
+	AMS_PMIC_W(0x14, 0x00),
 	// LDO3=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x17, 0x00);
+	AMS_PMIC_W(0x17, 0x00),
 	// LDO4=0V
-	ret = poncha110pmic_write(pmic_client, 0x1A, 0x00);
+	AMS_PMIC_W(0x1A, 0x00),
 	// LDO5=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1C, 0x00);
+	AMS_PMIC_W(0x1C, 0x00),
 	// LDO6=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1D, 0x00);
+	AMS_PMIC_W(0x1D, 0x00),
 	// LDO7=0V
-	ret = poncha110pmic_write(pmic_client, 0x1E, 0x0);
+	AMS_PMIC_W(0x1E, 0x0),
 	// LDO8=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1F, 0x00);
+	AMS_PMIC_W(0x1F, 0x00),
 	// Disable LDO9 Lock
-	ret = poncha110pmic_write(pmic_client, 0x24, 0x48);
+	AMS_PMIC_W(0x24, 0x48),
 	// LDO9=0V VDDHI
-	ret = poncha110pmic_write(pmic_client, 0x20, 0x00);
+	AMS_PMIC_W(0x20, 0x00),
 	// LDO10=0V VDDLO_ANA
-	ret = poncha110pmic_write(pmic_client, 0x21, 0x0);
+	AMS_PMIC_W(0x21, 0x0),
 
 	// Enable master switch //
-	usleep_range(50, 60);
-	ret = poncha110pmic_write(pmic_client, 0x62, 0x0D); // enable master switch
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_W(0x62, 0x0D), // enable master switch
+	AMS_PMIC_SLEEP(50, 60),
 
 	// start PMIC
 	// Keep LDOs always on
-	ret = poncha110pmic_write(pmic_client, 0x27, 0xFF);
-	ret = poncha110pmic_write(pmic_client, 0x28, 0xFF);
-	ret = poncha110pmic_write(pmic_client, 0x29, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x2A, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x2B, 0x00);
+	AMS_PMIC_W(0x27, 0xFF),
+	AMS_PMIC_W(0x28, 0xFF),
+	AMS_PMIC_W(0x29, 0x00),
+	AMS_PMIC_W(0x2A, 0x00),
+	AMS_PMIC_W(0x2B, 0x00),
 
 	// Unused LDO off //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// set GPIO1=0
-	ret = poncha110pmic_write(pmic_client, 0x41, 0x04);
+	AMS_PMIC_W(0x41, 0x04),
 	// DCDC2=0.0V SPARE_PWR1
-	ret = poncha110pmic_write(pmic_client, 0x01, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x08, 0x00);
+	AMS_PMIC_W(0x01, 0x00),
+	AMS_PMIC_W(0x08, 0x00),
 	// DCDC3=0V SPARE_PWR1
-	ret = poncha110pmic_write(pmic_client, 0x02, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x0B, 0x00);
+	AMS_PMIC_W(0x02, 0x00),
+	AMS_PMIC_W(0x0B, 0x00),
 	// LDO2=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x14, 0x00);
+	AMS_PMIC_W(0x14, 0x00),
 	// LDO3=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x17, 0x00);
+	AMS_PMIC_W(0x17, 0x00),
 	// LDO5=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1C, 0x00);
+	AMS_PMIC_W(0x1C, 0x00),
 	// LDO6=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1D, 0x00);
+	AMS_PMIC_W(0x1D, 0x00),
 	// LDO8=0.0V
-	ret = poncha110pmic_write(pmic_client, 0x1F, 0x00);
+	AMS_PMIC_W(0x1F, 0x00),
 
-	ret = poncha110pmic_write(pmic_client, 0x42, 4);
+	AMS_PMIC_W(0x42, 4),
 
 	// Enable 1.80V //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// DCDC1=1.8V VINLDO1p8 >=1P8
-	ret = poncha110pmic_write(pmic_client, 0x00, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x04, 0x34);
-	ret = poncha110pmic_write(pmic_client, 0x06, 0xBF);
-	ret = poncha110pmic_write(pmic_client, 0x05, 0xB4);
+	AMS_PMIC_W(0x00, 0x00),
+	AMS_PMIC_W(0x04, 0x34),
+	AMS_PMIC_W(0x06, 0xBF),
+	AMS_PMIC_W(0x05, 0xB4),
 	// DCDC4=1.8V VDDIO
-	ret = poncha110pmic_write(pmic_client, 0x03, 0x00);
-	ret = poncha110pmic_write(pmic_client, 0x0D, 0x34);
-	ret = poncha110pmic_write(pmic_client, 0x0F, 0xBF);
-	ret = poncha110pmic_write(pmic_client, 0x0E, 0xB4);
+	AMS_PMIC_W(0x03, 0x00),
+	AMS_PMIC_W(0x0D, 0x34),
+	AMS_PMIC_W(0x0F, 0xBF),
+	AMS_PMIC_W(0x0E, 0xB4),
 
 	// Enable 2.85V //
-	usleep_range(50, 60);
+	AMS_PMIC_SLEEP(50, 60),
 	// LDO4=2.85V VDDHI alternativ
-	ret = poncha110pmic_write(pmic_client, 0x1A, 0xB8); // Either 0x00 or 0xB8
+	AMS_PMIC_W(0x1A, 0xB8), // Either 0x00 or 0xB8
 	// Disable LDO9 Lock
-	ret = poncha110pmic_write(pmic_client, 0x24, 0x48);
+	AMS_PMIC_W(0x24, 0x48),
 	// LDO9=2.85V VDDHI
-	ret = poncha110pmic_read(pmic_client, 0x20, &val);
-	dev_err(&pmic_client->dev, "Read 0x20 with val %x\n", val);
-	ret = poncha110pmic_write(pmic_client, 0x20, 0xB9);
-	ret = poncha110pmic_read(pmic_client, 0x20, &val);
-	dev_err(&pmic_client->dev, "Read 0x20 with val %x\n", val);
+	AMS_PMIC_W(0x20, 0xB9),
 
 	// VPIXH on cob = vdd25A on interposer = LDO4 on pmic
 	// VPIXH should connect to VDD28 on pcb, or enable 4th supply
-	ret = poncha110pmic_read(pmic_client, 0x19, &val);
-	dev_err(&pmic_client->dev, "Read 0x19 with val %x\n", val);
-	ret = poncha110pmic_write(pmic_client, 0x19, 0x38);
-	ret = poncha110pmic_read(pmic_client, 0x19, &val);
-	dev_err(&pmic_client->dev, "Read 0x19 with val %x\n", val);
+	AMS_PMIC_W(0x19, 0x38),
 
 	// Enable 1.2V //
-	usleep_range(700, 710);
+	AMS_PMIC_SLEEP(700, 710),
 	// LDO1=1.2V VDDLO_PLL
-	ret = poncha110pmic_write(pmic_client, 0x12, 0x16);
-	ret = poncha110pmic_write(pmic_client, 0x10, 0x16);
-	ret = poncha110pmic_write(pmic_client, 0x11, 0x90);
+	AMS_PMIC_W(0x12, 0x16),
+	AMS_PMIC_W(0x10, 0x16),
+	AMS_PMIC_W(0x11, 0x90),
 	// LDO7=1.2V VDDLO_DIG
-	ret = poncha110pmic_write(pmic_client, 0x1E, 0x90);
+	AMS_PMIC_W(0x1E, 0x90),
 	// LDO10=1.2V VDDLO_ANA
-	ret = poncha110pmic_write(pmic_client, 0x21, 0x90);
+	AMS_PMIC_W(0x21, 0x90),
 
 	// Enable green LED //
-	usleep_range(50, 60);
-	ret = poncha110pmic_write(pmic_client, 0x42, 0x15); // gpio2
-	// ret = poncha110pmic_write(pmic_client, 0x43, 0x40); // leda
-	// ret = poncha110pmic_write(pmic_client, 0x44, 0x40); // ledb
-	ret = poncha110pmic_write(pmic_client, 0x45, 0x40); // ledc
+	AMS_PMIC_SLEEP(50, 60),
+	AMS_PMIC_W(0x42, 0x15), // gpio2
+	// AMS_PMIC_W(0x43, 0x40), // leda
+	// AMS_PMIC_W(0x44, 0x40), // ledb
+	AMS_PMIC_W(0x45, 0x40), // ledc
 
-	// ret = poncha110pmic_write(pmic_client, 0x47, 0x02); // leda ctrl1
-	// ret = poncha110pmic_write(pmic_client, 0x4F, 0x02); // ledb ctrl1
-	ret = poncha110pmic_write(pmic_client, 0x57, 0x02); // ledc ctrl1
+	// AMS_PMIC_W(0x47, 0x02), // leda ctrl1
+	// AMS_PMIC_W(0x4F, 0x02), // ledb ctrl1
+	AMS_PMIC_W(0x57, 0x02), // ledc ctrl1
 
-	// ret = poncha110pmic_write(pmic_client, 0x4D, 0x01); // leda ctrl1
-	// ret = poncha110pmic_write(pmic_client, 0x55, 0x10); // ledb ctrl7
-	ret = poncha110pmic_write(pmic_client, 0x5D, 0x10); // ledc ctrl7
-	ret = poncha110pmic_write(pmic_client, 0x61, 0x10); // led seq -- use this to turn on leds. abc0000- 1110000 for all leds
+	// AMS_PMIC_W(0x4D, 0x01), // leda ctrl1
+	// AMS_PMIC_W(0x55, 0x10), // ledb ctrl7
+	AMS_PMIC_W(0x5D, 0x10), // ledc ctrl7
+	AMS_PMIC_W(0x61, 0x10), // led seq -- use this to turn on leds. abc0000- 1110000 for all leds
 
 	// uC, set atb and jtag high and ldo_en
-	ret = poncha110pmic_write(uc_client, 12, 0xF7);
-	ret = poncha110pmic_write(uc_client, 16, 0xF7); // ldo en:0
+	AMS_UC_W(12, 0xF7),
+	AMS_UC_W(16, 0xF7), // ldo en:0
 	/*
 	 * In Poncha110-bringup.py, write 11, 0xCF; 15: 0x30.
 	 * In poncha110.py, write 11, 0x8D; 15, 0xFD.
 	 */
-	ret = poncha110pmic_write(uc_client, 11, 0X8D);
-	ret = poncha110pmic_write(uc_client, 15, 0xFD);
-	ret = poncha110pmic_write(uc_client, 6, 1); // write
+	AMS_UC_W(11, 0x8D),
+	AMS_UC_W(15, 0xFD),
+	AMS_UC_W(6, 1), // write
 
-	usleep_range(2000000, 2001000);
+	AMS_PMIC_SLEEP(2000000, 2001000),
+};
 
-	return 0;
-}
+/* Defined next to the device id tables in poncha110.c */
+static const struct poncha110_variant *poncha110_get_variant(struct i2c_client *client);
 
 static int poncha110_probe(struct i2c_client *client)
 {
@@ -4192,16 +4305,27 @@ static int poncha110_probe(struct i2c_client *client)
 
 	v4l2_i2c_subdev_init(&poncha110->sd, client, &poncha110_subdev_ops);
 
+	poncha110->variant = poncha110_get_variant(client);
+	if (!poncha110->variant)
+		return -ENODEV;
+	printk(KERN_INFO "[PONCHA110]: %s variant.\n", poncha110->variant->name);
+
+	poncha110->ams.client = client;
+	poncha110->ams.ops = &poncha110_ams_ops;
+	poncha110->ams.context_sel_reg = AMS_SENSOR_SEL_REG(PONCHA110_CONTEXT_REG);
+	mutex_init(&poncha110->hw_lock);
+	seqlock_init(&poncha110->fmt_seqlock);
+
 	/* Check the hardware configuration in device tree */
-	if (poncha110_check_hwcfg(dev))
+	if (poncha110_check_hwcfg(dev, poncha110))
 		return -EINVAL;
 
 	/* Parse device tree to check if dtoverlay has param skip-reg-upload=1 */
 	device_property_read_u32(dev, "skip-reg-upload", &poncha110->skip_reg_upload);
 	printk(KERN_INFO "[PONCHA110]: skip-reg-upload %d.\n", poncha110->skip_reg_upload);
 	/* Set default TBD I2C device address to LED I2C Address*/
-	poncha110->tbd_client_i2c_addr = PONCHA110LED_I2C_ADDR;
-	printk(KERN_INFO "[PONCHA110]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", poncha110->tbd_client_i2c_addr);
+	poncha110->ams.tbd_client_i2c_addr = PONCHA110LED_I2C_ADDR;
+	printk(KERN_INFO "[PONCHA110]: User defined I2C device address defaults to LED driver I2C address 0x%X.\n", poncha110->ams.tbd_client_i2c_addr);
 
 	/* Get system clock (xclk) */
 	poncha110->xclk = devm_clk_get(dev, NULL);
@@ -4228,20 +4352,21 @@ static int poncha110_probe(struct i2c_client *client)
 
 	{
 		printk(KERN_INFO "[PONCHA110]: Init PMIC and uC and led driver.\n");
-		poncha110->pmic_client = i2c_new_dummy_device(client->adapter,
+		poncha110->ams.pmic_client = i2c_new_dummy_device(client->adapter,
 													PONCHA110PMIC_I2C_ADDR);
-		if (IS_ERR(poncha110->pmic_client))
-			return PTR_ERR(poncha110->pmic_client);
-		poncha110->uc_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(poncha110->ams.pmic_client))
+			return PTR_ERR(poncha110->ams.pmic_client);
+		poncha110->ams.uc_client = i2c_new_dummy_device(client->adapter,
 												  PONCHA110UC_I2C_ADDR);
-		if (IS_ERR(poncha110->uc_client))
-			return PTR_ERR(poncha110->uc_client);
-		poncha110->led_client = i2c_new_dummy_device(client->adapter,
+		if (IS_ERR(poncha110->ams.uc_client))
+			return PTR_ERR(poncha110->ams.uc_client);
+		poncha110->ams.led_client = i2c_new_dummy_device(client->adapter,
 												   PONCHA110LED_I2C_ADDR);
-		if (IS_ERR(poncha110->led_client))
-			return PTR_ERR(poncha110->led_client);
+		if (IS_ERR(poncha110->ams.led_client))
+			return PTR_ERR(poncha110->ams.led_client);
 
-		// poncha110pmic_init_controls(poncha110->pmic_client, poncha110->uc_client);
+		// ams_pmic_run_seq(&poncha110->ams, poncha110_pmic_init_seq,
+		//				  ARRAY_SIZE(poncha110_pmic_init_seq));
 	}
 
 	dev_err(dev, "[PONCHA110] Sleep for 1 second to let PMIC driver complete init.\n");
@@ -4276,11 +4401,20 @@ static int poncha110_probe(struct i2c_client *client)
 	/* Set default mode to max resolution */
 	poncha110->mode = &supported_modes[0];
 
+	spin_lock_init(&poncha110->ctrl_pending_lock);
+	INIT_WORK(&poncha110->ctrl_work, poncha110_ctrl_work);
+	poncha110->ctrl_wq = alloc_ordered_workqueue("poncha110-ctrl", 0);
+	if (!poncha110->ctrl_wq)
+	{
+		ret = -ENOMEM;
+		goto error_power_off;
+	}
+
 	printk(KERN_INFO "[PONCHA110]: Entering init controls function.\n");
 
 	ret = poncha110_init_controls(poncha110);
 	if (ret)
-		goto error_power_off;
+		goto error_destroy_wq;
 
 	/* Initialize subdev */
 	poncha110->sd.internal_ops = &poncha110_internal_ops;
@@ -4331,12 +4465,15 @@ error_media_entity:
 error_handler_free:
 	poncha110_free_controls(poncha110);
 
+error_destroy_wq:
+	destroy_workqueue(poncha110->ctrl_wq);
+
 error_power_off:
 	poncha110_power_off(dev);
 
-	i2c_unregister_device(poncha110->pmic_client);
-	i2c_unregister_device(poncha110->uc_client);
-	i2c_unregister_device(poncha110->led_client);
+	i2c_unregister_device(poncha110->ams.pmic_client);
+	i2c_unregister_device(poncha110->ams.uc_client);
+	i2c_unregister_device(poncha110->ams.led_client);
 
 	return ret;
 }
@@ -4346,12 +4483,14 @@ static void poncha110_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct poncha110 *poncha110 = to_poncha110(sd);
 
-	i2c_unregister_device(poncha110->pmic_client);
-	i2c_unregister_device(poncha110->uc_client);
-	i2c_unregister_device(poncha110->led_client);
+	i2c_unregister_device(poncha110->ams.pmic_client);
+	i2c_unregister_device(poncha110->ams.uc_client);
+	i2c_unregister_device(poncha110->ams.led_client);
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	cancel_work_sync(&poncha110->ctrl_work);
+	destroy_workqueue(poncha110->ctrl_wq);
 	poncha110_free_controls(poncha110);
 
 	pm_runtime_disable(&client->dev);
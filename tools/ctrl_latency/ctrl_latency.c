@@ -0,0 +1,650 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Control-path latency benchmark for ams sensor subdevs.
+ *
+ * Repeatedly sets V4L2_CID_EXPOSURE, V4L2_CID_ANALOGUE_GAIN and
+ * V4L2_CID_VBLANK on a v4l-subdev node and reports p50/p99/max of
+ *  - ioctl latency: time spent inside VIDIOC_S_CTRL.
+ *  - write-complete latency: time from issuing VIDIOC_S_CTRL until the
+ *    driver has written the value to the sensor. Drivers that write slow
+ *    controls from a worker report this with AMS_CAMERA_EVENT_CTRL_APPLIED.
+ *    For controls applied synchronously it equals the ioctl latency.
+ *
+ * The maximum latencies are also given in frames, from the active format,
+ * V4L2_CID_PIXEL_RATE, V4L2_CID_HBLANK and V4L2_CID_VBLANK of the subdev.
+ * With -f the tool fails if any control took longer than one frame to
+ * reach the sensor.
+ *
+ * With -c the tool instead checks the exposure_delay, gain_delay and
+ * vblank_delay controls of the driver. It streams from the video node,
+ * changes each control right after a frame is dequeued and looks for the
+ * first frame that shows the change, counted with the buffer sequence
+ * numbers of the receiver: the mean pixel value for exposure and gain,
+ * the time to the next frame for VBLANK. A delay of d means the frame
+ * d frames after the one in progress at the write is the first to use
+ * the new value. Point the camera at a static, mid-grey scene. The
+ * delays are checked for the active mode only, which is printed first,
+ * so run it once per mode.
+ *
+ * Usage: ctrl_latency [-d /dev/v4l-subdevN] [-n iterations] [-f]
+ *        ctrl_latency [-d /dev/v4l-subdevN] -c /dev/videoN
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#include "ams_sensor_core.h"
+
+#define DEFAULT_DEVICE "/dev/v4l-subdev0"
+#define DEFAULT_ITERATIONS 200
+#define EVENT_TIMEOUT_MS 1000
+
+/* Frames streamed before a change, and frames looked at after it */
+#define CHECK_SETTLE_FRAMES 4
+#define CHECK_FRAMES 8
+#define CHECK_BUFFERS 4
+
+struct bench_ctrl {
+	uint32_t id;
+	const char *name;
+	/* Read-only control reporting the delay in frames */
+	uint32_t delay_id;
+};
+
+static const struct bench_ctrl bench_ctrls[] = {
+	{ V4L2_CID_EXPOSURE, "EXPOSURE", AMS_CAMERA_CID_EXPOSURE_DELAY },
+	{ V4L2_CID_ANALOGUE_GAIN, "ANALOGUE_GAIN", AMS_CAMERA_CID_GAIN_DELAY },
+	{ V4L2_CID_VBLANK, "VBLANK", AMS_CAMERA_CID_VBLANK_DELAY },
+};
+
+struct capture {
+	int fd;
+	struct v4l2_format fmt;
+	void *mem[CHECK_BUFFERS];
+	size_t len[CHECK_BUFFERS];
+	unsigned int count;
+};
+
+/* Per frame measurement, indexed by the distance to the changed frame */
+struct frame_sample {
+	uint32_t sequence;
+	double mean;
+	uint64_t ts_ns;
+};
+
+struct bench_result {
+	uint64_t *ioctl_ns;
+	uint64_t *complete_ns;
+	unsigned int count;
+	unsigned int errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Discard events queued by earlier writes */
+static void drain_events(int fd)
+{
+	struct v4l2_event ev;
+	struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+
+	while (poll(&pfd, 1, 0) > 0 && !ioctl(fd, VIDIOC_DQEVENT, &ev))
+		;
+}
+
+/*
+ * Wait for the driver to report that id was written with val.
+ * Returns 0 when applied, -1 on timeout or error.
+ */
+static int wait_applied(int fd, uint32_t id, int32_t val)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+	struct v4l2_event ev;
+
+	while (poll(&pfd, 1, EVENT_TIMEOUT_MS) > 0) {
+		const struct ams_camera_event_ctrl_applied *applied =
+			(const void *)ev.u.data;
+		unsigned int i;
+
+		if (ioctl(fd, VIDIOC_DQEVENT, &ev))
+			return -1;
+		if (ev.type != AMS_CAMERA_EVENT_CTRL_APPLIED)
+			continue;
+		for (i = 0; i < applied->count && i < AMS_CAMERA_CTRL_APPLIED_MAX; i++)
+			if (applied->ctrls[i].id == id && applied->ctrls[i].value == val)
+				return 0;
+	}
+	return -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile on a sorted array. */
+static uint64_t percentile(const uint64_t *sorted, unsigned int n, unsigned int pct)
+{
+	unsigned int rank;
+
+	if (n == 0)
+		return 0;
+	rank = (pct * n + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	return sorted[rank - 1];
+}
+
+/* Read the driver name of a subdev node from sysfs, e.g. "mira050 10-0036". */
+static void get_driver_name(const char *dev, char *name, size_t len)
+{
+	char path[256];
+	struct stat st;
+	FILE *f;
+
+	snprintf(name, len, "unknown");
+	if (stat(dev, &st) || !S_ISCHR(st.st_mode))
+		return;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/name",
+		 major(st.st_rdev), minor(st.st_rdev));
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (fgets(name, len, f))
+		name[strcspn(name, "\n")] = '\0';
+	fclose(f);
+}
+
+/*
+ * Frame time in ns of the current mode, or 0 if the subdev does not report
+ * enough to compute it. VBLANK is read before the benchmark changes it.
+ */
+static uint64_t get_frame_time_ns(int fd)
+{
+	struct v4l2_subdev_format fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+		.pad = 0,
+	};
+	struct v4l2_ext_control rate = { .id = V4L2_CID_PIXEL_RATE };
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 1,
+		.controls = &rate,
+	};
+	struct v4l2_control hblank = { .id = V4L2_CID_HBLANK };
+	struct v4l2_control vblank = { .id = V4L2_CID_VBLANK };
+	uint64_t pixels;
+
+	if (ioctl(fd, VIDIOC_SUBDEV_G_FMT, &fmt) ||
+	    ioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls) ||
+	    ioctl(fd, VIDIOC_G_CTRL, &hblank) ||
+	    ioctl(fd, VIDIOC_G_CTRL, &vblank) ||
+	    rate.value64 <= 0)
+		return 0;
+
+	pixels = (uint64_t)(fmt.format.width + hblank.value) *
+		 (fmt.format.height + vblank.value);
+	return pixels * 1000000000ull / rate.value64;
+}
+
+static int bench_one(int fd, const struct bench_ctrl *bc, unsigned int iterations,
+		     struct bench_result *res)
+{
+	struct v4l2_queryctrl qc = { .id = bc->id };
+	struct v4l2_control ctrl = { .id = bc->id };
+	struct v4l2_event_subscription sub = { .type = AMS_CAMERA_EVENT_CTRL_APPLIED };
+	int32_t orig, lo, hi, step, val;
+	unsigned int i;
+	int events;
+
+	if (ioctl(fd, VIDIOC_QUERYCTRL, &qc)) {
+		fprintf(stderr, "%s: not supported (%s)\n", bc->name, strerror(errno));
+		return -1;
+	}
+	if (qc.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY)) {
+		fprintf(stderr, "%s: not writable\n", bc->name);
+		return -1;
+	}
+	if (ioctl(fd, VIDIOC_G_CTRL, &ctrl)) {
+		fprintf(stderr, "%s: cannot read (%s)\n", bc->name, strerror(errno));
+		return -1;
+	}
+	orig = ctrl.value;
+
+	/* Sweep a few distinct values so the driver cannot skip unchanged ones. */
+	lo = qc.minimum;
+	hi = qc.maximum;
+	step = qc.step > 0 ? qc.step : 1;
+	if ((int64_t)hi - lo > 16 * (int64_t)step)
+		hi = lo + 16 * step;
+
+	res->ioctl_ns = calloc(iterations, sizeof(uint64_t));
+	res->complete_ns = calloc(iterations, sizeof(uint64_t));
+	if (!res->ioctl_ns || !res->complete_ns)
+		return -1;
+
+	/* Without the event, controls are applied when the ioctl returns */
+	events = !ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+
+	val = lo;
+	for (i = 0; i < iterations; i++) {
+		uint64_t t0, t1, t2;
+
+		val = val + step > hi ? lo : val + step;
+		if (val == orig && hi > lo)
+			val = val + step > hi ? lo : val + step;
+
+		if (events)
+			drain_events(fd);
+
+		ctrl.id = bc->id;
+		ctrl.value = val;
+		t0 = now_ns();
+		if (ioctl(fd, VIDIOC_S_CTRL, &ctrl)) {
+			res->errors++;
+			continue;
+		}
+		t1 = now_ns();
+		t2 = t1;
+		if (events) {
+			if (wait_applied(fd, bc->id, val) == 0) {
+				t2 = now_ns();
+			} else if (res->count == 0) {
+				/* Not streaming or not deferred: written synchronously */
+				events = 0;
+			}
+		}
+
+		res->ioctl_ns[res->count] = t1 - t0;
+		res->complete_ns[res->count] = t2 - t0;
+		res->count++;
+	}
+
+	ioctl(fd, VIDIOC_UNSUBSCRIBE_EVENT, &sub);
+
+	ctrl.id = bc->id;
+	ctrl.value = orig;
+	ioctl(fd, VIDIOC_S_CTRL, &ctrl);
+
+	return 0;
+}
+
+/* Prints one row and returns the maximum in ns. */
+static uint64_t print_row(const char *driver, const char *ctrl, const char *kind,
+			  uint64_t *samples, unsigned int n, uint64_t frame_ns)
+{
+	uint64_t max;
+
+	qsort(samples, n, sizeof(uint64_t), cmp_u64);
+	max = n ? samples[n - 1] : 0;
+	printf("%-20s %-14s %-15s %8u %10.1f %10.1f %10.1f",
+	       driver, ctrl, kind, n,
+	       percentile(samples, n, 50) / 1000.0,
+	       percentile(samples, n, 99) / 1000.0,
+	       max / 1000.0);
+	if (frame_ns)
+		printf(" %10.2f\n", (double)max / frame_ns);
+	else
+		printf(" %10s\n", "-");
+	return max;
+}
+
+static int capture_start(struct capture *cap, const char *video)
+{
+	struct v4l2_requestbuffers req = {
+		.count = CHECK_BUFFERS,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	unsigned int i;
+
+	cap->fd = open(video, O_RDWR);
+	if (cap->fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", video, strerror(errno));
+		return -1;
+	}
+	cap->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (ioctl(cap->fd, VIDIOC_G_FMT, &cap->fmt) ||
+	    ioctl(cap->fd, VIDIOC_REQBUFS, &req) || req.count == 0) {
+		fprintf(stderr, "%s: cannot set up buffers (%s)\n", video, strerror(errno));
+		return -1;
+	}
+
+	cap->count = req.count < CHECK_BUFFERS ? req.count : CHECK_BUFFERS;
+	for (i = 0; i < cap->count; i++) {
+		struct v4l2_buffer buf = {
+			.index = i,
+			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.memory = V4L2_MEMORY_MMAP,
+		};
+
+		if (ioctl(cap->fd, VIDIOC_QUERYBUF, &buf))
+			return -1;
+		cap->len[i] = buf.length;
+		cap->mem[i] = mmap(NULL, buf.length, PROT_READ, MAP_SHARED,
+				   cap->fd, buf.m.offset);
+		if (cap->mem[i] == MAP_FAILED || ioctl(cap->fd, VIDIOC_QBUF, &buf))
+			return -1;
+	}
+
+	if (ioctl(cap->fd, VIDIOC_STREAMON, &type)) {
+		fprintf(stderr, "%s: cannot stream (%s)\n", video, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void capture_stop(struct capture *cap)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	unsigned int i;
+
+	ioctl(cap->fd, VIDIOC_STREAMOFF, &type);
+	for (i = 0; i < cap->count; i++)
+		munmap(cap->mem[i], cap->len[i]);
+	close(cap->fd);
+}
+
+/*
+ * Dequeue the next frame, sample its mean byte value and queue it again.
+ * The mean of packed raw data still grows with the pixel values.
+ */
+static int capture_frame(struct capture *cap, struct frame_sample *fs)
+{
+	struct v4l2_buffer buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	const uint8_t *p;
+	uint64_t sum = 0;
+	size_t i, n = 0;
+
+	if (ioctl(cap->fd, VIDIOC_DQBUF, &buf))
+		return -1;
+
+	p = cap->mem[buf.index];
+	for (i = 0; i < buf.bytesused; i += 61, n++)
+		sum += p[i];
+
+	fs->sequence = buf.sequence;
+	fs->mean = n ? (double)sum / n : 0;
+	fs->ts_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ull +
+		    buf.timestamp.tv_usec * 1000ull;
+
+	return ioctl(cap->fd, VIDIOC_QBUF, &buf);
+}
+
+/* Value that changes the measurement clearly, or orig if there is none */
+static int32_t check_value(const struct v4l2_queryctrl *qc, int32_t orig)
+{
+	int64_t val;
+
+	switch (qc->id) {
+	case V4L2_CID_EXPOSURE:
+		val = orig / 2 >= qc->minimum ? orig / 2 : (int64_t)orig * 2;
+		break;
+	case V4L2_CID_VBLANK:
+		/* At least 100 rows longer, or back to the minimum */
+		val = (int64_t)orig + orig / 2 + 100;
+		if (val > qc->maximum)
+			val = qc->minimum;
+		break;
+	default:
+		val = orig == qc->maximum ? qc->minimum : qc->maximum;
+		break;
+	}
+	if (val > qc->maximum)
+		val = qc->maximum;
+	if (val < qc->minimum)
+		val = qc->minimum;
+	return val;
+}
+
+/*
+ * Measured delay of one control, or -1 if no change was seen.
+ * samples[0] is the frame dequeued right before the write.
+ */
+static int measure_delay(uint32_t id, const struct frame_sample *samples,
+			 unsigned int n)
+{
+	double before, after, v;
+	unsigned int i;
+
+	if (id == V4L2_CID_VBLANK) {
+		/* Frame length i is the time from frame i to frame i + 1 */
+		before = samples[0].ts_ns - samples[-1].ts_ns;
+		after = samples[n - 1].ts_ns - samples[n - 2].ts_ns;
+	} else {
+		before = samples[0].mean;
+		after = samples[n - 1].mean;
+	}
+	if (fabs(after - before) < 0.02 * before || fabs(after - before) < 1.0)
+		return -1;
+
+	for (i = 1; i < n; i++) {
+		if (id == V4L2_CID_VBLANK) {
+			if (i == n - 1)
+				break;
+			v = samples[i + 1].ts_ns - samples[i].ts_ns;
+		} else {
+			v = samples[i].mean;
+		}
+		if (fabs(v - before) > fabs(after - before) / 2)
+			/* Sequence numbers skip dropped frames */
+			return samples[i].sequence - samples[0].sequence - 1;
+	}
+	return -1;
+}
+
+/* Returns 0 if the measured delay matches the reported one. */
+static int check_one(int fd, struct capture *cap, const struct bench_ctrl *bc,
+		     const char *driver)
+{
+	struct v4l2_queryctrl qc = { .id = bc->id };
+	struct v4l2_control ctrl = { .id = bc->id };
+	struct v4l2_control delay = { .id = bc->delay_id };
+	struct frame_sample samples[CHECK_SETTLE_FRAMES + CHECK_FRAMES];
+	struct frame_sample *changed = &samples[CHECK_SETTLE_FRAMES - 1];
+	struct frame_sample restore;
+	int32_t orig;
+	unsigned int i;
+	int measured, ret = 0;
+
+	if (ioctl(fd, VIDIOC_QUERYCTRL, &qc) || ioctl(fd, VIDIOC_G_CTRL, &ctrl) ||
+	    (qc.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY |
+			 V4L2_CTRL_FLAG_INACTIVE))) {
+		fprintf(stderr, "%s: not writable\n", bc->name);
+		return 0;
+	}
+	if (ioctl(fd, VIDIOC_G_CTRL, &delay)) {
+		fprintf(stderr, "%s: no delay reported\n", bc->name);
+		return 0;
+	}
+	orig = ctrl.value;
+	if (check_value(&qc, orig) == orig) {
+		fprintf(stderr, "%s: cannot change\n", bc->name);
+		return 0;
+	}
+
+	for (i = 0; i < CHECK_SETTLE_FRAMES; i++)
+		if (capture_frame(cap, &samples[i]))
+			return -1;
+
+	ctrl.value = check_value(&qc, orig);
+	if (ioctl(fd, VIDIOC_S_CTRL, &ctrl))
+		ret = -1;
+
+	for (; i < CHECK_SETTLE_FRAMES + CHECK_FRAMES; i++)
+		if (capture_frame(cap, &samples[i]))
+			ret = -1;
+
+	ctrl.value = orig;
+	ioctl(fd, VIDIOC_S_CTRL, &ctrl);
+	/* Let the old value reach the frames before the next control */
+	for (i = 0; i < CHECK_FRAMES; i++)
+		if (capture_frame(cap, &restore))
+			ret = -1;
+	if (ret) {
+		fprintf(stderr, "%s: capture failed (%s)\n", bc->name, strerror(errno));
+		return ret;
+	}
+
+	measured = measure_delay(bc->id, changed, CHECK_FRAMES + 1);
+	printf("%-20s %-14s %8d ", driver, bc->name, delay.value);
+	if (measured < 0) {
+		printf("%8s\n", "-");
+		fprintf(stderr, "%s: no change seen, check the scene\n", bc->name);
+		return -1;
+	}
+	printf("%8d\n", measured);
+	return measured == delay.value ? 0 : -1;
+}
+
+static int check_delays(int fd, const char *video, const char *driver)
+{
+	struct v4l2_subdev_format fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+		.pad = 0,
+	};
+	struct capture cap = { 0 };
+	unsigned int i;
+	int ret = 0;
+
+	if (capture_start(&cap, video)) {
+		if (cap.fd >= 0)
+			close(cap.fd);
+		return 1;
+	}
+
+	if (ioctl(fd, VIDIOC_SUBDEV_G_FMT, &fmt) == 0)
+		printf("mode: code 0x%04x %ux%u\n", fmt.format.code,
+		       fmt.format.width, fmt.format.height);
+	printf("%-20s %-14s %8s %8s\n", "driver", "control", "reported", "measured");
+	for (i = 0; i < sizeof(bench_ctrls) / sizeof(bench_ctrls[0]); i++)
+		if (check_one(fd, &cap, &bench_ctrls[i], driver))
+			ret = 1;
+
+	capture_stop(&cap);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-n iterations] [-f]\n", prog);
+	fprintf(stderr, "       %s [-d device] -c video\n", prog);
+	fprintf(stderr, "  -d  subdev node (default %s)\n", DEFAULT_DEVICE);
+	fprintf(stderr, "  -n  writes per control (default %d)\n", DEFAULT_ITERATIONS);
+	fprintf(stderr, "  -f  fail if a write takes longer than one frame\n");
+	fprintf(stderr, "  -c  check the reported control delays on frames of a video node\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = DEFAULT_DEVICE;
+	const char *video = NULL;
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	uint64_t frame_ns;
+	char driver[64];
+	unsigned int i;
+	int within_frame = 0;
+	int late = 0;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:n:fc:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'c':
+			video = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			within_frame = 1;
+			break;
+		default:
+			usage(basename(argv[0]));
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (iterations == 0) {
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", dev, strerror(errno));
+		return 1;
+	}
+	get_driver_name(dev, driver, sizeof(driver));
+	if (video) {
+		late = check_delays(fd, video, driver);
+		close(fd);
+		return late;
+	}
+
+	frame_ns = get_frame_time_ns(fd);
+	if (frame_ns)
+		printf("frame time %.1f us\n", frame_ns / 1000.0);
+	else if (within_frame)
+		fprintf(stderr, "Cannot compute the frame time, -f ignored\n");
+
+	printf("%-20s %-14s %-15s %8s %10s %10s %10s %10s\n",
+	       "driver", "control", "latency", "samples", "p50[us]", "p99[us]",
+	       "max[us]", "max[fr]");
+
+	for (i = 0; i < sizeof(bench_ctrls) / sizeof(bench_ctrls[0]); i++) {
+		struct bench_result res = { 0 };
+
+		if (bench_one(fd, &bench_ctrls[i], iterations, &res) == 0) {
+			uint64_t max;
+
+			print_row(driver, bench_ctrls[i].name, "ioctl",
+				  res.ioctl_ns, res.count, frame_ns);
+			max = print_row(driver, bench_ctrls[i].name, "write-complete",
+					res.complete_ns, res.count, frame_ns);
+			if (within_frame && frame_ns && max > frame_ns) {
+				fprintf(stderr, "%s: write took %.2f frames\n",
+					bench_ctrls[i].name, (double)max / frame_ns);
+				late = 1;
+			}
+			if (res.errors)
+				fprintf(stderr, "%s: %u writes failed\n",
+					bench_ctrls[i].name, res.errors);
+		}
+		free(res.ioctl_ns);
+		free(res.complete_ns);
+	}
+
+	close(fd);
+	return late;
+}
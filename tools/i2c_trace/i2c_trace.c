@@ -0,0 +1,411 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host tool for I2C transaction traces captured by the sensor drivers
+ * through debugfs (<debugfs>/<sensor>-<i2c dev>/i2c_trace).
+ *
+ * The traces are replayed into a register file emulator of the sensor,
+ * so two traces can be compared on the final register state they leave
+ * behind, independent of how the writes were batched or ordered.
+ *
+ * Usage:
+ *   i2c_trace dump TRACE
+ *   i2c_trace state [-m MODEL] TRACE
+ *   i2c_trace compare [-m MODEL] TRACE_A TRACE_B
+ *
+ * MODEL selects the register map of the emulator:
+ *   flat     one flat 16-bit register space (mira220, mira130, ...)
+ *   mira050  BANK_SEL (0xE000) and RW_CONTEXT (0xE004) select the bank and,
+ *            in bank 1, the context of addresses below 0xE000 (also poncha110
+ *            and mira016)
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Must match struct ams_sensor_trace and ams_sensor_trace_record. */
+#define TRACE_MAGIC "AMSI2CTR"
+#define TRACE_VERSION 1
+#define TRACE_MAX_DATA 8
+#define TRACE_WRITE 0
+#define TRACE_READ 1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t num_records;
+	uint32_t num_dropped;
+} __attribute__((packed));
+
+struct trace_record {
+	uint64_t timestamp_ns;
+	uint32_t duration_ns;
+	int32_t status;
+	uint16_t i2c_addr;
+	uint8_t dir;
+	uint8_t len;
+	uint8_t data[TRACE_MAX_DATA];
+	uint8_t reserved[4];
+} __attribute__((packed));
+
+struct trace {
+	const char *path;
+	struct trace_header hdr;
+	struct trace_record *recs;
+};
+
+enum model {
+	MODEL_FLAT,
+	MODEL_MIRA050,
+};
+
+#define MIRA050_BANK_SEL_REG 0xE000
+#define MIRA050_RW_CONTEXT_REG 0xE004
+
+/* Register file: one entry per (i2c addr, bank, context, reg) */
+#define KEY(i2c, bank, ctx, reg) \
+	(((uint32_t)(i2c) << 24) | ((uint32_t)(bank) << 17) | ((uint32_t)(ctx) << 16) | (reg))
+#define KEY_I2C(k) ((k) >> 24)
+#define KEY_BANK(k) (((k) >> 17) & 0x1)
+#define KEY_CTX(k) (((k) >> 16) & 0x1)
+#define KEY_REG(k) ((k) & 0xffff)
+
+struct regfile {
+	uint32_t *keys;
+	uint8_t *vals;
+	size_t n, cap;
+	/* Writes that were only partially captured */
+	unsigned int truncated;
+};
+
+/* Only little-endian hosts are supported, the trace is little-endian. */
+static int load_trace(const char *path, struct trace *t)
+{
+	FILE *f = fopen(path, "rb");
+	size_t n;
+
+	memset(t, 0, sizeof(*t));
+	t->path = path;
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fread(&t->hdr, sizeof(t->hdr), 1, f) != 1 ||
+	    memcmp(t->hdr.magic, TRACE_MAGIC, sizeof(t->hdr.magic))) {
+		fprintf(stderr, "%s: not an I2C trace\n", path);
+		goto err;
+	}
+	if (t->hdr.version != TRACE_VERSION ||
+	    t->hdr.record_size != sizeof(struct trace_record)) {
+		fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n",
+			path, t->hdr.version, t->hdr.record_size);
+		goto err;
+	}
+	t->recs = calloc(t->hdr.num_records ? t->hdr.num_records : 1,
+			 sizeof(struct trace_record));
+	if (!t->recs)
+		goto err;
+	n = fread(t->recs, sizeof(struct trace_record), t->hdr.num_records, f);
+	if (n != t->hdr.num_records) {
+		fprintf(stderr, "%s: truncated, %zu of %u records\n",
+			path, n, t->hdr.num_records);
+		t->hdr.num_records = n;
+	}
+	if (t->hdr.num_dropped)
+		fprintf(stderr, "%s: warning: %u records were dropped during capture\n",
+			path, t->hdr.num_dropped);
+	fclose(f);
+	return 0;
+err:
+	fclose(f);
+	return -1;
+}
+
+static int regfile_find(const struct regfile *rf, uint32_t key, size_t *pos)
+{
+	size_t lo = 0, hi = rf->n;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (rf->keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pos = lo;
+	return lo < rf->n && rf->keys[lo] == key;
+}
+
+static int regfile_set(struct regfile *rf, uint32_t key, uint8_t val)
+{
+	size_t pos;
+
+	if (regfile_find(rf, key, &pos)) {
+		rf->vals[pos] = val;
+		return 0;
+	}
+	if (rf->n == rf->cap) {
+		size_t cap = rf->cap ? rf->cap * 2 : 1024;
+		uint32_t *keys = realloc(rf->keys, cap * sizeof(*keys));
+		uint8_t *vals;
+
+		if (!keys)
+			return -1;
+		rf->keys = keys;
+		vals = realloc(rf->vals, cap * sizeof(*vals));
+		if (!vals)
+			return -1;
+		rf->vals = vals;
+		rf->cap = cap;
+	}
+	memmove(&rf->keys[pos + 1], &rf->keys[pos], (rf->n - pos) * sizeof(*rf->keys));
+	memmove(&rf->vals[pos + 1], &rf->vals[pos], (rf->n - pos) * sizeof(*rf->vals));
+	rf->keys[pos] = key;
+	rf->vals[pos] = val;
+	rf->n++;
+	return 0;
+}
+
+/* Replay all successful writes of a trace into the register file. */
+static int replay(const struct trace *t, enum model model, struct regfile *rf)
+{
+	/* Bank and context selection per I2C address */
+	uint8_t bank[128] = { 0 }, ctx[128] = { 0 };
+	uint32_t i;
+
+	for (i = 0; i < t->hdr.num_records; i++) {
+		const struct trace_record *r = &t->recs[i];
+		unsigned int n, j, addr = r->i2c_addr & 0x7f;
+		uint16_t reg;
+
+		/* Reads and the address phase of a read do not change state */
+		if (r->dir != TRACE_WRITE || r->status != r->len || r->len <= 2)
+			continue;
+
+		n = r->len;
+		if (n > TRACE_MAX_DATA) {
+			rf->truncated++;
+			n = TRACE_MAX_DATA;
+		}
+
+		/* The sensor auto-increments the address on burst writes */
+		reg = (r->data[0] << 8) | r->data[1];
+		for (j = 2; j < n; j++, reg++) {
+			uint8_t val = r->data[j];
+			uint32_t key;
+
+			if (model == MODEL_MIRA050 && reg < 0xE000)
+				key = KEY(addr, bank[addr], bank[addr] ? ctx[addr] : 0, reg);
+			else
+				key = KEY(addr, 0, 0, reg);
+			if (regfile_set(rf, key, val))
+				return -1;
+
+			if (model == MODEL_MIRA050 && reg == MIRA050_BANK_SEL_REG)
+				bank[addr] = val & 0x1;
+			if (model == MODEL_MIRA050 && reg == MIRA050_RW_CONTEXT_REG)
+				ctx[addr] = val & 0x1;
+		}
+	}
+	return 0;
+}
+
+static void print_key(uint32_t key, enum model model)
+{
+	printf("i2c 0x%02x ", KEY_I2C(key));
+	if (model == MODEL_MIRA050) {
+		if (KEY_REG(key) < 0xE000)
+			printf("bank %u ctx %u ", KEY_BANK(key), KEY_CTX(key));
+		else
+			printf("             ");
+	}
+	printf("reg 0x%04x", KEY_REG(key));
+}
+
+static void print_stats(const struct trace *t)
+{
+	uint64_t bytes = 0, bus_ns = 0, span_ns = 0;
+	unsigned int writes = 0, reads = 0, errors = 0;
+	uint32_t i;
+
+	for (i = 0; i < t->hdr.num_records; i++) {
+		const struct trace_record *r = &t->recs[i];
+
+		if (r->dir == TRACE_WRITE)
+			writes++;
+		else
+			reads++;
+		if (r->status != r->len)
+			errors++;
+		bytes += r->len;
+		bus_ns += r->duration_ns;
+	}
+	if (t->hdr.num_records)
+		span_ns = t->recs[t->hdr.num_records - 1].timestamp_ns +
+			  t->recs[t->hdr.num_records - 1].duration_ns -
+			  t->recs[0].timestamp_ns;
+
+	printf("%s: %u transactions (%u writes, %u reads, %u failed), %llu bytes, "
+	       "%.3f ms in transfers, %.3f ms total\n",
+	       t->path, t->hdr.num_records, writes, reads, errors,
+	       (unsigned long long)bytes, bus_ns / 1e6, span_ns / 1e6);
+}
+
+static int cmd_dump(const struct trace *t)
+{
+	uint32_t i;
+	int j;
+
+	print_stats(t);
+	for (i = 0; i < t->hdr.num_records; i++) {
+		const struct trace_record *r = &t->recs[i];
+
+		printf("%12.3f us %8.1f us 0x%02x %s len %3u status %4d :",
+		       r->timestamp_ns / 1e3, r->duration_ns / 1e3, r->i2c_addr,
+		       r->dir == TRACE_WRITE ? "W" : "R", r->len, r->status);
+		for (j = 0; j < r->len && j < TRACE_MAX_DATA; j++)
+			printf(" %02x", r->data[j]);
+		if (r->len > TRACE_MAX_DATA)
+			printf(" ...");
+		printf("\n");
+	}
+	return 0;
+}
+
+static int cmd_state(const struct trace *t, enum model model)
+{
+	struct regfile rf = { 0 };
+	size_t i;
+
+	if (replay(t, model, &rf))
+		return 2;
+	print_stats(t);
+	for (i = 0; i < rf.n; i++) {
+		print_key(rf.keys[i], model);
+		printf(" = 0x%02x\n", rf.vals[i]);
+	}
+	if (rf.truncated)
+		fprintf(stderr, "warning: %u writes longer than %d bytes were partially captured\n",
+			rf.truncated, TRACE_MAX_DATA);
+	free(rf.keys);
+	free(rf.vals);
+	return 0;
+}
+
+static int cmd_compare(const struct trace *a, const struct trace *b, enum model model)
+{
+	struct regfile ra = { 0 }, rb = { 0 };
+	size_t i = 0, j = 0;
+	unsigned int diffs = 0;
+
+	if (replay(a, model, &ra) || replay(b, model, &rb))
+		return 2;
+	print_stats(a);
+	print_stats(b);
+
+	while (i < ra.n || j < rb.n) {
+		if (j >= rb.n || (i < ra.n && ra.keys[i] < rb.keys[j])) {
+			print_key(ra.keys[i], model);
+			printf(": 0x%02x only in A\n", ra.vals[i]);
+			diffs++;
+			i++;
+		} else if (i >= ra.n || rb.keys[j] < ra.keys[i]) {
+			print_key(rb.keys[j], model);
+			printf(": 0x%02x only in B\n", rb.vals[j]);
+			diffs++;
+			j++;
+		} else {
+			if (ra.vals[i] != rb.vals[j]) {
+				print_key(ra.keys[i], model);
+				printf(": A 0x%02x, B 0x%02x\n", ra.vals[i], rb.vals[j]);
+				diffs++;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	if (ra.truncated || rb.truncated)
+		fprintf(stderr, "warning: writes longer than %d bytes were partially captured\n",
+			TRACE_MAX_DATA);
+	printf("%zu/%zu registers written, %u differences\n", ra.n, rb.n, diffs);
+
+	free(ra.keys);
+	free(ra.vals);
+	free(rb.keys);
+	free(rb.vals);
+	return diffs ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: i2c_trace dump TRACE\n"
+		"       i2c_trace state [-m flat|mira050] TRACE\n"
+		"       i2c_trace compare [-m flat|mira050] TRACE_A TRACE_B\n"
+		"compare exits with 1 if the final register states differ.\n");
+}
+
+int main(int argc, char **argv)
+{
+	enum model model = MODEL_FLAT;
+	struct trace a, b;
+	const char *cmd;
+	int opt, ret;
+
+	if (argc < 2) {
+		usage();
+		return 2;
+	}
+	cmd = argv[1];
+	optind = 2;
+	while ((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "flat")) {
+				model = MODEL_FLAT;
+			} else if (!strcmp(optarg, "mira050")) {
+				model = MODEL_MIRA050;
+			} else {
+				fprintf(stderr, "Unknown model %s\n", optarg);
+				return 2;
+			}
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+
+	if (!strcmp(cmd, "dump") && argc - optind == 1) {
+		if (load_trace(argv[optind], &a))
+			return 2;
+		ret = cmd_dump(&a);
+		free(a.recs);
+	} else if (!strcmp(cmd, "state") && argc - optind == 1) {
+		if (load_trace(argv[optind], &a))
+			return 2;
+		ret = cmd_state(&a, model);
+		free(a.recs);
+	} else if (!strcmp(cmd, "compare") && argc - optind == 2) {
+		if (load_trace(argv[optind], &a))
+			return 2;
+		if (load_trace(argv[optind + 1], &b)) {
+			free(a.recs);
+			return 2;
+		}
+		ret = cmd_compare(&a, &b, model);
+		free(a.recs);
+		free(b.recs);
+	} else {
+		usage();
+		ret = 2;
+	}
+
+	return ret;
+}
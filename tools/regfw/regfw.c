@@ -0,0 +1,356 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host tool for the mode register table firmware of the sensor drivers.
+ * A driver loads /lib/firmware/ams/<sensor>_<table>.bin in place of its
+ * built-in table <table>, see ams_sensor_write_table().
+ *
+ * Usage:
+ *   regfw extract SOURCE TABLE OUT
+ *   regfw pack TEXT OUT
+ *   regfw dump FIRMWARE
+ *
+ * extract packs the built-in table TABLE of a driver source, for example
+ *   regfw extract mira050/src/mira050.inl \
+ *     full_576_768_50fps_12b_1lane_reg_pre_soft_reset \
+ *     mira050_full_576_768_50fps_12b_1lane_reg_pre_soft_reset.bin
+ * pack reads one "reg val" pair per line, '#' starts a comment. dump
+ * checks a firmware and prints it in the pack format.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Must match struct ams_sensor_fw_header, all fields little-endian. */
+#define FW_MAGIC 0x52534d41 /* "AMSR" */
+#define FW_VERSION 1
+#define FW_HEADER_SIZE 16
+#define FW_ENTRY_SIZE 3
+
+struct reg {
+	uint16_t addr;
+	uint8_t val;
+};
+
+struct table {
+	struct reg *regs;
+	size_t n, cap;
+};
+
+/* zlib crc32(), as crc32_le(~0, ...) ^ ~0 in the kernel */
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = ~0u;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int table_add(struct table *t, unsigned long addr, unsigned long val)
+{
+	if (addr > 0xffff || val > 0xff) {
+		fprintf(stderr, "Entry 0x%lx 0x%lx out of range\n", addr, val);
+		return -1;
+	}
+	if (t->n == t->cap) {
+		size_t cap = t->cap ? t->cap * 2 : 1024;
+		struct reg *regs = realloc(t->regs, cap * sizeof(*regs));
+
+		if (!regs)
+			return -1;
+		t->regs = regs;
+		t->cap = cap;
+	}
+	t->regs[t->n].addr = addr;
+	t->regs[t->n].val = val;
+	t->n++;
+	return 0;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+		goto out;
+	buf = malloc(size + 1);
+	if (!buf)
+		goto out;
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", path);
+		free(buf);
+		buf = NULL;
+		goto out;
+	}
+	buf[size] = '\0';
+	*len = size;
+out:
+	fclose(f);
+	return buf;
+}
+
+static int write_fw(const char *path, const struct table *t)
+{
+	uint8_t hdr[FW_HEADER_SIZE] = { 0 };
+	uint8_t *entries;
+	size_t len = t->n * FW_ENTRY_SIZE, i;
+	FILE *f;
+	int ret = -1;
+
+	entries = malloc(len ? len : 1);
+	if (!entries)
+		return -1;
+	for (i = 0; i < t->n; i++) {
+		put_le16(&entries[i * FW_ENTRY_SIZE], t->regs[i].addr);
+		entries[i * FW_ENTRY_SIZE + 2] = t->regs[i].val;
+	}
+	put_le32(&hdr[0], FW_MAGIC);
+	put_le16(&hdr[4], FW_VERSION);
+	put_le32(&hdr[8], t->n);
+	put_le32(&hdr[12], crc32(entries, len));
+
+	f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out;
+	}
+	if (fwrite(hdr, sizeof(hdr), 1, f) != 1 ||
+	    (len && fwrite(entries, len, 1, f) != 1))
+		fprintf(stderr, "%s: write error\n", path);
+	else
+		ret = 0;
+	if (fclose(f))
+		ret = -1;
+	if (!ret)
+		printf("%s: %zu regs\n", path, t->n);
+out:
+	free(entries);
+	return ret;
+}
+
+/* Blank out C comments, keeping line structure. */
+static void strip_comments(char *s)
+{
+	while (*s) {
+		if (s[0] == '/' && s[1] == '/') {
+			while (*s && *s != '\n')
+				*s++ = ' ';
+		} else if (s[0] == '/' && s[1] == '*') {
+			for (; *s && !(s[0] == '*' && s[1] == '/'); s++)
+				if (*s != '\n')
+					*s = ' ';
+			if (*s) {
+				*s++ = ' ';
+				*s++ = ' ';
+			}
+		} else {
+			s++;
+		}
+	}
+}
+
+static int is_ident(char c)
+{
+	return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	       (c >= '0' && c <= '9');
+}
+
+static const char *skip_space(const char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r' || *s == ',')
+		s++;
+	return s;
+}
+
+/* Parse "NAME[] = { {reg, val}, ... };" of the source. */
+static int cmd_extract(const char *src, const char *name, const char *out)
+{
+	struct table t = { 0 };
+	size_t len, nlen = strlen(name);
+	char *buf, *p, *end;
+	unsigned long addr, val;
+	const char *s;
+	int ret = -1;
+
+	buf = read_file(src, &len);
+	if (!buf)
+		return 2;
+	strip_comments(buf);
+
+	for (p = strstr(buf, name); p; p = strstr(p + 1, name)) {
+		s = skip_space(p + nlen);
+		if ((p == buf || !is_ident(p[-1])) && !strncmp(s, "[]", 2) &&
+		    *(s = skip_space(s + 2)) == '=' &&
+		    *(s = skip_space(s + 1)) == '{')
+			break;
+	}
+	if (!p) {
+		fprintf(stderr, "%s: no table %s\n", src, name);
+		goto out;
+	}
+
+	for (s = skip_space(s + 1); *s == '{'; s = skip_space(s)) {
+		s = skip_space(s + 1);
+		addr = strtoul(s, &end, 0);
+		if (end == s)
+			break;
+		s = skip_space(end);
+		val = strtoul(s, &end, 0);
+		if (end == s)
+			break;
+		s = skip_space(end);
+		if (*s != '}') {
+			fprintf(stderr, "%s: %s: cannot parse entry %zu\n", src, name, t.n);
+			goto out;
+		}
+		if (table_add(&t, addr, val))
+			goto out;
+		s++;
+	}
+	if (*s != '}') {
+		fprintf(stderr, "%s: %s: cannot parse entry %zu\n", src, name, t.n);
+		goto out;
+	}
+
+	ret = write_fw(out, &t);
+out:
+	free(t.regs);
+	free(buf);
+	return ret ? 2 : 0;
+}
+
+static int cmd_pack(const char *in, const char *out)
+{
+	struct table t = { 0 };
+	unsigned long addr, val;
+	char *buf, *line, *next, *end;
+	unsigned int lineno = 0;
+	size_t len;
+	int ret = -1;
+
+	buf = read_file(in, &len);
+	if (!buf)
+		return 2;
+
+	for (line = buf; line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		lineno++;
+		if (strchr(line, '#'))
+			*strchr(line, '#') = '\0';
+		if (*skip_space(line) == '\0')
+			continue;
+		addr = strtoul(line, &end, 0);
+		if (end == line)
+			goto parse_err;
+		line = end;
+		val = strtoul(line, &end, 0);
+		if (end == line || *skip_space(end) != '\0')
+			goto parse_err;
+		if (table_add(&t, addr, val))
+			goto out;
+	}
+
+	ret = write_fw(out, &t);
+	goto out;
+parse_err:
+	fprintf(stderr, "%s:%u: expected \"reg val\"\n", in, lineno);
+out:
+	free(t.regs);
+	free(buf);
+	return ret ? 2 : 0;
+}
+
+static int cmd_dump(const char *path)
+{
+	const uint8_t *fw, *e;
+	uint32_t n, i;
+	size_t len;
+	char *buf;
+	int ret = 2;
+
+	buf = read_file(path, &len);
+	if (!buf)
+		return 2;
+	fw = (const uint8_t *)buf;
+
+	if (len < FW_HEADER_SIZE || get_le32(fw) != FW_MAGIC) {
+		fprintf(stderr, "%s: not a register table\n", path);
+		goto out;
+	}
+	if ((fw[4] | (fw[5] << 8)) != FW_VERSION) {
+		fprintf(stderr, "%s: unsupported version %u\n", path, fw[4] | (fw[5] << 8));
+		goto out;
+	}
+	n = get_le32(&fw[8]);
+	if (n > (len - FW_HEADER_SIZE) / FW_ENTRY_SIZE ||
+	    len != FW_HEADER_SIZE + (size_t)n * FW_ENTRY_SIZE) {
+		fprintf(stderr, "%s: size %zu does not match %u regs\n", path, len, n);
+		goto out;
+	}
+	if (crc32(&fw[FW_HEADER_SIZE], (size_t)n * FW_ENTRY_SIZE) != get_le32(&fw[12])) {
+		fprintf(stderr, "%s: checksum mismatch\n", path);
+		goto out;
+	}
+
+	printf("# %s: %u regs\n", path, n);
+	for (i = 0, e = &fw[FW_HEADER_SIZE]; i < n; i++, e += FW_ENTRY_SIZE)
+		printf("0x%04X 0x%02X\n", e[0] | (e[1] << 8), e[2]);
+	ret = 0;
+out:
+	free(buf);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"  regfw extract SOURCE TABLE OUT\n"
+		"  regfw pack TEXT OUT\n"
+		"  regfw dump FIRMWARE\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 5 && !strcmp(argv[1], "extract"))
+		return cmd_extract(argv[2], argv[3], argv[4]);
+	if (argc == 4 && !strcmp(argv[1], "pack"))
+		return cmd_pack(argv[2], argv[3]);
+	if (argc == 3 && !strcmp(argv[1], "dump"))
+		return cmd_dump(argv[2]);
+
+	usage();
+	return 2;
+}